@@ -18,6 +18,8 @@
 #define BENCHMARK_H
 
 extern char *benchmark_file;
+// started with "headless", there's no window and nothing was set up for drawing, only simulation tests run
+extern bool benchmark_headless;
 
 void benchmark_run();
 double benchmark_get_time();
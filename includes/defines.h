@@ -49,10 +49,19 @@
 #define MTOS_EXPAND(str) #str
 #define MTOS(str) MTOS_EXPAND(str)
 
+// All of these can be overridden at build time, e.g. to point the game at a local mock server
+#ifndef SCHEME
 #define SCHEME "https://"
+#endif
+#ifndef STATICSCHEME
 #define STATICSCHEME "https://"
+#endif
+#ifndef UPDATESCHEME
 #define UPDATESCHEME "https://"
+#endif
+#ifndef ALLOW_HTTP
 #define ENFORCE_HTTPS
+#endif
 
 #ifndef SERVER
 #define SERVER "powdertoy.co.uk"
@@ -67,6 +76,9 @@
 #define LOCAL_SAVE_DIR "Saves"
 
 #define THUMB_CACHE_SIZE 256
+#define THUMB_DECODED_CACHE_SIZE 128
+#define THUMB_DISK_CACHE_SIZE (32*1024*1024)
+#define HTTP_CACHE_SIZE (64*1024*1024)
 
 #ifndef M_PI
 #define M_PI 3.14159265f
@@ -252,9 +264,6 @@ extern unsigned short last_major, last_minor, update_flag, last_build;
 extern char http_proxy_string[256];
 
 //Functions in main.c
-void thumb_cache_inval(char *id);
-void thumb_cache_add(char *id, void *thumb, int size);
-bool thumb_cache_find(char *id, void **thumb, int *size);
 void clear_sim();
 void NewSim();
 char* stamp_save(int x, int y, int w, int h, bool includePressure);
@@ -262,6 +271,7 @@ void tab_save(int num);
 #ifdef __cplusplus
 class Save;
 Save *stamp_load(int i, int reorder);
+int stamp_gen_thumb(int i);
 #endif
 int tab_load(int tabNum, bool del = false, bool showException = true);
 void stamp_init();
@@ -22,6 +22,7 @@
 #include "graphics/Pixel.h"
 
 class Simulation;
+struct FramePacket;
 
 extern pixel sampleColor;
 
@@ -36,12 +37,14 @@ extern unsigned char fire_b[YRES/CELL][XRES/CELL];
 extern unsigned int fire_alpha[CELL*3][CELL*3];
 extern pixel *pers_bg;
 
-extern char * flm_data;
+// colours for FIRE and PLSM by life, 200 RGB triplets each, built on first use
+const char *flm_gradient();
+const char *plasma_gradient();
+
 extern int flm_data_points;
 extern pixel flm_data_colours[];
 extern float flm_data_pos[];
 
-extern char * plasma_data;
 extern int plasma_data_points;
 extern pixel plasma_data_colours[];
 extern float plasma_data_pos[];
@@ -57,8 +60,6 @@ typedef struct gcache_item gcache_item;
 
 extern gcache_item *graphicscache;
 
-void prepare_graphicscache();
-
 void draw_other(pixel *vid, Simulation * sim);
 
 void draw_rgba_image(pixel *vid, unsigned char *data, int x, int y, float a);
@@ -126,11 +127,11 @@ void draw_icon(pixel *vid_buf, int x, int y, char ch, int flag);
 
 pixel HeatToColor(float temp);
 
-void draw_air(pixel *vid, Simulation * sim);
+void draw_air(pixel *vid, Simulation * sim, FramePacket *packet = nullptr);
 
 void draw_grav_zones(pixel *vid);
 
-void draw_grav(pixel *vid);
+void draw_grav(pixel *vid, FramePacket *packet = nullptr);
 
 void draw_line(pixel *vid, int x1, int y1, int x2, int y2, int r, int g, int b, int screenwidth);
 
@@ -145,15 +146,19 @@ void xor_rect(pixel *vid, int x, int y, int w, int h);
 void blend_line(pixel *vid, int x1, int y1, int x2, int y2, int r, int g, int b, int a);
 
 struct Point;
-void render_parts(pixel *vid, Simulation * sim, Point mousePos);
+void render_parts(pixel *vid, Simulation * sim, Point mousePos, FramePacket *packet = nullptr);
 
-void render_before(pixel *part_vbuf, Simulation * sim);
+void render_before(pixel *part_vbuf, Simulation * sim, FramePacket *packet = nullptr);
 
 void render_after(pixel *part_vbuf, pixel *vid_buf, Simulation * sim, Point mousePos);
 
+void render_particle_layers(pixel *part_vbuf, pixel *vid_buf, Simulation * sim, Point mousePos, FramePacket *packet = nullptr);
+
+void render_overlays(pixel *part_vbuf, pixel *vid_buf, Simulation * sim, Point mousePos);
+
 void draw_parts(pixel *vid);
 
-void draw_walls(pixel *vid, Simulation * sim);
+void draw_walls(pixel *vid, Simulation * sim, FramePacket *packet = nullptr);
 
 void draw_find(Simulation * sim);
 
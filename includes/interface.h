@@ -174,8 +174,7 @@ extern int	  search_scoredown[GRID_X*GRID_Y];
 extern int	  search_scoreup[GRID_X*GRID_Y];
 extern char *search_names[GRID_X*GRID_Y];
 extern char *search_owners[GRID_X*GRID_Y];
-extern void *search_thumbs[GRID_X*GRID_Y];
-extern int   search_thsizes[GRID_X*GRID_Y];
+extern std::string search_thumb_ids[GRID_X*GRID_Y];
 
 extern int search_own;
 extern int search_fav;
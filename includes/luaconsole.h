@@ -25,6 +25,7 @@
 
 #include "LuaCompat.h"
 #include "defines.h"
+#include "graphics.h"
 #include "graphics/Pixel.h"
 #include "lua/LuaEvents.h"
 #include "simulation/Element.h"
@@ -50,9 +51,11 @@ extern std::deque<std::pair<std::string, int>> logHistory;
 extern unsigned long loop_time;
 
 class LuaSmartRef;
-extern int *lua_el_mode;
+extern int lua_el_mode[];
 extern LuaSmartRef *lua_el_func, *lua_gr_func;
 extern std::vector<LuaSmartRef> lua_el_func_v, lua_gr_func_v;
+extern std::vector<LuaSmartRef> lua_el_batch_func, lua_gr_batch_func;
+extern std::vector<gcache_item> lua_gr_batch_results;
 extern std::vector<LuaSmartRef> luaCtypeDrawHandlers, luaCreateHandlers, luaCreateAllowedHandlers, luaChangeTypeHandlers;
 extern LuaSmartRef *tptPart;
 
@@ -70,6 +73,9 @@ void luacon_log(std::string log);
 int luacon_eval(const char *command, char **result);
 int luacon_part_update(unsigned int t, int i, int x, int y, int surround_space, int nt);
 int luacon_graphics_update(int t, int i, int *pixel_mode, int *cola, int *colr, int *colg, int *colb, int *firea, int *firer, int *fireg, int *fireb);
+void luacon_part_update_batch(Simulation *sim);
+void luacon_graphics_update_batch(Simulation *sim);
+bool luacon_has_graphics_funcs();
 bool luaCtypeDrawWrapper(CTYPEDRAW_FUNC_ARGS);
 void luaCreateWrapper(ELEMENT_CREATE_FUNC_ARGS);
 bool luaCreateAllowedWrapper(ELEMENT_CREATE_ALLOWED_FUNC_ARGS);
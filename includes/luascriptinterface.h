@@ -63,6 +63,11 @@ int simulation_reloadSave(lua_State * l);
 int simulation_getSaveID(lua_State * l);
 int simulation_adjustCoords(lua_State * l);
 int simulation_prettyPowders(lua_State * l);
+int simulation_deterministicHeat(lua_State * l);
+int simulation_particleCompaction(lua_State * l);
+int simulation_compactedID(lua_State * l);
+int simulation_randomKey(lua_State * l);
+int simulation_particleRandom(lua_State * l);
 int simulation_gravityGrid(lua_State * l);
 int simulation_edgeMode(lua_State * l);
 int simulation_gravityMode(lua_State * l);
@@ -94,6 +99,8 @@ int renderer_grid(lua_State * l);
 int renderer_debugHUD(lua_State * l);
 int renderer_showBrush(lua_State * l);
 int renderer_depth3d(lua_State * l);
+int renderer_simAhead(lua_State * l);
+int renderer_frameSkip(lua_State * l);
 int renderer_zoomEnabled(lua_State *l);
 int renderer_zoomWindowInfo(lua_State *l);
 int renderer_zoomScopeInfo(lua_State *l);
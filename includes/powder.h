@@ -31,8 +31,6 @@ class Simulation;
 
 #include "simulation/Particle.h"
 
-void TRON_init_graphics();
-
 void PPIP_flood_trigger(Simulation* sim, int x, int y, int sparkedBy);
 
 #define CHANNELS ((int)(MAX_TEMP-73)/100+2)
@@ -14,6 +14,8 @@
 
 #include "common/Platform.h"
 #include "common/tpt-minmax.h"
+#include "graphics/DamageTracker.h"
+#include "graphics/FrameSkip.h"
 #include "interface/Engine.h"
 #include "gui/game/PowderToy.h" // for the_game->DeFocus(), remove once all interfaces get modernized
 
@@ -21,6 +23,7 @@
 SDL_Window * sdl_window = nullptr;
 SDL_Renderer * sdl_renderer = nullptr;
 SDL_Texture * sdl_texture = nullptr;
+gfx::DamageTracker blitDamage(VIDXRES, VIDYRES);
 
 bool resizable = false;
 int pixelFilteringMode = 0;
@@ -246,6 +249,7 @@ void RecreateWindow()
 	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, filteringMode.c_str());
 	sdl_texture = SDL_CreateTexture(sdl_renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
 		VIDXRES, VIDYRES);
+	blitDamage.Invalidate();
 
 	if (fullscreen)
 		SDL_RaiseWindow(sdl_window);
@@ -258,7 +262,12 @@ void RecreateWindow()
 
 void SDLBlit(pixel * vid)
 {
-	SDL_UpdateTexture(sdl_texture, NULL, vid, VIDXRES * sizeof (Uint32));
+	// only upload the parts of the frame that changed, the texture keeps the rest from last time
+	for (const gfx::DirtyRect &dirty : blitDamage.Update(vid))
+	{
+		SDL_Rect area = { dirty.x, dirty.y, dirty.w, dirty.h };
+		SDL_UpdateTexture(sdl_texture, &area, vid + dirty.y * VIDXRES + dirty.x, VIDXRES * sizeof (Uint32));
+	}
 	// need to clear the renderer if there are black edges (fullscreen, or resizable window)
 	if (fullscreen || resizable)
 		SDL_RenderClear(sdl_renderer);
@@ -434,6 +443,11 @@ int EventProcess(SDL_Event event, ui::Window * eventHandler)
 		}
 		break;
 	}
+	// texture contents can be lost with the render device, upload everything again
+	case SDL_RENDER_TARGETS_RESET:
+	case SDL_RENDER_DEVICE_RESET:
+		blitDamage.Invalidate();
+		break;
 	case SDL_DROPFILE:
 		eventHandler->DoFileDrop(event.drop.file);
 		SDL_free(event.drop.file);
@@ -714,6 +728,7 @@ float FPSB2 = 60.0f;
 double frameTimeAvg = 0.0, correctedFrameTimeAvg = 60.0;
 void limit_fps()
 {
+	FrameSkip::Ref().EndFrame();
 	int frameTime = SDL_GetTicks() - currentTime;
 
 	frameTimeAvg = frameTimeAvg * .8 + frameTime * .2;
@@ -14,6 +14,7 @@
 
 #include "common/Platform.h"
 #include "common/tpt-minmax.h"
+#include "graphics/FrameSkip.h"
 #include "interface/Engine.h"
 #include "gui/game/PowderToy.h" // for the_game->DeFocus(), remove once all interfaces get modernized
 
@@ -439,6 +440,7 @@ float FPSB2 = 60.0f;
 double frameTimeAvg = 0.0, correctedFrameTimeAvg = 60.0;
 void limit_fps()
 {
+	FrameSkip::Ref().EndFrame();
 	int frameTime = SDL_GetTicks() - currentTime;
 
 	frameTimeAvg = frameTimeAvg * .8 + frameTime * .2;
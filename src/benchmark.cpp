@@ -1,27 +1,55 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <cmath>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if !defined(NOHTTP) && !defined(WIN)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
 #include "EventLoopSDL.h"
 #include "powder.h"
 #include "graphics.h"
 #include "powdergraphics.h"
 #include "benchmark.h"
+#include "luaconsole.h"
 #include "save_legacy.h"
 
+#include "common/Format.h"
+#include "common/tpt-rand.h"
 #include "common/Point.h"
+#include "common/WorkerPool.h"
+#include "game/Brush.h"
+#include "game/Request.h"
+#include "game/RequestManager.h"
+#include "game/ResponseCache.h"
 #include "game/Save.h"
 #include "game/Sign.h"
+#include "graphics/DamageTracker.h"
 #include "graphics/Pixel.h"
+#include "graphics/Renderer.h"
+#include "graphics/VideoBuffer.h"
 #include "json/json.h"
+#include "simulation/CoordStack.h"
 #include "simulation/Simulation.h"
 
 char *benchmark_file = NULL;
+bool benchmark_headless = false;
 double benchmark_loops_multiply = 1.0; // Increase for more accurate results (particularly on fast computers)
 int benchmark_repeat_count = 5; // this too, but try benchmark_loops_multiply first
 
+// not SDL_GetTicks, headless runs never initialise SDL
 double benchmark_get_time()
 {
-	return GetTicks()/1000.0;
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 // repeat_count - how many times to run the test, iterations_count = number of loops to execute each time
@@ -72,6 +100,1431 @@ bool benchmark_load_save(Simulation *sim, Save *save)
 	return false;
 }
 
+#ifdef LUACONSOLE
+bool benchmark_lua_eval(const char *code)
+{
+	char *result = NULL;
+	int ret = luacon_eval(code, &result);
+	if (ret)
+		printf("Lua error: %s\n", luacon_geterror().c_str());
+	else if (result)
+		printf("Lua: %s\n", result);
+	free(result);
+	return !ret;
+}
+
+// Compares per-particle Lua update / graphics functions with the batched versions, both doing the same work
+void benchmark_lua_elements(Simulation *sim, pixel *vid_buf)
+{
+	const char *setup =
+		"benchElem = elements.allocate('BENCH', 'LUAE') "
+		"elements.element(benchElem, elements.element(elements.DEFAULT_PT_DMND)) "
+		"elements.property(benchElem, 'Name', 'LUAE') "
+		"function benchUpdate(i, x, y, s, n) sim.partProperty(i, 'tmp', sim.partProperty(i, 'tmp') + 1) end "
+		"function benchUpdateBatch(ids, count) for n = 1, count do local i = ids[n] sim.partProperty(i, 'tmp', sim.partProperty(i, 'tmp') + 1) end end "
+		"function benchGraphics(i, r, g, b) return 0, 1, 255, 255, i % 256, 0 end "
+		"function benchGraphicsBatch(ids, count) local out = {} for n = 1, count do local o = (n - 1) * 9 "
+		"out[o + 1] = 1 out[o + 2] = 255 out[o + 3] = 255 out[o + 4] = ids[n] % 256 out[o + 5] = 0 end return out end";
+	if (!benchmark_lua_eval(setup))
+		return;
+
+	int type = 0;
+	for (int t = 1; t < PT_NUM; t++)
+		if (sim->elements[t].Enabled && sim->elements[t].Identifier == "BENCH_PT_LUAE")
+			type = t;
+	if (!type)
+		return;
+
+	clear_sim();
+	for (int y = CELL; y < YRES-CELL; y += 2)
+		for (int x = CELL; x < XRES-CELL; x++)
+			sim->part_create(-1, x, y, type);
+	sim->RecountElements();
+	printf("Lua elements (%d particles):\n", sim->elementCount[type]);
+
+	sys_pause = false;
+	framerender = 0;
+	printf("Update - per particle: ");
+	benchmark_lua_eval("elements.property(benchElem, 'Update', benchUpdate)");
+	BENCHMARK_START(benchmark_repeat_count, 20)
+	{
+		sim->Tick();
+	}
+	BENCHMARK_END()
+	benchmark_lua_eval("elements.property(benchElem, 'Update', false)");
+
+	printf("Update - batched: ");
+	benchmark_lua_eval("elements.property(benchElem, 'UpdateBatch', benchUpdateBatch)");
+	BENCHMARK_START(benchmark_repeat_count, 20)
+	{
+		sim->Tick();
+	}
+	BENCHMARK_END()
+	benchmark_lua_eval("elements.property(benchElem, 'UpdateBatch', false)");
+
+	display_mode = 0;
+	render_mode = RENDER_BASC;
+	Renderer::Ref().SetColorMode(COLOR_DEFAULT);
+	printf("Graphics - per particle: ");
+	benchmark_lua_eval("elements.property(benchElem, 'Graphics', benchGraphics)");
+	BENCHMARK_START(benchmark_repeat_count, 20)
+	{
+		render_parts(vid_buf, sim, Point(0, 0));
+	}
+	BENCHMARK_END()
+	benchmark_lua_eval("elements.property(benchElem, 'Graphics', false)");
+
+	printf("Graphics - batched: ");
+	benchmark_lua_eval("elements.property(benchElem, 'GraphicsBatch', benchGraphicsBatch)");
+	BENCHMARK_START(benchmark_repeat_count, 20)
+	{
+		render_parts(vid_buf, sim, Point(0, 0));
+	}
+	BENCHMARK_END()
+
+	clear_sim();
+	benchmark_lua_eval("elements.free(benchElem)");
+}
+#endif
+
+// Frame time with the whole frame uploaded every time, like SDLBlit used to, vs only the tiles DamageTracker
+// finds changed. A plain buffer stands in for the texture, so this is the CPU / memory bandwidth side of it
+void benchmark_present(Simulation *sim, pixel *vid_buf)
+{
+	std::vector<pixel> texture(VIDXRES*VIDYRES);
+	gfx::DamageTracker damage(VIDXRES, VIDYRES);
+	display_mode = 0;
+	render_mode = RENDER_BASC;
+
+	printf("Frame - full upload: ");
+	BENCHMARK_START(benchmark_repeat_count, 200)
+	{
+		sim->Tick();
+		render_before(vid_buf, sim);
+		render_parts(vid_buf, sim, Point(0, 0));
+		memcpy(&texture[0], vid_buf, VIDXRES*VIDYRES*PIXELSIZE);
+	}
+	BENCHMARK_END()
+
+	printf("Frame - dirty rects: ");
+	double uploaded = 0, frames = 0;
+	BENCHMARK_START(benchmark_repeat_count, 200)
+	{
+		sim->Tick();
+		render_before(vid_buf, sim);
+		render_parts(vid_buf, sim, Point(0, 0));
+		for (const gfx::DirtyRect &dirty : damage.Update(vid_buf))
+		{
+			for (int y = dirty.y; y < dirty.y + dirty.h; y++)
+				memcpy(&texture[y*VIDXRES + dirty.x], vid_buf + y*VIDXRES + dirty.x, dirty.w*PIXELSIZE);
+			uploaded += dirty.w * dirty.h;
+		}
+		frames++;
+	}
+	BENCHMARK_END()
+	printf("Dirty rects uploaded %g%% of the frame on average\n", uploaded / (frames * VIDXRES*VIDYRES) * 100.0);
+}
+
+// PTI and PNG encode / decode speed for the current frame, plus compressing a page of save browser sized
+// thumbnails one after another vs all at once with ptif_pack_batch
+void benchmark_thumbnails(pixel *vid_buf)
+{
+	std::vector<pixel> image(XRES*YRES);
+	for (int y = 0; y < YRES; y++)
+		memcpy(&image[y*XRES], vid_buf + y*(XRES+BARSIZE), XRES*PIXELSIZE);
+
+	int bestSize = 0, fastSize = 0, w, h;
+	void *best = ptif_pack(&image[0], XRES, YRES, &bestSize);
+	void *fast = ptif_pack(&image[0], XRES, YRES, &fastSize, true);
+	if (!best || !fast)
+	{
+		printf("PTI encode failed\n");
+		free(best);
+		free(fast);
+		return;
+	}
+	pixel *bestDecoded = ptif_unpack(best, bestSize, &w, &h);
+	pixel *fastDecoded = ptif_unpack(fast, fastSize, &w, &h);
+	bool roundTrip = bestDecoded && fastDecoded;
+	for (int i = 0; roundTrip && i < XRES*YRES; i++)
+		roundTrip = PIXRGB(PIXR(image[i]), PIXG(image[i]), PIXB(image[i])) == bestDecoded[i] && bestDecoded[i] == fastDecoded[i];
+	free(bestDecoded);
+	free(fastDecoded);
+	printf("PTI %dx%d, %d bytes raw, %d bytes bzip2, %d bytes fast, round trip %s\n", XRES, YRES, XRES*YRES*3, bestSize, fastSize, roundTrip ? "ok" : "FAILED");
+
+	printf("PTI encode - bzip2: ");
+	BENCHMARK_START(benchmark_repeat_count, 10)
+	{
+		int size;
+		free(ptif_pack(&image[0], XRES, YRES, &size));
+	}
+	BENCHMARK_END()
+	printf("PTI encode - fast: ");
+	BENCHMARK_START(benchmark_repeat_count, 100)
+	{
+		int size;
+		free(ptif_pack(&image[0], XRES, YRES, &size, true));
+	}
+	BENCHMARK_END()
+	printf("PTI decode - bzip2: ");
+	BENCHMARK_START(benchmark_repeat_count, 50)
+	{
+		free(ptif_unpack(best, bestSize, &w, &h));
+	}
+	BENCHMARK_END()
+	printf("PTI decode - fast: ");
+	BENCHMARK_START(benchmark_repeat_count, 200)
+	{
+		free(ptif_unpack(fast, fastSize, &w, &h));
+	}
+	BENCHMARK_END()
+	free(best);
+	free(fast);
+
+	pixel *small = resample_img(&image[0], XRES, YRES, XRES/GRID_S, YRES/GRID_S);
+	std::vector<PtifImage> page(GRID_X*GRID_Y, PtifImage{ small, XRES/GRID_S, YRES/GRID_S, NULL, 0 });
+	printf("PTI encode %d thumbnails - one at a time: ", GRID_X*GRID_Y);
+	BENCHMARK_START(benchmark_repeat_count, 5)
+	{
+		for (PtifImage &thumb : page)
+		{
+			thumb.data = ptif_pack(small, thumb.w, thumb.h, &thumb.size);
+			free(thumb.data);
+		}
+	}
+	BENCHMARK_END()
+	printf("PTI encode %d thumbnails - batched: ", GRID_X*GRID_Y);
+	BENCHMARK_START(benchmark_repeat_count, 5)
+	{
+		ptif_pack_batch(page);
+		for (PtifImage &thumb : page)
+			free(thumb.data);
+	}
+	BENCHMARK_END()
+	free(small);
+
+	gfx::VideoBuffer vid(XRES, YRES);
+	vid.CopyBufferFrom(&image[0], XRES, YRES, XRES, YRES);
+	printf("PNG encode - level 9: ");
+	BENCHMARK_START(benchmark_repeat_count, 10)
+	{
+		Format::VideoBufferToPNG(vid);
+	}
+	BENCHMARK_END()
+	printf("PNG encode - level 1: ");
+	BENCHMARK_START(benchmark_repeat_count, 10)
+	{
+		Format::VideoBufferToPNG(vid, 1);
+	}
+	BENCHMARK_END()
+}
+
+// draw_air and render_gravlensing as they were before being rewritten row-major with SSE2, kept to check the
+// new versions still give exactly the same pixels
+static void reference_draw_air(pixel *vid, Simulation *sim)
+{
+	pixel c = 0;
+	for (int x = 0; x < XRES/CELL; x++)
+		for (int y = 0; y < YRES/CELL; y++)
+		{
+			float pv = sim->air->pv[y][x], vx = sim->air->vx[y][x], vy = sim->air->vy[y][x];
+			if (display_mode & DISPLAY_AIRP)
+			{
+				if (pv > 0.0f)
+					c = PIXRGB(clamp_flt(pv, 0.0f, 8.0f), 0, 0);
+				else
+					c = PIXRGB(0, 0, clamp_flt(-pv, 0.0f, 8.0f));
+			}
+			else if (display_mode & DISPLAY_AIRV)
+				c = PIXRGB(clamp_flt(fabsf(vx), 0.0f, 8.0f), clamp_flt(pv, 0.0f, 8.0f), clamp_flt(fabsf(vy), 0.0f, 8.0f));
+			else if (display_mode & DISPLAY_AIRH)
+				c = aheat_enable ? PIXPACK(HeatToColor(sim->air->hv[y][x]+(-MIN_TEMP))) : 0;
+			else if (display_mode & DISPLAY_AIRC)
+			{
+				int r = clamp_flt(fabsf(vx), 0.0f, 24.0f) + clamp_flt(fabsf(vy), 0.0f, 20.0f);
+				int g = clamp_flt(fabsf(vx), 0.0f, 20.0f) + clamp_flt(fabsf(vy), 0.0f, 24.0f);
+				int b = clamp_flt(fabsf(vx), 0.0f, 24.0f) + clamp_flt(fabsf(vy), 0.0f, 20.0f);
+				if (pv > 0.0f)
+					r += clamp_flt(pv, 0.0f, 16.0f);
+				else
+					b += clamp_flt(-pv, 0.0f, 16.0f);
+				c = PIXRGB(std::min(r, 255), std::min(g, 255), std::min(b, 255));
+			}
+			if (finding && !(finding & 0x8))
+				c = PIXRGB(PIXR(c)/10, PIXG(c)/10, PIXB(c)/10);
+			for (int j = 0; j < CELL; j++)
+				for (int i = 0; i < CELL; i++)
+					vid[(x*CELL+i) + (y*CELL+j)*(XRES+BARSIZE)] = c;
+		}
+}
+
+static void reference_render_gravlensing(pixel *src, pixel *dst, Simulation *sim)
+{
+	for (int nx = 0; nx < XRES; nx++)
+		for (int ny = 0; ny < YRES; ny++)
+		{
+			int co = (ny/CELL)*(XRES/CELL)+(nx/CELL);
+			int rx = (int)(nx - sim->grav->gravx[co] * 0.75f + 0.5f);
+			int ry = (int)(ny - sim->grav->gravy[co] * 0.75f + 0.5f);
+			int gx = (int)(nx - sim->grav->gravx[co] * 0.875f + 0.5f);
+			int gy = (int)(ny - sim->grav->gravy[co] * 0.875f + 0.5f);
+			int bx = (int)(nx - sim->grav->gravx[co] + 0.5f);
+			int by = (int)(ny - sim->grav->gravy[co] + 0.5f);
+			if (rx >= 0 && rx < XRES && ry >= 0 && ry < YRES && gx >= 0 && gx < XRES && gy >= 0 && gy < YRES && bx >= 0 && bx < XRES && by >= 0 && by < YRES)
+			{
+				pixel t = dst[ny*(XRES+BARSIZE)+nx];
+				int r = std::min(PIXR(src[ry*(XRES+BARSIZE)+rx]) + PIXR(t), 255u);
+				int g = std::min(PIXG(src[gy*(XRES+BARSIZE)+gx]) + PIXG(t), 255u);
+				int b = std::min(PIXB(src[by*(XRES+BARSIZE)+bx]) + PIXB(t), 255u);
+				dst[ny*(XRES+BARSIZE)+nx] = PIXRGB(r, g, b);
+			}
+		}
+}
+
+static int count_different_pixels(const std::vector<pixel> &a, const std::vector<pixel> &b)
+{
+	int different = 0;
+	for (size_t i = 0; i < a.size(); i++)
+		if (a[i] != b[i])
+			different++;
+	return different;
+}
+
+// Pixel diff of draw_air and render_gravlensing against the reference versions above, using made up air and
+// gravity fields with every sign and plenty of out of range values, then how long each version takes
+void benchmark_air_display(Simulation *sim)
+{
+	std::vector<float> savedAir(4*(XRES/CELL)*(YRES/CELL)), savedGrav(2*(XRES/CELL)*(YRES/CELL));
+	memcpy(&savedAir[0], sim->air->pv, sizeof(sim->air->pv));
+	memcpy(&savedAir[(XRES/CELL)*(YRES/CELL)], sim->air->vx, sizeof(sim->air->vx));
+	memcpy(&savedAir[2*(XRES/CELL)*(YRES/CELL)], sim->air->vy, sizeof(sim->air->vy));
+	memcpy(&savedAir[3*(XRES/CELL)*(YRES/CELL)], sim->air->hv, sizeof(sim->air->hv));
+	memcpy(&savedGrav[0], sim->grav->gravx, (XRES/CELL)*(YRES/CELL)*sizeof(float));
+	memcpy(&savedGrav[(XRES/CELL)*(YRES/CELL)], sim->grav->gravy, (XRES/CELL)*(YRES/CELL)*sizeof(float));
+	unsigned int oldDisplayMode = display_mode;
+	int oldFinding = finding;
+
+	for (int y = 0; y < YRES/CELL; y++)
+		for (int x = 0; x < XRES/CELL; x++)
+		{
+			sim->air->pv[y][x] = sinf(x*0.37f) * cosf(y*0.23f) * 30.0f;
+			sim->air->vx[y][x] = sinf(x*0.11f + y*0.29f) * 40.0f;
+			sim->air->vy[y][x] = cosf(x*0.31f - y*0.17f) * 40.0f;
+			sim->air->hv[y][x] = 2000.0f + sinf(x*0.05f) * 2500.0f;
+			sim->grav->gravx[y*(XRES/CELL)+x] = sinf(x*0.07f + y*0.13f) * 30.0f;
+			sim->grav->gravy[y*(XRES/CELL)+x] = cosf(x*0.19f - y*0.05f) * 30.0f;
+		}
+
+	std::vector<pixel> expected((XRES+BARSIZE)*YRES), actual((XRES+BARSIZE)*YRES), source((XRES+BARSIZE)*YRES);
+	unsigned int airModes[] = { DISPLAY_AIRP, DISPLAY_AIRV, DISPLAY_AIRH, DISPLAY_AIRC };
+	int different = 0;
+	for (finding = 0; finding < 2; finding++)
+		for (unsigned int mode : airModes)
+		{
+			display_mode = mode;
+			std::fill(expected.begin(), expected.end(), 0);
+			std::fill(actual.begin(), actual.end(), 0);
+			reference_draw_air(&expected[0], sim);
+			draw_air(&actual[0], sim);
+			different += count_different_pixels(expected, actual);
+		}
+	finding = 0;
+	printf("Air display - pixels different from the reference: %d\n", different);
+
+	for (size_t i = 0; i < source.size(); i++)
+		source[i] = PIXRGB((i*7)&0xFF, (i*13)&0xFF, (i/3)&0xFF);
+	for (size_t i = 0; i < expected.size(); i++)
+		expected[i] = actual[i] = PIXRGB((i/5)&0xFF, (i*3)&0xFF, (i*11)&0xFF);
+	reference_render_gravlensing(&source[0], &expected[0], sim);
+	render_gravlensing(&source[0], &actual[0]);
+	printf("Gravity lensing - pixels different from the reference: %d\n", count_different_pixels(expected, actual));
+
+	display_mode = DISPLAY_AIRC;
+	printf("Air display - reference: ");
+	BENCHMARK_START(benchmark_repeat_count, 1000)
+	{
+		reference_draw_air(&actual[0], sim);
+	}
+	BENCHMARK_END()
+	printf("Air display: ");
+	BENCHMARK_START(benchmark_repeat_count, 1000)
+	{
+		draw_air(&actual[0], sim);
+	}
+	BENCHMARK_END()
+	printf("Gravity lensing - reference: ");
+	BENCHMARK_START(benchmark_repeat_count, 200)
+	{
+		reference_render_gravlensing(&source[0], &actual[0], sim);
+	}
+	BENCHMARK_END()
+	printf("Gravity lensing: ");
+	BENCHMARK_START(benchmark_repeat_count, 200)
+	{
+		render_gravlensing(&source[0], &actual[0]);
+	}
+	BENCHMARK_END()
+
+	memcpy(sim->air->pv, &savedAir[0], sizeof(sim->air->pv));
+	memcpy(sim->air->vx, &savedAir[(XRES/CELL)*(YRES/CELL)], sizeof(sim->air->vx));
+	memcpy(sim->air->vy, &savedAir[2*(XRES/CELL)*(YRES/CELL)], sizeof(sim->air->vy));
+	memcpy(sim->air->hv, &savedAir[3*(XRES/CELL)*(YRES/CELL)], sizeof(sim->air->hv));
+	memcpy(sim->grav->gravx, &savedGrav[0], (XRES/CELL)*(YRES/CELL)*sizeof(float));
+	memcpy(sim->grav->gravy, &savedGrav[(XRES/CELL)*(YRES/CELL)], (XRES/CELL)*(YRES/CELL)*sizeof(float));
+	display_mode = oldDisplayMode;
+	finding = oldFinding;
+}
+
+// Renders whatever particles are in the simulation once in each colour mode
+void benchmark_colour_modes(Simulation *sim, pixel *vid_buf)
+{
+	struct ColourMode
+	{
+		const char *name;
+		unsigned int mode;
+	};
+	ColourMode modes[] = {
+		{ "default", COLOR_DEFAULT },
+		{ "heat", COLOR_HEAT },
+		{ "life", COLOR_LIFE },
+		{ "heat gradient", COLOR_GRAD },
+		{ "basic", COLOR_BASC }
+	};
+	unsigned int oldColorMode = Renderer::Ref().GetColorMode(), oldDisplayMode = display_mode, oldRenderMode = render_mode;
+	display_mode = 0;
+	render_mode = RENDER_BASC;
+	for (ColourMode &mode : modes)
+	{
+		Renderer::Ref().SetColorMode(mode.mode);
+		printf("Render particles - %s colour mode: ", mode.name);
+		BENCHMARK_START(benchmark_repeat_count, 500)
+		{
+			render_parts(vid_buf, sim, Point(0, 0));
+		}
+		BENCHMARK_END()
+	}
+	Renderer::Ref().SetColorMode(oldColorMode);
+	display_mode = oldDisplayMode;
+	render_mode = oldRenderMode;
+
+	std::vector<pixel> persistent((XRES+BARSIZE)*YRES);
+	printf("Persistent display fade: ");
+	BENCHMARK_START(benchmark_repeat_count, 2000)
+	{
+		dim_copy_pers(&persistent[0], vid_buf);
+	}
+	BENCHMARK_END()
+}
+
+// Top half of the screen filled with one element, with gaps so everything keeps moving for a while
+void benchmark_movement_scene(Simulation *sim, int type)
+{
+	clear_sim();
+	for (int y = CELL; y < YRES/2; y++)
+		for (int x = CELL; x < XRES-CELL; x++)
+			if ((x + y) % 3)
+				sim->part_create(-1, x, y, type);
+	RNG::Ref().seed(1234);
+	sys_pause = false;
+	framerender = 0;
+}
+
+unsigned int benchmark_particle_hash(Simulation *sim)
+{
+	unsigned int hash = 0;
+	for (int i = 0; i <= sim->parts_lastActiveIndex; i++)
+		if (sim->parts[i].type)
+		{
+			hash = hash * 31 + sim->parts[i].type;
+			hash = hash * 31 + (int)(sim->parts[i].x * 256.0f);
+			hash = hash * 31 + (int)(sim->parts[i].y * 256.0f);
+		}
+	return hash;
+}
+
+// TryMove's move class fast path against the full special case path, which is what every pair of
+// types takes when move_class is all MOVE_SPECIAL
+void benchmark_movement(Simulation *sim)
+{
+	struct Scene
+	{
+		const char *name;
+		int type;
+	};
+	Scene scenes[] = {
+		{ "powder", PT_SAND },
+		{ "liquid", PT_WATR }
+	};
+	for (Scene &scene : scenes)
+	{
+		unsigned int hashes[2];
+		for (int reference = 0; reference < 2; reference++)
+		{
+			benchmark_movement_scene(sim, scene.type);
+			if (reference)
+				memset(sim->move_class, Simulation::MOVE_SPECIAL, sizeof(sim->move_class));
+			for (int i = 0; i < 100; i++)
+				sim->Tick();
+			hashes[reference] = benchmark_particle_hash(sim);
+			sim->InitMoveClasses();
+		}
+		printf("Movement - %s, same result as without the fast path: %s\n", scene.name, hashes[0] == hashes[1] ? "yes" : "NO");
+
+		printf("Movement - %s, without the fast path: ", scene.name);
+		BENCHMARK_INIT(benchmark_repeat_count, 200)
+		{
+			benchmark_movement_scene(sim, scene.type);
+			memset(sim->move_class, Simulation::MOVE_SPECIAL, sizeof(sim->move_class));
+			BENCHMARK_RUN()
+			{
+				sim->Tick();
+			}
+		}
+		BENCHMARK_END()
+		sim->InitMoveClasses();
+
+		printf("Movement - %s: ", scene.name);
+		BENCHMARK_INIT(benchmark_repeat_count, 200)
+		{
+			benchmark_movement_scene(sim, scene.type);
+			BENCHMARK_RUN()
+			{
+				sim->Tick();
+			}
+		}
+		BENCHMARK_END()
+	}
+	clear_sim();
+}
+
+// A solid block of DMND in stripes of different temperatures, so every particle conducts every tick
+void benchmark_heat_scene(Simulation *sim, unsigned int seed)
+{
+	clear_sim();
+	for (int y = CELL; y < YRES-CELL; y++)
+		for (int x = CELL; x < XRES-CELL; x++)
+		{
+			int i = sim->part_create(-1, x, y, PT_DMND);
+			if (i >= 0)
+				sim->parts[i].temp = (float)(((x / 8 + y / 8) % 10) * 500);
+		}
+	RNG::Ref().seed(seed);
+	sim->currentTick = 0;
+	sys_pause = false;
+	framerender = 0;
+}
+
+unsigned int benchmark_temperature_hash(Simulation *sim)
+{
+	unsigned int hash = 0;
+	for (int i = 0; i <= sim->parts_lastActiveIndex; i++)
+		if (sim->parts[i].type)
+			hash = hash * 31 + (int)(sim->parts[i].temp * 16.0f);
+	return hash;
+}
+
+// Heat conduction with the usual random chance to conduct and with sim.deterministicHeat, which has to give
+// the same temperatures no matter what state the random number generator is in
+void benchmark_heat(Simulation *sim)
+{
+	bool oldDeterministic = sim->deterministicHeat;
+	sim->deterministicHeat = true;
+	unsigned int hashes[2];
+	for (int run = 0; run < 2; run++)
+	{
+		benchmark_heat_scene(sim, run ? 4321 : 1234);
+		for (int i = 0; i < 50; i++)
+			sim->Tick();
+		hashes[run] = benchmark_temperature_hash(sim);
+	}
+	printf("Heat - deterministic mode independent of the random seed: %s\n", hashes[0] == hashes[1] ? "yes" : "NO");
+
+	for (int deterministic = 0; deterministic < 2; deterministic++)
+	{
+		sim->deterministicHeat = deterministic != 0;
+		printf("Heat - %s: ", deterministic ? "deterministic" : "random");
+		BENCHMARK_INIT(benchmark_repeat_count, 100)
+		{
+			benchmark_heat_scene(sim, 1234);
+			BENCHMARK_RUN()
+			{
+				sim->Tick();
+			}
+		}
+		BENCHMARK_END()
+	}
+	sim->deterministicHeat = oldDeterministic;
+	clear_sim();
+}
+
+// FloodProp as it was before the shared flood fill: a new bitmap for every fill and every pixel through the
+// coordinate stack
+static int reference_flood_prop(Simulation *sim, int x, int y, StructProperty prop, PropertyValue propValue)
+{
+	static CoordStack cs;
+	int x1, x2;
+	int did_something = 0;
+	int r = pmap[y][x];
+	if (!r)
+		r = photons[y][x];
+	if (!r)
+		return 0;
+	int parttype = TYP(r);
+	std::vector<char> bitmap(XRES*YRES, 0);
+	cs.clear();
+	try
+	{
+		cs.push(x, y);
+		do
+		{
+			cs.pop(x, y);
+			x1 = x2 = x;
+			while (x1 >= CELL && sim->FloodFillPmapCheck(x1-1, y, parttype) && !bitmap[y*XRES+x1-1])
+				x1--;
+			while (x2 < XRES-CELL && sim->FloodFillPmapCheck(x2+1, y, parttype) && !bitmap[y*XRES+x2+1])
+				x2++;
+			for (x = x1; x <= x2; x++)
+			{
+				sim->CreateProp(x, y, prop, propValue);
+				bitmap[y*XRES+x] = 1;
+				did_something = 1;
+			}
+			if (y >= CELL+1)
+				for (x = x1; x <= x2; x++)
+					if (sim->FloodFillPmapCheck(x, y-1, parttype) && !bitmap[(y-1)*XRES+x])
+						cs.push(x, y-1);
+			if (y < YRES-CELL-1)
+				for (x = x1; x <= x2; x++)
+					if (sim->FloodFillPmapCheck(x, y+1, parttype) && !bitmap[(y+1)*XRES+x])
+						cs.push(x, y+1);
+		} while (cs.getSize() > 0);
+	}
+	catch (const CoordStackOverflowException&)
+	{
+		return -1;
+	}
+	return did_something;
+}
+
+// DMND over the whole screen with holes and a few walls of DUST, so the fill has to wind its way around
+void benchmark_flood_scene(Simulation *sim)
+{
+	clear_sim();
+	for (int y = CELL; y < YRES-CELL; y++)
+		for (int x = CELL; x < XRES-CELL; x++)
+		{
+			if ((x * 7 + y * 13) % 23 == 0)
+				continue;
+			sim->part_create(-1, x, y, (x % 97 == 50 && y % 64 > 8) ? PT_DUST : PT_DMND);
+		}
+}
+
+unsigned int benchmark_tmp_hash(Simulation *sim)
+{
+	unsigned int hash = 0;
+	for (int i = 0; i <= sim->parts_lastActiveIndex; i++)
+		if (sim->parts[i].type)
+			hash = hash * 31 + sim->parts[i].tmp;
+	return hash;
+}
+
+// FloodProp with the shared flood fill against the old version above, over the whole screen and for lots of
+// small fills like the ones POWERED elements and PWHT do every frame
+void benchmark_flood_fill(Simulation *sim)
+{
+	StructProperty tmp = particle::PropertyByName("tmp");
+	unsigned int hashes[2];
+	for (int reference = 0; reference < 2; reference++)
+	{
+		benchmark_flood_scene(sim);
+		for (int i = 0; i < 20; i++)
+		{
+			int x = CELL + (i * 151) % (XRES-2*CELL), y = CELL + (i * 89) % (YRES-2*CELL);
+			if (reference)
+				reference_flood_prop(sim, x, y, tmp, { i + 1 });
+			else
+				sim->FloodProp(x, y, tmp, { i + 1 });
+		}
+		hashes[reference] = benchmark_tmp_hash(sim);
+	}
+	printf("Flood fill - same result as the old fill: %s\n", hashes[0] == hashes[1] ? "yes" : "NO");
+
+	// starts in the border rows and columns, outside the area the fills normally stay in
+	clear_sim();
+	for (int x = 1; x < XRES-1; x++)
+	{
+		sim->part_create(-1, x, YRES-1, PT_METL);
+		sim->part_create(-1, x, 0, PT_METL);
+	}
+	sim->FloodProp(1, YRES-1, tmp, { 77 });
+	sim->FloodProp(XRES-2, 0, tmp, { 78 });
+	int borderFilled = (sim->parts[ID(pmap[YRES-1][1])].tmp == 77) + (sim->parts[ID(pmap[0][XRES-2])].tmp == 78);
+	clear_sim();
+	sim->FloodParts(1, YRES-1, PT_DUST, PT_NONE, 0);
+	sim->FloodParts(XRES-1, 1, PT_DUST, PT_NONE, 0);
+	borderFilled += TYP(pmap[YRES-1][1]) == PT_DUST;
+	borderFilled += TYP(pmap[1][XRES-1]) == PT_DUST;
+	printf("Flood fill - fills started in the border that reached their start: %d/4\n", borderFilled);
+
+	benchmark_flood_scene(sim);
+	printf("Flood fill - whole screen, old: ");
+	BENCHMARK_START(benchmark_repeat_count, 50)
+	{
+		reference_flood_prop(sim, XRES/2, YRES/2, tmp, { bench_i });
+	}
+	BENCHMARK_END()
+	printf("Flood fill - whole screen: ");
+	BENCHMARK_START(benchmark_repeat_count, 50)
+	{
+		sim->FloodProp(XRES/2, YRES/2, tmp, { bench_i });
+	}
+	BENCHMARK_END()
+
+	clear_sim();
+	for (int y = 100; y < 110; y++)
+		for (int x = 100; x < 140; x++)
+			sim->part_create(-1, x, y, PT_METL);
+	printf("Flood fill - small area, old: ");
+	BENCHMARK_START(benchmark_repeat_count, 2000)
+	{
+		reference_flood_prop(sim, 100, 100, tmp, { bench_i });
+	}
+	BENCHMARK_END()
+	printf("Flood fill - small area: ");
+	BENCHMARK_START(benchmark_repeat_count, 2000)
+	{
+		sim->FloodProp(100, 100, tmp, { bench_i });
+	}
+	BENCHMARK_END()
+	clear_sim();
+}
+
+// Bands of wire made of every kind of conductor, with batteries at one end, insulation and gaps along the way and
+// a sparked METL grid below them, so sparks are always travelling through every sender and receiver pair
+void benchmark_electronics_scene(Simulation *sim)
+{
+	int wires[] = { PT_METL, PT_PSCN, PT_NSCN, PT_INST, PT_SWCH, PT_NTCT, PT_PTCT, PT_INWR, PT_WATR, PT_QRTZ, PT_ETRD, PT_TUNG, PT_INSL, PT_LCRY, PT_PUMP, PT_HSWC };
+	int wireCount = sizeof(wires) / sizeof(wires[0]);
+	clear_sim();
+	for (int band = 0; band < 12; band++)
+	{
+		int y = CELL + 4 + band * 12;
+		for (int x = CELL; x < CELL + 3; x++)
+			for (int dy = 0; dy < 5; dy++)
+				sim->part_create(-1, x, y + dy, PT_BTRY);
+		for (int x = CELL + 3; x < XRES - CELL; x++)
+			for (int dy = 0; dy < 5; dy++)
+			{
+				int segment = (x / 9 + band * 5 + (dy == 2 ? 3 : 0)) % wireCount;
+				if ((x + dy * 3 + band) % 29 == 0)
+					continue;
+				sim->part_create(-1, x, y + dy, wires[segment]);
+			}
+	}
+	for (int y = YRES - 100; y < YRES - CELL; y++)
+		for (int x = CELL; x < XRES - CELL; x++)
+			if (x % 4 == 0 || y % 4 == 0)
+			{
+				int i = sim->part_create(-1, x, y, PT_METL);
+				if (i >= 0 && (x + y) % 40 == 0)
+					sim->spark_conductive(i, x, y);
+			}
+	RNG::Ref().seed(1234);
+	sim->currentTick = 0;
+	sys_pause = false;
+	framerender = 0;
+}
+
+void benchmark_electronics(Simulation *sim)
+{
+	printf("Electronics: ");
+	BENCHMARK_INIT(benchmark_repeat_count, 200)
+	{
+		benchmark_electronics_scene(sim);
+		BENCHMARK_RUN()
+		{
+			sim->Tick();
+		}
+	}
+	BENCHMARK_END()
+	clear_sim();
+}
+
+// The particle loop of Save::Transform as it was, one m2d_multiply_v2d call at a time
+static void reference_transform_particles(particle *particles, unsigned int count, Matrix::matrix2d transform, Matrix::vector2d translate, int newWidth, int newHeight)
+{
+	using namespace Matrix;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		if (!particles[i].type)
+			continue;
+		vector2d pos = v2d_new(particles[i].x, particles[i].y);
+		pos = v2d_add(m2d_multiply_v2d(transform, pos), translate);
+		int nx = std::floor(pos.x + 0.5f);
+		int ny = std::floor(pos.y + 0.5f);
+		if (nx < 0 || nx >= newWidth || ny < 0 || ny >= newHeight)
+		{
+			particles[i].type = PT_NONE;
+			continue;
+		}
+		particles[i].x = nx;
+		particles[i].y = ny;
+		vector2d vel = v2d_new(particles[i].vx, particles[i].vy);
+		vel = m2d_multiply_v2d(transform, vel);
+		particles[i].vx = vel.x;
+		particles[i].vy = vel.y;
+	}
+}
+
+// Save::Transform on a save of the whole screen: particle positions against the old loop for a few rotations,
+// then flips and rotations of the whole save
+void benchmark_transform(Simulation *sim)
+{
+	using namespace Matrix;
+	benchmark_flood_scene(sim);
+	for (int i = 0; i <= sim->parts_lastActiveIndex; i++)
+		if (sim->parts[i].type)
+		{
+			sim->parts[i].vx = (i % 7) - 3.0f;
+			sim->parts[i].vy = (i % 5) * 0.5f;
+		}
+	Save *save = sim->CreateSave(0, 0, XRES, YRES);
+	clear_sim();
+	if (!save)
+		return;
+
+	float angles[] = { 0.5f * (float)M_PI, (float)M_PI, 0.3f, -1.1f };
+	int different = 0;
+	for (float angle : angles)
+	{
+		matrix2d rotate = m2d_new(cosf(angle), sinf(angle), -sinf(angle), cosf(angle));
+		vector2d translate = v2d_new(XRES/3, YRES/4);
+		Save transformed(*save);
+		std::vector<particle> expected(save->particles, save->particles + save->particlesCount);
+		transformed.Transform(rotate, translate, translate, XRES, YRES);
+		reference_transform_particles(&expected[0], expected.size(), rotate, translate, XRES, YRES);
+		for (unsigned int i = 0; i < save->particlesCount; i++)
+		{
+			const particle &a = expected[i], &b = transformed.particles[i];
+			if (a.type != b.type || (a.type && (a.x != b.x || a.y != b.y || a.vx != b.vx || a.vy != b.vy)))
+				different++;
+		}
+	}
+	printf("Save transform - particles different from the old loop: %d\n", different);
+
+	std::vector<particle> particles(save->particles, save->particles + save->particlesCount);
+	matrix2d flip = m2d_new(-1, 0, 0, 1);
+	printf("Save transform - particles only, old: ");
+	BENCHMARK_START(benchmark_repeat_count, 100)
+	{
+		reference_transform_particles(&particles[0], particles.size(), flip, v2d_new(XRES-1, 0), XRES, YRES);
+	}
+	BENCHMARK_END()
+
+	printf("Save transform - horizontal flip: ");
+	BENCHMARK_START(benchmark_repeat_count, 100)
+	{
+		save->Transform(flip, v2d_zero);
+	}
+	BENCHMARK_END()
+
+	printf("Save transform - 90 degree rotation, copy included: ");
+	matrix2d rotate90 = m2d_new(0, 1, -1, 0);
+	BENCHMARK_START(benchmark_repeat_count, 50)
+	{
+		Save rotated(*save);
+		rotated.Transform(rotate90, v2d_zero);
+	}
+	BENCHMARK_END()
+	delete save;
+}
+
+// How CreateLine used to draw with a brush: a full brush at the start, then the outline of the brush at every step
+static void reference_create_line(Simulation *sim, int x1, int y1, int x2, int y2, int c, Brush *brush)
+{
+	bool reverseXY = abs(y2-y1) > abs(x2-x1), fill = true;
+	if (reverseXY)
+	{
+		std::swap(x1, y1);
+		std::swap(x2, y2);
+	}
+	if (x1 > x2)
+	{
+		std::swap(x1, x2);
+		std::swap(y1, y2);
+	}
+	float e = 0.0f, de = (x2 - x1) ? abs(y2 - y1)/(float)(x2 - x1) : 0.0f;
+	int y = y1, sy = (y1<y2) ? 1 : -1;
+	for (int x = x1; x <= x2; x++)
+	{
+		if (reverseXY)
+			sim->CreateParts(y, x, c, 0, fill, brush);
+		else
+			sim->CreateParts(x, y, c, 0, fill, brush);
+		e += de;
+		fill = false;
+		if (e >= 0.5f)
+		{
+			y += sy;
+			e -= 1.0f;
+		}
+	}
+}
+
+static int count_particles(Simulation *sim)
+{
+	int count = 0;
+	for (int i = 0; i <= sim->parts_lastActiveIndex; i++)
+		if (sim->parts[i].type)
+			count++;
+	return count;
+}
+
+// Big brushes: single clicks, and long lines drawn the old way and as swept spans. Lines are drawn with the
+// eraser on an empty screen so the times are the rasterising, not creating particles
+void benchmark_brush(Simulation *sim)
+{
+	int shapes[] = { CIRCLE_BRUSH, SQUARE_BRUSH, TRI_BRUSH };
+	const char *shapeNames[] = { "circle", "square", "triangle" };
+	for (int shape = 0; shape < BRUSH_NUM; shape++)
+	{
+		Brush brush(Point(40, 25), shapes[shape]);
+		int counts[2];
+		for (int swept = 0; swept < 2; swept++)
+		{
+			clear_sim();
+			if (swept)
+				sim->CreateLine(60, 60, XRES-80, YRES-70, PT_DUST, 0, &brush);
+			else
+				reference_create_line(sim, 60, 60, XRES-80, YRES-70, PT_DUST, &brush);
+			counts[swept] = count_particles(sim);
+		}
+		printf("Brush - %s line, particles drawn the old way: %d, swept: %d\n", shapeNames[shape], counts[0], counts[1]);
+	}
+	clear_sim();
+
+	Brush big(Point(150, 150), CIRCLE_BRUSH);
+	printf("Brush - radius 150 click: ");
+	BENCHMARK_START(benchmark_repeat_count, 200)
+	{
+		sim->CreateParts(XRES/2, YRES/2, 0, 0, true, &big);
+	}
+	BENCHMARK_END()
+
+	Brush thick(Point(60, 60), CIRCLE_BRUSH);
+	printf("Brush - radius 60 line across the screen, old: ");
+	BENCHMARK_START(benchmark_repeat_count, 50)
+	{
+		reference_create_line(sim, 0, 0, XRES-1, YRES-1, 0, &thick);
+	}
+	BENCHMARK_END()
+	printf("Brush - radius 60 line across the screen: ");
+	BENCHMARK_START(benchmark_repeat_count, 50)
+	{
+		sim->CreateLine(0, 0, XRES-1, YRES-1, 0, 0, &thick);
+	}
+	BENCHMARK_END()
+}
+
+// A full screen of sand and water created in a random order, like the ids end up after a long session
+void benchmark_scattered_scene(Simulation *sim)
+{
+	clear_sim();
+	RNG::Ref().seed(1234);
+	std::vector<int> positions;
+	for (int y = CELL; y < YRES-CELL; y++)
+		for (int x = CELL; x < XRES-CELL; x++)
+			if ((x * y) % 7)
+				positions.push_back(y * XRES + x);
+	for (int i = (int)positions.size() - 1; i > 0; i--)
+		std::swap(positions[i], positions[RNG::Ref().between(0, i)]);
+	for (int position : positions)
+	{
+		int x = position % XRES, y = position / XRES;
+		sim->part_create(-1, x, y, y < YRES/2 ? PT_SAND : PT_WATR);
+	}
+	sys_pause = false;
+	framerender = 0;
+}
+
+// Doesn't depend on which id each particle has
+unsigned int benchmark_unordered_hash(Simulation *sim)
+{
+	unsigned int hash = 0;
+	for (int i = 0; i <= sim->parts_lastActiveIndex; i++)
+		if (sim->parts[i].type)
+		{
+			unsigned int h = sim->parts[i].type;
+			h = h * 31 + (int)(sim->parts[i].x * 256.0f);
+			h = h * 31 + (int)(sim->parts[i].y * 256.0f);
+			h = h * 31 + (int)(sim->parts[i].temp * 16.0f);
+			hash += h * 2654435761u;
+		}
+	return hash;
+}
+
+// Particle updates with ids scattered all over the screen, and after sorting them by position
+void benchmark_compaction(Simulation *sim)
+{
+	benchmark_scattered_scene(sim);
+	unsigned int before = benchmark_unordered_hash(sim);
+	sim->CompactParticles();
+	sim->RecalcFreeParticles(false);
+	printf("Compaction - same particles afterwards: %s\n", before == benchmark_unordered_hash(sim) ? "yes" : "NO");
+
+	for (int compacted = 0; compacted < 2; compacted++)
+	{
+		printf("Compaction - sand and water, %s: ", compacted ? "compacted" : "scattered ids");
+		BENCHMARK_INIT(benchmark_repeat_count, 100)
+		{
+			benchmark_scattered_scene(sim);
+			if (compacted)
+				sim->CompactParticles();
+			BENCHMARK_RUN()
+			{
+				sim->Tick();
+			}
+		}
+		BENCHMARK_END()
+	}
+
+	printf("Compaction - one pass: ");
+	benchmark_scattered_scene(sim);
+	BENCHMARK_START(benchmark_repeat_count, 50)
+	{
+		sim->CompactParticles();
+		sim->RecalcFreeParticles(false);
+	}
+	BENCHMARK_END()
+	clear_sim();
+}
+
+// Counter-based RNG gives the same numbers however the work is split up, and how fast it is next to RNG
+void benchmark_random()
+{
+	const int count = 1 << 20;
+	// not a multiple of the block size, so slices start part way through blocks
+	const int sliceSize = 12345;
+	CounterRNG rng(1234, RANDOM_SITE_LUA, 5, 6);
+	std::vector<unsigned int> single(count), split(count), sequential(count);
+	rng.Fill(single.data(), count);
+	for (int i = 0; i < count; i++)
+		sequential[i] = rng.gen();
+	WorkerPool &pool = WorkerPool::Shared();
+	WorkerPool::Group slices;
+	for (int start = 0; start < count; start += sliceSize)
+	{
+		pool.Push([&rng, &split, start, sliceSize, count]() {
+			rng.Fill(&split[start], std::min(sliceSize, count - start), start);
+		}, &slices);
+	}
+	pool.Wait(&slices);
+	printf("Random - batch same as one at a time: %s, same on %d threads: %s\n", single == sequential ? "yes" : "NO",
+	       pool.ThreadCount(), single == split ? "yes" : "NO");
+
+	unsigned int sum = 0;
+	printf("Random - RNG::gen, 1M values: ");
+	BENCHMARK_START(benchmark_repeat_count, 20)
+	{
+		for (int i = 0; i < count; i++)
+			sum += RNG::Ref().gen();
+	}
+	BENCHMARK_END()
+
+	printf("Random - CounterRNG::gen, 1M values: ");
+	BENCHMARK_START(benchmark_repeat_count, 20)
+	{
+		CounterRNG particleRng(1234, RANDOM_SITE_LUA, bench_i, 6);
+		for (int i = 0; i < count; i++)
+			sum += particleRng.gen();
+	}
+	BENCHMARK_END()
+
+	// a new generator per particle that only draws a couple of values, why element code stays on RNG
+	printf("Random - CounterRNG::gen, 2 values from each of 512K streams: ");
+	BENCHMARK_START(benchmark_repeat_count, 20)
+	{
+		for (int i = 0; i < count / 2; i++)
+		{
+			CounterRNG particleRng(1234, RANDOM_SITE_LUA, bench_i, i);
+			sum += particleRng.gen();
+			sum += particleRng.gen();
+		}
+	}
+	BENCHMARK_END()
+
+	printf("Random - CounterRNG::Fill, 1M values: ");
+	BENCHMARK_START(benchmark_repeat_count, 20)
+	{
+		CounterRNG(1234, RANDOM_SITE_LUA, bench_i, 6).Fill(single.data(), count);
+		sum += single[bench_i];
+	}
+	BENCHMARK_END()
+
+	printf("Random - CounterRNG::Fill on %d threads, 1M values: ", pool.ThreadCount());
+	BENCHMARK_START(benchmark_repeat_count, 20)
+	{
+		CounterRNG tickRng(1234, RANDOM_SITE_LUA, bench_i, 6);
+		for (int start = 0; start < count; start += sliceSize)
+		{
+			pool.Push([&tickRng, &split, start, sliceSize, count]() {
+				tickRng.Fill(&split[start], std::min(sliceSize, count - start), start);
+			}, &slices);
+		}
+		pool.Wait(&slices);
+		sum += split[bench_i];
+	}
+	BENCHMARK_END()
+	// printed so the loops can't be optimised away
+	printf("Random - checksum %08x\n", sum);
+}
+
+// Scripts rebuild the movement tables after every element property change, most of those don't affect them
+void benchmark_move_tables(Simulation *sim)
+{
+	std::vector<unsigned char> before(&sim->can_move[0][0], &sim->can_move[0][0] + PT_NUM * PT_NUM);
+	int weight = sim->elements[PT_SAND].Weight;
+	sim->elements[PT_SAND].Weight = 10;
+	sim->InitCanMove();
+	bool changed = sim->can_move[PT_WATR][PT_SAND] != before[PT_WATR * PT_NUM + PT_SAND];
+	sim->elements[PT_SAND].Weight = weight;
+	sim->InitCanMove();
+	bool restored = std::equal(before.begin(), before.end(), &sim->can_move[0][0]);
+	printf("Move tables - rebuilt after a weight change: %s, same as before after changing it back: %s\n", changed ? "yes" : "NO", restored ? "yes" : "NO");
+
+	printf("Move tables - InitCanMove, nothing changed: ");
+	BENCHMARK_START(benchmark_repeat_count, 2000)
+	{
+		sim->InitCanMove();
+	}
+	BENCHMARK_END()
+
+	printf("Move tables - InitCanMove, full rebuild: ");
+	BENCHMARK_START(benchmark_repeat_count, 50)
+	{
+		sim->SetCanMove(PT_SAND, PT_SAND, sim->can_move[PT_SAND][PT_SAND]);
+		sim->InitCanMove();
+	}
+	BENCHMARK_END()
+}
+
+// Loading large saves over an empty screen and pasting them over a full one. A loaded save should give back
+// exactly the particles it was made from
+void benchmark_save_loading(Simulation *sim)
+{
+	const char *names[] = { "sand and water", "diamond and dust", "electronics" };
+	std::vector<Save*> saves;
+	std::vector<unsigned int> hashes;
+	for (int scene = 0; scene < 3; scene++)
+	{
+		if (scene == 0)
+			benchmark_scattered_scene(sim);
+		else if (scene == 1)
+			benchmark_flood_scene(sim);
+		else
+			benchmark_electronics_scene(sim);
+		hashes.push_back(benchmark_unordered_hash(sim));
+		saves.push_back(sim->CreateSave(0, 0, XRES, YRES));
+	}
+
+	int same = 0;
+	for (size_t s = 0; s < saves.size(); s++)
+	{
+		if (!saves[s] || benchmark_load_save(sim, saves[s]))
+			continue;
+		if (benchmark_unordered_hash(sim) == hashes[s])
+			same++;
+	}
+	printf("Save loading - saves that load back the same particles: %d/%d\n", same, (int)saves.size());
+
+	for (size_t s = 0; s < saves.size(); s++)
+	{
+		if (!saves[s])
+			continue;
+		printf("Save loading - %s, %u particles: ", names[s], saves[s]->particlesCount);
+		BENCHMARK_START(benchmark_repeat_count, 50)
+		{
+			sim->LoadSave(0, 0, saves[s], 1);
+		}
+		BENCHMARK_END()
+
+		printf("Save loading - %s, pasted over the last one: ", names[s]);
+		BENCHMARK_INIT(benchmark_repeat_count, 50)
+		{
+			sim->LoadSave(0, 0, saves[(s + 1) % saves.size()], 1);
+			BENCHMARK_RUN()
+			{
+				sim->LoadSave(0, 0, saves[s], 0);
+			}
+		}
+		BENCHMARK_END()
+	}
+
+	for (Save *save : saves)
+		delete save;
+	clear_sim();
+}
+
+#ifndef NOHTTP
+#if !defined(ENFORCE_HTTPS) && !defined(WIN)
+// Minimal keep-alive HTTP/1.1 server on 127.0.0.1 for checking RequestManager, one thread per connection.
+// It logs the paths it is asked for in arrival order, marking conditional requests
+class MockHttpServer
+{
+	int listenFd = -1;
+	bool stopping = false;
+	std::thread acceptThread;
+	std::vector<std::thread> connectionThreads;
+	std::vector<int> connectionFds;
+
+	void Accept()
+	{
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> g(mutex);
+				if (stopping)
+					return;
+			}
+			struct pollfd pfd = { listenFd, POLLIN, 0 };
+			if (poll(&pfd, 1, 50) <= 0)
+				continue;
+			int fd = accept(listenFd, NULL, NULL);
+			if (fd < 0)
+				continue;
+			std::lock_guard<std::mutex> g(mutex);
+			connections++;
+			connectionFds.push_back(fd);
+			connectionThreads.push_back(std::thread([this, fd]() { Serve(fd); }));
+		}
+	}
+
+	void Serve(int fd)
+	{
+		std::string buffer;
+		char chunk[4096];
+		while (true)
+		{
+			size_t end;
+			while ((end = buffer.find("\r\n\r\n")) == buffer.npos)
+			{
+				ssize_t got = recv(fd, chunk, sizeof(chunk), 0);
+				if (got <= 0)
+					return;
+				buffer.append(chunk, got);
+			}
+			std::string head = buffer.substr(0, end);
+			buffer.erase(0, end + 4);
+			size_t pathStart = head.find(' ') + 1;
+			std::string path = head.substr(pathStart, head.find(' ', pathStart) - pathStart);
+			bool conditional = head.find("If-None-Match:") != head.npos || head.find("If-Modified-Since:") != head.npos;
+
+			std::string status = "200 OK", headers, body = path;
+			{
+				std::unique_lock<std::mutex> l(mutex);
+				log.push_back(path + (conditional ? " (conditional)" : ""));
+				cv.notify_all();
+				if (!path.compare(0, 6, "/hold/"))
+					cv.wait(l, [this]() { return !holding; });
+			}
+			if (path == "/etag")
+				headers = "ETag: \"v1\"\r\n";
+			else if (path == "/lastmod")
+				headers = "Last-Modified: Mon, 01 Jan 2024 00:00:00 GMT\r\n";
+			else if (path == "/evict")
+			{
+				// the cached copy disappears while the server is saying it's still good
+				headers = "ETag: \"e1\"\r\n";
+				if (conditional)
+					ResponseCache::Ref().Erase(Uri(path));
+			}
+			if (conditional)
+			{
+				status = "304 Not Modified";
+				body = "";
+			}
+			std::string response = "HTTP/1.1 " + status + "\r\n" + headers + "Content-Length: " + Format::NumberToString<size_t>(body.size()) + "\r\n\r\n" + body;
+			if (send(fd, response.data(), response.size(), 0) != (ssize_t)response.size())
+				return;
+		}
+	}
+
+public:
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool holding = true;
+	int connections = 0;
+	std::vector<std::string> log;
+	int port = 0;
+
+	bool Start()
+	{
+		listenFd = socket(AF_INET, SOCK_STREAM, 0);
+		if (listenFd < 0)
+			return false;
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t addrLen = sizeof(addr);
+		if (bind(listenFd, (struct sockaddr *)&addr, addrLen) || listen(listenFd, 64) || getsockname(listenFd, (struct sockaddr *)&addr, &addrLen))
+		{
+			close(listenFd);
+			return false;
+		}
+		port = ntohs(addr.sin_port);
+		acceptThread = std::thread([this]() { Accept(); });
+		return true;
+	}
+
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> g(mutex);
+			stopping = true;
+			holding = false;
+			for (int fd : connectionFds)
+				shutdown(fd, SHUT_RDWR);
+		}
+		cv.notify_all();
+		acceptThread.join();
+		for (std::thread &thread : connectionThreads)
+			thread.join();
+		for (int fd : connectionFds)
+			close(fd);
+		close(listenFd);
+	}
+
+	std::string Uri(const std::string &path)
+	{
+		return "http://127.0.0.1:" + Format::NumberToString<int>(port) + path;
+	}
+
+	void Release()
+	{
+		{
+			std::lock_guard<std::mutex> g(mutex);
+			holding = false;
+		}
+		cv.notify_all();
+	}
+
+	// position of the first and last log entries starting with prefix, and how many there are
+	void Find(const std::string &prefix, int *first, int *last, int *count)
+	{
+		std::lock_guard<std::mutex> g(mutex);
+		*first = *last = -1;
+		*count = 0;
+		for (int i = 0; i < (int)log.size(); i++)
+			if (!log[i].compare(0, prefix.size(), prefix))
+			{
+				if (*first < 0)
+					*first = i;
+				*last = i;
+				(*count)++;
+			}
+	}
+};
+
+static std::string benchmark_request(MockHttpServer &server, const std::string &path, int *status, bool useCache)
+{
+	Request *request = new Request(server.Uri(path));
+	if (useCache)
+		request->UseCache();
+	request->Start();
+	return request->Finish(status);
+}
+
+#endif
+
+// Priorities, connection reuse and cache revalidation in RequestManager, against a local server
+void benchmark_requests()
+{
+#if defined(ENFORCE_HTTPS) || defined(WIN)
+	printf("Requests - needs plain http (scons --allow-http) and POSIX sockets, skipped\n");
+#else
+	MockHttpServer server;
+	if (!server.Start())
+	{
+		printf("Requests - couldn't start a local server, skipped\n");
+		return;
+	}
+	RequestManager::Ref().Initialise("");
+
+	// fill every slot with requests the server holds on to, then queue low priority requests before high ones
+	const int blockers = 12, queued = 4;
+	std::vector<Request *> requests;
+	for (int i = 0; i < blockers; i++)
+	{
+		requests.push_back(new Request(server.Uri("/hold/" + Format::NumberToString<int>(i))));
+		requests.back()->Start();
+	}
+	{
+		// curl only opens a few connections per host, the rest of the blockers wait inside curl
+		std::unique_lock<std::mutex> l(server.mutex);
+		server.cv.wait_for(l, std::chrono::seconds(5), [&server]() { return server.log.size() >= 6; });
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(300));
+	for (int priority = PRIORITY_LOW; priority >= PRIORITY_HIGH; priority -= PRIORITY_LOW - PRIORITY_HIGH)
+		for (int i = 0; i < queued; i++)
+		{
+			requests.push_back(new Request(server.Uri((priority == PRIORITY_HIGH ? "/high/" : "/low/") + Format::NumberToString<int>(i))));
+			requests.back()->SetPriority((RequestPriority)priority);
+			requests.back()->Start();
+		}
+	std::this_thread::sleep_for(std::chrono::milliseconds(300));
+	server.Release();
+	int finished = 0;
+	for (Request *request : requests)
+	{
+		int status;
+		request->Finish(&status);
+		finished += status == 200;
+	}
+	int firstHigh, lastHigh, firstLow, lastLow, count;
+	server.Find("/high/", &firstHigh, &lastHigh, &count);
+	server.Find("/low/", &firstLow, &lastLow, &count);
+	printf("Requests - %d/%d finished, high priority requests sent before low priority ones: %s\n", finished, (int)requests.size(),
+	       firstHigh >= 0 && firstLow >= 0 && lastHigh < firstLow ? "yes" : "NO");
+
+	int status, connectionsBefore, sequential = 5, ok = 0;
+	{
+		std::lock_guard<std::mutex> g(server.mutex);
+		connectionsBefore = server.connections;
+	}
+	for (int i = 0; i < sequential; i++)
+	{
+		benchmark_request(server, "/seq/" + Format::NumberToString<int>(i), &status, false);
+		ok += status == 200;
+	}
+	{
+		std::lock_guard<std::mutex> g(server.mutex);
+		printf("Requests - %d/%d requests in a row, new connections opened for them: %d\n", ok, sequential, server.connections - connectionsBefore);
+	}
+
+	// fetched twice, the second time the server answers 304 and the body comes from the disk cache. For /evict the
+	// cache entry is deleted just before the 304, so the request has to be repeated without validators
+	const char *paths[] = { "/etag", "/lastmod", "/evict" };
+	for (const char *path : paths)
+	{
+		ResponseCache::Ref().Erase(server.Uri(path));
+		std::string firstBody = benchmark_request(server, path, &status, true);
+		int firstStatus = status;
+		std::string secondBody = benchmark_request(server, path, &status, true);
+		int first, last, revalidated, sent;
+		server.Find(std::string(path) + " (conditional)", &first, &last, &revalidated);
+		server.Find(path, &first, &last, &sent);
+		printf("Requests - %s: statuses %d %d, same body both times: %s, revalidated: %s, sent to the server %d times\n", path, firstStatus, status,
+		       firstBody == path && secondBody == path ? "yes" : "NO", revalidated ? "yes" : "NO", sent);
+		ResponseCache::Ref().Erase(server.Uri(path));
+	}
+
+	RequestManager::Ref().Shutdown();
+	server.Stop();
+#endif
+}
+#endif
+
 void benchmark_run()
 {
 	pixel *vid_buf = (pixel*)calloc((XRES+BARSIZE)*(YRES+MENUSIZE), PIXELSIZE);
@@ -139,40 +1592,50 @@ void benchmark_run()
 				}
 				BENCHMARK_END()
 
-				printf("Render particles: ");
-				BENCHMARK_INIT(benchmark_repeat_count, 1500)
+				if (!benchmark_headless)
 				{
-					benchmark_load_save(sim, save);
-					sys_pause = false;
-					framerender = 0;
-					display_mode = 0;
-					render_mode = RENDER_BASC;
-					decorations_enable = true;
-					sim->Tick();
-					BENCHMARK_RUN()
+					printf("Render particles: ");
+					BENCHMARK_INIT(benchmark_repeat_count, 1500)
 					{
-						render_parts(vid_buf, sim, Point(0,0));
+						benchmark_load_save(sim, save);
+						sys_pause = false;
+						framerender = 0;
+						display_mode = 0;
+						render_mode = RENDER_BASC;
+						decorations_enable = true;
+						sim->Tick();
+						BENCHMARK_RUN()
+						{
+							render_parts(vid_buf, sim, Point(0,0));
+						}
 					}
-				}
-				BENCHMARK_END()
+					BENCHMARK_END()
+
+					printf("Render particles+fire: ");
+					BENCHMARK_INIT(benchmark_repeat_count, 1200)
+					{
+						benchmark_load_save(sim, save);
+						sys_pause = false;
+						framerender = 0;
+						display_mode = 0;
+						render_mode = RENDER_FIRE;
+						decorations_enable = true;
+						sim->Tick();
+						BENCHMARK_RUN()
+						{
+							render_parts(vid_buf, sim, Point(0, 0));
+							render_fire(vid_buf);
+						}
+					}
+					BENCHMARK_END()
 
-				printf("Render particles+fire: ");
-				BENCHMARK_INIT(benchmark_repeat_count, 1200)
-				{
 					benchmark_load_save(sim, save);
 					sys_pause = false;
 					framerender = 0;
-					display_mode = 0;
-					render_mode = RENDER_FIRE;
-					decorations_enable = true;
-					sim->Tick();
-					BENCHMARK_RUN()
-					{
-						render_parts(vid_buf, sim, Point(0, 0));
-						render_fire(vid_buf);
-					}
+					benchmark_present(sim, vid_buf);
+					benchmark_thumbnails(vid_buf);
+					benchmark_colour_modes(sim, vid_buf);
 				}
-				BENCHMARK_END()
 
 
 			}
@@ -212,6 +1675,42 @@ void benchmark_run()
 		}
 		BENCHMARK_END()*/
 
+		if (!benchmark_headless)
+		{
+			printf("Present a static frame:\n");
+			benchmark_present(sim, vid_buf);
+			benchmark_thumbnails(vid_buf);
+
+			benchmark_air_display(sim);
+
+			// a spread of temperatures and lives, so every colour table gets used
+			for (int y = CELL; y < YRES-CELL; y += 2)
+				for (int x = CELL; x < XRES-CELL; x += 2)
+				{
+					int i = sim->part_create(-1, x, y, PT_DUST);
+					if (i < 0)
+						continue;
+					parts[i].temp = (float)((x * 17 + y * 5) % MAX_TEMP);
+					parts[i].life = (x * y) % 5000;
+				}
+			benchmark_colour_modes(sim, vid_buf);
+			clear_sim();
+		}
+
+		benchmark_movement(sim);
+		benchmark_heat(sim);
+		benchmark_flood_fill(sim);
+		benchmark_electronics(sim);
+		benchmark_transform(sim);
+		benchmark_brush(sim);
+		benchmark_compaction(sim);
+		benchmark_random();
+		benchmark_move_tables(sim);
+		benchmark_save_loading(sim);
+#ifndef NOHTTP
+		benchmark_requests();
+#endif
+
 		printf("Air - no walls, no changes: ");
 		BENCHMARK_START(benchmark_repeat_count, 3000)
 		{
@@ -226,6 +1725,11 @@ void benchmark_run()
 			sim->air->UpdateAirHeat(sim->gravityMode == 0);
 		}
 		BENCHMARK_END()
+
+#ifdef LUACONSOLE
+		if (!benchmark_headless)
+			benchmark_lua_elements(sim, vid_buf);
+#endif
 	}
 	free(vid_buf);
 }
@@ -7,6 +7,9 @@
 #include <iostream>
 #include <iterator>
 #include <zlib.h>
+#ifdef X86_SSE2
+#include <emmintrin.h>
+#endif
 #include <cstdio>
 #include "Format.h"
 #include "graphics/Pixel.h"
@@ -288,7 +291,7 @@ public:
 	~PngException() throw() {}
 };
 
-std::vector<char> Format::VideoBufferToPNG(const gfx::VideoBuffer & vidBuf)
+std::vector<char> Format::VideoBufferToPNG(const gfx::VideoBuffer & vidBuf, int level)
 {
 	int width = vidBuf.GetWidth();
 	int height = vidBuf.GetHeight();
@@ -324,33 +327,40 @@ std::vector<char> Format::VideoBufferToPNG(const gfx::VideoBuffer & vidBuf)
 	int dataPos = 0;
 	unsigned char * uncompressedData = new unsigned char[(width*height*3)+height];
 
-	//Byte ordering and filtering
-	unsigned char * previousRow = new unsigned char[width*3];
-	std::fill(previousRow, previousRow+(width*3), 0);
-	unsigned char * currentRow = new unsigned char[width*3];
+	//Byte ordering and filtering, Up filter: every byte minus the one above it
 	for(int y = 0; y < height; y++)
 	{
-		int rowPos = 0;
-		for(int x = 0; x < width; x++)
+		const pixel *row = vid + y*width;
+		const pixel *above = y ? row - width : nullptr;
+		uncompressedData[dataPos++] = 2; //Up Sub(x) filter 
+		int x = 0;
+#ifdef X86_SSE2
+		// a bytewise subtraction of whole pixels filters all three channels at once
+		if (above)
 		{
-			currentRow[rowPos++] = PIXR(vid[(y*width)+x]);
-			currentRow[rowPos++] = PIXG(vid[(y*width)+x]);
-			currentRow[rowPos++] = PIXB(vid[(y*width)+x]);
+			alignas(16) pixel filtered[4];
+			for(; x + 4 <= width; x += 4)
+			{
+				__m128i current = _mm_loadu_si128((const __m128i *)(row + x));
+				__m128i previous = _mm_loadu_si128((const __m128i *)(above + x));
+				_mm_store_si128((__m128i *)filtered, _mm_sub_epi8(current, previous));
+				for(int k = 0; k < 4; k++)
+				{
+					uncompressedData[dataPos++] = PIXR(filtered[k]);
+					uncompressedData[dataPos++] = PIXG(filtered[k]);
+					uncompressedData[dataPos++] = PIXB(filtered[k]);
+				}
+			}
 		}
-
-		uncompressedData[dataPos++] = 2; //Up Sub(x) filter 
-		for(int b = 0; b < rowPos; b++)
+#endif
+		for(; x < width; x++)
 		{
-			int filteredByte = (currentRow[b]-previousRow[b])&0xFF;
-			uncompressedData[dataPos++] = filteredByte;
+			pixel previous = above ? above[x] : 0;
+			uncompressedData[dataPos++] = (PIXR(row[x])-PIXR(previous))&0xFF;
+			uncompressedData[dataPos++] = (PIXG(row[x])-PIXG(previous))&0xFF;
+			uncompressedData[dataPos++] = (PIXB(row[x])-PIXB(previous))&0xFF;
 		}
-
-		unsigned char * tempRow = previousRow;
-		previousRow = currentRow;
-		currentRow = tempRow;
 	}
-	delete[] currentRow;
-	delete[] previousRow;
 
 	//Compression
 	int compressedBufferSize = (width*height*3)*2;
@@ -363,7 +373,7 @@ std::vector<char> Format::VideoBufferToPNG(const gfx::VideoBuffer & vidBuf)
     zipStream.opaque = Z_NULL;
 
     result = deflateInit2(&zipStream,
-            9,              // level
+            level,          // level
             Z_DEFLATED,     // method
             10,             // windowBits
             1,              // memLevel
@@ -34,7 +34,8 @@ namespace Format
 	std::string UnixtimeToDateMini(time_t unixtime);
 	std::string CleanString(std::string dirtyString, bool ascii, bool color, bool newlines, bool numeric = false);
 	std::string CleanString(const char * dirtyData, bool ascii, bool color, bool newlines, bool numeric = false);
-	std::vector<char> VideoBufferToPNG(const gfx::VideoBuffer & vidBuf);
+	// level is the zlib compression level, lower is faster
+	std::vector<char> VideoBufferToPNG(const gfx::VideoBuffer & vidBuf, int level = 9);
 	std::vector<char> VideoBufferToBMP(const gfx::VideoBuffer & vidBuf);
 	std::vector<char> VideoBufferToPPM(const gfx::VideoBuffer & vidBuf);
 	std::vector<char> VideoBufferToPTI(const gfx::VideoBuffer & vidBuf);
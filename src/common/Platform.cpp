@@ -11,6 +11,7 @@
 
 #ifdef WIN
 #include "game/RequestManager.h"
+#include "game/ThumbnailCache.h"
 #include <direct.h>
 #include <shlobj.h>
 #include <shlwapi.h>
@@ -136,6 +137,7 @@ void DoRestart(bool saveTab, bool disableSignals)
 		{
 #ifndef NOHTTP
 			RequestManager::Ref().Shutdown();
+			ThumbnailCache::Ref().Shutdown();
 #endif
 		}
 #elif defined(LIN) || defined(MACOSX)
@@ -616,6 +618,23 @@ bool FileExists(std::string filename)
 	}
 }
 
+bool FileInfo(std::string filename, long *size, long long *modified)
+{
+#ifdef WIN
+	struct _stat s;
+	if (_stat(filename.c_str(), &s) != 0)
+#else
+	struct stat s;
+	if (stat(filename.c_str(), &s) != 0)
+#endif
+		return false;
+	if (size)
+		*size = (long)s.st_size;
+	if (modified)
+		*modified = (long long)s.st_mtime;
+	return true;
+}
+
 bool DirectoryExists(std::string directory)
 {
 #ifdef WIN
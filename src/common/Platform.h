@@ -22,6 +22,8 @@ namespace Platform
 
 	bool Stat(std::string filename);
 	bool FileExists(std::string filename);
+	// size in bytes and modification time in seconds, returns false if the file doesn't exist
+	bool FileInfo(std::string filename, long *size, long long *modified);
 	bool DirectoryExists(std::string directory);
 
 	/**
@@ -16,6 +16,7 @@
 #include <numeric>
 #include <cstdlib>
 #include "Probability.h"
+#include "tpt-rand.h"
 
 namespace Probability
 {
@@ -61,4 +62,9 @@ unsigned int SmallKBinomialGenerator::calc(float randFloat)
 	return maxK;
 }
 
+unsigned int SmallKBinomialGenerator::calc(CounterRNG &rng)
+{
+	return calc(rng.uniform01());
+}
+
 }
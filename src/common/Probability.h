@@ -20,6 +20,8 @@
 
 #include <cmath>
 
+class CounterRNG;
+
 namespace Probability
 {
 	// X ~ binomial(n,p), returns P(X>=1)
@@ -38,6 +40,8 @@ namespace Probability
 		SmallKBinomialGenerator(unsigned int n, float p, unsigned int maxK_);
 		~SmallKBinomialGenerator();
 		unsigned int calc(float randFloat);
+		// Same, drawing the float from rng
+		unsigned int calc(CounterRNG &rng);
 	};
 }
 
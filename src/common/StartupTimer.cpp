@@ -0,0 +1,30 @@
+#include "StartupTimer.h"
+
+void StartupTimer::EndPhase()
+{
+	clock::time_point now = clock::now();
+	if (current.length())
+		phases.push_back({ current, std::chrono::duration<double, std::milli>(now - phaseStart).count() });
+	current.clear();
+	phaseStart = now;
+}
+
+void StartupTimer::Phase(const std::string &name)
+{
+	EndPhase();
+	current = name;
+}
+
+void StartupTimer::Finish()
+{
+	EndPhase();
+}
+
+void StartupTimer::Report(FILE *out)
+{
+	double total = std::chrono::duration<double, std::milli>(phaseStart - start).count();
+	fprintf(out, "Startup phases:\n");
+	for (PhaseTime &phase : phases)
+		fprintf(out, "  %-28s %9.2f ms %5.1f%%\n", phase.name.c_str(), phase.ms, total > 0.0 ? phase.ms / total * 100.0 : 0.0);
+	fprintf(out, "  %-28s %9.2f ms\n", "total", total);
+}
@@ -0,0 +1,36 @@
+#ifndef STARTUPTIMER_H
+#define STARTUPTIMER_H
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "common/Singleton.h"
+
+// Startup split into named phases, each one timed. main calls Phase whenever it moves on to the next part of
+// startup and Finish just before the first frame (or the benchmark). The report is printed with the
+// "startup-report" argument, and always in benchmark mode
+class StartupTimer : public Singleton<StartupTimer>
+{
+	typedef std::chrono::steady_clock clock;
+
+	struct PhaseTime
+	{
+		std::string name;
+		double ms;
+	};
+	std::vector<PhaseTime> phases;
+	std::string current;
+	clock::time_point start = clock::now();
+	clock::time_point phaseStart = start;
+
+	void EndPhase();
+
+public:
+	// ends the current phase, if there is one, and starts timing name
+	void Phase(const std::string &name);
+	void Finish();
+	void Report(FILE *out);
+};
+
+#endif // STARTUPTIMER_H
@@ -0,0 +1,166 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = DefaultThreadCount();
+	for (int i = 0; i < threadCount; i++)
+		threads.push_back(std::thread([this]() { Worker(); }));
+}
+
+WorkerPool::~WorkerPool()
+{
+	Shutdown();
+}
+
+int WorkerPool::DefaultThreadCount()
+{
+	int cores = std::thread::hardware_concurrency();
+	if (cores > 8)
+		cores = 8;
+	return cores > 1 ? cores - 1 : 1;
+}
+
+WorkerPool & WorkerPool::Shared()
+{
+	static WorkerPool pool;
+	return pool;
+}
+
+void WorkerPool::Worker()
+{
+	while (true)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> l(jobMutex);
+			jobCv.wait(l, [this]() { return shuttingDown || !jobs.empty(); });
+			if (shuttingDown)
+				return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+			busy++;
+		}
+
+		job.run();
+
+		{
+			std::lock_guard<std::mutex> g(jobMutex);
+			busy--;
+			Finished(job.group);
+		}
+		idleCv.notify_all();
+	}
+}
+
+// with jobMutex held
+void WorkerPool::Finished(Group *group)
+{
+	if (group)
+		group->outstanding--;
+}
+
+void WorkerPool::Enqueue(Job job, bool front)
+{
+	{
+		std::lock_guard<std::mutex> g(jobMutex);
+		if (!shuttingDown)
+		{
+			if (job.group)
+				job.group->outstanding++;
+			if (front)
+				jobs.push_front(std::move(job));
+			else
+				jobs.push_back(std::move(job));
+			job.run = nullptr;
+		}
+	}
+	// nothing would ever run it after shutdown, and whoever pushed it may be waiting for it
+	if (job.run)
+		job.run();
+	else
+		jobCv.notify_one();
+}
+
+void WorkerPool::Push(std::function<void()> job, Group *group)
+{
+	Enqueue({ std::move(job), group }, false);
+}
+
+void WorkerPool::PushFront(std::function<void()> job, Group *group)
+{
+	Enqueue({ std::move(job), group }, true);
+}
+
+void WorkerPool::Clear()
+{
+	std::lock_guard<std::mutex> g(jobMutex);
+	for (Job &job : jobs)
+		Finished(job.group);
+	jobs.clear();
+	idleCv.notify_all();
+}
+
+void WorkerPool::Clear(Group *group)
+{
+	std::lock_guard<std::mutex> g(jobMutex);
+	for (auto iter = jobs.begin(); iter != jobs.end();)
+	{
+		if (iter->group == group)
+		{
+			Finished(group);
+			iter = jobs.erase(iter);
+		}
+		else
+			++iter;
+	}
+	idleCv.notify_all();
+}
+
+void WorkerPool::Wait()
+{
+	std::unique_lock<std::mutex> l(jobMutex);
+	idleCv.wait(l, [this]() { return shuttingDown || (jobs.empty() && !busy); });
+}
+
+void WorkerPool::Wait(Group *group)
+{
+	std::unique_lock<std::mutex> l(jobMutex);
+	while (group->outstanding)
+	{
+		auto iter = jobs.begin();
+		while (iter != jobs.end() && iter->group != group)
+			++iter;
+		if (iter == jobs.end())
+		{
+			idleCv.wait(l);
+			continue;
+		}
+
+		Job job = std::move(*iter);
+		jobs.erase(iter);
+		l.unlock();
+		job.run();
+		l.lock();
+		Finished(group);
+		idleCv.notify_all();
+	}
+}
+
+void WorkerPool::Shutdown()
+{
+	{
+		std::lock_guard<std::mutex> g(jobMutex);
+		if (shuttingDown)
+			return;
+		shuttingDown = true;
+		for (Job &job : jobs)
+			Finished(job.group);
+		jobs.clear();
+	}
+	jobCv.notify_all();
+	idleCv.notify_all();
+	for (auto &thread : threads)
+		thread.join();
+	threads.clear();
+}
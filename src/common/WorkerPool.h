@@ -0,0 +1,69 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of background threads that run queued jobs in FIFO order
+// Jobs must not touch the simulation or draw to the screen, hand results back to the main thread instead
+class WorkerPool
+{
+public:
+	// Jobs pushed with a group can be cleared and waited for without affecting anyone else's jobs, which is how
+	// everything shares the one pool from Shared(). Must outlive its jobs
+	class Group
+	{
+		int outstanding = 0;
+		friend class WorkerPool;
+	};
+
+private:
+	struct Job
+	{
+		std::function<void()> run;
+		Group *group;
+	};
+
+	std::vector<std::thread> threads;
+	std::deque<Job> jobs;
+	std::mutex jobMutex;
+	std::condition_variable jobCv;
+	std::condition_variable idleCv;
+	int busy = 0;
+	bool shuttingDown = false;
+
+	void Worker();
+	void Finished(Group *group);
+	void Enqueue(Job job, bool front);
+
+public:
+	// threadCount of 0 uses DefaultThreadCount()
+	WorkerPool(int threadCount = 0);
+	~WorkerPool();
+
+	void Push(std::function<void()> job, Group *group = nullptr);
+	// Push a job ahead of everything else that is queued
+	void PushFront(std::function<void()> job, Group *group = nullptr);
+	// Drop all jobs that haven't started yet
+	void Clear();
+	// Drop the group's jobs that haven't started yet
+	void Clear(Group *group);
+	// Block until the queue is empty and no job is running
+	void Wait();
+	// Block until all of the group's jobs have finished. Queued ones are run on the calling thread meanwhile,
+	// so a job can wait for jobs it pushed itself
+	void Wait(Group *group);
+	void Shutdown();
+	int ThreadCount() { return threads.size(); }
+
+	// One less than the number of cores (leaving one for the main thread), but at least one
+	static int DefaultThreadCount();
+	// The pool background work goes on, so there is only one set of idle threads
+	static WorkerPool & Shared();
+};
+
+#endif
@@ -1,6 +1,10 @@
 #include "tpt-rand.h"
+#include <algorithm>
 #include <cstdlib>
 #include <ctime>
+#ifdef X86_SSE2
+#include <emmintrin.h>
+#endif
 
 /* xoroshiro128+ by David Blackman and Sebastiano Vigna */
 
@@ -58,3 +62,167 @@ void RNG::seed(unsigned int sd)
 }
 
 RNG random_gen;
+
+RNG& RNG::Graphics()
+{
+	static thread_local RNG instance;
+	return instance;
+}
+
+/* Philox4x32-10 by John Salmon, Mark Moraes, Ron Dror and David Shaw */
+
+static inline uint32_t mulhilo(uint32_t a, uint32_t b, uint32_t &hi)
+{
+	uint64_t product = static_cast<uint64_t>(a) * b;
+	hi = static_cast<uint32_t>(product >> 32);
+	return static_cast<uint32_t>(product);
+}
+
+void CounterRNG::Philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+{
+	uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+	uint32_t k0 = key[0], k1 = key[1];
+	for (int round = 0; round < 10; round++)
+	{
+		uint32_t hi0, hi1;
+		uint32_t lo0 = mulhilo(0xD2511F53, c0, hi0);
+		uint32_t lo1 = mulhilo(0xCD9E8D57, c2, hi1);
+		c0 = hi1 ^ c1 ^ k0;
+		c1 = lo1;
+		c2 = hi0 ^ c3 ^ k1;
+		c3 = lo0;
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+CounterRNG::CounterRNG(uint32_t seed, uint32_t site, uint32_t tick, uint32_t stream):
+	tick(tick),
+	stream(stream)
+{
+	key[0] = seed;
+	key[1] = site;
+}
+
+// Philox on several counters at once, same output as calling CounterRNG::Philox for blocks firstBlock to
+// firstBlock+philoxLanes-1 in turn
+static const int philoxLanes = CounterRNG::batchBlocks;
+
+#ifdef X86_SSE2
+// Each vector holds two blocks, one word of each in the low half of a 64 bit lane. _mm_mul_epu32 only reads
+// those halves and gives the full product back in the same lane, low word where the next round wants it and high
+// word one shift away, so nothing has to be shuffled between rounds. Three vectors per word keeps everything in
+// registers with enough independent multiplies in flight to hide their latency
+static void philox_lanes(uint32_t firstBlock, uint32_t stream, uint32_t tick, const uint32_t key[2], uint32_t out[philoxLanes * 4])
+{
+	static_assert(philoxLanes % 2 == 0, "philox_lanes does two blocks per vector");
+	const int vectors = philoxLanes / 2;
+	const __m128i m0 = _mm_set1_epi32(0xD2511F53), m1 = _mm_set1_epi32(0xCD9E8D57);
+	__m128i c0[vectors], c1[vectors], c2[vectors], c3[vectors];
+	for (int v = 0; v < vectors; v++)
+	{
+		uint32_t block = firstBlock + v * 2;
+		c0[v] = _mm_set_epi32(0, block + 1, 0, block);
+		c1[v] = _mm_set1_epi32(stream);
+		c2[v] = _mm_set1_epi32(tick);
+		c3[v] = _mm_setzero_si128();
+	}
+	uint32_t k0 = key[0], k1 = key[1];
+	for (int round = 0; round < 10; round++)
+	{
+		__m128i vk0 = _mm_set1_epi32(k0), vk1 = _mm_set1_epi32(k1);
+		for (int v = 0; v < vectors; v++)
+		{
+			__m128i product0 = _mm_mul_epu32(c0[v], m0), product1 = _mm_mul_epu32(c2[v], m1);
+			c0[v] = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi64(product1, 32), c1[v]), vk0);
+			c1[v] = product1;
+			c2[v] = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi64(product0, 32), c3[v]), vk1);
+			c3[v] = product0;
+		}
+		k0 += 0x9E3779B9;
+		k1 += 0xBB67AE85;
+	}
+	// gather the low halves, so each block's four words are next to each other
+	for (int v = 0; v < vectors; v++)
+	{
+		__m128i t0 = _mm_unpacklo_epi32(c0[v], c1[v]), t1 = _mm_unpacklo_epi32(c2[v], c3[v]);
+		__m128i t2 = _mm_unpackhi_epi32(c0[v], c1[v]), t3 = _mm_unpackhi_epi32(c2[v], c3[v]);
+		_mm_storeu_si128((__m128i *)&out[v * 8], _mm_unpacklo_epi64(t0, t1));
+		_mm_storeu_si128((__m128i *)&out[v * 8 + 4], _mm_unpacklo_epi64(t2, t3));
+	}
+}
+#else
+static void philox_lanes(uint32_t firstBlock, uint32_t stream, uint32_t tick, const uint32_t key[2], uint32_t out[philoxLanes * 4])
+{
+	for (int l = 0; l < philoxLanes; l++)
+	{
+		uint32_t counter[4] = { firstBlock + l, stream, tick, 0 };
+		CounterRNG::Philox(counter, key, &out[l * 4]);
+	}
+}
+#endif
+
+// Position n is word n%4 of block n/4. Most users only take a few values, so the first block is computed on
+// its own, after that a full batch is computed whenever the buffer runs out
+void CounterRNG::Refill()
+{
+	if (nextBlock == 0)
+	{
+		uint32_t counter[4] = { 0, stream, tick, 0 };
+		Philox(counter, key, buffer);
+		nextBlock = 1;
+		available = 4;
+	}
+	else
+	{
+		philox_lanes(nextBlock, stream, tick, key, buffer);
+		nextBlock += philoxLanes;
+		available = philoxLanes * 4;
+	}
+	used = 0;
+}
+
+template<typename T, typename Convert>
+static void philox_fill(const uint32_t key[2], uint32_t stream, uint32_t tick, T *out, size_t count, uint32_t first, Convert convert)
+{
+	uint32_t words[philoxLanes * 4];
+	uint32_t block = first >> 2;
+	unsigned int skip = first & 3;
+	size_t i = 0;
+	while (i < count)
+	{
+		unsigned int available;
+		if (skip + (count - i) >= philoxLanes * 4)
+		{
+			philox_lanes(block, stream, tick, key, words);
+			block += philoxLanes;
+			available = philoxLanes * 4;
+		}
+		else
+		{
+			uint32_t counter[4] = { block, stream, tick, 0 };
+			CounterRNG::Philox(counter, key, words);
+			block++;
+			available = 4;
+		}
+		unsigned int end = static_cast<unsigned int>(std::min<size_t>(available, skip + (count - i)));
+		for (unsigned int w = skip; w < end; w++)
+			out[i + w - skip] = convert(words[w]);
+		i += end - skip;
+		skip = 0;
+	}
+}
+
+void CounterRNG::Fill(unsigned int *out, size_t count, uint32_t first) const
+{
+	philox_fill(key, stream, tick, out, count, first, [](uint32_t word) { return word & 0x7FFFFFFF; });
+}
+
+void CounterRNG::FillUniform01(float *out, size_t count, uint32_t first) const
+{
+	philox_fill(key, stream, tick, out, count, first, [](uint32_t word) { return static_cast<float>(word) / static_cast<float>(0xFFFFFFFF); });
+}
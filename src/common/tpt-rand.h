@@ -1,6 +1,7 @@
 #ifndef TPT_RAND_
 #define TPT_RAND_
 
+#include <cstddef>
 #include <stdint.h>
 #include "Singleton.h"
 
@@ -18,6 +19,69 @@ public:
 
 	RNG();
 	void seed(unsigned int sd);
+
+	// Separate generator for element graphics functions, one per thread. They may run on the render thread,
+	// and drawing shouldn't change the simulation's random sequence anyway
+	static RNG& Graphics();
+};
+
+// Counter-based generator (Philox4x32-10, Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+// Every value is a pure function of the key (seed, call site) and the counter (tick, stream, position), so
+// there's no shared state to fight over: whichever thread asks, in whatever order, the numbers are the same.
+// Simulation::ParticleRNG hands out one keyed by the particle index as the stream. Element code still uses RNG,
+// which is faster per call when only a few values are drawn from each stream
+class CounterRNG
+{
+public:
+	// Philox blocks computed at once by Fill, and by gen() and friends once the first block is used up
+	static const int batchBlocks = 6;
+
+private:
+	uint32_t key[2];
+	uint32_t tick, stream;
+	// the next block to compute, and the words of the last ones that haven't been handed out yet
+	uint32_t nextBlock = 0;
+	unsigned int used = 0, available = 0;
+	uint32_t buffer[batchBlocks * 4];
+
+	void Refill();
+	uint32_t next()
+	{
+		if (used == available)
+			Refill();
+		return buffer[used++];
+	}
+
+public:
+	CounterRNG(uint32_t seed, uint32_t site, uint32_t tick, uint32_t stream);
+
+	// same ranges as RNG, inline since they're usually called once per particle in a tight loop
+	unsigned int gen()
+	{
+		return next() & 0x7FFFFFFF;
+	}
+	int between(int lower, int upper)
+	{
+		unsigned int r = next();
+		return static_cast<int>(r % (upper - lower + 1)) + lower;
+	}
+	bool chance(int nominator, unsigned int denominator)
+	{
+		if (nominator < 0)
+			return false;
+		return next() % denominator < static_cast<unsigned int>(nominator);
+	}
+	float uniform01()
+	{
+		return static_cast<float>(next()) / static_cast<float>(0xFFFFFFFF);
+	}
+
+	// Batch interface, out[i] is what gen() / uniform01() would return as the (first + i)th call.
+	// Doesn't move this generator's position, so disjoint slices can be filled on different threads
+	void Fill(unsigned int *out, size_t count, uint32_t first = 0) const;
+	void FillUniform01(float *out, size_t count, uint32_t first = 0) const;
+
+	static void Philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
 };
 
 #endif /* TPT_RAND_ */
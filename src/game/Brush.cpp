@@ -8,6 +8,7 @@ bool perfectCircleBrush = false;
 
 void Brush::GenerateBitmap()
 {
+	shapeGenerated = false;
 	if (bitmap)
 		delete[] bitmap;
 	int sizeX = radius.X + radius.X + 1;
@@ -54,6 +55,58 @@ void Brush::GenerateBitmap()
 	}
 }
 
+// Same walk as CreateParts used to do on every call: along the left half, each column's top moves up while it's
+// still inside the brush. The filled part of a column is between its top and its mirror image (or the bottom row
+// for triangles), not including either
+void Brush::GenerateShape()
+{
+	shapeGenerated = true;
+	generatedPerfectCircle = perfectCircleBrush;
+	spans.clear();
+	columnTops.clear();
+	int rx = radius.X, ry = radius.Y;
+	if (rx <= 0)
+		return;
+
+	int top = shape == TRI_BRUSH ? ry : -1;
+	for (int i = -rx; i <= 0; i++)
+	{
+		while (top >= -ry && IsInside(i, top))
+			top--;
+		columnTops.push_back(top);
+	}
+
+	for (int y = -ry; y <= ry; y++)
+	{
+		int runStart = 0;
+		bool inRun = false;
+		for (int i = -rx; i <= 1; i++)
+		{
+			bool inside = false;
+			if (i <= 0)
+			{
+				int top = columnTops[i + rx], bottom = shape == TRI_BRUSH ? ry : -top;
+				inside = y > top && y < bottom;
+			}
+			if (inside && !inRun)
+				runStart = i;
+			else if (!inside && inRun)
+			{
+				int runEnd = i - 1;
+				// runs that reach the centre column join up with their mirror image
+				if (runEnd == 0)
+					spans.push_back({ y, runStart, -runStart });
+				else
+				{
+					spans.push_back({ y, runStart, runEnd });
+					spans.push_back({ y, -runEnd, -runStart });
+				}
+			}
+			inRun = inside;
+		}
+	}
+}
+
 // May return true for coordinates NOT inside the brush's radius, in the case of perfect circle brush. This happens for points on each axis
 bool Brush::IsInside(int x, int y)
 {
@@ -1,12 +1,21 @@
 #ifndef BRUSH_H
 #define BRUSH_H
 
+#include <vector>
 #include "common/Point.h"
 
 enum { CIRCLE_BRUSH, SQUARE_BRUSH, TRI_BRUSH};
 #define BRUSH_NUM 3
 
-//TODO: maybe use bitmaps for actual drawing and support tpt++ custom brushes?
+// One row of a brush's filled area, relative to the brush centre
+struct BrushSpan
+{
+	int y, x1, x2;
+};
+
+//TODO: support tpt++ custom brushes?
+extern bool perfectCircleBrush;
+
 class Brush
 {
 	Point radius;
@@ -15,7 +24,21 @@ class Brush
 	// in the future, actual brushes and custom brushes can be stored in here
 	bool * bitmap;
 
+	// What CreateParts draws, worked out the first time it's needed after a change instead of on every click
+	// spans: the filled area, for a single click and for lines
+	// columnTops: the top of column x-radius.X .. x, just above the brush, which the outline walk uses
+	std::vector<BrushSpan> spans;
+	std::vector<int> columnTops;
+	bool shapeGenerated = false;
+	bool generatedPerfectCircle = false;
+
 	void GenerateBitmap();
+	void GenerateShape();
+	void CheckShape()
+	{
+		if (!shapeGenerated || (shape == CIRCLE_BRUSH && generatedPerfectCircle != perfectCircleBrush))
+			GenerateShape();
+	}
 
 public:
 	Brush(Point radius_, int shape_) :
@@ -35,9 +58,12 @@ public:
 	int GetShape() { return shape; }
 	bool * GetBitmap() { return bitmap; }
 	bool IsInside(int x, int y);
+
+	// Only for radius.X > 0, CreateParts draws a single column otherwise
+	const std::vector<BrushSpan> & GetSpans() { CheckShape(); return spans; }
+	int GetColumnTop(int column) { CheckShape(); return columnTops[column + radius.X]; }
 };
 
 extern Brush *currentBrush;
-extern bool perfectCircleBrush;
 
 #endif
@@ -1,8 +1,11 @@
 #include "Request.h"
+#include <algorithm>
 #ifndef NOHTTP
+#include <atomic>
 #include "defines.h"
 #include <curl/curl.h>
 #include "RequestManager.h"
+#include "ResponseCache.h"
 #include "common/Platform.h"
 
 
@@ -18,6 +21,16 @@
 # define REQUEST_USE_CURL_TLSV13CL
 #endif
 
+#if defined(CURL_AT_LEAST_VERSION) && CURL_AT_LEAST_VERSION(7, 43, 0)
+# define REQUEST_USE_CURL_PIPEWAIT
+#endif
+
+#if defined(CURL_AT_LEAST_VERSION) && CURL_AT_LEAST_VERSION(7, 47, 0)
+# define REQUEST_USE_CURL_HTTP2TLS
+#endif
+
+static std::atomic<unsigned long> request_sequence(0);
+
 void SetupCurlEasyCiphers(CURL *easy)
 {
 #ifdef SECURE_CIPHERS_ONLY
@@ -49,6 +62,12 @@ void SetupCurlEasyCiphers(CURL *easy)
 
 Request::Request(std::string uri_):
 	uri(uri_),
+	priority(PRIORITY_NORMAL),
+	sequence(request_sequence++),
+	use_cache(false),
+	cache_revalidating(false),
+	cache_bypass(false),
+	has_auth(false),
 	rm_total(0),
 	rm_done(0),
 	rm_finished(false),
@@ -57,6 +76,7 @@ Request::Request(std::string uri_):
 	added_to_multi(false),
 	status(0),
 	headers(NULL),
+	conditional_headers(NULL),
 #ifdef REQUEST_USE_CURL_MIMEPOST
 	post_fields(NULL)
 #else
@@ -86,6 +106,7 @@ Request::~Request()
 	curl_formfree(post_fields_first);
 #endif
 	curl_slist_free_all(headers);
+	curl_slist_free_all(conditional_headers);
 	delete[] error_buffer;
 #endif
 }
@@ -97,6 +118,20 @@ void Request::AddHeader(std::string name, std::string value)
 #endif
 }
 
+void Request::SetPriority(RequestPriority newPriority)
+{
+#ifndef NOHTTP
+	std::lock_guard<std::mutex> g(rm_mutex);
+	priority = newPriority;
+#endif
+}
+
+// keep a copy of the response on disk and revalidate it with a conditional request next time
+void Request::UseCache()
+{
+	use_cache = true;
+}
+
 // add post data to a request
 void Request::AddPostData(std::map<std::string, std::string> data)
 {
@@ -141,6 +176,8 @@ void Request::AuthHeaders(std::string ID, std::string session)
 {
 	if (ID.size())
 	{
+		// the responses can be private to this user, so they must not end up in the shared disk cache
+		has_auth = true;
 		if (session.size())
 		{
 			AddHeader("X-Auth-User-Id", ID);
@@ -161,6 +198,66 @@ size_t Request::WriteDataHandler(char *ptr, size_t size, size_t count, void *use
 	return actual_size;
 }
 
+size_t Request::HeaderDataHandler(char *ptr, size_t size, size_t count, void *userdata)
+{
+	Request *req = (Request *)userdata;
+	auto actual_size = size * count;
+	std::string header(ptr, actual_size);
+	while (header.size() && (header.back() == '\r' || header.back() == '\n'))
+		header.pop_back();
+
+	// A new status line means a redirect or 100-continue, only the final response counts
+	if (!header.compare(0, 5, "HTTP/"))
+	{
+		req->response_etag.clear();
+		req->response_last_modified.clear();
+		return actual_size;
+	}
+	size_t colonPos = header.find(':');
+	if (colonPos == header.npos)
+		return actual_size;
+	std::string name = header.substr(0, colonPos);
+	std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+	size_t valuePos = header.find_first_not_of(" \t", colonPos + 1);
+	std::string value = valuePos == header.npos ? "" : header.substr(valuePos);
+	if (name == "etag")
+		req->response_etag = value;
+	else if (name == "last-modified")
+		req->response_last_modified = value;
+	return actual_size;
+}
+
+// turn this into a conditional request if there is a cached copy of the response
+void Request::AddCacheValidators()
+{
+#ifndef NOHTTP
+	std::string etag, lastModified;
+	if (cache_bypass || !ResponseCache::Ref().GetValidators(uri, etag, lastModified))
+		return;
+	for (struct curl_slist *header = headers; header; header = header->next)
+		conditional_headers = curl_slist_append(conditional_headers, header->data);
+	if (etag.size())
+		conditional_headers = curl_slist_append(conditional_headers, ("If-None-Match: " + etag).c_str());
+	if (lastModified.size())
+		conditional_headers = curl_slist_append(conditional_headers, ("If-Modified-Since: " + lastModified).c_str());
+	curl_easy_setopt(easy, CURLOPT_HTTPHEADER, conditional_headers);
+	cache_revalidating = true;
+#endif
+}
+
+// back to a plain request, for when the server said our copy is fine but it can't be read any more
+void Request::DropCacheValidators()
+{
+#ifndef NOHTTP
+	curl_easy_setopt(easy, CURLOPT_HTTPHEADER, headers);
+	curl_slist_free_all(conditional_headers);
+	conditional_headers = NULL;
+	cache_revalidating = false;
+	cache_bypass = true;
+	response_body.clear();
+#endif
+}
+
 // start the request thread
 void Request::Start()
 {
@@ -172,6 +269,15 @@ void Request::Start()
 
 	if (easy)
 	{
+#ifdef REQUEST_USE_CURL_MIMEPOST
+		bool isGet = !post_fields;
+#else
+		bool isGet = post_fields_map.empty();
+#endif
+		// the cache entry itself is read on the request thread, see AddCacheValidators
+		if (!isGet || has_auth)
+			use_cache = false;
+
 #ifdef REQUEST_USE_CURL_MIMEPOST
 		if (post_fields)
 		{
@@ -242,6 +348,20 @@ void Request::Start()
 
 		curl_easy_setopt(easy, CURLOPT_WRITEDATA, (void *) this);
 		curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, Request::WriteDataHandler);
+		curl_easy_setopt(easy, CURLOPT_HEADERDATA, (void *) this);
+		curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, Request::HeaderDataHandler);
+
+		// Everything goes to a handful of hosts, so share connections as much as possible:
+		// multiplex over HTTP/2 where the server allows it, and keep idle connections alive
+#ifdef REQUEST_USE_CURL_HTTP2TLS
+		curl_easy_setopt(easy, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#endif
+#ifdef REQUEST_USE_CURL_PIPEWAIT
+		curl_easy_setopt(easy, CURLOPT_PIPEWAIT, 1L);
+#endif
+		curl_easy_setopt(easy, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(easy, CURLOPT_TCP_KEEPIDLE, 60L);
+		curl_easy_setopt(easy, CURLOPT_TCP_KEEPINTVL, 30L);
 	}
 
 	{
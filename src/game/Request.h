@@ -14,12 +14,32 @@ struct curl_mime_s;
 struct curl_httppost;
 typedef struct curl_mime_s curl_mime;
 
+// Requests of a higher priority are handed to curl first, the rest wait until a slot is free
+enum RequestPriority
+{
+	PRIORITY_HIGH,
+	PRIORITY_NORMAL,
+	PRIORITY_LOW
+};
+
 class RequestManager;
 class Request
 {
 	std::string uri;
 	std::string response_body;
 
+	RequestPriority priority;
+	unsigned long sequence;
+
+	// conditional request state, see ResponseCache
+	bool use_cache;
+	bool cache_revalidating;
+	// set when a 304 came back but the cached body was gone by then, the request is repeated without validators
+	bool cache_bypass;
+	bool has_auth;
+	std::string response_etag;
+	std::string response_last_modified;
+
 	CURL *easy;
 	char *error_buffer;
 
@@ -34,6 +54,8 @@ class Request
 	int status;
 
 	struct curl_slist *headers;
+	// headers plus If-None-Match / If-Modified-Since, kept apart so they can be dropped again
+	struct curl_slist *conditional_headers;
 
 	curl_mime *post_fields;
 	curl_httppost *post_fields_first, *post_fields_last;
@@ -42,6 +64,10 @@ class Request
 	std::condition_variable done_cv;
 
 	static size_t WriteDataHandler(char * ptr, size_t size, size_t count, void * userdata);
+	static size_t HeaderDataHandler(char * ptr, size_t size, size_t count, void * userdata);
+	// called on the request thread just before the request is handed to curl
+	void AddCacheValidators();
+	void DropCacheValidators();
 
 public:
 	Request(std::string uri);
@@ -50,6 +76,9 @@ public:
 	void AddHeader(std::string name, std::string value);
 	void AddPostData(std::map<std::string, std::string> data);
 	void AuthHeaders(std::string ID, std::string session);
+	// both must be called before Start. Requests with auth headers are never cached
+	void SetPriority(RequestPriority newPriority);
+	void UseCache();
 
 	void Start();
 	std::string Finish(int *status);
@@ -1,14 +1,20 @@
 #ifndef NOHTTP
 #include "RequestManager.h"
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <vector>
 #include <curl/curl.h>
 #include "defines.h"
 #include "Request.h"
+#include "ResponseCache.h"
 #include "common/Platform.h"
 
 const int curl_multi_wait_timeout_ms = 100;
 const long curl_max_host_connections = 6;
+const long curl_max_total_connections = 12;
+// Requests beyond this wait in RequestManager instead of curl's own FIFO queue, so they can be reordered by priority
+const int curl_max_active_requests = 12;
 
 const long timeout = 15;
 std::string proxy;
@@ -41,6 +47,12 @@ void RequestManager::Initialise(std::string Proxy)
 	if (multi)
 	{
 		curl_multi_setopt(multi, CURLMOPT_MAX_HOST_CONNECTIONS, curl_max_host_connections);
+		curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, curl_max_total_connections);
+		// size of the idle connection cache, connections in it are reused by later requests
+		curl_multi_setopt(multi, CURLMOPT_MAXCONNECTS, curl_max_total_connections);
+#if defined(CURL_AT_LEAST_VERSION) && CURL_AT_LEAST_VERSION(7, 43, 0)
+		curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#endif
 	}
 
 	proxy = Proxy;
@@ -63,6 +75,8 @@ void RequestManager::Initialise(std::string Proxy)
 
 void RequestManager::Worker()
 {
+	ResponseCache::Ref().Init();
+
 	bool shutting_down = false;
 	while (!shutting_down)
 	{
@@ -144,6 +158,26 @@ void RequestManager::Worker()
 					{
 						std::cerr << "Http status code " << finish_with << ": " << request->error_buffer << std::endl;
 					}
+					else if (request->use_cache)
+					{
+						if (finish_with == 304 && request->cache_revalidating)
+						{
+							// Our copy is still good, pretend the server sent it again. If it was pruned or deleted
+							// since the request went out, ask again for the whole thing. The request goes back to
+							// waiting and is handed to curl again below, the caller never sees the 304
+							if (!ResponseCache::Ref().GetBody(request->uri, request->response_body))
+							{
+								MultiRemove(request);
+								request->DropCacheValidators();
+								continue;
+							}
+							finish_with = 200;
+						}
+						else if (finish_with == 200)
+						{
+							ResponseCache::Ref().Store(request->uri, request->response_etag, request->response_last_modified, request->response_body);
+						}
+					}
 
 					request->status = finish_with;
 				}
@@ -151,6 +185,7 @@ void RequestManager::Worker()
 		}
 
 		std::set<Request *> requests_to_remove;
+		std::vector<Request *> requests_waiting;
 		for (Request *request : requests)
 		{
 			bool signal_done = false;
@@ -169,7 +204,7 @@ void RequestManager::Worker()
 				{
 					if (multi && request->easy)
 					{
-						MultiAdd(request);
+						requests_waiting.push_back(request);
 					}
 					else
 					{
@@ -209,6 +244,24 @@ void RequestManager::Worker()
 				request->done_cv.notify_one();
 			}
 		}
+		// Hand waiting requests to curl, most important and then oldest first
+		std::sort(requests_waiting.begin(), requests_waiting.end(), [](Request *a, Request *b) {
+			if (a->priority != b->priority)
+				return a->priority < b->priority;
+			return a->sequence < b->sequence;
+		});
+		for (Request *request : requests_waiting)
+		{
+			if (requests_added_to_multi >= curl_max_active_requests)
+				break;
+			// only this thread touches the request's headers once it has started, and reading the cache entry
+			// here keeps the disk access off the UI thread
+			if (request->use_cache && !request->cache_revalidating)
+				request->AddCacheValidators();
+			std::lock_guard<std::mutex> g(request->rm_mutex);
+			if (!request->rm_canceled)
+				MultiAdd(request);
+		}
 		for (Request *request : requests_to_remove)
 		{
 			requests.erase(request);
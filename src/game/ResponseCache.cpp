@@ -0,0 +1,155 @@
+#ifndef NOHTTP
+#include "ResponseCache.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "defines.h"
+#include "common/Platform.h"
+
+#define RESPONSE_CACHE_DIR "cache" PATH_SEP "http"
+
+// Entry layout: magic line, then uri, ETag and Last-Modified each on their own line, then the body
+static const char *cacheMagic = "TPTRESP1";
+
+void ResponseCache::Init()
+{
+	Platform::MakeDirectory("cache");
+	Platform::MakeDirectory(RESPONSE_CACHE_DIR);
+	if (!Platform::DirectoryExists(RESPONSE_CACHE_DIR))
+		return;
+	Prune();
+	std::lock_guard<std::mutex> g(cacheMutex);
+	enabled = true;
+}
+
+// Drop the oldest entries until the cache fits in HTTP_CACHE_SIZE
+void ResponseCache::Prune()
+{
+	struct Entry
+	{
+		std::string path;
+		long size;
+		long long modified;
+	};
+	std::vector<Entry> entries;
+	long totalSize = 0;
+	for (auto &file : Platform::DirectorySearch(RESPONSE_CACHE_DIR, "", { ".resp" }))
+	{
+		Entry entry;
+		entry.path = RESPONSE_CACHE_DIR PATH_SEP + file;
+		if (!Platform::FileInfo(entry.path, &entry.size, &entry.modified))
+			continue;
+		entries.push_back(entry);
+		totalSize += entry.size;
+	}
+	if (totalSize <= HTTP_CACHE_SIZE)
+		return;
+
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.modified < b.modified; });
+	for (auto &entry : entries)
+	{
+		if (totalSize <= HTTP_CACHE_SIZE)
+			break;
+		if (Platform::DeleteFile(entry.path))
+			totalSize -= entry.size;
+	}
+}
+
+std::string ResponseCache::CachePath(const std::string &uri)
+{
+	// 64 bit FNV-1a, collisions are caught by comparing the stored uri
+	unsigned long long hash = 14695981039346656037ULL;
+	for (unsigned char c : uri)
+	{
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", hash);
+	return RESPONSE_CACHE_DIR PATH_SEP + std::string(name) + ".resp";
+}
+
+bool ResponseCache::ReadEntry(const std::string &uri, std::string *etag, std::string *lastModified, std::string *body)
+{
+	std::lock_guard<std::mutex> g(cacheMutex);
+	if (!enabled)
+		return false;
+	std::ifstream file(CachePath(uri).c_str(), std::ios::binary);
+	if (!file)
+		return false;
+
+	std::string magic, storedUri, storedEtag, storedLastModified;
+	if (!std::getline(file, magic) || magic != cacheMagic)
+		return false;
+	if (!std::getline(file, storedUri) || storedUri != uri)
+		return false;
+	if (!std::getline(file, storedEtag) || !std::getline(file, storedLastModified))
+		return false;
+	if (storedEtag.empty() && storedLastModified.empty())
+		return false;
+
+	if (etag)
+		*etag = storedEtag;
+	if (lastModified)
+		*lastModified = storedLastModified;
+	if (body)
+	{
+		std::stringstream contents;
+		contents << file.rdbuf();
+		*body = contents.str();
+	}
+	return true;
+}
+
+bool ResponseCache::GetValidators(const std::string &uri, std::string &etag, std::string &lastModified)
+{
+	return ReadEntry(uri, &etag, &lastModified, nullptr);
+}
+
+bool ResponseCache::GetBody(const std::string &uri, std::string &body)
+{
+	return ReadEntry(uri, nullptr, nullptr, &body);
+}
+
+void ResponseCache::Store(const std::string &uri, const std::string &etag, const std::string &lastModified, const std::string &body)
+{
+	// Without a validator the entry could never be used
+	if (etag.empty() && lastModified.empty())
+		return;
+	if (uri.find('\n') != uri.npos || etag.find('\n') != etag.npos || lastModified.find('\n') != lastModified.npos)
+		return;
+
+	std::lock_guard<std::mutex> g(cacheMutex);
+	if (!enabled)
+		return;
+	std::string path = CachePath(uri);
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream file(tempPath.c_str(), std::ios::binary);
+		if (!file)
+			return;
+		file << cacheMagic << "\n" << uri << "\n" << etag << "\n" << lastModified << "\n";
+		file.write(body.c_str(), body.size());
+		if (!file)
+		{
+			file.close();
+			Platform::DeleteFile(tempPath);
+			return;
+		}
+	}
+	// rename won't replace an existing file on windows
+	Platform::DeleteFile(path);
+	if (std::rename(tempPath.c_str(), path.c_str()))
+		Platform::DeleteFile(tempPath);
+}
+
+void ResponseCache::Erase(const std::string &uri)
+{
+	std::lock_guard<std::mutex> g(cacheMutex);
+	if (enabled)
+		Platform::DeleteFile(CachePath(uri));
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef RESPONSECACHE_H
+#define RESPONSECACHE_H
+#ifndef NOHTTP
+
+#include <mutex>
+#include <string>
+#include "common/Singleton.h"
+
+// On-disk cache of GET responses, keyed by URL
+// Entries are never trusted blindly, they are only used to turn a request into a conditional one
+// (If-None-Match / If-Modified-Since) and to fill in the body when the server answers 304
+class ResponseCache : public Singleton<ResponseCache>
+{
+	std::mutex cacheMutex;
+	bool enabled = false;
+
+	std::string CachePath(const std::string &uri);
+	bool ReadEntry(const std::string &uri, std::string *etag, std::string *lastModified, std::string *body);
+	void Prune();
+
+public:
+	// Creates the cache directory and trims it down to size, runs on the request thread
+	void Init();
+
+	bool GetValidators(const std::string &uri, std::string &etag, std::string &lastModified);
+	bool GetBody(const std::string &uri, std::string &body);
+	void Store(const std::string &uri, const std::string &etag, const std::string &lastModified, const std::string &body);
+	void Erase(const std::string &uri);
+};
+
+#endif // NOHTTP
+#endif // RESPONSECACHE_H
@@ -26,6 +26,7 @@
 
 #include "common/Format.h"
 #include "common/Platform.h"
+#include "common/WorkerPool.h"
 #include "simulation/ElementNumbers.h"
 #include "simulation/GolNumbers.h"
 #include "simulation/SimulationData.h"
@@ -2868,6 +2869,61 @@ void Save::Transform(matrix2d transform, vector2d translate)
 	Transform(transform, translate, translateReal, newWidth, newHeight);
 }
 
+// floor(v + 0.5f) as an int, for positions that fit in one
+static inline int round_position(float v)
+{
+	v += 0.5f;
+	int n = (int)v;
+	return n - (v < n);
+}
+
+// Moves particles [start, end) the same way m2d_multiply_v2d and v2d_add would, with the matrix in registers
+void Save::TransformParticleRange(unsigned int start, unsigned int end, matrix2d transform, vector2d translate, int newWidth, int newHeight, bool patchPipe90)
+{
+	for (unsigned int i = start; i < end; i++)
+	{
+		particle &part = particles[i];
+		if (!part.type)
+			continue;
+		int nx = round_position(transform.a*part.x + transform.b*part.y + translate.x);
+		int ny = round_position(transform.c*part.x + transform.d*part.y + translate.y);
+		if (nx<0 || nx>=newWidth || ny<0 || ny>=newHeight)
+		{
+			part.type = PT_NONE;
+			continue;
+		}
+		part.x = nx;
+		part.y = ny;
+		float vx = part.vx, vy = part.vy;
+		part.vx = transform.a*vx + transform.b*vy;
+		part.vy = transform.c*vx + transform.d*vy;
+		if (patchPipe90 && (part.type == PT_PIPE || part.type == PT_PPIP))
+			PIPE_patch90(part);
+	}
+}
+
+// Every particle is moved on its own, so big saves are split into chunks and done on the worker pool
+void Save::TransformParticles(matrix2d transform, vector2d translate, int newWidth, int newHeight, bool patchPipe90)
+{
+	const unsigned int chunkSize = 16384;
+	if (particlesCount <= chunkSize)
+	{
+		TransformParticleRange(0, particlesCount, transform, translate, newWidth, newHeight, patchPipe90);
+		return;
+	}
+
+	WorkerPool &pool = WorkerPool::Shared();
+	WorkerPool::Group chunks;
+	for (unsigned int start = 0; start < particlesCount; start += chunkSize)
+	{
+		unsigned int end = std::min(start + chunkSize, particlesCount);
+		pool.Push([this, start, end, transform, translate, newWidth, newHeight, patchPipe90]() {
+			TransformParticleRange(start, end, transform, translate, newWidth, newHeight, patchPipe90);
+		}, &chunks);
+	}
+	pool.Wait(&chunks);
+}
+
 // transform is a matrix describing how we want to rotate this save
 // translate can vary depending on whether the save is bring rotated, or if a normal translate caused it to expand
 // translateReal is the original amount we tried to translate, used to calculate wall shifting
@@ -2915,28 +2971,7 @@ void Save::Transform(matrix2d transform, vector2d translate, vector2d translateR
 		}
 		signs[i].SetPos(Point(nx, ny));
 	}
-	for (unsigned int i = 0; i < particlesCount; i++)
-	{
-		if (!particles[i].type)
-			continue;
-		vector2d pos = v2d_new(particles[i].x, particles[i].y);
-		pos = v2d_add(m2d_multiply_v2d(transform,pos),translate);
-		int nx = std::floor(pos.x + 0.5f);
-		int ny = std::floor(pos.y + 0.5f);
-		if (nx<0 || nx>=newWidth || ny<0 || ny>=newHeight)
-		{
-			particles[i].type = PT_NONE;
-			continue;
-		}
-		particles[i].x = nx;
-		particles[i].y = ny;
-		vector2d vel = v2d_new(particles[i].vx, particles[i].vy);
-		vel = m2d_multiply_v2d(transform, vel);
-		particles[i].vx = vel.x;
-		particles[i].vy = vel.y;
-		if (patchPipe90 && (particles[i].type == PT_PIPE || particles[i].type == PT_PPIP))
-			PIPE_patch90(particles[i]);
-	}
+	TransformParticles(transform, translate, newWidth, newHeight, patchPipe90);
 
 	// translate walls and other grid items when the stamp is shifted more than 4 pixels in any direction
 	int translateX = 0, translateY = 0;
@@ -2954,10 +2989,14 @@ void Save::Transform(matrix2d transform, vector2d translate, vector2d translateR
 		translateY = -CELL;
 
 	for (unsigned int y = 0; y < blockHeight; y++)
+	{
+		// the y half of the transform only changes once per row
+		float posY = y*CELL+CELL*0.4f+translateY;
+		float rowX = transform.b*posY, rowY = transform.d*posY;
 		for (unsigned int x = 0; x < blockWidth; x++)
 		{
-			vector2d pos = v2d_new(x*CELL+CELL*0.4f+translateX, y*CELL+CELL*0.4f+translateY);
-			pos = v2d_add(m2d_multiply_v2d(transform,pos),translate);
+			float posX = x*CELL+CELL*0.4f+translateX;
+			vector2d pos = v2d_new(transform.a*posX + rowX + translate.x, transform.c*posX + rowY + translate.y);
 			int nx = pos.x/CELL;
 			int ny = pos.y/CELL;
 			if (pos.x<0 || nx>=newBlockWidth || pos.y<0 || ny>=newBlockHeight)
@@ -2978,6 +3017,7 @@ void Save::Transform(matrix2d transform, vector2d translate, vector2d translateR
 			velocityYNew[ny][nx] = velocityY[y][x];
 			ambientHeatNew[ny][nx] = ambientHeat[y][x];
 		}
+	}
 	translated = v2d_add(m2d_multiply_v2d(transform, translated), translateReal);
 
 	for (unsigned int j = 0; j < blockHeight; j++)
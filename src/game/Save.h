@@ -231,6 +231,9 @@ private:
 	void SetSize(int newWidth, int newHeight);
 	void InitVars();
 	
+	void TransformParticleRange(unsigned int start, unsigned int end, Matrix::matrix2d transform, Matrix::vector2d translate, int newWidth, int newHeight, bool patchPipe90);
+	void TransformParticles(Matrix::matrix2d transform, Matrix::vector2d translate, int newWidth, int newHeight, bool patchPipe90);
+
 	template <typename T> static T ** Allocate2DArray(int blockWidth, int blockHeight, T defaultVal);
 	template <typename T> static void Deallocate2DArray(T ***array, int blockHeight);
 
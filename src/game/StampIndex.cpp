@@ -0,0 +1,242 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "StampIndex.h"
+#include "defines.h"
+#include "misc.h"
+#include "powder.h"
+#include "save_legacy.h"
+#include "common/Platform.h"
+
+#define STAMP_INDEX_FILE "stamps" PATH_SEP "stamps.idx"
+
+static const char indexMagic[8] = { 'T', 'P', 'T', 'S', 'T', 'I', 'X', '2' };
+
+static std::string StampPath(const std::string &name)
+{
+	return "stamps" PATH_SEP + name + ".stm";
+}
+
+StampIndex::StampIndex()
+{
+
+}
+
+StampIndex::~StampIndex()
+{
+	Shutdown();
+}
+
+void StampIndex::Load()
+{
+	std::lock_guard<std::mutex> g(indexMutex);
+	if (loaded)
+		return;
+	loaded = true;
+
+	FILE *f = fopen(STAMP_INDEX_FILE, "rb");
+	if (!f)
+		return;
+	char magic[8];
+	unsigned int count;
+	if (fread(magic, 1, 8, f) != 8 || memcmp(magic, indexMagic, 8) || fread(&count, sizeof(count), 1, f) != 1)
+	{
+		fclose(f);
+		return;
+	}
+	for (unsigned int i = 0; i < count; i++)
+	{
+		unsigned char nameLen, failed;
+		char name[256];
+		Entry entry;
+		if (fread(&nameLen, 1, 1, f) != 1 || fread(name, 1, nameLen, f) != nameLen)
+			break;
+		if (fread(&entry.modified, sizeof(entry.modified), 1, f) != 1 || fread(&entry.size, sizeof(entry.size), 1, f) != 1)
+			break;
+		if (fread(&failed, 1, 1, f) != 1 || fread(&entry.w, sizeof(int), 1, f) != 1 || fread(&entry.h, sizeof(int), 1, f) != 1)
+			break;
+		if (entry.w < 0 || entry.h < 0 || entry.w > XRES || entry.h > YRES)
+			break;
+		entry.failed = failed != 0;
+		unsigned int packedSize;
+		if (fread(&packedSize, sizeof(packedSize), 1, f) != 1 || packedSize > (unsigned int)(XRES*YRES*4))
+			break;
+		if (packedSize)
+		{
+			std::vector<char> packed(packedSize);
+			if (fread(&packed[0], 1, packedSize, f) != packedSize)
+				break;
+			int w, h;
+			pixel *thumb = ptif_unpack(&packed[0], packedSize, &w, &h);
+			if (!thumb)
+				continue;
+			if (w == entry.w && h == entry.h)
+				entry.thumb.assign(thumb, thumb + w*h);
+			free(thumb);
+			if (entry.thumb.size() != (size_t)(entry.w * entry.h))
+				continue;
+		}
+		// the thumbnail couldn't be compressed when this was saved, render it again
+		else if (entry.w && entry.h)
+			continue;
+		entries[std::string(name, nameLen)] = std::move(entry);
+	}
+	fclose(f);
+}
+
+void StampIndex::Save()
+{
+	std::lock_guard<std::mutex> g(indexMutex);
+	if (!dirty)
+		return;
+
+	std::string tempFile = STAMP_INDEX_FILE ".tmp";
+	FILE *f = fopen(tempFile.c_str(), "wb");
+	if (!f)
+		return;
+	// thumbnails never leave this machine, so they're stored as fast PTI, all compressed at once on the pool
+	std::vector<PtifImage> packed;
+	for (auto &iter : entries)
+		if (iter.second.thumb.size())
+			packed.push_back({ &iter.second.thumb[0], iter.second.w, iter.second.h, NULL, 0 });
+	ptif_pack_batch(packed, true);
+
+	unsigned int count = entries.size();
+	fwrite(indexMagic, 1, 8, f);
+	fwrite(&count, sizeof(count), 1, f);
+	size_t packedIndex = 0;
+	for (auto &iter : entries)
+	{
+		const Entry &entry = iter.second;
+		unsigned char nameLen = iter.first.size(), failed = entry.failed;
+		fwrite(&nameLen, 1, 1, f);
+		fwrite(iter.first.c_str(), 1, nameLen, f);
+		fwrite(&entry.modified, sizeof(entry.modified), 1, f);
+		fwrite(&entry.size, sizeof(entry.size), 1, f);
+		fwrite(&failed, 1, 1, f);
+		fwrite(&entry.w, sizeof(int), 1, f);
+		fwrite(&entry.h, sizeof(int), 1, f);
+		unsigned int packedSize = 0;
+		void *packedData = NULL;
+		if (entry.thumb.size())
+		{
+			packedData = packed[packedIndex].data;
+			packedSize = packedData ? packed[packedIndex].size : 0;
+			packedIndex++;
+		}
+		fwrite(&packedSize, sizeof(packedSize), 1, f);
+		if (packedSize)
+			fwrite(packedData, 1, packedSize, f);
+	}
+	for (PtifImage &image : packed)
+		free(image.data);
+	bool success = !ferror(f);
+	fclose(f);
+
+	Platform::DeleteFile(STAMP_INDEX_FILE);
+	if (!success || rename(tempFile.c_str(), STAMP_INDEX_FILE))
+		Platform::DeleteFile(tempFile);
+	else
+		dirty = false;
+}
+
+void StampIndex::Shutdown()
+{
+	CancelPending();
+	Save();
+}
+
+// Same thumbnail stamp_gen_thumb used to make: the stamp prerendered, then scaled down to fit in a grid cell
+void StampIndex::Render(std::string name)
+{
+	std::string path = StampPath(name);
+	Entry entry;
+	entry.verified = true;
+	entry.failed = true;
+	if (Platform::FileInfo(path, &entry.size, &entry.modified))
+	{
+		int size, w, h;
+		void *data = file_load(path.c_str(), &size);
+		pixel *thumb = data ? prerender_save(data, size, &w, &h) : NULL;
+		free(data);
+		if (thumb && (w > XRES/GRID_S || h > YRES/GRID_S))
+		{
+			int factor_x = (int)ceil((float)w/(float)(XRES/GRID_S));
+			int factor_y = (int)ceil((float)h/(float)(YRES/GRID_S));
+			if (factor_y > factor_x)
+				factor_x = factor_y;
+			pixel *tmp = rescale_img(thumb, w, h, &w, &h, factor_x);
+			free(thumb);
+			thumb = tmp;
+		}
+		if (thumb)
+		{
+			entry.failed = false;
+			entry.w = w;
+			entry.h = h;
+			entry.thumb.assign(thumb, thumb + w*h);
+			free(thumb);
+		}
+	}
+
+	std::lock_guard<std::mutex> g(indexMutex);
+	entries[name] = std::move(entry);
+	pending.erase(name);
+	dirty = true;
+}
+
+StampThumbStatus StampIndex::GetThumb(const std::string &name, pixel **thumb, int *w, int *h)
+{
+	std::lock_guard<std::mutex> g(indexMutex);
+	auto iter = entries.find(name);
+	if (iter != entries.end() && !iter->second.verified)
+	{
+		long size;
+		long long modified;
+		if (Platform::FileInfo(StampPath(name), &size, &modified) && size == iter->second.size && modified == iter->second.modified)
+			iter->second.verified = true;
+		else
+		{
+			entries.erase(iter);
+			iter = entries.end();
+			dirty = true;
+		}
+	}
+
+	if (iter != entries.end())
+	{
+		const Entry &entry = iter->second;
+		if (entry.failed)
+			return STAMP_THUMB_FAILED;
+		*thumb = (pixel *)malloc(entry.thumb.size() * sizeof(pixel));
+		if (entry.thumb.size())
+			memcpy(*thumb, &entry.thumb[0], entry.thumb.size() * sizeof(pixel));
+		*w = entry.w;
+		*h = entry.h;
+		return STAMP_THUMB_READY;
+	}
+
+	if (!pending.count(name))
+	{
+		pending.insert(name);
+		WorkerPool::Shared().Push([this, name]() { Render(name); }, &renders);
+	}
+	return STAMP_THUMB_PENDING;
+}
+
+void StampIndex::Remove(const std::string &name)
+{
+	std::lock_guard<std::mutex> g(indexMutex);
+	if (entries.erase(name))
+		dirty = true;
+}
+
+void StampIndex::CancelPending()
+{
+	// not holding indexMutex, the renders take it when they finish
+	WorkerPool::Shared().Clear(&renders);
+	WorkerPool::Shared().Wait(&renders);
+	std::lock_guard<std::mutex> g(indexMutex);
+	pending.clear();
+}
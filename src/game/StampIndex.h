@@ -0,0 +1,61 @@
+#ifndef STAMPINDEX_H
+#define STAMPINDEX_H
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "common/Singleton.h"
+#include "common/WorkerPool.h"
+#include "graphics/Pixel.h"
+
+enum StampThumbStatus
+{
+	STAMP_THUMB_PENDING,
+	STAMP_THUMB_READY,
+	STAMP_THUMB_FAILED
+};
+
+// stamps/stamps.idx, pre-rendered stamp thumbnails keyed by stamp name and checked against the
+// .stm file's size and modification time. Missing or outdated thumbnails are rendered on a
+// background thread, so the stamp browser never has to parse saves itself
+class StampIndex : public Singleton<StampIndex>
+{
+	struct Entry
+	{
+		long size = 0;
+		long long modified = 0;
+		bool failed = false;
+		// set once the entry has been compared against the file this session
+		bool verified = false;
+		int w = 0, h = 0;
+		std::vector<pixel> thumb;
+	};
+
+	std::mutex indexMutex;
+	std::map<std::string, Entry> entries;
+	std::set<std::string> pending;
+	bool loaded = false;
+	bool dirty = false;
+	WorkerPool::Group renders;
+
+	void Render(std::string name);
+
+public:
+	StampIndex();
+	~StampIndex();
+
+	void Load();
+	void Save();
+	void Shutdown();
+
+	// On STAMP_THUMB_READY *thumb is set to a malloc'd copy of the thumbnail
+	StampThumbStatus GetThumb(const std::string &name, pixel **thumb, int *w, int *h);
+	void Remove(const std::string &name);
+	// Forget queued renders for stamps that are no longer on screen, and wait for the ones already running.
+	// Renders read the element tables, so stamp_ui calls this before going back to the simulation
+	void CancelPending();
+};
+
+#endif // STAMPINDEX_H
@@ -0,0 +1,364 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include "ThumbnailCache.h"
+#include "defines.h"
+#include "common/Platform.h"
+
+#define THUMB_DISK_DIR "cache" PATH_SEP "thumbs"
+
+template<typename T>
+T * ThumbnailCache::LRU<T>::Get(const std::string &key)
+{
+	auto found = index.find(key);
+	if (found == index.end())
+		return nullptr;
+	order.splice(order.begin(), order, found->second);
+	return &found->second->second;
+}
+
+template<typename T>
+void ThumbnailCache::LRU<T>::Put(const std::string &key, T value)
+{
+	auto found = index.find(key);
+	if (found != index.end())
+	{
+		found->second->second = std::move(value);
+		order.splice(order.begin(), order, found->second);
+		return;
+	}
+	order.push_front(std::make_pair(key, std::move(value)));
+	index[key] = order.begin();
+	while (order.size() > capacity)
+	{
+		index.erase(order.back().first);
+		order.pop_back();
+	}
+}
+
+template<typename T>
+void ThumbnailCache::LRU<T>::Erase(const std::string &key)
+{
+	auto found = index.find(key);
+	if (found == index.end())
+		return;
+	order.erase(found->second);
+	index.erase(found);
+}
+
+template<typename T>
+void ThumbnailCache::LRU<T>::ErasePrefix(const std::string &prefix)
+{
+	for (auto iter = order.begin(); iter != order.end();)
+	{
+		if (!iter->first.compare(0, prefix.size(), prefix))
+		{
+			index.erase(iter->first);
+			iter = order.erase(iter);
+		}
+		else
+			++iter;
+	}
+}
+
+ThumbnailCache::ThumbnailCache():
+	raw(THUMB_CACHE_SIZE),
+	decoded(THUMB_DECODED_CACHE_SIZE)
+{
+
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+	Shutdown();
+}
+
+void ThumbnailCache::Init()
+{
+	if (initialized)
+		return;
+	initialized = true;
+
+	Platform::MakeDirectory("cache");
+	Platform::MakeDirectory(THUMB_DISK_DIR);
+	if (!Platform::DirectoryExists(THUMB_DISK_DIR))
+		return;
+	diskEnabled = true;
+
+	// Building the index means touching every file, don't hold up startup for it
+	WorkerPool::Shared().Push([this]() {
+		std::vector<std::string> files = Platform::DirectorySearch(THUMB_DISK_DIR, "", { ".pti" });
+		std::map<std::string, DiskEntry> found;
+		for (auto &file : files)
+		{
+			// left over from when the current version of saves was kept here too, it could be out of date
+			if (!Immutable(file.substr(0, file.size() - 4)))
+			{
+				Platform::DeleteFile(THUMB_DISK_DIR PATH_SEP + file);
+				continue;
+			}
+			FILE *f = fopen((THUMB_DISK_DIR PATH_SEP + file).c_str(), "rb");
+			if (!f)
+				continue;
+			fseek(f, 0, SEEK_END);
+			long size = ftell(f);
+			fclose(f);
+			DiskEntry entry = { size, 0 };
+			found[file.substr(0, file.size() - 4)] = entry;
+		}
+
+		std::lock_guard<std::mutex> g(cacheMutex);
+		// Anything written while we were scanning is newer than what's on the list
+		for (auto &entry : found)
+		{
+			if (diskIndex.find(entry.first) == diskIndex.end())
+			{
+				diskIndex[entry.first] = entry.second;
+				diskSize += entry.second.size;
+			}
+		}
+		TrimDisk();
+	}, &jobs);
+}
+
+void ThumbnailCache::Shutdown()
+{
+	if (!initialized)
+		return;
+	{
+		std::lock_guard<std::mutex> g(cacheMutex);
+		generation++;
+		pending.clear();
+	}
+	// Let disk writes finish, queued decodes will see the new generation and return immediately
+	WorkerPool::Shared().Wait(&jobs);
+	initialized = false;
+	std::lock_guard<std::mutex> g(cacheMutex);
+	raw.Clear();
+	decoded.Clear();
+}
+
+std::string ThumbnailCache::DiskPath(const std::string &id)
+{
+	// ids are "<id>" or "<id>_<date>", only the second kind is kept on disk. Refuse anything that could
+	// escape the cache directory
+	if (!diskEnabled || !Immutable(id))
+		return "";
+	for (char c : id)
+		if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'))
+			return "";
+	return THUMB_DISK_DIR PATH_SEP + id + ".pti";
+}
+
+bool ThumbnailCache::LoadFromDisk(const std::string &id, std::string &data)
+{
+	std::string path = DiskPath(id);
+	{
+		std::lock_guard<std::mutex> g(cacheMutex);
+		if (path.empty() || diskIndex.find(id) == diskIndex.end())
+			return false;
+	}
+
+	std::ifstream file(path.c_str(), std::ios::binary);
+	std::stringstream contents;
+	if (file)
+		contents << file.rdbuf();
+	data = contents.str();
+
+	std::lock_guard<std::mutex> g(cacheMutex);
+	auto entry = diskIndex.find(id);
+	if (data.empty())
+	{
+		// File vanished or is unreadable, stop advertising it
+		if (entry != diskIndex.end())
+		{
+			diskSize -= entry->second.size;
+			diskIndex.erase(entry);
+		}
+		return false;
+	}
+	if (entry != diskIndex.end())
+		entry->second.lastUse = ++diskClock;
+	raw.Put(id, data);
+	return true;
+}
+
+void ThumbnailCache::WriteToDisk(std::string id, std::string data)
+{
+	std::string path = DiskPath(id);
+	if (path.empty())
+		return;
+
+	FILE *f = fopen(path.c_str(), "wb");
+	if (!f)
+		return;
+	bool success = fwrite(data.c_str(), 1, data.size(), f) == data.size();
+	fclose(f);
+
+	std::lock_guard<std::mutex> g(cacheMutex);
+	// Invalidated while we were writing, or the write failed
+	if (!success || !raw.Get(id))
+	{
+		Platform::DeleteFile(path);
+		return;
+	}
+	auto entry = diskIndex.find(id);
+	if (entry != diskIndex.end())
+		diskSize -= entry->second.size;
+	DiskEntry newEntry = { (long)data.size(), ++diskClock };
+	diskIndex[id] = newEntry;
+	diskSize += newEntry.size;
+	TrimDisk();
+}
+
+// Evict least recently used files until the cache fits, cacheMutex must be held
+void ThumbnailCache::TrimDisk()
+{
+	while (diskSize > THUMB_DISK_CACHE_SIZE && diskIndex.size())
+	{
+		auto oldest = diskIndex.begin();
+		for (auto iter = diskIndex.begin(); iter != diskIndex.end(); ++iter)
+			if (iter->second.lastUse < oldest->second.lastUse)
+				oldest = iter;
+		Platform::DeleteFile(DiskPath(oldest->first));
+		diskSize -= oldest->second.size;
+		diskIndex.erase(oldest);
+	}
+}
+
+bool ThumbnailCache::Contains(const std::string &id)
+{
+	std::lock_guard<std::mutex> g(cacheMutex);
+	return raw.Get(id) || diskIndex.find(id) != diskIndex.end();
+}
+
+void ThumbnailCache::Add(const std::string &id, std::string data)
+{
+	if (data.empty())
+		return;
+	{
+		std::lock_guard<std::mutex> g(cacheMutex);
+		// revalidated and unchanged, keep the decoded images
+		std::string *cached = raw.Get(id);
+		if (cached && *cached == data)
+			return;
+		raw.Put(id, data);
+		decoded.ErasePrefix(id + ":");
+	}
+	if (initialized && diskEnabled)
+		WorkerPool::Shared().Push([this, id, data]() { WriteToDisk(id, data); }, &jobs);
+}
+
+bool ThumbnailCache::Find(const std::string &id, std::string &data)
+{
+	{
+		std::lock_guard<std::mutex> g(cacheMutex);
+		std::string *cached = raw.Get(id);
+		if (cached)
+		{
+			data = *cached;
+			return true;
+		}
+	}
+	return LoadFromDisk(id, data);
+}
+
+void ThumbnailCache::Invalidate(const std::string &id)
+{
+	std::lock_guard<std::mutex> g(cacheMutex);
+	raw.Erase(id);
+	decoded.ErasePrefix(id + ":");
+	generation++;
+	invalidations++;
+	pending.clear();
+	auto entry = diskIndex.find(id);
+	if (entry != diskIndex.end())
+	{
+		Platform::DeleteFile(DiskPath(id));
+		diskSize -= entry->second.size;
+		diskIndex.erase(entry);
+	}
+}
+
+void ThumbnailCache::Decode(std::string id, int w, int h, unsigned int jobGeneration)
+{
+	std::stringstream keyStream;
+	keyStream << id << ":" << w << "x" << h;
+	std::string key = keyStream.str();
+
+	std::string data;
+	unsigned int jobInvalidations;
+	{
+		std::lock_guard<std::mutex> g(cacheMutex);
+		if (jobGeneration != generation)
+			return;
+		jobInvalidations = invalidations;
+		std::string *cached = raw.Get(id);
+		if (cached)
+			data = *cached;
+	}
+	if (data.empty() && !LoadFromDisk(id, data))
+	{
+		std::lock_guard<std::mutex> g(cacheMutex);
+		if (jobGeneration == generation)
+			pending.erase(key);
+		return;
+	}
+
+	// A null image is cached too, so broken thumbnails aren't decoded again every frame
+	Image image;
+	int finw, finh;
+	pixel *imgData = ptif_unpack(&data[0], data.size(), &finw, &finh);
+	if (imgData)
+	{
+		pixel *resampled = resample_img(imgData, finw, finh, w, h);
+		free(imgData);
+		if (resampled)
+		{
+			image = std::make_shared<std::vector<pixel>>(resampled, resampled + w*h);
+			free(resampled);
+		}
+	}
+
+	std::lock_guard<std::mutex> g(cacheMutex);
+	// Still worth keeping after a page change, but not if the data it came from is gone
+	if (jobInvalidations == invalidations)
+		decoded.Put(key, image);
+	if (jobGeneration == generation)
+		pending.erase(key);
+}
+
+ThumbnailCache::Image ThumbnailCache::GetDecoded(const std::string &id, int w, int h, bool urgent)
+{
+	if (id.empty())
+		return nullptr;
+	std::stringstream keyStream;
+	keyStream << id << ":" << w << "x" << h;
+	std::string key = keyStream.str();
+
+	std::lock_guard<std::mutex> g(cacheMutex);
+	Image *image = decoded.Get(key);
+	if (image)
+		return *image;
+	if (!initialized || pending.count(key))
+		return nullptr;
+	if (!raw.Get(id) && diskIndex.find(id) == diskIndex.end())
+		return nullptr;
+
+	pending.insert(key);
+	unsigned int jobGeneration = generation;
+	auto job = [this, id, w, h, jobGeneration]() { Decode(id, w, h, jobGeneration); };
+	if (urgent)
+		WorkerPool::Shared().PushFront(job, &jobs);
+	else
+		WorkerPool::Shared().Push(job, &jobs);
+	return nullptr;
+}
+
+void ThumbnailCache::CancelDecodes()
+{
+	std::lock_guard<std::mutex> g(cacheMutex);
+	generation++;
+	pending.clear();
+}
@@ -0,0 +1,98 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "common/Singleton.h"
+#include "common/WorkerPool.h"
+#include "graphics/Pixel.h"
+
+// Save browser thumbnail cache, three levels deep:
+//  - decoded and resampled images, ready to be drawn
+//  - compressed PTI data as downloaded from the server
+//  - the same PTI data on disk, so thumbnails survive restarts. Only for history thumbnails ("<id>_<date>"),
+//    which never change. The current version of a save can be updated, those go through the HTTP cache instead,
+//    which asks the server whether they're still current
+// Decoding, resampling and disk access all happen on the shared worker pool, the UI thread only ever
+// does hash lookups and gets nothing back until the image is ready
+class ThumbnailCache : public Singleton<ThumbnailCache>
+{
+public:
+	typedef std::shared_ptr<std::vector<pixel>> Image;
+
+private:
+	template<typename T>
+	class LRU
+	{
+		typedef std::list<std::pair<std::string, T>> List;
+		List order;
+		std::unordered_map<std::string, typename List::iterator> index;
+		size_t capacity;
+
+	public:
+		LRU(size_t capacity) : capacity(capacity) { }
+		T * Get(const std::string &key);
+		void Put(const std::string &key, T value);
+		void Erase(const std::string &key);
+		void ErasePrefix(const std::string &prefix);
+		void Clear() { order.clear(); index.clear(); }
+	};
+
+	struct DiskEntry
+	{
+		long size;
+		unsigned long lastUse;
+	};
+
+	std::mutex cacheMutex;
+	LRU<std::string> raw;
+	LRU<Image> decoded;
+	std::set<std::string> pending;
+	std::map<std::string, DiskEntry> diskIndex;
+	long diskSize = 0;
+	unsigned long diskClock = 0;
+	bool diskEnabled = false;
+	// Bumped whenever queued decodes become useless (new page, invalidation), jobs started from
+	// an older generation just bail out. Finished decodes are only thrown away on invalidation
+	unsigned int generation = 0;
+	unsigned int invalidations = 0;
+	bool initialized = false;
+	WorkerPool::Group jobs;
+
+	std::string DiskPath(const std::string &id);
+	bool LoadFromDisk(const std::string &id, std::string &data);
+	void WriteToDisk(std::string id, std::string data);
+	void TrimDisk();
+	void Decode(std::string id, int w, int h, unsigned int jobGeneration);
+
+public:
+	ThumbnailCache();
+	~ThumbnailCache();
+
+	void Init();
+	void Shutdown();
+
+	// history thumbnails are one fixed version of a save, anything else can change on the server
+	static bool Immutable(const std::string &id) { return id.find('_') != std::string::npos; }
+
+	// true if compressed data for this id is in memory or on disk
+	bool Contains(const std::string &id);
+	void Add(const std::string &id, std::string data);
+	// Synchronous lookup of the compressed data, checking disk if needed
+	bool Find(const std::string &id, std::string &data);
+	void Invalidate(const std::string &id);
+
+	// Returns the thumbnail resampled to w*h, or nullptr and queues a decode if it isn't ready yet
+	// urgent decodes skip the queue, used for the hover preview
+	Image GetDecoded(const std::string &id, int w, int h, bool urgent = false);
+	// Forget about all queued decodes, call when the visible set of thumbnails changes
+	void CancelDecodes();
+};
+
+#endif // THUMBNAILCACHE_H
@@ -20,6 +20,9 @@
 #include <sstream>
 #include <bzlib.h>
 #include <climits>
+#ifdef X86_SSE2
+#include <emmintrin.h>
+#endif
 
 #include "defines.h"
 #include "interface.h"
@@ -38,7 +41,9 @@
 #include "game/Brush.h"
 #include "game/Menus.h"
 #include "game/Sign.h"
+#include "graphics/RenderPipeline.h"
 #include "graphics/Renderer.h"
+#include "graphics/TextCache.h"
 #include "interface/Engine.h"
 #include "lua/LuaSmartRef.h"
 #include "simulation/Simulation.h"
@@ -55,7 +60,8 @@
 
 unsigned int render_mode;
 unsigned int display_mode;
-gcache_item *graphicscache;
+static gcache_item graphicscacheItems[PT_NUM];
+gcache_item *graphicscache = graphicscacheItems;
 
 pixel sampleColor = 0;
 
@@ -66,16 +72,26 @@ unsigned char fire_b[YRES/CELL][XRES/CELL];
 unsigned int fire_alpha[CELL*3][CELL*3];
 pixel *pers_bg;
 
-char * flm_data;
 int flm_data_points = 4;
 pixel flm_data_colours[] = {PIXPACK(0xAF9F0F), PIXPACK(0xDFBF6F), PIXPACK(0x60300F), PIXPACK(0x000000)};
 float flm_data_pos[] = {1.0f, 0.9f, 0.5f, 0.0f};
 
-char * plasma_data;
 int plasma_data_points = 5;
 pixel plasma_data_colours[] = {PIXPACK(0xAFFFFF), PIXPACK(0xAFFFFF), PIXPACK(0x301060), PIXPACK(0x301040), PIXPACK(0x000000)};
 float plasma_data_pos[] = {1.0f, 0.9f, 0.5f, 0.25, 0.0f};
 
+const char *flm_gradient()
+{
+	static const char *gradient = generate_gradient(flm_data_colours, flm_data_pos, flm_data_points, 200);
+	return gradient;
+}
+
+const char *plasma_gradient()
+{
+	static const char *gradient = generate_gradient(plasma_data_colours, plasma_data_pos, plasma_data_points, 200);
+	return gradient;
+}
+
 
 
 //an easy way to draw a blob
@@ -564,7 +580,10 @@ void drawpixel(pixel *vid, int x, int y, int r, int g, int b, int a)
 #endif
 }
 
-int drawchar(pixel *vid, int x, int y, int c, int r, int g, int b, int a)
+// walks the pixels of glyph c drawn at x, y, calling plot(x, y, level) for each of them with an alpha level from 0 to 3
+// returns the x of the next glyph
+template<typename PlotFunc>
+static inline int font_glyph(int x, int y, int c, PlotFunc plot)
 {
 	int bn = 0, ba = 0;
 	unsigned char *rp = font_data + font_ptrs[c];
@@ -589,13 +608,20 @@ int drawchar(pixel *vid, int x, int y, int c, int r, int g, int b, int a)
 				ba = *(rp++);
 				bn = 8;
 			}
-			drawpixel(vid, x+i+l, y+j+t, r, g, b, ((ba&3)*a)/3);
+			plot(x+i+l, y+j+t, ba&3);
 			ba >>= 2;
 			bn -= 2;
 		}
 	return x + (flags&0x01 ? 0 : w);
 }
 
+int drawchar(pixel *vid, int x, int y, int c, int r, int g, int b, int a)
+{
+	return font_glyph(x, y, c, [&](int px, int py, int level) {
+		drawpixel(vid, px, py, r, g, b, (level*a)/3);
+	});
+}
+
 int addchar(pixel *vid, int x, int y, int c, int r, int g, int b, int a)
 {
 	int bn = 0, ba = 0;
@@ -630,7 +656,10 @@ int addchar(pixel *vid, int x, int y, int c, int r, int g, int b, int a)
 	return x + (flags&0x1 ? 0 : w);
 }
 
-int drawtext(pixel *vid, int x, int y, const char *s, int r, int g, int b, int a, bool noColor)
+// lays out s the way drawtext draws it, calling glyph(x, y, c, r, g, b) for every character, which returns the x of
+// the next one, and highlight(x, y, w) for the box behind highlighted characters. Returns the final x
+template<typename GlyphFunc, typename HighlightFunc>
+static int layout_text(int x, int y, const char *s, int r, int g, int b, bool noColor, GlyphFunc glyph, HighlightFunc highlightBox)
 {
 	int sx = x;
 	bool highlight = false;
@@ -643,7 +672,7 @@ int drawtext(pixel *vid, int x, int y, const char *s, int r, int g, int b, int a
 			y += FONT_H+2;
 			if (highlight && (s[1] == '\n' || s[1] == '\r' || (s[1] == '\x01' && (s[2] == '\n' || s[2] == '\r'))))
 			{
-				fillrect(vid, x-1, y-3, font_data[font_ptrs[' ']]+1, FONT_H+3, 0, 0, 255, 127);
+				highlightBox(x, y, font_data[font_ptrs[' ']]);
 			}
 		}
 		else if (*s == '\x0F')
@@ -723,14 +752,62 @@ int drawtext(pixel *vid, int x, int y, const char *s, int r, int g, int b, int a
 		{
 			if (highlight)
 			{
-				fillrect(vid, x-1, y-3, font_data[font_ptrs[(int)(*(unsigned char *)s)]]+1, FONT_H+3, 0, 0, 255, 127);
+				highlightBox(x, y, font_data[font_ptrs[(int)(*(unsigned char *)s)]]);
 			}
-			x = drawchar(vid, x, y, *(unsigned char *)s, r, g, b, a);
+			x = glyph(x, y, *(unsigned char *)s, r, g, b);
 		}
 	}
 	return x;
 }
 
+static int drawtext_direct(pixel *vid, int x, int y, const char *s, int r, int g, int b, int a, bool noColor)
+{
+	return layout_text(x, y, s, r, g, b, noColor,
+		[&](int gx, int gy, int c, int cr, int cg, int cb) {
+			return drawchar(vid, gx, gy, c, cr, cg, cb, a);
+		},
+		[&](int hx, int hy, int w) {
+			fillrect(vid, hx-1, hy-3, w+1, FONT_H+3, 0, 0, 255, 127);
+		});
+}
+
+static void rasterise_text(gfx::TextRun &run, const char *s, int r, int g, int b, int a, bool noColor)
+{
+	std::vector<gfx::TextDot> dots;
+	bool highlighted = false;
+	int advance = layout_text(0, 0, s, r, g, b, noColor,
+		[&](int gx, int gy, int c, int cr, int cg, int cb) {
+			return font_glyph(gx, gy, c, [&](int px, int py, int level) {
+				int alpha = (level*a)/3;
+				if (alpha)
+					dots.push_back({ px, py, (pixel)PIXRGB(cr, cg, cb), alpha });
+			});
+		},
+		[&](int hx, int hy, int w) {
+			highlighted = true;
+		});
+	run.Rasterise(dots, advance, !highlighted);
+}
+
+int drawtext(pixel *vid, int x, int y, const char *s, int r, int g, int b, int a, bool noColor)
+{
+#ifndef PIXALPHA
+	if (r >= 0 && r <= 255 && g >= 0 && g <= 255 && b >= 0 && b <= 255 && a >= 0 && a <= 255)
+	{
+		gfx::TextRun &run = gfx::TextCache::ForThisThread().Get(s, r, g, b, a, noColor);
+		// text that is only ever drawn once isn't worth rasterising, wait until it shows up again
+		if (!run.rasterised && run.uses > 1)
+			rasterise_text(run, s, r, g, b, a, noColor);
+		if (run.rasterised && run.cacheable)
+		{
+			run.Blit(vid, x, y, XRES+BARSIZE, YRES+MENUSIZE);
+			return x + run.advance;
+		}
+	}
+#endif
+	return drawtext_direct(vid, x, y, s, r, g, b, a, noColor);
+}
+
 int drawhighlight(pixel *vid, int x, int y, const char *s)
 {
 	int sx = x;
@@ -1452,83 +1529,253 @@ void draw_icon(pixel *vid_buf, int x, int y, char ch, int flag)
 	}
 }
 
+// How temperatures map onto the 1024 entries of color_data, for one heat display range
+struct HeatScale
+{
+	float offset, range, step;
+};
+
+// Same int/float mix as the old per particle expressions, so the buckets don't move
+// The full range really does use an integer step, the manual / automatic range doesn't
+static const HeatScale fullHeatScale = { (float)(-MIN_TEMP), (float)(MAX_TEMP+(-MIN_TEMP)), (float)((MAX_TEMP+(-MIN_TEMP))/1024) };
+
+static HeatScale heat_scale(int low, int high)
+{
+	return { (float)(-low), (float)high+(-low), (float)(high+(-low))/1024 };
+}
+
+static inline int heat_bucket(float temp, const HeatScale &scale)
+{
+	int bucket = (int)(restrict_flt(temp+scale.offset, 0.0f, scale.range) / scale.step);
+	// an empty range divides by zero, that always ended up at the coldest colour
+	if (bucket < 0)
+		return 0;
+	return bucket < 1023 ? bucket : 1023;
+}
+
+// Colours for the heat, life and gradient colour modes, filled in with exactly the expressions they replace
+typedef decltype(sin(0.05f) * 16) GradOffset;
+struct ColourModeTables
+{
+	static const int lifeSize = 46341; // (int)sqrtf(INT_MAX) + 1
+	static const int gradSize = MAX_TEMP - MIN_TEMP + 1;
+	static const int gradStart = MIN_TEMP - 40;
+
+	ARGBColour heat[1024], airHeat[1024];
+	unsigned char life[lifeSize];
+	GradOffset grad[gradSize];
+
+	ColourModeTables()
+	{
+		for (int i = 0; i < 1024; i++)
+		{
+			int r = color_data[i*3], g = color_data[i*3+1], b = color_data[i*3+2];
+			heat[i] = COLRGB(r, g, b);
+			airHeat[i] = COLARGB(255, (int)(r * 0.7f), (int)(g * 0.7f), (int)(b * 0.7f));
+		}
+		float gradv = 0.4f;
+		for (int q = 0; q < lifeSize; q++)
+			life[q] = (int)(sin(gradv*q) * 100 + 128);
+		float frequency = 0.05f;
+		for (int i = 0; i < gradSize; i++)
+			grad[i] = sin(frequency*(i + gradStart)) * 16;
+	}
+
+	// only built when a colour mode first needs it, thread safe since the render thread might get there first
+	static const ColourModeTables & Ref()
+	{
+		static ColourModeTables tables;
+		return tables;
+	}
+
+	int Life(int life) const
+	{
+		int q = life < 5 ? life : (int)sqrtf((float)life);
+		if (q >= 0 && q < lifeSize)
+			return this->life[q];
+		return (int)(sin(0.4f*q) * 100 + 128);
+	}
+
+	GradOffset Grad(float temp) const
+	{
+		int q = (int)temp-40;
+		if (q >= gradStart && q < gradStart + gradSize)
+			return grad[q - gradStart];
+		return sin(0.05f*q) * 16;
+	}
+};
+
 pixel HeatToColor(float temp)
 {
-	int caddress = (int)restrict_flt((int)(restrict_flt(temp, 0.0f, (float)MAX_TEMP+(-MIN_TEMP)) / ((MAX_TEMP+(-MIN_TEMP))/1024) ) * 3.0f, 0.0f, (1024.0f * 3) - 3);
-	return COLARGB(255, (int)((unsigned char)color_data[caddress] * 0.7f), (int)((unsigned char)color_data[caddress + 1] * 0.7f), (int)((unsigned char)color_data[caddress + 2] * 0.7f));
+	// callers already subtracted MIN_TEMP
+	static const HeatScale airScale = { 0.0f, fullHeatScale.range, fullHeatScale.step };
+	return ColourModeTables::Ref().airHeat[heat_bucket(temp, airScale)];
 }
 
-void draw_air(pixel *vid, Simulation * sim)
+#ifdef X86_SSE2
+// clamp_flt for four values at once, with exactly the same results
+static inline __m128i clamp_flt_sse2(__m128 f, float min, float max)
 {
-	pixel c;
-	for (int y = 0; y < YRES/CELL; y++)
-		for (int x = 0; x < XRES/CELL; x++)
+	__m128 vmin = _mm_set1_ps(min), vmax = _mm_set1_ps(max);
+	__m128i scaled = _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(_mm_set1_ps(255.0f), _mm_sub_ps(f, vmin)), _mm_sub_ps(vmax, vmin)));
+	__m128i below = _mm_castps_si128(_mm_cmplt_ps(f, vmin));
+	__m128i above = _mm_castps_si128(_mm_cmpgt_ps(f, vmax));
+	scaled = _mm_andnot_si128(below, scaled);
+	return _mm_or_si128(_mm_andnot_si128(above, scaled), _mm_and_si128(above, _mm_set1_epi32(255)));
+}
+
+static inline __m128 fabsf_sse2(__m128 f)
+{
+	return _mm_and_ps(f, _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)));
+}
+#endif
+
+// colours of one row of air cells in the current air display mode
+static void air_row_colours(pixel *colours, const float *pv, const float *vx, const float *vy, const float *hv)
+{
+	// channels before they are packed, a few spare entries so the last SSE2 store can't overflow
+	int r[XRES/CELL+3], g[XRES/CELL+3], b[XRES/CELL+3];
+	int x = 0;
+	if (display_mode & DISPLAY_AIRP)
+	{
+#ifdef X86_SSE2
+		for (; x + 4 <= XRES/CELL; x += 4)
 		{
-			if (display_mode & DISPLAY_AIRP)
-			{
-				if (sim->air->pv[y][x] > 0.0f)
-					c  = PIXRGB(clamp_flt(sim->air->pv[y][x], 0.0f, 8.0f), 0, 0);//positive pressure is red!
-				else
-					c  = PIXRGB(0, 0, clamp_flt(-sim->air->pv[y][x], 0.0f, 8.0f));//negative pressure is blue!
-			}
-			else if (display_mode & DISPLAY_AIRV)
+			__m128 p = _mm_loadu_ps(&pv[x]);
+			__m128i positive = _mm_castps_si128(_mm_cmpgt_ps(p, _mm_setzero_ps()));
+			__m128i red = clamp_flt_sse2(p, 0.0f, 8.0f);
+			__m128i blue = clamp_flt_sse2(_mm_xor_ps(p, _mm_set1_ps(-0.0f)), 0.0f, 8.0f);
+			_mm_storeu_si128((__m128i *)&r[x], _mm_and_si128(positive, red));
+			_mm_storeu_si128((__m128i *)&b[x], _mm_andnot_si128(positive, blue));
+		}
+#endif
+		for (; x < XRES/CELL; x++)
+		{
+			if (pv[x] > 0.0f)
 			{
-				c  = PIXRGB(clamp_flt(fabsf(sim->air->vx[y][x]), 0.0f, 8.0f),//vx adds red
-				clamp_flt(sim->air->pv[y][x], 0.0f, 8.0f),//pressure adds green
-				clamp_flt(fabsf(sim->air->vy[y][x]), 0.0f, 8.0f));//vy adds blue
+				r[x] = clamp_flt(pv[x], 0.0f, 8.0f);//positive pressure is red!
+				b[x] = 0;
 			}
-			else if (display_mode & DISPLAY_AIRH)
-			{
-				if (!aheat_enable)
-					c = 0;
-				else
-				{
-					float ttemp = sim->air->hv[y][x]+(-MIN_TEMP);
-					c = HeatToColor(ttemp);
-					c = PIXPACK(c);
-				}
-			}
-			else if (display_mode & DISPLAY_AIRC)
+			else
 			{
-				int r;
-				int g;
-				int b;
-				// velocity adds grey
-				r = clamp_flt(fabsf(sim->air->vx[y][x]), 0.0f, 24.0f) + clamp_flt(fabsf(sim->air->vy[y][x]), 0.0f, 20.0f);
-				g = clamp_flt(fabsf(sim->air->vx[y][x]), 0.0f, 20.0f) + clamp_flt(fabsf(sim->air->vy[y][x]), 0.0f, 24.0f);
-				b = clamp_flt(fabsf(sim->air->vx[y][x]), 0.0f, 24.0f) + clamp_flt(fabsf(sim->air->vy[y][x]), 0.0f, 20.0f);
-				if (sim->air->pv[y][x] > 0.0f)
-				{
-					r += clamp_flt(sim->air->pv[y][x], 0.0f, 16.0f);//pressure adds red!
-					if (r>255)
-						r=255;
-					if (g>255)
-						g=255;
-					if (b>255)
-						b=255;
-					c  = PIXRGB(r, g, b);
-				}
-				else
-				{
-					b += clamp_flt(-sim->air->pv[y][x], 0.0f, 16.0f);//pressure adds blue!
-					if (r>255)
-						r=255;
-					if (g>255)
-						g=255;
-					if (b>255)
-						b=255;
-					c  = PIXRGB(r, g, b);
-				}
+				r[x] = 0;
+				b[x] = clamp_flt(-pv[x], 0.0f, 8.0f);//negative pressure is blue!
 			}
-			if (finding && !(finding & 0x8))
+		}
+		for (x = 0; x < XRES/CELL; x++)
+			colours[x] = PIXRGB((unsigned)r[x], 0, (unsigned)b[x]);
+	}
+	else if (display_mode & DISPLAY_AIRV)
+	{
+#ifdef X86_SSE2
+		for (; x + 4 <= XRES/CELL; x += 4)
+		{
+			_mm_storeu_si128((__m128i *)&r[x], clamp_flt_sse2(fabsf_sse2(_mm_loadu_ps(&vx[x])), 0.0f, 8.0f));
+			_mm_storeu_si128((__m128i *)&g[x], clamp_flt_sse2(_mm_loadu_ps(&pv[x]), 0.0f, 8.0f));
+			_mm_storeu_si128((__m128i *)&b[x], clamp_flt_sse2(fabsf_sse2(_mm_loadu_ps(&vy[x])), 0.0f, 8.0f));
+		}
+#endif
+		for (; x < XRES/CELL; x++)
+		{
+			r[x] = clamp_flt(fabsf(vx[x]), 0.0f, 8.0f);//vx adds red
+			g[x] = clamp_flt(pv[x], 0.0f, 8.0f);//pressure adds green
+			b[x] = clamp_flt(fabsf(vy[x]), 0.0f, 8.0f);//vy adds blue
+		}
+		for (x = 0; x < XRES/CELL; x++)
+			colours[x] = PIXRGB((unsigned)r[x], (unsigned)g[x], (unsigned)b[x]);
+	}
+	else if (display_mode & DISPLAY_AIRH)
+	{
+		for (x = 0; x < XRES/CELL; x++)
+		{
+			if (!aheat_enable)
+				colours[x] = 0;
+			else
 			{
-				c = PIXRGB(PIXR(c)/10,PIXG(c)/10,PIXB(c)/10);
-			}
-			// Draws the colors
-			for (int j = 0; j < CELL; j++)
-				for (int i = 0; i < CELL; i++)
-					vid[(x*CELL+i) + (y*CELL+j)*(XRES+BARSIZE)] = c;
+				float ttemp = hv[x]+(-MIN_TEMP);
+				colours[x] = PIXPACK(HeatToColor(ttemp));
+			}
+		}
+	}
+	else if (display_mode & DISPLAY_AIRC)
+	{
+#ifdef X86_SSE2
+		for (; x + 4 <= XRES/CELL; x += 4)
+		{
+			__m128 absVx = fabsf_sse2(_mm_loadu_ps(&vx[x])), absVy = fabsf_sse2(_mm_loadu_ps(&vy[x]));
+			__m128 p = _mm_loadu_ps(&pv[x]);
+			__m128i positive = _mm_castps_si128(_mm_cmpgt_ps(p, _mm_setzero_ps()));
+			__m128i pressureRed = clamp_flt_sse2(p, 0.0f, 16.0f);
+			__m128i pressureBlue = clamp_flt_sse2(_mm_xor_ps(p, _mm_set1_ps(-0.0f)), 0.0f, 16.0f);
+			// velocity adds grey, pressure adds red or blue
+			__m128i red = _mm_add_epi32(clamp_flt_sse2(absVx, 0.0f, 24.0f), clamp_flt_sse2(absVy, 0.0f, 20.0f));
+			__m128i green = _mm_add_epi32(clamp_flt_sse2(absVx, 0.0f, 20.0f), clamp_flt_sse2(absVy, 0.0f, 24.0f));
+			__m128i blue = red;
+			red = _mm_add_epi32(red, _mm_and_si128(positive, pressureRed));
+			blue = _mm_add_epi32(blue, _mm_andnot_si128(positive, pressureBlue));
+			__m128i max = _mm_set1_epi32(255);
+			__m128i over = _mm_cmpgt_epi32(red, max);
+			red = _mm_or_si128(_mm_andnot_si128(over, red), _mm_and_si128(over, max));
+			over = _mm_cmpgt_epi32(green, max);
+			green = _mm_or_si128(_mm_andnot_si128(over, green), _mm_and_si128(over, max));
+			over = _mm_cmpgt_epi32(blue, max);
+			blue = _mm_or_si128(_mm_andnot_si128(over, blue), _mm_and_si128(over, max));
+			_mm_storeu_si128((__m128i *)&r[x], red);
+			_mm_storeu_si128((__m128i *)&g[x], green);
+			_mm_storeu_si128((__m128i *)&b[x], blue);
+		}
+#endif
+		for (; x < XRES/CELL; x++)
+		{
+			// velocity adds grey
+			r[x] = clamp_flt(fabsf(vx[x]), 0.0f, 24.0f) + clamp_flt(fabsf(vy[x]), 0.0f, 20.0f);
+			g[x] = clamp_flt(fabsf(vx[x]), 0.0f, 20.0f) + clamp_flt(fabsf(vy[x]), 0.0f, 24.0f);
+			b[x] = clamp_flt(fabsf(vx[x]), 0.0f, 24.0f) + clamp_flt(fabsf(vy[x]), 0.0f, 20.0f);
+			if (pv[x] > 0.0f)
+				r[x] += clamp_flt(pv[x], 0.0f, 16.0f);//pressure adds red!
+			else
+				b[x] += clamp_flt(-pv[x], 0.0f, 16.0f);//pressure adds blue!
+			if (r[x]>255)
+				r[x]=255;
+			if (g[x]>255)
+				g[x]=255;
+			if (b[x]>255)
+				b[x]=255;
 		}
+		for (x = 0; x < XRES/CELL; x++)
+			colours[x] = PIXRGB(r[x], g[x], b[x]);
+	}
+	else
+		std::fill_n(colours, XRES/CELL, 0);
+
+	if (finding && !(finding & 0x8))
+		for (x = 0; x < XRES/CELL; x++)
+			colours[x] = PIXRGB(PIXR(colours[x])/10,PIXG(colours[x])/10,PIXB(colours[x])/10);
+}
+
+// Air is drawn a row of cells at a time: colours for the whole row first, then each colour is widened
+// to CELL pixels and the first pixel row copied down to the other CELL-1
+void draw_air(pixel *vid, Simulation * sim, FramePacket *packet)
+{
+	float (*pv)[XRES/CELL] = packet ? packet->pv : sim->air->pv;
+	float (*vx)[XRES/CELL] = packet ? packet->vx : sim->air->vx;
+	float (*vy)[XRES/CELL] = packet ? packet->vy : sim->air->vy;
+	float (*hv)[XRES/CELL] = packet ? packet->hv : sim->air->hv;
+	pixel colours[XRES/CELL];
+	for (int y = 0; y < YRES/CELL; y++)
+	{
+		air_row_colours(colours, pv[y], vx[y], vy[y], hv[y]);
+		pixel *row = vid + y*CELL*(XRES+BARSIZE);
+		int x = 0;
+#if defined(X86_SSE2) && CELL == 4
+		for (; x < XRES/CELL; x++)
+			_mm_storeu_si128((__m128i *)&row[x*CELL], _mm_set1_epi32(colours[x]));
+#endif
+		for (; x < XRES/CELL; x++)
+			std::fill_n(&row[x*CELL], CELL, colours[x]);
+		for (int j = 1; j < CELL; j++)
+			memcpy(row + j*(XRES+BARSIZE), row, XRES*PIXELSIZE);
+	}
 }
 
 void draw_grav_zones(pixel * vid)
@@ -1551,25 +1798,27 @@ void draw_grav_zones(pixel * vid)
 	}
 }
 
-void draw_grav(pixel *vid)
+void draw_grav(pixel *vid, FramePacket *packet)
 {
 	int x, y, i, ca;
 	float nx, ny, dist;
+	float *gravx = packet ? packet->gravx : globalSim->grav->gravx;
+	float *gravy = packet ? packet->gravy : globalSim->grav->gravy;
 
 	for (y=0; y<YRES/CELL; y++)
 	{
 		for (x=0; x<XRES/CELL; x++)
 		{
 			ca = y*(XRES/CELL)+x;
-			if (fabsf(globalSim->grav->gravx[ca]) <= 0.001f && fabsf(globalSim->grav->gravy[ca]) <= 0.001f)
+			if (fabsf(gravx[ca]) <= 0.001f && fabsf(gravy[ca]) <= 0.001f)
 				continue;
 			nx = (float)x*CELL;
 			ny = (float)y*CELL;
-			dist = fabsf(globalSim->grav->gravy[ca])+fabsf(globalSim->grav->gravx[ca]);
+			dist = fabsf(gravy[ca])+fabsf(gravx[ca]);
 			for (i = 0; i < 4; i++)
 			{
-				nx -= globalSim->grav->gravx[ca] * 0.5f;
-				ny -= globalSim->grav->gravy[ca] * 0.5f;
+				nx -= gravx[ca] * 0.5f;
+				ny -= gravy[ca] * 0.5f;
 				addpixel(vid, (int)(nx+0.5f), (int)(ny+0.5f), 255, 255, 255, (int)(dist*20.0f));
 			}
 		}
@@ -1801,18 +2050,19 @@ void draw_other(pixel *vid, Simulation * sim) // EMP effect
 	}
 }
 
-void prepare_graphicscache()
-{
-	graphicscache = (gcache_item*)malloc(sizeof(gcache_item)*PT_NUM);
-	memset(graphicscache, 0, sizeof(gcache_item)*PT_NUM);
-}
-
-void render_parts(pixel *vid, Simulation * sim, Point mousePos)
+void render_parts(pixel *vid, Simulation * sim, Point mousePos, FramePacket *packet)
 {
-	int deca, decr, decg, decb, cola, colr, colg, colb, firea, firer = 0, fireg = 0, fireb = 0, pixel_mode, q, t, nx, ny, x, y, caddress;
+	// On the render thread everything comes from the captured packet, the simulation is already running the next tick
+	particle *parts = packet ? packet->parts.data() : ::parts;
+	unsigned (*pmap)[XRES] = packet ? packet->pmap : ::pmap;
+	unsigned (*photons)[XRES] = packet ? packet->photons : ::photons;
+	int lastActiveIndex = packet ? packet->lastActiveIndex : sim->parts_lastActiveIndex;
+	int deca, decr, decg, decb, cola, colr, colg, colb, firea, firer = 0, fireg = 0, fireb = 0, pixel_mode, t, nx, ny, x, y, caddress;
 	int orbd[4] = {0, 0, 0, 0}, orbl[4] = {0, 0, 0, 0};
 	float gradv, flicker;
 	unsigned int color_mode = Renderer::Ref().GetColorMode();
+	const ColourModeTables *colourTables = (color_mode & (COLOR_HEAT | COLOR_LIFE | COLOR_GRAD)) ? &ColourModeTables::Ref() : nullptr;
+	HeatScale heatScale = heatmode == 0 ? fullHeatScale : heat_scale(lowesttemp, highesttemp);
 	if (GRID_MODE)//draws the grid
 	{
 		for (ny=0; ny<YRES; ny++)
@@ -1824,8 +2074,12 @@ void render_parts(pixel *vid, Simulation * sim, Point mousePos)
 					blendpixel(vid, nx, ny, 100, 100, 100, 80);
 			}
 	}
+#ifdef LUACONSOLE
+	if (!packet && !(color_mode & COLOR_BASC))
+		luacon_graphics_update_batch(sim);
+#endif
 	foundParticles = 0;
-	for(int i = 0; i <= sim->parts_lastActiveIndex; i++) {
+	for(int i = 0; i <= lastActiveIndex; i++) {
 		if (parts[i].type) {
 			t = parts[i].type;
 #ifndef NOMOD
@@ -1885,7 +2139,22 @@ void render_parts(pixel *vid, Simulation * sim, Point mousePos)
 				else if(!(color_mode & COLOR_BASC))	//Don't get special effects for BASIC colour mode
 				{
 #ifdef LUACONSOLE
-					if (lua_gr_func[t])
+					if (!packet && lua_gr_batch_func[t])
+					{
+						if (lua_gr_batch_results[i].isready)
+						{
+							pixel_mode = lua_gr_batch_results[i].pixel_mode;
+							cola = lua_gr_batch_results[i].cola;
+							colr = lua_gr_batch_results[i].colr;
+							colg = lua_gr_batch_results[i].colg;
+							colb = lua_gr_batch_results[i].colb;
+							firea = lua_gr_batch_results[i].firea;
+							firer = lua_gr_batch_results[i].firer;
+							fireg = lua_gr_batch_results[i].fireg;
+							fireb = lua_gr_batch_results[i].fireb;
+						}
+					}
+					else if (!packet && lua_gr_func[t])
 					{
 						if (luacon_graphics_update(t,i, &pixel_mode, &cola, &colr, &colg, &colb, &firea, &firer, &fireg, &fireb))
 						{
@@ -1969,14 +2238,11 @@ void render_parts(pixel *vid, Simulation * sim, Point mousePos)
 				//Alter colour based on display mode
 				if(color_mode & COLOR_HEAT)
 				{
-					if (heatmode == 0)
-						caddress = (int)restrict_flt((int)( restrict_flt((float)(parts[i].temp+(-MIN_TEMP)), 0.0f, MAX_TEMP+(-MIN_TEMP)) / ((MAX_TEMP+(-MIN_TEMP))/1024) ) *3.0f, 0.0f, (1024.0f*3)-3); //Not having that second (float) might be a bug, and is definetely needed if min&max temps are less than 1024 apart
-					else
-						caddress = (int)restrict_flt((int)( restrict_flt((float)(parts[i].temp+(-lowesttemp)), 0.0f, (float)highesttemp+(-lowesttemp)) / ((float)(highesttemp+(-lowesttemp))/1024) ) *3.0f, 0.0f, (1024.0f*3)-3);
+					ARGBColour heatColour = colourTables->heat[heat_bucket(parts[i].temp, heatScale)];
 					firea = 255;
-					firer = colr = (unsigned char)color_data[caddress];
-					fireg = colg = (unsigned char)color_data[caddress+1];
-					fireb = colb = (unsigned char)color_data[caddress+2];
+					firer = colr = COLR(heatColour);
+					fireg = colg = COLG(heatColour);
+					fireb = colb = COLB(heatColour);
 					cola = 255;
 					if (pixel_mode & (FIREMODE | PMODE_GLOW))
 						pixel_mode = (pixel_mode & ~(FIREMODE|PMODE_GLOW)) | PMODE_BLUR;
@@ -1987,12 +2253,7 @@ void render_parts(pixel *vid, Simulation * sim, Point mousePos)
 				}
 				else if(color_mode & COLOR_LIFE)
 				{
-					gradv = 0.4f;
-					if (!(parts[i].life<5))
-						q = (int)sqrtf((float)parts[i].life);
-					else
-						q = parts[i].life;
-					colr = colg = colb = (int)(sin(gradv*q) * 100 + 128);
+					colr = colg = colb = colourTables->Life(parts[i].life);
 					cola = 255;
 					if (pixel_mode & (FIREMODE | PMODE_GLOW))
 						pixel_mode = (pixel_mode & ~(FIREMODE|PMODE_GLOW)) | PMODE_BLUR;
@@ -2030,11 +2291,10 @@ void render_parts(pixel *vid, Simulation * sim, Point mousePos)
 
 				if (color_mode & COLOR_GRAD)
 				{
-					float frequency = 0.05f;
-					int q = (int)parts[i].temp-40;
-					colr = (int)(sin(frequency*q) * 16 + colr);
-					colg = (int)(sin(frequency*q) * 16 + colg);
-					colb = (int)(sin(frequency*q) * 16 + colb);
+					GradOffset offset = colourTables->Grad(parts[i].temp);
+					colr = (int)(offset + colr);
+					colg = (int)(offset + colg);
+					colb = (int)(offset + colb);
 					if(pixel_mode & (FIREMODE | PMODE_GLOW)) pixel_mode = (pixel_mode & ~(FIREMODE|PMODE_GLOW)) | PMODE_BLUR;
 				}
 
@@ -2094,7 +2354,7 @@ void render_parts(pixel *vid, Simulation * sim, Point mousePos)
 				//Pixel rendering
 				if (t==PT_SOAP) //pixel_mode & EFFECT_LINES, pointless to check if only soap has it ...
 				{
-					if ((parts[i].ctype&3) == 3 && parts[i].tmp >= 0 && parts[i].tmp < NPART)
+					if ((parts[i].ctype&3) == 3 && parts[i].tmp >= 0 && parts[i].tmp <= lastActiveIndex)
 						draw_line(vid, nx, ny, (int)(parts[parts[i].tmp].x+0.5f), (int)(parts[parts[i].tmp].y+0.5f), colr, colg, colb, XRES+BARSIZE);
 				}
 				if(pixel_mode & PSPEC_STICKMAN)
@@ -2103,7 +2363,18 @@ void render_parts(pixel *vid, Simulation * sim, Point mousePos)
 					int s;
 					int legr, legg, legb;
 					Stickman *cplayer;
-					if (t == PT_STKM)
+					if (packet)
+					{
+						if (t == PT_STKM)
+							cplayer = &packet->stickman1;
+						else if (t == PT_STKM2)
+							cplayer = &packet->stickman2;
+						else if (t == PT_FIGH && parts[i].tmp >= 0 && parts[i].tmp < (int)packet->fighters.size())
+							cplayer = &packet->fighters[parts[i].tmp];
+						else
+							continue;
+					}
+					else if (t == PT_STKM)
 						cplayer = static_cast<STKM_ElementDataContainer&>(*sim->elementData[PT_STKM]).GetStickman1();
 					else if (t == PT_STKM2)
 						cplayer = static_cast<STKM_ElementDataContainer&>(*sim->elementData[PT_STKM]).GetStickman2();
@@ -2388,7 +2659,7 @@ void render_parts(pixel *vid, Simulation * sim, Point mousePos)
 						else if (type == PT_PRTO)
 							type2 = PT_PPTO;
 #endif
-						for (int z = 0; z <= sim->parts_lastActiveIndex; z++)
+						for (int z = 0; z <= lastActiveIndex; z++)
 						{
 							if (parts[z].type==type || parts[z].type==type2)
 							{
@@ -2438,11 +2709,11 @@ void render_parts(pixel *vid, Simulation * sim, Point mousePos)
 }
 
 // draw the graphics that appear before update_particles is called
-void render_before(pixel *part_vbuf, Simulation * sim)
+void render_before(pixel *part_vbuf, Simulation * sim, FramePacket *packet)
 {
 		if (display_mode & DISPLAY_AIR)//air only gets drawn in these modes
 		{
-			draw_air(part_vbuf, sim);
+			draw_air(part_vbuf, sim, packet);
 		}
 		else if (display_mode & DISPLAY_PERS)//save background for persistent, then clear
 		{
@@ -2453,16 +2724,23 @@ void render_before(pixel *part_vbuf, Simulation * sim)
 		{
 			memset(part_vbuf, 0, (XRES+BARSIZE)*YRES*PIXELSIZE);
 		}
-		if (sim->grav->IsEnabled() && drawgrav_enable)
-			draw_grav(part_vbuf);
-		draw_walls(part_vbuf, sim);
+		if ((packet ? packet->gravEnabled : sim->grav->IsEnabled()) && drawgrav_enable)
+			draw_grav(part_vbuf, packet);
+		draw_walls(part_vbuf, sim, packet);
 }
 
 int persist_counter = 0;
 // draw the graphics that appear after update_particles is called
 void render_after(pixel *part_vbuf, pixel *vid_buf, Simulation * sim, Point mousePos)
 {
-	render_parts(part_vbuf, sim, mousePos); //draw particles
+	render_particle_layers(part_vbuf, vid_buf, sim, mousePos);
+	render_overlays(part_vbuf, vid_buf, sim, mousePos);
+}
+
+// particles, persistent display and fire, the part of render_after that the render thread can do from a FramePacket
+void render_particle_layers(pixel *part_vbuf, pixel *vid_buf, Simulation * sim, Point mousePos, FramePacket *packet)
+{
+	render_parts(part_vbuf, sim, mousePos, packet); //draw particles
 	if (vid_buf && (display_mode & DISPLAY_PERS))
 	{
 		if (!persist_counter)
@@ -2479,6 +2757,11 @@ void render_after(pixel *part_vbuf, pixel *vid_buf, Simulation * sim, Point mous
 	if (render_mode & FIREMODE)
 		render_fire(part_vbuf);
 #endif
+}
+
+// everything drawn on top of the particles, always done on the main thread
+void render_overlays(pixel *part_vbuf, pixel *vid_buf, Simulation * sim, Point mousePos)
+{
 	draw_other(part_vbuf, sim);
 #ifndef RENDERER
 	if (((WallTool*)activeTools[the_game->GetToolIndex()])->GetID() == WL_GRAV)
@@ -2541,267 +2824,427 @@ void draw_find(Simulation * sim)
 	}
 }
 
-void draw_walls(pixel *vid, Simulation * sim)
+// colours a wall is drawn with, find mode highlights the searched for walls and dims the others
+static void wall_colours(unsigned char wt, pixel &pc, pixel &gc)
 {
-	for (int y = 0; y < YRES/CELL; y++)
-		for (int x =0; x < XRES/CELL; x++)
-			if (bmap[y][x])
-			{
-				unsigned char wt = bmap[y][x];
-				if (wt >= WALLCOUNT)
-					continue;
-				unsigned char powered = emap[y][x];
-				pixel pc = PIXPACK(wallTypes[wt].colour);
-				pixel gc = PIXPACK(wallTypes[wt].eglow);
-
-				if (finding)
-				{
-					if ((finding & 0x1) && wt == ((WallTool*)activeTools[0])->GetID())
-					{
-						pc = PIXRGB(255,0,0);
-						gc = PIXRGB(255,0,0);
-					}
-					else if ((finding & 0x2) && wt == ((WallTool*)activeTools[1])->GetID())
-					{
-						pc = PIXRGB(0,0,255);
-						gc = PIXRGB(0,0,255);
-					}
-					else if ((finding & 0x4) && wt == ((WallTool*)activeTools[2])->GetID())
-					{
-						pc = PIXRGB(0,255,0);
-						gc = PIXRGB(0,255,0);
-					}
-					else if (!(finding &0x8))
-					{
-						pc = PIXRGB(PIXR(pc)/10,PIXG(pc)/10,PIXB(pc)/10);
-						gc = PIXRGB(PIXR(gc)/10,PIXG(gc)/10,PIXB(gc)/10);
-					}
-				}
+	pc = PIXPACK(wallTypes[wt].colour);
+	gc = PIXPACK(wallTypes[wt].eglow);
+	if (finding)
+	{
+		if ((finding & 0x1) && wt == ((WallTool*)activeTools[0])->GetID())
+		{
+			pc = PIXRGB(255,0,0);
+			gc = PIXRGB(255,0,0);
+		}
+		else if ((finding & 0x2) && wt == ((WallTool*)activeTools[1])->GetID())
+		{
+			pc = PIXRGB(0,0,255);
+			gc = PIXRGB(0,0,255);
+		}
+		else if ((finding & 0x4) && wt == ((WallTool*)activeTools[2])->GetID())
+		{
+			pc = PIXRGB(0,255,0);
+			gc = PIXRGB(0,255,0);
+		}
+		else if (!(finding &0x8))
+		{
+			pc = PIXRGB(PIXR(pc)/10,PIXG(pc)/10,PIXB(pc)/10);
+			gc = PIXRGB(PIXR(gc)/10,PIXG(gc)/10,PIXB(gc)/10);
+		}
+	}
+}
 
-				switch (wallTypes[wt].drawstyle)
-				{
-				case 0:
-					if (wt == WL_EWALL || wt == WL_STASIS)
-					{
-						bool reverse = wt == WL_STASIS;
-						if ((powered > 0) ^ reverse)
-						{
-							for (int j = 0; j < CELL; j++)
-								for (int i =0; i < CELL; i++)
-									if (i&j&1)
-										vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = pc;
-						}
-						else
-						{
-							for (int j = 0; j < CELL; j++)
-								for (int i = 0; i < CELL; i++)
-									if (!(i&j&1))
-										vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = pc;
-						}
-					}
-					else if (wt == WL_WALLELEC)
-					{
-						for (int j = 0; j < CELL; j++)
-							for (int i = 0; i < CELL; i++)
-							{
-								if (!((y*CELL+j)%2) && !((x*CELL+i)%2))
-									vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = pc;
-								else
-									vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = PIXPACK(0x808080);
-							}
-					}
-					else if (wt == WL_EHOLE)
-					{
-						if (powered)
-						{
-							for (int j = 0; j < CELL; j++)
-								for (int i = 0; i < CELL; i++)
-									vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = PIXPACK(0x242424);
-							for (int j = 0; j < CELL; j += 2)
-								for (int i = 0; i < CELL; i += 2)
-									vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = PIXPACK(0x000000);
-						}
-						else
-						{
-							for (int j = 0; j < CELL; j += 2)
-								for (int i =0; i < CELL; i += 2)
-									vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = PIXPACK(0x242424);
-						}
-					}
-					else if (wt == WL_STREAM)
-					{
-						float xf = x*CELL + CELL*0.5f;
-						float yf = y*CELL + CELL*0.5f;
-						int oldX = (int)(xf+0.5f), oldY = (int)(yf+0.5f);
-						int newX, newY;
-						float xVel = sim->air->vx[y][x]*0.125f, yVel = sim->air->vy[y][x]*0.125f;
-						// there is no velocity here, draw a streamline and continue
-						if (!xVel && !yVel)
-						{
-							drawtext(vid, x*CELL, y*CELL-2, "\x8D", 255, 255, 255, 128);
-							drawpixel(vid, oldX, oldY, 255, 255, 255, 255);
-							continue;
-						}
-						bool changed = false;
-						for (int t = 0; t < 1024; t++)
-						{
-							newX = (int)(xf+0.5f);
-							newY = (int)(yf+0.5f);
-							if (newX != oldX || newY != oldY)
-							{
-								changed = true;
-								oldX = newX;
-								oldY = newY;
-							}
-							if (changed && (newX<0 || newX>=XRES || newY<0 || newY>=YRES))
-								break;
-							addpixel(vid, newX, newY, 255, 255, 255, 64);
-							// cache velocity and other checks so we aren't running them constantly
-							if (changed)
-							{
-								int wallX = newX/CELL;
-								int wallY = newY/CELL;
-								xVel = sim->air->vx[wallY][wallX]*0.125f;
-								yVel = sim->air->vy[wallY][wallX]*0.125f;
-								if (wallX != x && wallY != y && bmap[wallY][wallX] == WL_STREAM)
-									break;
-							}
-							xf += xVel;
-							yf += yVel;
-						}
-						drawtext(vid, x*CELL, y*CELL-2, "\x8D", 255, 255, 255, 128);
-					}
-					break;
-				case 1:
-					for (int j = 0; j < CELL; j += 2)
-						for (int i = (j>>1)&1; i < CELL; i += 2)
-							vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = pc;
-					break;
-				case 2:
-					for (int j = 0; j < CELL; j += 2)
-						for (int i = 0; i < CELL; i += 2)
+// the pattern of a single wall cell, streamlines are drawn separately by draw_wall_stream
+static void draw_wall_cell(pixel *vid, int x, int y, unsigned char wt, unsigned char powered)
+{
+	pixel pc, gc;
+	wall_colours(wt, pc, gc);
+	switch (wallTypes[wt].drawstyle)
+	{
+	case 0:
+		if (wt == WL_EWALL || wt == WL_STASIS)
+		{
+			bool reverse = wt == WL_STASIS;
+			if ((powered > 0) ^ reverse)
+			{
+				for (int j = 0; j < CELL; j++)
+					for (int i =0; i < CELL; i++)
+						if (i&j&1)
 							vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = pc;
-					break;
-				case 3:
-					for (int j = 0; j < CELL; j++)
-						for (int i = 0; i < CELL; i++)
+			}
+			else
+			{
+				for (int j = 0; j < CELL; j++)
+					for (int i = 0; i < CELL; i++)
+						if (!(i&j&1))
 							vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = pc;
-					break;
-				case 4:
-					for (int j = 0; j < CELL; j++)
-						for (int i = 0; i < CELL; i++)
-							if (i == j)
-								vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = pc;
-							else if (i == j+1 || (i == 0 && j == CELL-1))
-								vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = gc;
-							else
-								vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = PIXPACK(0x202020);
-					break;
+			}
+		}
+		else if (wt == WL_WALLELEC)
+		{
+			for (int j = 0; j < CELL; j++)
+				for (int i = 0; i < CELL; i++)
+				{
+					if (!((y*CELL+j)%2) && !((x*CELL+i)%2))
+						vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = pc;
+					else
+						vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = PIXPACK(0x808080);
 				}
+		}
+		else if (wt == WL_EHOLE)
+		{
+			if (powered)
+			{
+				for (int j = 0; j < CELL; j++)
+					for (int i = 0; i < CELL; i++)
+						vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = PIXPACK(0x242424);
+				for (int j = 0; j < CELL; j += 2)
+					for (int i = 0; i < CELL; i += 2)
+						vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = PIXPACK(0x000000);
+			}
+			else
+			{
+				for (int j = 0; j < CELL; j += 2)
+					for (int i =0; i < CELL; i += 2)
+						vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = PIXPACK(0x242424);
+			}
+		}
+		break;
+	case 1:
+		for (int j = 0; j < CELL; j += 2)
+			for (int i = (j>>1)&1; i < CELL; i += 2)
+				vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = pc;
+		break;
+	case 2:
+		for (int j = 0; j < CELL; j += 2)
+			for (int i = 0; i < CELL; i += 2)
+				vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = pc;
+		break;
+	case 3:
+		for (int j = 0; j < CELL; j++)
+			for (int i = 0; i < CELL; i++)
+				vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = pc;
+		break;
+	case 4:
+		for (int j = 0; j < CELL; j++)
+			for (int i = 0; i < CELL; i++)
+				if (i == j)
+					vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = pc;
+				else if (i == j+1 || (i == 0 && j == CELL-1))
+					vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = gc;
+				else
+					vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = PIXPACK(0x202020);
+		break;
+	}
+}
 
-				// when in blob view, draw some blobs...
-				if (render_mode & PMODE_BLOB)
+// streamlines follow the air velocity, so unlike the other walls they are drawn from scratch every frame
+static void draw_wall_stream(pixel *vid, int x, int y, unsigned char (*bmap)[XRES/CELL], float (*vx)[XRES/CELL], float (*vy)[XRES/CELL])
+{
+	float xf = x*CELL + CELL*0.5f;
+	float yf = y*CELL + CELL*0.5f;
+	int oldX = (int)(xf+0.5f), oldY = (int)(yf+0.5f);
+	int newX, newY;
+	float xVel = vx[y][x]*0.125f, yVel = vy[y][x]*0.125f;
+	// there is no velocity here, draw a streamline and continue
+	if (!xVel && !yVel)
+	{
+		drawtext(vid, x*CELL, y*CELL-2, "\x8D", 255, 255, 255, 128);
+		drawpixel(vid, oldX, oldY, 255, 255, 255, 255);
+		return;
+	}
+	bool changed = false;
+	for (int t = 0; t < 1024; t++)
+	{
+		newX = (int)(xf+0.5f);
+		newY = (int)(yf+0.5f);
+		if (newX != oldX || newY != oldY)
+		{
+			changed = true;
+			oldX = newX;
+			oldY = newY;
+		}
+		if (changed && (newX<0 || newX>=XRES || newY<0 || newY>=YRES))
+			break;
+		addpixel(vid, newX, newY, 255, 255, 255, 64);
+		// cache velocity and other checks so we aren't running them constantly
+		if (changed)
+		{
+			int wallX = newX/CELL;
+			int wallY = newY/CELL;
+			xVel = vx[wallY][wallX]*0.125f;
+			yVel = vy[wallY][wallX]*0.125f;
+			if (wallX != x && wallY != y && bmap[wallY][wallX] == WL_STREAM)
+				break;
+		}
+		xf += xVel;
+		yf += yVel;
+	}
+	drawtext(vid, x*CELL, y*CELL-2, "\x8D", 255, 255, 255, 128);
+}
+
+// when in blob view, draw some blobs...
+static void draw_wall_blobs(pixel *vid, int x, int y, unsigned char wt, unsigned char powered)
+{
+	pixel pc, gc;
+	wall_colours(wt, pc, gc);
+	switch (wallTypes[wt].drawstyle)
+	{
+	case 0:
+		if (wt == WL_EWALL || wt == WL_STASIS)
+		{
+			bool reverse = wt == WL_STASIS;
+			if ((powered > 0) ^ reverse)
+			{
+				for (int j = 0; j < CELL; j++)
+					for (int i =0; i < CELL; i++)
+						if (i&j&1)
+							drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
+			}
+			else
+			{
+				for (int j = 0; j < CELL; j++)
+					for (int i = 0; i < CELL; i++)
+						if (!(i&j&1))
+							drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
+			}
+		}
+		else if (wt == WL_WALLELEC)
+		{
+			for (int j = 0; j < CELL; j++)
+				for (int i =0; i < CELL; i++)
 				{
-					switch (wallTypes[wt].drawstyle)
-					{
-					case 0:
-						if (wt == WL_EWALL || wt == WL_STASIS)
-						{
-							bool reverse = wt == WL_STASIS;
-							if ((powered > 0) ^ reverse)
-							{
-								for (int j = 0; j < CELL; j++)
-									for (int i =0; i < CELL; i++)
-										if (i&j&1)
-											drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
-							}
-							else
-							{
-								for (int j = 0; j < CELL; j++)
-									for (int i = 0; i < CELL; i++)
-										if (!(i&j&1))
-											drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
-							}
-						}
-						else if (wt == WL_WALLELEC)
-						{
-							for (int j = 0; j < CELL; j++)
-								for (int i =0; i < CELL; i++)
-								{
-									if (!((y*CELL+j)%2) && !((x*CELL+i)%2))
-										drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
-									else
-										drawblob(vid, (x*CELL+i), (y*CELL+j), 0x80, 0x80, 0x80);
-								}
-						}
-						else if (wt == WL_EHOLE)
-						{
-							if (powered)
-							{
-								for (int j = 0; j < CELL; j++)
-									for (int i = 0; i < CELL; i++)
-										drawblob(vid, (x*CELL+i), (y*CELL+j), 0x24, 0x24, 0x24);
-								for (int j = 0; j < CELL; j += 2)
-									for (int i = 0; i < CELL; i += 2)
-										// looks bad if drawing black blobs
-										vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = PIXPACK(0x000000);
-							}
-							else
-							{
-								for (int j = 0; j < CELL; j += 2)
-									for (int i = 0; i < CELL; i += 2)
-										drawblob(vid, (x*CELL+i), (y*CELL+j), 0x24, 0x24, 0x24);
-							}
-						}
-						break;
-					 case 1:
-						for (int j = 0; j < CELL; j += 2)
-							for (int i = (j>>1)&1; i < CELL; i += 2)
-								drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
-						break;
-					case 2:
-						for (int j = 0; j < CELL; j += 2)
-							for (int i = 0; i < CELL; i+=2)
-								drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
-						break;
-					case 3:
-						for (int j = 0; j < CELL; j++)
-							for (int i = 0; i < CELL; i++)
-								drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
-						break;
-					case 4:
-						for (int j = 0; j < CELL; j++)
-							for (int i = 0; i < CELL; i++)
-								if (i == j)
-									drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
-								else if (i == j+1 || (i == 0 && j == CELL-1))
-									drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(gc), PIXG(gc), PIXB(gc));
-								else
-									drawblob(vid, (x*CELL+i), (y*CELL+j), 0x20, 0x20, 0x20);
-						break;
-					}
+					if (!((y*CELL+j)%2) && !((x*CELL+i)%2))
+						drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
+					else
+						drawblob(vid, (x*CELL+i), (y*CELL+j), 0x80, 0x80, 0x80);
 				}
+		}
+		else if (wt == WL_EHOLE)
+		{
+			if (powered)
+			{
+				for (int j = 0; j < CELL; j++)
+					for (int i = 0; i < CELL; i++)
+						drawblob(vid, (x*CELL+i), (y*CELL+j), 0x24, 0x24, 0x24);
+				for (int j = 0; j < CELL; j += 2)
+					for (int i = 0; i < CELL; i += 2)
+						// looks bad if drawing black blobs
+						vid[(y*CELL+j)*(XRES+BARSIZE)+(x*CELL+i)] = PIXPACK(0x000000);
+			}
+			else
+			{
+				for (int j = 0; j < CELL; j += 2)
+					for (int i = 0; i < CELL; i += 2)
+						drawblob(vid, (x*CELL+i), (y*CELL+j), 0x24, 0x24, 0x24);
+			}
+		}
+		break;
+	 case 1:
+		for (int j = 0; j < CELL; j += 2)
+			for (int i = (j>>1)&1; i < CELL; i += 2)
+				drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
+		break;
+	case 2:
+		for (int j = 0; j < CELL; j += 2)
+			for (int i = 0; i < CELL; i+=2)
+				drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
+		break;
+	case 3:
+		for (int j = 0; j < CELL; j++)
+			for (int i = 0; i < CELL; i++)
+				drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
+		break;
+	case 4:
+		for (int j = 0; j < CELL; j++)
+			for (int i = 0; i < CELL; i++)
+				if (i == j)
+					drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(pc), PIXG(pc), PIXB(pc));
+				else if (i == j+1 || (i == 0 && j == CELL-1))
+					drawblob(vid, (x*CELL+i), (y*CELL+j), PIXR(gc), PIXG(gc), PIXB(gc));
+				else
+					drawblob(vid, (x*CELL+i), (y*CELL+j), 0x20, 0x20, 0x20);
+		break;
+	}
+}
+
+// glow if electrified, the blend is at full alpha so nothing of the old fire colour is left
+static void draw_wall_glow(int x, int y, unsigned char wt)
+{
+	ARGBColour glow = wallTypes[wt].eglow;
+	fire_r[y][x] = (255*COLR(glow)) >> 8;
+	fire_g[y][x] = (255*COLG(glow)) >> 8;
+	fire_b[y][x] = (255*COLB(glow)) >> 8;
+}
+
+// Walls change far less often than they are drawn, so outside of blob view their patterns are kept
+// pre-rasterised in wallLayer. A cell is rasterised again only when its key (wall type, plus the powered
+// state for the walls that look different when powered) no longer matches the one it was drawn with.
+// Only the cells the simulation listed in changedWalls since the last frame are compared
+static pixel wallLayer[(XRES+BARSIZE)*YRES];
+// all bits set where a cell's pattern has a pixel, the frame shows through everywhere else
+static pixel wallMask[(XRES+BARSIZE)*YRES];
+static unsigned short wallKeys[YRES/CELL][XRES/CELL];
+static const unsigned short wallKeyDirty = 0xFFFF;
+// find mode settings the layer was drawn with, everything is redrawn when they change
+static int wallLayerFind[4] = { -1, -1, -1, -1 };
+// y*(XRES/CELL)+x of cells that are composited, have a streamline or can glow
+static std::vector<int> wallCells, streamCells, glowCells;
+
+static unsigned short wall_key(unsigned char wt, unsigned char powered)
+{
+	if (!wt || wt >= WALLCOUNT)
+		return 0;
+	if (powered && (wt == WL_EWALL || wt == WL_STASIS || wt == WL_EHOLE))
+		return wt | 0x100;
+	return wt;
+}
+
+static void rasterise_wall_cell(int x, int y, unsigned char wt, unsigned char powered)
+{
+	// draw the cell over two different backgrounds, the pixels that come out the same both times are the pattern
+	pixel first[CELL*CELL];
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (int j = 0; j < CELL; j++)
+			std::fill_n(&wallLayer[(y*CELL+j)*(XRES+BARSIZE)+x*CELL], CELL, pass ? ~(pixel)0 : 0);
+		if (wall_key(wt, powered) && wt != WL_STREAM)
+			draw_wall_cell(wallLayer, x, y, wt, powered);
+		if (!pass)
+			for (int j = 0; j < CELL; j++)
+				std::copy_n(&wallLayer[(y*CELL+j)*(XRES+BARSIZE)+x*CELL], CELL, &first[j*CELL]);
+	}
+	for (int j = 0; j < CELL; j++)
+		for (int i = 0; i < CELL; i++)
+		{
+			int offset = (y*CELL+j)*(XRES+BARSIZE)+x*CELL+i;
+			wallMask[offset] = wallLayer[offset] == first[j*CELL+i] ? ~(pixel)0 : 0;
+			wallLayer[offset] &= wallMask[offset];
+		}
+}
+
+static bool update_wall_cell(int x, int y, unsigned char (*bmap)[XRES/CELL], unsigned char (*emap)[XRES/CELL])
+{
+	unsigned short key = wall_key(bmap[y][x], emap[y][x]);
+	if (key == wallKeys[y][x])
+		return false;
+	wallKeys[y][x] = key;
+	rasterise_wall_cell(x, y, bmap[y][x], emap[y][x]);
+	return true;
+}
+
+static void update_wall_layer(unsigned char (*bmap)[XRES/CELL], unsigned char (*emap)[XRES/CELL], const std::vector<int> &changedWalls)
+{
+	int find[4] = { finding, 0, 0, 0 };
+	if (finding)
+		for (int k = 0; k < 3; k++)
+			find[k+1] = ((WallTool*)activeTools[k])->GetID();
+	bool changed = false;
+	if (memcmp(find, wallLayerFind, sizeof(find)))
+	{
+		memcpy(wallLayerFind, find, sizeof(find));
+		std::fill(&wallKeys[0][0], &wallKeys[0][0] + (YRES/CELL)*(XRES/CELL), wallKeyDirty);
+		for (int y = 0; y < YRES/CELL; y++)
+			for (int x = 0; x < XRES/CELL; x++)
+				changed |= update_wall_cell(x, y, bmap, emap);
+	}
+	else
+	{
+		for (int cell : changedWalls)
+			changed |= update_wall_cell(cell%(XRES/CELL), cell/(XRES/CELL), bmap, emap);
+	}
+	if (!changed)
+		return;
+
+	wallCells.clear();
+	streamCells.clear();
+	glowCells.clear();
+	for (int y = 0; y < YRES/CELL; y++)
+		for (int x = 0; x < XRES/CELL; x++)
+		{
+			unsigned char wt = wallKeys[y][x] & 0xFF;
+			if (!wt)
+				continue;
+			if (wt == WL_STREAM)
+				streamCells.push_back(y*(XRES/CELL)+x);
+			else
+				wallCells.push_back(y*(XRES/CELL)+x);
+			if (wallTypes[wt].eglow)
+				glowCells.push_back(y*(XRES/CELL)+x);
+		}
+}
 
-				if (wallTypes[wt].eglow && powered)
+// copies one cell of the wall layer over vid, keeping the pixels the pattern doesn't cover
+static inline void composite_wall_cell(pixel *vid, int offset)
+{
+	for (int j = 0; j < CELL; j++, offset += XRES+BARSIZE)
+	{
+		int i = 0;
+#ifdef X86_SSE2
+		for (; i + 4 <= CELL; i += 4)
+		{
+			__m128i mask = _mm_loadu_si128((const __m128i *)&wallMask[offset+i]);
+			__m128i layer = _mm_loadu_si128((const __m128i *)&wallLayer[offset+i]);
+			__m128i dst = _mm_loadu_si128((const __m128i *)&vid[offset+i]);
+			_mm_storeu_si128((__m128i *)&vid[offset+i], _mm_or_si128(_mm_andnot_si128(mask, dst), layer));
+		}
+#endif
+		for (; i < CELL; i++)
+			vid[offset+i] = (vid[offset+i] & ~wallMask[offset+i]) | wallLayer[offset+i];
+	}
+}
+
+void draw_walls(pixel *vid, Simulation * sim, FramePacket *packet)
+{
+	unsigned char (*bmap)[XRES/CELL] = packet ? packet->bmap : ::bmap;
+	unsigned char (*emap)[XRES/CELL] = packet ? packet->emap : ::emap;
+	float (*vx)[XRES/CELL] = packet ? packet->vx : sim->air->vx;
+	float (*vy)[XRES/CELL] = packet ? packet->vy : sim->air->vy;
+
+	std::vector<int> &changedWalls = packet ? packet->changedWalls : sim->changedWalls;
+	// blobs spill over into the neighbouring cells, so blob view draws everything directly
+	if (render_mode & PMODE_BLOB)
+	{
+		// the changes are dropped here, so the whole layer is redrawn when blob view is turned off
+		wallLayerFind[0] = -1;
+		if (packet)
+			packet->changedWalls.clear();
+		else
+			sim->ClearChangedWalls();
+		for (int y = 0; y < YRES/CELL; y++)
+			for (int x = 0; x < XRES/CELL; x++)
+			{
+				unsigned char wt = bmap[y][x];
+				if (!wt || wt >= WALLCOUNT)
+					continue;
+				if (wt == WL_STREAM)
 				{
-					// glow if electrified
-					ARGBColour glow = wallTypes[wt].eglow;
-					int alpha = 255;
-					int cr = (alpha*COLR(glow) + (255-alpha)*fire_r[y/CELL][x/CELL]) >> 8;
-					int cg = (alpha*COLG(glow) + (255-alpha)*fire_g[y/CELL][x/CELL]) >> 8;
-					int cb = (alpha*COLB(glow) + (255-alpha)*fire_b[y/CELL][x/CELL]) >> 8;
-
-					if (cr > 255)
-						cr = 255;
-					if (cg > 255)
-						cg = 255;
-					if (cb > 255)
-						cb = 255;
-					fire_r[y][x] = cr;
-					fire_g[y][x] = cg;
-					fire_b[y][x] = cb;
+					draw_wall_stream(vid, x, y, bmap, vx, vy);
+					continue;
 				}
+				draw_wall_cell(vid, x, y, wt, emap[y][x]);
+				draw_wall_blobs(vid, x, y, wt, emap[y][x]);
+				if (wallTypes[wt].eglow && emap[y][x])
+					draw_wall_glow(x, y, wt);
 			}
+		return;
+	}
+
+	update_wall_layer(bmap, emap, changedWalls);
+	if (packet)
+		packet->changedWalls.clear();
+	else
+		sim->ClearChangedWalls();
+	for (int cell : wallCells)
+		composite_wall_cell(vid, (cell/(XRES/CELL))*CELL*(XRES+BARSIZE) + (cell%(XRES/CELL))*CELL);
+	for (int cell : streamCells)
+		draw_wall_stream(vid, cell%(XRES/CELL), cell/(XRES/CELL), bmap, vx, vy);
+	for (int cell : glowCells)
+	{
+		int x = cell%(XRES/CELL), y = cell/(XRES/CELL);
+		if (emap[y][x])
+			draw_wall_glow(x, y, bmap[y][x]);
+	}
 }
 
 void render_signs(pixel *vid_buf, Simulation * sim)
@@ -2853,35 +3296,92 @@ void render_signs(pixel *vid_buf, Simulation * sim)
 	}
 }
 
+// Row-major, so src and dst are walked in memory order and each row of gravity cells is reused for CELL
+// rows of pixels. Each colour channel is read from its own displaced position, and a pixel is only changed
+// if all three positions are on screen
 void render_gravlensing(pixel *src, pixel * dst)
 {
-	int nx, ny, rx, ry, gx, gy, bx, by, co;
-	int r, g, b;
-	pixel t;
-	for(nx = 0; nx < XRES; nx++)
-	{
-		for(ny = 0; ny < YRES; ny++)
-		{
-			co = (ny/CELL)*(XRES/CELL)+(nx/CELL);
-			rx = (int)(nx - globalSim->grav->gravx[co] * 0.75f + 0.5f);
-			ry = (int)(ny - globalSim->grav->gravy[co] * 0.75f + 0.5f);
-			gx = (int)(nx - globalSim->grav->gravx[co] * 0.875f + 0.5f);
-			gy = (int)(ny - globalSim->grav->gravy[co] * 0.875f + 0.5f);
-			bx = (int)(nx - globalSim->grav->gravx[co] + 0.5f);
-			by = (int)(ny - globalSim->grav->gravy[co] + 0.5f);
-			if(rx >= 0 && rx < XRES && ry >= 0 && ry < YRES && gx >= 0 && gx < XRES && gy >= 0 && gy < YRES && bx >= 0 && bx < XRES && by >= 0 && by < YRES)
-			{
-				t = dst[ny*(XRES+BARSIZE)+nx];
-				r = PIXR(src[ry*(XRES+BARSIZE)+rx]) + PIXR(t);
-				g = PIXG(src[gy*(XRES+BARSIZE)+gx]) + PIXG(t);
-				b = PIXB(src[by*(XRES+BARSIZE)+bx]) + PIXB(t);
+	const float *gravx = globalSim->grav->gravx, *gravy = globalSim->grav->gravy;
+	for (int ny = 0; ny < YRES; ny++)
+	{
+		const float *rowGravx = gravx + (ny/CELL)*(XRES/CELL), *rowGravy = gravy + (ny/CELL)*(XRES/CELL);
+		pixel *out = dst + ny*(XRES+BARSIZE);
+		int nx = 0;
+#ifdef X86_SSE2
+		const __m128i maskR = _mm_set1_epi32(PIXRGB(255,0,0)), maskG = _mm_set1_epi32(PIXRGB(0,255,0));
+		const __m128i maskB = _mm_set1_epi32(PIXRGB(0,0,255)), maskRGB = _mm_set1_epi32(PIXRGB(255,255,255));
+		const __m128i minusOne = _mm_set1_epi32(-1), width = _mm_set1_epi32(XRES), height = _mm_set1_epi32(YRES);
+		const __m128 half = _mm_set1_ps(0.5f), fy = _mm_set1_ps((float)ny);
+		for (; nx + 4 <= XRES; nx += 4)
+		{
+			__m128 gx = _mm_setr_ps(rowGravx[nx/CELL], rowGravx[(nx+1)/CELL], rowGravx[(nx+2)/CELL], rowGravx[(nx+3)/CELL]);
+			__m128 gy = _mm_setr_ps(rowGravy[nx/CELL], rowGravy[(nx+1)/CELL], rowGravy[(nx+2)/CELL], rowGravy[(nx+3)/CELL]);
+			__m128 fx = _mm_setr_ps((float)nx, (float)(nx+1), (float)(nx+2), (float)(nx+3));
+			// same operations in the same order as (int)(nx - gravx * 0.75f + 0.5f), so the result is identical
+			__m128 scaleR = _mm_set1_ps(0.75f), scaleG = _mm_set1_ps(0.875f);
+			__m128i rx = _mm_cvttps_epi32(_mm_add_ps(_mm_sub_ps(fx, _mm_mul_ps(gx, scaleR)), half));
+			__m128i ry = _mm_cvttps_epi32(_mm_add_ps(_mm_sub_ps(fy, _mm_mul_ps(gy, scaleR)), half));
+			__m128i gxi = _mm_cvttps_epi32(_mm_add_ps(_mm_sub_ps(fx, _mm_mul_ps(gx, scaleG)), half));
+			__m128i gyi = _mm_cvttps_epi32(_mm_add_ps(_mm_sub_ps(fy, _mm_mul_ps(gy, scaleG)), half));
+			__m128i bx = _mm_cvttps_epi32(_mm_add_ps(_mm_sub_ps(fx, gx), half));
+			__m128i by = _mm_cvttps_epi32(_mm_add_ps(_mm_sub_ps(fy, gy), half));
+
+			__m128i inside = _mm_and_si128(_mm_cmpgt_epi32(rx, minusOne), _mm_cmplt_epi32(rx, width));
+			inside = _mm_and_si128(inside, _mm_and_si128(_mm_cmpgt_epi32(ry, minusOne), _mm_cmplt_epi32(ry, height)));
+			inside = _mm_and_si128(inside, _mm_and_si128(_mm_cmpgt_epi32(gxi, minusOne), _mm_cmplt_epi32(gxi, width)));
+			inside = _mm_and_si128(inside, _mm_and_si128(_mm_cmpgt_epi32(gyi, minusOne), _mm_cmplt_epi32(gyi, height)));
+			inside = _mm_and_si128(inside, _mm_and_si128(_mm_cmpgt_epi32(bx, minusOne), _mm_cmplt_epi32(bx, width)));
+			inside = _mm_and_si128(inside, _mm_and_si128(_mm_cmpgt_epi32(by, minusOne), _mm_cmplt_epi32(by, height)));
+			int insideMask = _mm_movemask_ps(_mm_castsi128_ps(inside));
+			if (!insideMask)
+				continue;
+
+			// SSE2 has no gather, the reads themselves are done one lane at a time
+			alignas(16) int lanes[6][4];
+			_mm_store_si128((__m128i *)lanes[0], rx);
+			_mm_store_si128((__m128i *)lanes[1], ry);
+			_mm_store_si128((__m128i *)lanes[2], gxi);
+			_mm_store_si128((__m128i *)lanes[3], gyi);
+			_mm_store_si128((__m128i *)lanes[4], bx);
+			_mm_store_si128((__m128i *)lanes[5], by);
+			alignas(16) pixel red[4] = { 0, 0, 0, 0 }, green[4] = { 0, 0, 0, 0 }, blue[4] = { 0, 0, 0, 0 };
+			for (int lane = 0; lane < 4; lane++)
+				if (insideMask & (1 << lane))
+				{
+					red[lane] = src[lanes[1][lane]*(XRES+BARSIZE)+lanes[0][lane]];
+					green[lane] = src[lanes[3][lane]*(XRES+BARSIZE)+lanes[2][lane]];
+					blue[lane] = src[lanes[5][lane]*(XRES+BARSIZE)+lanes[4][lane]];
+				}
+			__m128i lens = _mm_or_si128(_mm_and_si128(_mm_load_si128((__m128i *)red), maskR), _mm_or_si128(
+				_mm_and_si128(_mm_load_si128((__m128i *)green), maskG), _mm_and_si128(_mm_load_si128((__m128i *)blue), maskB)));
+			// adding with unsigned saturation is the clamp to 255
+			__m128i t = _mm_loadu_si128((__m128i *)&out[nx]);
+			__m128i sum = _mm_and_si128(_mm_adds_epu8(t, lens), maskRGB);
+			_mm_storeu_si128((__m128i *)&out[nx], _mm_or_si128(_mm_and_si128(inside, sum), _mm_andnot_si128(inside, t)));
+		}
+#endif
+		for (; nx < XRES; nx++)
+		{
+			int co = nx/CELL;
+			int rx = (int)(nx - rowGravx[co] * 0.75f + 0.5f);
+			int ry = (int)(ny - rowGravy[co] * 0.75f + 0.5f);
+			int gx = (int)(nx - rowGravx[co] * 0.875f + 0.5f);
+			int gy = (int)(ny - rowGravy[co] * 0.875f + 0.5f);
+			int bx = (int)(nx - rowGravx[co] + 0.5f);
+			int by = (int)(ny - rowGravy[co] + 0.5f);
+			if (rx >= 0 && rx < XRES && ry >= 0 && ry < YRES && gx >= 0 && gx < XRES && gy >= 0 && gy < YRES && bx >= 0 && bx < XRES && by >= 0 && by < YRES)
+			{
+				pixel t = out[nx];
+				int r = PIXR(src[ry*(XRES+BARSIZE)+rx]) + PIXR(t);
+				int g = PIXG(src[gy*(XRES+BARSIZE)+gx]) + PIXG(t);
+				int b = PIXB(src[by*(XRES+BARSIZE)+bx]) + PIXB(t);
 				if (r>255)
 					r = 255;
 				if (g>255)
 					g = 255;
 				if (b>255)
 					b = 255;
-				dst[ny*(XRES+BARSIZE)+nx] = PIXRGB(r,g,b);
+				out[nx] = PIXRGB(r,g,b);
 			}
 		}
 	}
@@ -2925,20 +3425,29 @@ void render_fire(pixel *vid)
 		}
 }
 
+// the blur kernel doesn't depend on the intensity, it's only summed up once (clear_sim calls this every time)
+struct FireAlphaKernel
+{
+	float temp[CELL*3][CELL*3];
+
+	FireAlphaKernel()
+	{
+		memset(temp, 0, sizeof(temp));
+		for (int x = 0; x < CELL; x++)
+			for (int y = 0; y < CELL; y++)
+				for (int i = -CELL; i < CELL; i++)
+					for (int j = -CELL; j < CELL; j++)
+						temp[y+CELL+j][x+CELL+i] += expf(-0.1f*(i*i+j*j));
+	}
+};
+
 void prepare_alpha(float intensity)
 {
-	int x,y,i,j;
+	static const FireAlphaKernel kernel;
 	float multiplier = 255.0f*intensity;
-	float temp[CELL*3][CELL*3];
-	memset(temp, 0, sizeof(temp));
-	for (x=0; x<CELL; x++)
-		for (y=0; y<CELL; y++)
-			for (i=-CELL; i<CELL; i++)
-				for (j=-CELL; j<CELL; j++)
-					temp[y+CELL+j][x+CELL+i] += expf(-0.1f*(i*i+j*j));
-	for (x=0; x<CELL*3; x++)
-		for (y=0; y<CELL*3; y++)
-			fire_alpha[y][x] = (int)(multiplier*temp[y][x]/(CELL*CELL));
+	for (int x = 0; x < CELL*3; x++)
+		for (int y = 0; y < CELL*3; y++)
+			fire_alpha[y][x] = (int)(multiplier*kernel.temp[y][x]/(CELL*CELL));
 }
 
 pixel *render_packed_rgb(void *image, int width, int height, int cmp_size)
@@ -3068,8 +3577,17 @@ void dim_copy(pixel *dst, pixel *src) //old persistent, unused
 
 void dim_copy_pers(pixel *dst, pixel *src) //for persistent view, reduces rgb slowly
 {
-	int i,r,g,b;
-	for (i=0; i<(XRES+BARSIZE)*YRES; i++)
+	int i = 0, r, g, b;
+#ifdef X86_SSE2
+	// saturating subtract does the "if (r>0) r--" for every channel at once
+	__m128i one = _mm_set1_epi32(PIXRGB(1, 1, 1)), rgbMask = _mm_set1_epi32(PIXRGB(255, 255, 255));
+	for (; i+4<=(XRES+BARSIZE)*YRES; i+=4)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)(src+i));
+		_mm_storeu_si128((__m128i *)(dst+i), _mm_and_si128(_mm_subs_epu8(p, one), rgbMask));
+	}
+#endif
+	for (; i<(XRES+BARSIZE)*YRES; i++)
 	{
 		r = PIXR(src[i]);
 		g = PIXG(src[i]);
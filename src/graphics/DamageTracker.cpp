@@ -0,0 +1,62 @@
+#include <cstring>
+#include "common/tpt-minmax.h"
+#include "DamageTracker.h"
+
+using namespace gfx;
+
+DamageTracker::DamageTracker(int width, int height):
+	width(width),
+	height(height),
+	previous(width * height)
+{
+
+}
+
+const std::vector<DirtyRect> & DamageTracker::Update(const pixel *frame)
+{
+	rects.clear();
+	if (fullDamage)
+	{
+		fullDamage = false;
+		memcpy(&previous[0], frame, width * height * PIXELSIZE);
+		rects.push_back({ 0, 0, width, height });
+		return rects;
+	}
+
+	int dirtyArea = 0;
+	for (int bandY = 0; bandY < height; bandY += tileHeight)
+	{
+		int bandH = std::min(height - bandY, (int)tileHeight);
+		int minX = width, maxX = 0;
+		for (int tileX = 0; tileX < width; tileX += tileWidth)
+		{
+			int tileW = std::min(width - tileX, (int)tileWidth);
+			bool dirty = false;
+			for (int y = bandY; y < bandY + bandH && !dirty; y++)
+				dirty = memcmp(frame + y * width + tileX, &previous[y * width + tileX], tileW * PIXELSIZE) != 0;
+			if (!dirty)
+				continue;
+			for (int y = bandY; y < bandY + bandH; y++)
+				memcpy(&previous[y * width + tileX], frame + y * width + tileX, tileW * PIXELSIZE);
+			minX = std::min(minX, tileX);
+			maxX = std::max(maxX, tileX + tileW);
+		}
+		if (minX >= maxX)
+			continue;
+
+		DirtyRect *last = rects.size() ? &rects.back() : nullptr;
+		if (last && last->y + last->h == bandY && last->x == minX && last->w == maxX - minX)
+			last->h += bandH;
+		else
+			rects.push_back({ minX, bandY, maxX - minX, bandH });
+		dirtyArea += (maxX - minX) * bandH;
+	}
+
+	// past this point one big upload is cheaper than lots of small ones
+	if (dirtyArea > width * height / 2)
+	{
+		rects.clear();
+		rects.push_back({ 0, 0, width, height });
+	}
+	return rects;
+}
@@ -0,0 +1,40 @@
+#ifndef DAMAGETRACKER_H
+#define DAMAGETRACKER_H
+
+#include <vector>
+#include "Pixel.h"
+
+namespace gfx
+{
+
+struct DirtyRect
+{
+	int x, y, w, h;
+};
+
+// Finds the parts of a frame that changed since the last one, so only those have to be uploaded
+// Frames are compared against a private copy in tiles, which catches every change no matter which of
+// the old drawing functions made it. Unchanged frames (paused game, static menus) produce no rects at all
+class DamageTracker
+{
+	int width, height;
+	std::vector<pixel> previous;
+	std::vector<DirtyRect> rects;
+	bool fullDamage = true;
+
+public:
+	static const int tileWidth = 64;
+	static const int tileHeight = 16;
+
+	DamageTracker(int width, int height);
+
+	// Next Update returns the whole frame, for when the destination lost its contents
+	void Invalidate() { fullDamage = true; }
+	// Compares frame (width*height, no padding) with the previous one and remembers it
+	// Returns dirty rects in tile granularity, adjacent bands with the same columns merged together
+	const std::vector<DirtyRect> & Update(const pixel *frame);
+};
+
+}
+
+#endif // DAMAGETRACKER_H
@@ -0,0 +1,75 @@
+#include "common/tpt-minmax.h"
+#include "FrameSkip.h"
+
+void FrameSkip::SetTargetFps(int fps)
+{
+	targetFps = std::max(fps, 0);
+	ratio = 1;
+	tickCost = frameOverhead = 0.0;
+}
+
+void FrameSkip::BeginFrame()
+{
+	frameStart = clock::now();
+	inFrame = true;
+	frameTicks = 0;
+	frameTickTime = 0.0;
+}
+
+void FrameSkip::BeginTick()
+{
+	tickStart = clock::now();
+}
+
+void FrameSkip::EndTick()
+{
+	frameTickTime += std::chrono::duration<double, std::milli>(clock::now() - tickStart).count();
+	frameTicks++;
+	rateTicks++;
+}
+
+void FrameSkip::EndFrame()
+{
+	clock::time_point now = clock::now();
+	double sinceRateStart = std::chrono::duration<double, std::milli>(now - rateStart).count();
+	if (sinceRateStart >= 500.0)
+	{
+		tickRate = (float)(rateTicks * 1000.0 / sinceRateStart);
+		rateTicks = 0;
+		rateStart = now;
+	}
+
+	// other windows on top of the game run the loop without main_loop_temp
+	if (!inFrame)
+		return;
+	inFrame = false;
+	if (frameTicks)
+		Adapt(std::chrono::duration<double, std::milli>(now - frameStart).count());
+}
+
+void FrameSkip::Adapt(double work)
+{
+	double cost = frameTickTime / frameTicks, overhead = std::max(work - frameTickTime, 0.0);
+	if (tickCost <= 0.0)
+	{
+		tickCost = cost;
+		frameOverhead = overhead;
+	}
+	else
+	{
+		tickCost = tickCost * 0.8 + cost * 0.2;
+		frameOverhead = frameOverhead * 0.8 + overhead * 0.2;
+	}
+	if (!Enabled())
+		return;
+
+	// leave a bit of the frame free, so small hiccups don't drop the frame rate straight away
+	double budget = 1000.0 / targetFps * 0.9 - frameOverhead;
+	int wanted = tickCost > 0.0 ? (int)(budget / tickCost) : maxRatio;
+	wanted = std::max(1, std::min(wanted, (int)maxRatio));
+	// drop straight away when the frame rate is in danger, climb back up gradually
+	if (wanted < ratio)
+		ratio = wanted;
+	else
+		ratio = std::min(wanted, ratio + std::max(1, ratio / 4));
+}
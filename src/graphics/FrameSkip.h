@@ -0,0 +1,54 @@
+#ifndef FRAMESKIP_H
+#define FRAMESKIP_H
+
+#include <chrono>
+#include "common/Singleton.h"
+
+// Render-only frame skipping: with a target display rate set, every main loop iteration runs ratio simulation
+// ticks and only the last of them is drawn. The ticks in between skip render_before / render_after entirely
+//
+// The ratio adapts every frame. Each tick is timed on its own, the rest of the frame's work (drawing, UI,
+// presenting) is what's left over, and the ratio becomes as many ticks as fit in a frame at the target rate
+// next to that overhead. Time spent sleeping in limit_fps is not counted as work, so an fps cap doesn't hide
+// the headroom. A target of 0 turns it off, one tick per frame like before
+class FrameSkip : public Singleton<FrameSkip>
+{
+	typedef std::chrono::steady_clock clock;
+
+	int targetFps = 0;
+	int ratio = 1;
+
+	// smoothed, in milliseconds
+	double tickCost = 0.0, frameOverhead = 0.0;
+	clock::time_point frameStart, tickStart;
+	bool inFrame = false;
+	int frameTicks = 0;
+	double frameTickTime = 0.0;
+
+	// for the HUD, every tick counts, skipped or not
+	clock::time_point rateStart = clock::now();
+	int rateTicks = 0;
+	float tickRate = 0.0f;
+
+	void Adapt(double work);
+
+public:
+	static const int maxRatio = 32;
+
+	int GetTargetFps() { return targetFps; }
+	void SetTargetFps(int fps);
+	bool Enabled() { return targetFps > 0; }
+	// how many ticks the next frame runs, including the drawn one
+	int GetRatio() { return Enabled() ? ratio : 1; }
+	// simulation ticks per second, measured over the last half second
+	float GetTickRate() { return tickRate; }
+
+	// main_loop_temp calls these around its work, and around each tick inside it
+	void BeginFrame();
+	void BeginTick();
+	void EndTick();
+	// limit_fps calls this before sleeping
+	void EndFrame();
+};
+
+#endif // FRAMESKIP_H
@@ -2,8 +2,14 @@
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <cstdio>
+#include <zlib.h>
+#ifdef X86_SSE2
+#include <emmintrin.h>
+#endif
 #include "bzlib.h"
 #include "Pixel.h"
+#include "common/WorkerPool.h"
 #include "resampler/Resampler.h"
 
 char * generate_gradient(pixel * colours, float * points, int pointcount, int size)
@@ -50,51 +56,127 @@ char * generate_gradient(pixel * colours, float * points, int pointcount, int si
 	return newdata;
 }
 
-void * ptif_pack(pixel *src, int w, int h, int *result_size)
+// bit position of a channel inside a pixel, from the mask PIXRGB gives for it
+static int channel_shift(pixel mask)
 {
-	int datalen = (w*h)*3;
-	unsigned char *red_chan = (unsigned char*)calloc(1, w*h);
-	unsigned char *green_chan = (unsigned char*)calloc(1, w*h);
-	unsigned char *blue_chan = (unsigned char*)calloc(1, w*h);
-	unsigned char *data = (unsigned char*)malloc(((w*h)*3)+8);
-	unsigned char *result = (unsigned char*)malloc(((w*h)*3)+8);
+	int shift = 0;
+	while (!(mask & 1))
+	{
+		mask >>= 1;
+		shift++;
+	}
+	return shift;
+}
+
+#ifdef X86_SSE2
+// one channel of 16 pixels as 16 bytes
+static inline __m128i split_channel_sse2(const __m128i p[4], __m128i shift)
+{
+	const __m128i low = _mm_set1_epi32(0xFF);
+	__m128i c0 = _mm_and_si128(_mm_srl_epi32(p[0], shift), low);
+	__m128i c1 = _mm_and_si128(_mm_srl_epi32(p[1], shift), low);
+	__m128i c2 = _mm_and_si128(_mm_srl_epi32(p[2], shift), low);
+	__m128i c3 = _mm_and_si128(_mm_srl_epi32(p[3], shift), low);
+	return _mm_packus_epi16(_mm_packs_epi32(c0, c1), _mm_packs_epi32(c2, c3));
+}
+
+// 16 bytes of one channel widened to 16 pixels with only that channel set
+static inline void merge_channel_sse2(__m128i bytes, __m128i shift, __m128i p[4])
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i lo = _mm_unpacklo_epi8(bytes, zero), hi = _mm_unpackhi_epi8(bytes, zero);
+	p[0] = _mm_or_si128(p[0], _mm_sll_epi32(_mm_unpacklo_epi16(lo, zero), shift));
+	p[1] = _mm_or_si128(p[1], _mm_sll_epi32(_mm_unpackhi_epi16(lo, zero), shift));
+	p[2] = _mm_or_si128(p[2], _mm_sll_epi32(_mm_unpacklo_epi16(hi, zero), shift));
+	p[3] = _mm_or_si128(p[3], _mm_sll_epi32(_mm_unpackhi_epi16(hi, zero), shift));
+}
+#endif
 
-	for (int cx = 0; cx<w; cx++)
+void ptif_split_channels(const pixel *src, int count, unsigned char *red, unsigned char *green, unsigned char *blue)
+{
+	int i = 0;
+#ifdef X86_SSE2
+	const __m128i shiftR = _mm_cvtsi32_si128(channel_shift(PIXRGB(255,0,0)));
+	const __m128i shiftG = _mm_cvtsi32_si128(channel_shift(PIXRGB(0,255,0)));
+	const __m128i shiftB = _mm_cvtsi32_si128(channel_shift(PIXRGB(0,0,255)));
+	for (; i + 16 <= count; i += 16)
 	{
-		for (int cy = 0; cy<h; cy++)
-		{
-			red_chan[w*(cy)+(cx)] = PIXR(src[w*(cy)+(cx)]);
-			green_chan[w*(cy)+(cx)] = PIXG(src[w*(cy)+(cx)]);
-			blue_chan[w*(cy)+(cx)] = PIXB(src[w*(cy)+(cx)]);
-		}
+		__m128i p[4];
+		for (int k = 0; k < 4; k++)
+			p[k] = _mm_loadu_si128((const __m128i *)(src + i + k*4));
+		_mm_storeu_si128((__m128i *)(red + i), split_channel_sse2(p, shiftR));
+		_mm_storeu_si128((__m128i *)(green + i), split_channel_sse2(p, shiftG));
+		_mm_storeu_si128((__m128i *)(blue + i), split_channel_sse2(p, shiftB));
+	}
+#endif
+	for (; i < count; i++)
+	{
+		red[i] = PIXR(src[i]);
+		green[i] = PIXG(src[i]);
+		blue[i] = PIXB(src[i]);
 	}
+}
 
-	memcpy(data, red_chan, w*h);
-	memcpy(data+(w*h), green_chan, w*h);
-	memcpy(data+((w*h)*2), blue_chan, w*h);
-	free(red_chan);
-	free(green_chan);
-	free(blue_chan);
+void ptif_merge_channels(const unsigned char *red, const unsigned char *green, const unsigned char *blue, int count, pixel *dst)
+{
+	int i = 0;
+#ifdef X86_SSE2
+	const __m128i shiftR = _mm_cvtsi32_si128(channel_shift(PIXRGB(255,0,0)));
+	const __m128i shiftG = _mm_cvtsi32_si128(channel_shift(PIXRGB(0,255,0)));
+	const __m128i shiftB = _mm_cvtsi32_si128(channel_shift(PIXRGB(0,0,255)));
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i p[4] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+		merge_channel_sse2(_mm_loadu_si128((const __m128i *)(red + i)), shiftR, p);
+		merge_channel_sse2(_mm_loadu_si128((const __m128i *)(green + i)), shiftG, p);
+		merge_channel_sse2(_mm_loadu_si128((const __m128i *)(blue + i)), shiftB, p);
+		for (int k = 0; k < 4; k++)
+			_mm_storeu_si128((__m128i *)(dst + i + k*4), p[k]);
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = PIXRGB(red[i], green[i], blue[i]);
+}
 
+void * ptif_pack(pixel *src, int w, int h, int *result_size, bool fast)
+{
+	int datalen = (w*h)*3;
+	unsigned char *data = (unsigned char*)malloc(datalen);
+	ptif_split_channels(src, w*h, data, data+(w*h), data+((w*h)*2));
+
+	// bzip2 can't shrink the planes below this either, and zlib needs a little extra room in the worst case
+	unsigned int capacity = std::max((unsigned int)datalen, (unsigned int)compressBound(datalen));
+	unsigned char *result = (unsigned char*)malloc(capacity+8);
 	result[0] = 'P';
 	result[1] = 'T';
 	result[2] = 'i';
-	result[3] = 1;
+	result[3] = fast ? 2 : 1;
 	result[4] = w;
 	result[5] = w>>8;
 	result[6] = h;
 	result[7] = h>>8;
 
-	int i = (w*h)*3-8;
-	if (BZ2_bzBuffToBuffCompress((char *)(result+8), (unsigned *)&i, (char *)data, datalen, 9, 0, 0) != BZ_OK)
+	bool success;
+	unsigned int i;
+	if (fast)
+	{
+		uLongf compressedSize = capacity;
+		success = compress2(result+8, &compressedSize, data, datalen, Z_BEST_SPEED) == Z_OK;
+		i = compressedSize;
+	}
+	else
+	{
+		i = (w*h)*3-8;
+		success = BZ2_bzBuffToBuffCompress((char *)(result+8), &i, (char *)data, datalen, 9, 0, 0) == BZ_OK;
+	}
+	free(data);
+	if (!success)
 	{
-		free(data);
 		free(result);
 		return NULL;
 	}
 
 	*result_size = i+8;
-	free(data);
 	return result;
 }
 
@@ -114,55 +196,54 @@ pixel * ptif_unpack(void *datain, int size, int *w, int *h)
 
 	int width = data[4]|(data[5]<<8);
 	int height = data[6]|(data[7]<<8);
-	int i = (width*height)*3;
+	unsigned int i = (width*height)*3;
 	unsigned char *undata = (unsigned char*)calloc(1, (width*height)*3);
-	unsigned char *red_chan = (unsigned char*)calloc(1, width*height);
-	unsigned char *green_chan = (unsigned char*)calloc(1, width*height);
-	unsigned char *blue_chan = (unsigned char*)calloc(1, width*height);
-	pixel *result = (pixel*)calloc(width*height, PIXELSIZE);
 
-	int resCode = BZ2_bzBuffToBuffDecompress((char *)undata, (unsigned *)&i, (char *)(data+8), size-8, 0, 0);
+	int resCode;
+	if (data[3] == 2)
+	{
+		uLongf unpackedSize = i;
+		resCode = uncompress(undata, &unpackedSize, data+8, size-8);
+		i = unpackedSize;
+	}
+	else
+		resCode = BZ2_bzBuffToBuffDecompress((char *)undata, &i, (char *)(data+8), size-8, 0, 0);
 	if (resCode)
 	{
 		printf("Decompression failure, %d\n", resCode);
-		free(red_chan);
-		free(green_chan);
-		free(blue_chan);
 		free(undata);
-		free(result);
 		return NULL;
 	}
-	if (i != (width*height)*3)
+	if (i != (unsigned int)(width*height)*3)
 	{
 		printf("Result buffer size mismatch, %d != %d\n", i, (width*height)*3);
-		free(red_chan);
-		free(green_chan);
-		free(blue_chan);
 		free(undata);
-		free(result);
 		return NULL;
 	}
-	memcpy(red_chan, undata, width*height);
-	memcpy(green_chan, undata+(width*height), width*height);
-	memcpy(blue_chan, undata+((width*height)*2), width*height);
-
-	for (int cx = 0; cx < width; cx++)
-	{
-		for (int cy = 0; cy < height; cy++)
-		{
-			result[width*(cy)+(cx)] = PIXRGB(red_chan[width*(cy)+(cx)], green_chan[width*(cy)+(cx)], blue_chan[width*(cy)+(cx)]);
-		}
-	}
 
+	pixel *result = (pixel*)malloc(width*height*PIXELSIZE);
+	ptif_merge_channels(undata, undata+(width*height), undata+((width*height)*2), width*height, result);
 	*w = width;
 	*h = height;
-	free(red_chan);
-	free(green_chan);
-	free(blue_chan);
 	free(undata);
 	return result;
 }
 
+void ptif_pack_batch(std::vector<PtifImage> &images, bool fast)
+{
+	WorkerPool &pool = WorkerPool::Shared();
+	WorkerPool::Group batch;
+	for (PtifImage &image : images)
+	{
+		image.data = NULL;
+		image.size = 0;
+		pool.Push([&image, fast]() {
+			image.data = ptif_pack(const_cast<pixel *>(image.src), image.w, image.h, &image.size, fast);
+		}, &batch);
+	}
+	pool.Wait(&batch);
+}
+
 pixel * resample_img_nn(pixel * src, int sw, int sh, int rw, int rh)
 {
 	pixel *q = (pixel*)malloc(rw*rh*PIXELSIZE);
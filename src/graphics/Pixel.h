@@ -25,6 +25,8 @@
 #ifndef PIXEL_H
 #define PIXEL_H
 
+#include <vector>
+
 #define PIXELSIZE 4
 #define PIXELCHANNELS 3
 typedef unsigned int pixel;
@@ -59,8 +61,24 @@ typedef unsigned int pixel;
 #endif
 
 char * generate_gradient(pixel * colours, float * points, int pointcount, int size);
-void * ptif_pack(pixel *src, int w, int h, int *result_size);
+// PTI images are the three colour planes one after the other, bzip2 compressed
+// fast writes version 2 instead, zlib at its fastest level. Only this client can read those, so it is just
+// for images that never leave the machine
+void * ptif_pack(pixel *src, int w, int h, int *result_size, bool fast = false);
 pixel * ptif_unpack(void *datain, int size, int *w, int *h);
+void ptif_split_channels(const pixel *src, int count, unsigned char *red, unsigned char *green, unsigned char *blue);
+void ptif_merge_channels(const unsigned char *red, const unsigned char *green, const unsigned char *blue, int count, pixel *dst);
+
+struct PtifImage
+{
+	const pixel *src;
+	int w, h;
+	// set by ptif_pack_batch, exactly what ptif_pack would have returned
+	void *data;
+	int size;
+};
+// ptif_pack for many images at once, spread over a worker pool. Returns when all of them are done
+void ptif_pack_batch(std::vector<PtifImage> &images, bool fast = false);
 pixel * resample_img_nn(pixel *src, int sw, int sh, int rw, int rh);
 pixel * resample_img(pixel *src, int sw, int sh, int rw, int rh, bool highQualityResample=true);
 pixel * rescale_img(pixel *src, int sw, int sh, int *qw, int *qh, int f);
@@ -0,0 +1,171 @@
+#include <cstring>
+#include "common/tpt-minmax.h"
+#include "RenderPipeline.h"
+#include "graphics.h"
+#include "luaconsole.h"
+#include "powder.h"
+#include "simulation/Simulation.h"
+#include "simulation/elements/FIGH.h"
+
+void FramePacket::Capture(Simulation *sim, Point mousePos)
+{
+	this->sim = sim;
+	this->mousePos = mousePos;
+	lastActiveIndex = sim->parts_lastActiveIndex;
+	parts.assign(sim->parts, sim->parts + lastActiveIndex + 1);
+	memcpy(pmap, ::pmap, sizeof(pmap));
+	memcpy(photons, ::photons, sizeof(photons));
+
+	memcpy(pv, sim->air->pv, sizeof(pv));
+	memcpy(vx, sim->air->vx, sizeof(vx));
+	memcpy(vy, sim->air->vy, sizeof(vy));
+	memcpy(hv, sim->air->hv, sizeof(hv));
+	memcpy(bmap, ::bmap, sizeof(bmap));
+	memcpy(emap, ::emap, sizeof(emap));
+	changedWalls = sim->changedWalls;
+	sim->ClearChangedWalls();
+
+	gravEnabled = sim->grav->IsEnabled();
+	if (gravEnabled)
+	{
+		memcpy(gravx, sim->grav->gravx, sizeof(gravx));
+		memcpy(gravy, sim->grav->gravy, sizeof(gravy));
+	}
+
+	STKM_ElementDataContainer &stkm = static_cast<STKM_ElementDataContainer&>(*sim->elementData[PT_STKM]);
+	stickman1 = *stkm.GetStickman1();
+	stickman2 = *stkm.GetStickman2();
+	FIGH_ElementDataContainer &figh = static_cast<FIGH_ElementDataContainer&>(*sim->elementData[PT_FIGH]);
+	fighters.resize(figh.MaxFighters());
+	for (int i = 0; i < figh.MaxFighters(); i++)
+		fighters[i] = *figh.Get(i);
+}
+
+RenderPipeline::~RenderPipeline()
+{
+	Stop();
+}
+
+void RenderPipeline::SetSimAhead(int frames)
+{
+	if (frames < 0)
+		frames = 0;
+	else if (frames > maxSimAhead)
+		frames = maxSimAhead;
+	simAhead = frames;
+}
+
+bool RenderPipeline::Active()
+{
+	bool wanted = simAhead > 0;
+#ifdef OGLR
+	wanted = false;
+#endif
+#ifdef LUACONSOLE
+	if (wanted && luacon_has_graphics_funcs())
+		wanted = false;
+#endif
+	if (wanted && !running)
+		Start();
+	else if (!wanted && running)
+		Stop();
+	return wanted;
+}
+
+void RenderPipeline::Start()
+{
+	backFrame.assign((XRES+BARSIZE)*YRES, 0);
+	readyFrame.assign((XRES+BARSIZE)*YRES, 0);
+	frameReady = false;
+	stopping = false;
+	running = true;
+	thread = std::thread([this]() { Worker(); });
+}
+
+void RenderPipeline::Stop()
+{
+	if (!running)
+		return;
+	{
+		std::lock_guard<std::mutex> g(pipelineMutex);
+		stopping = true;
+	}
+	packetCv.notify_all();
+	thread.join();
+
+	// fire_r/g/b and pers_bg now belong to the main thread again, packets that were never drawn are dropped.
+	// The wall changes they carried are lost with them, so the walls are all checked again
+	std::lock_guard<std::mutex> g(pipelineMutex);
+	for (auto &packet : queued)
+	{
+		packet->sim->AllWallsChanged();
+		unused.push_back(std::move(packet));
+	}
+	queued.clear();
+	inFlight = 0;
+	frameReady = false;
+	running = false;
+}
+
+void RenderPipeline::Worker()
+{
+	while (true)
+	{
+		std::unique_ptr<FramePacket> packet;
+		{
+			std::unique_lock<std::mutex> lock(pipelineMutex);
+			packetCv.wait(lock, [this]() { return stopping || !queued.empty(); });
+			if (stopping)
+				return;
+			packet = std::move(queued.front());
+			queued.pop_front();
+		}
+
+		pixel *frame = &backFrame[0];
+		render_before(frame, packet->sim, packet.get());
+		render_particle_layers(frame, frame, packet->sim, packet->mousePos, packet.get());
+
+		{
+			std::lock_guard<std::mutex> g(pipelineMutex);
+			std::swap(backFrame, readyFrame);
+			frameReady = true;
+			unused.push_back(std::move(packet));
+			inFlight--;
+		}
+		spaceCv.notify_all();
+		frameCv.notify_all();
+	}
+}
+
+void RenderPipeline::Submit(Simulation *sim, Point mousePos)
+{
+	std::unique_ptr<FramePacket> packet;
+	{
+		std::unique_lock<std::mutex> lock(pipelineMutex);
+		// back-pressure, the simulation waits here until the render thread catches up
+		spaceCv.wait(lock, [this]() { return inFlight < std::max(simAhead, 1); });
+		if (!unused.empty())
+		{
+			packet = std::move(unused.back());
+			unused.pop_back();
+		}
+		inFlight++;
+	}
+	// packets are big (pmap and photons alone are about 2MB), keep them around once allocated
+	if (!packet)
+		packet.reset(new FramePacket());
+	packet->Capture(sim, mousePos);
+
+	{
+		std::lock_guard<std::mutex> g(pipelineMutex);
+		queued.push_back(std::move(packet));
+	}
+	packetCv.notify_one();
+}
+
+void RenderPipeline::Composite(pixel *part_vbuf)
+{
+	std::unique_lock<std::mutex> lock(pipelineMutex);
+	frameCv.wait(lock, [this]() { return frameReady; });
+	memcpy(part_vbuf, &readyFrame[0], (XRES+BARSIZE)*YRES*PIXELSIZE);
+}
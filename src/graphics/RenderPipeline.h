@@ -0,0 +1,96 @@
+#ifndef RENDERPIPELINE_H
+#define RENDERPIPELINE_H
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "defines.h"
+#include "common/Point.h"
+#include "common/Singleton.h"
+#include "graphics/Pixel.h"
+#include "simulation/elements/STKM.h"
+
+class Simulation;
+
+// Everything render_before / render_parts read from the simulation, copied right after a tick
+// Only live particles are copied, parts has lastActiveIndex+1 entries
+struct FramePacket
+{
+	Simulation *sim = nullptr;
+	Point mousePos = Point(0, 0);
+	int lastActiveIndex = -1;
+	std::vector<particle> parts;
+	unsigned pmap[YRES][XRES];
+	unsigned photons[YRES][XRES];
+
+	float pv[YRES/CELL][XRES/CELL];
+	float vx[YRES/CELL][XRES/CELL];
+	float vy[YRES/CELL][XRES/CELL];
+	float hv[YRES/CELL][XRES/CELL];
+	unsigned char bmap[YRES/CELL][XRES/CELL];
+	unsigned char emap[YRES/CELL][XRES/CELL];
+	// taken from Simulation::changedWalls, which starts over for the next packet
+	std::vector<int> changedWalls;
+
+	bool gravEnabled = false;
+	float gravx[(YRES/CELL)*(XRES/CELL)];
+	float gravy[(YRES/CELL)*(XRES/CELL)];
+
+	Stickman stickman1, stickman2;
+	std::vector<Stickman> fighters;
+
+	void Capture(Simulation *sim, Point mousePos);
+};
+
+// Pipelined rendering: after each tick the main thread captures a FramePacket and hands it to a render
+// thread, which draws air, walls, particles and fire into a frame while the next tick is simulated. The main
+// thread only copies the newest finished frame and draws the overlays (signs, cursor, HUD) on top of it
+// The simulation may be at most simAhead frames ahead of the render thread, Submit blocks once that many
+// packets are in flight. A simAhead of 0 disables the pipeline and everything is drawn in order like before
+class RenderPipeline : public Singleton<RenderPipeline>
+{
+	std::thread thread;
+	std::mutex pipelineMutex;
+	std::condition_variable packetCv;
+	std::condition_variable spaceCv;
+	std::condition_variable frameCv;
+
+	std::deque<std::unique_ptr<FramePacket>> queued;
+	std::vector<std::unique_ptr<FramePacket>> unused;
+	// submitted packets that haven't finished rendering yet, including the one being drawn
+	int inFlight = 0;
+	int simAhead = 0;
+	bool running = false;
+	bool stopping = false;
+
+	// the render thread draws into backFrame, then swaps it with readyFrame
+	std::vector<pixel> backFrame, readyFrame;
+	bool frameReady = false;
+
+	void Worker();
+	void Start();
+
+public:
+	static const int maxSimAhead = 8;
+
+	~RenderPipeline();
+
+	int GetSimAhead() { return simAhead; }
+	void SetSimAhead(int frames);
+
+	// true if this frame should go through the pipeline, starts or stops the render thread to match
+	// Lua graphics functions can only run on the main thread, so they turn the pipeline off
+	bool Active();
+	void Stop();
+
+	// Capture the simulation's current state and queue it for the render thread, blocking while
+	// simAhead packets are already waiting
+	void Submit(Simulation *sim, Point mousePos);
+	// Copy the newest finished frame into part_vbuf, waits only if nothing has been rendered yet
+	void Composite(pixel *part_vbuf);
+};
+
+#endif // RENDERPIPELINE_H
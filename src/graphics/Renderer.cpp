@@ -1,7 +1,6 @@
 #include <cstring>
 #include <ctime>
 #include <fstream>
-#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include "graphics.h"
@@ -11,12 +10,11 @@
 #include "common/Format.h"
 #include "common/Platform.h"
 #include "game/Save.h"
+#include "graphics/RenderPipeline.h"
 #include "graphics/VideoBuffer.h"
+#include "graphics/VideoRecorder.h"
 
 Renderer::Renderer():
-	recording(false),
-	recordingIndex(0),
-	recordingFolder(0),
 	renderModes(std::set<unsigned int>()),
 	displayModes(std::set<unsigned int>()),
 	colorMode(0)
@@ -29,6 +27,11 @@ Renderer::Renderer():
 	InitRenderPresets();
 }
 
+Renderer::~Renderer()
+{
+	StopRecording();
+}
+
 std::string Renderer::TakeScreenshot(bool includeUI, int format)
 {
 	int w = includeUI ? XRES+BARSIZE : XRES;
@@ -79,52 +82,37 @@ std::string Renderer::TakeScreenshot(bool includeUI, int format)
 
 void Renderer::RecordingTick()
 {
-	if (!recording)
+	if (!recorder)
 		return;
-
-	gfx::VideoBuffer *screenshot = new gfx::VideoBuffer(XRES, YRES);
-	screenshot->CopyBufferFrom(vid_buf, XRES+BARSIZE, YRES+MENUSIZE, XRES, YRES);
-
-	std::vector<char> screenshotData = Format::VideoBufferToPPM(*screenshot);
-
-	std::stringstream fileName;
-	fileName << "recordings" << PATH_SEP << recordingFolder << PATH_SEP << "frame_"
-	         << std::setfill('0') << std::setw(6) << (recordingIndex++) << ".ppm";
-
-	try
-	{
-		std::ofstream screenshot;
-		screenshot.open(fileName.str(), std::ios::binary);
-		if (screenshot.is_open())
-		{
-			screenshot.write(&screenshotData[0], screenshotData.size());
-			screenshot.close();
-		}
-	}
-	catch (std::exception& e)
-	{
-		std::cout << "Error saving screenshot: " << e.what() << std::endl;
-	}
+	recorder->AddFrame(vid_buf, XRES+BARSIZE);
 }
 
 int Renderer::StartRecording()
 {
-	time_t startTime = time(NULL);
-	recordingFolder = startTime;
-	std::stringstream recordingDir;
-	recordingDir << "recordings" << PATH_SEP << recordingFolder;
+	StopRecording();
+	int startTime = (int)time(NULL);
+	std::stringstream fileName;
+	fileName << "recordings" << PATH_SEP << startTime << ".tptrec";
 	Platform::MakeDirectory("recordings");
-	Platform::MakeDirectory(recordingDir.str());
-	recording = true;
-	recordingIndex = 0;
-	return recordingFolder;
+	recorder.reset(new VideoRecorder(fileName.str(), XRES, YRES));
+	if (!recorder->IsOpen())
+	{
+		recorder.reset();
+		return 0;
+	}
+	return startTime;
 }
 
-void Renderer::StopRecording()
+void Renderer::StopRecording(unsigned int *framesWritten, unsigned int *framesDropped)
 {
-	recording = false;
-	recordingIndex = 0;
-	recordingFolder = 0;
+	if (!recorder)
+		return;
+	recorder->Stop();
+	if (framesWritten)
+		*framesWritten = recorder->GetFramesWritten();
+	if (framesDropped)
+		*framesDropped = recorder->GetFramesDropped();
+	recorder.reset();
 }
 
 void Renderer::InitRenderPresets()
@@ -196,6 +184,7 @@ bool Renderer::LoadRenderPreset(int preset)
 	render_mode = GetRenderModesRaw();
 	display_mode = GetDisplayModesRaw();
 
+	RenderPipeline::Ref().Stop();
 	if (HasRenderMode(RENDER_FIRE))
 	{
 		memset(fire_r, 0, sizeof(fire_r));
@@ -297,7 +286,10 @@ void Renderer::ToggleDisplayMode(unsigned int displayMode)
 	display_mode = GetDisplayModesRaw();
 
 	if (displayMode == DISPLAY_PERS)
+	{
+		RenderPipeline::Ref().Stop();
 		memset(pers_bg, 0, (XRES+BARSIZE)*YRES*PIXELSIZE);
+	}
 }
 
 void Renderer::ClearDisplayModes()
@@ -1,6 +1,7 @@
 #ifndef RENDERER_H
 #define RENDERER_H
 
+#include <memory>
 #include <set>
 #include <string>
 #include "common/Singleton.h"
@@ -19,6 +20,7 @@
 #define CM_COUNT 11
 
 class Save;
+class VideoRecorder;
 
 struct RenderPreset
 {
@@ -31,9 +33,7 @@ struct RenderPreset
 // This class is mostly unused at the moment, but is used for controlling render / display modes
 class Renderer : public Singleton<Renderer>
 {
-	bool recording;
-	int recordingIndex;
-	int recordingFolder;
+	std::unique_ptr<VideoRecorder> recorder;
 
 	std::set<unsigned int> renderModes;
 	std::set<unsigned int> displayModes;
@@ -45,11 +45,13 @@ class Renderer : public Singleton<Renderer>
 
 public:
 	Renderer();
+	~Renderer();
 
 	std::string TakeScreenshot(bool includeUI, int format);
 	void RecordingTick();
+	// Starts recording to recordings/<time>.tptrec, returns the time used in the name or 0 on failure
 	int StartRecording();
-	void StopRecording();
+	void StopRecording(unsigned int *framesWritten = nullptr, unsigned int *framesDropped = nullptr);
 
 	bool LoadRenderPreset(int preset);
 	std::string GetRenderPresetToolTip(int preset);
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <climits>
+#ifdef X86_SSE2
+#include <emmintrin.h>
+#endif
+#include "TextCache.h"
+
+using namespace gfx;
+
+void TextRun::Rasterise(const std::vector<TextDot> &dots, int advance, bool cacheable)
+{
+	this->advance = advance;
+	this->cacheable = cacheable;
+	rasterised = true;
+	colour.clear();
+	alpha.clear();
+	width = height = 0;
+	if (!cacheable || dots.empty())
+		return;
+
+	int minX = INT_MAX, minY = INT_MAX, maxX = INT_MIN, maxY = INT_MIN;
+	for (const TextDot &dot : dots)
+	{
+		minX = std::min(minX, dot.x);
+		minY = std::min(minY, dot.y);
+		maxX = std::max(maxX, dot.x);
+		maxY = std::max(maxY, dot.y);
+	}
+	left = minX;
+	top = minY;
+	width = maxX - minX + 1;
+	height = maxY - minY + 1;
+	colour.assign(width * height, 0);
+	alpha.assign(width * height, 0);
+	for (const TextDot &dot : dots)
+	{
+		int offset = (dot.y - top) * width + dot.x - left;
+		// blending twice in a row can't be stored as one alpha with drawpixel's rounding, draw those directly
+		if (alpha[offset])
+		{
+			this->cacheable = false;
+			colour.clear();
+			alpha.clear();
+			width = height = 0;
+			return;
+		}
+		colour[offset] = dot.colour;
+		alpha[offset] = dot.alpha * 0x01010101U;
+	}
+}
+
+void TextRun::Blit(pixel *vid, int x, int y, int vidWidth, int vidHeight) const
+{
+	int startX = std::max(0, -(x + left)), endX = std::min(width, vidWidth - (x + left));
+	int startY = std::max(0, -(y + top)), endY = std::min(height, vidHeight - (y + top));
+	for (int j = startY; j < endY; j++)
+	{
+		pixel *dst = vid + (y + top + j) * vidWidth + x + left;
+		const pixel *src = &colour[j * width], *srcAlpha = &alpha[j * width];
+		int i = startX;
+#ifdef X86_SSE2
+		const __m128i zero = _mm_setzero_si128(), full = _mm_set1_epi16(255);
+		const __m128i rgbMask = _mm_set1_epi32(PIXRGB(255, 255, 255)), opaque = _mm_set1_epi32(-1);
+		for (; i + 4 <= endX; i += 4)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(srcAlpha + i));
+			__m128i empty = _mm_cmpeq_epi32(a, zero);
+			if (_mm_movemask_epi8(empty) == 0xFFFF)
+				continue;
+			__m128i c = _mm_loadu_si128((const __m128i *)(src + i));
+			__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+			// (a*c + (255-a)*d) >> 8 for every channel, like drawpixel
+			__m128i aLo = _mm_unpacklo_epi8(a, zero), aHi = _mm_unpackhi_epi8(a, zero);
+			__m128i lo = _mm_add_epi16(_mm_mullo_epi16(aLo, _mm_unpacklo_epi8(c, zero)), _mm_mullo_epi16(_mm_sub_epi16(full, aLo), _mm_unpacklo_epi8(d, zero)));
+			__m128i hi = _mm_add_epi16(_mm_mullo_epi16(aHi, _mm_unpackhi_epi8(c, zero)), _mm_mullo_epi16(_mm_sub_epi16(full, aHi), _mm_unpackhi_epi8(d, zero)));
+			__m128i blended = _mm_and_si128(_mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)), rgbMask);
+			// full alpha is a plain copy and zero alpha leaves the pixel alone, also like drawpixel
+			__m128i solid = _mm_cmpeq_epi32(a, opaque);
+			blended = _mm_or_si128(_mm_and_si128(solid, c), _mm_andnot_si128(solid, blended));
+			blended = _mm_or_si128(_mm_and_si128(empty, d), _mm_andnot_si128(empty, blended));
+			_mm_storeu_si128((__m128i *)(dst + i), blended);
+		}
+#endif
+		for (; i < endX; i++)
+		{
+			int a = srcAlpha[i] & 0xFF;
+			if (!a)
+				continue;
+			if (a == 255)
+				dst[i] = src[i];
+			else
+			{
+				pixel t = dst[i];
+				dst[i] = PIXRGB((a*PIXR(src[i]) + (255-a)*PIXR(t)) >> 8, (a*PIXG(src[i]) + (255-a)*PIXG(t)) >> 8, (a*PIXB(src[i]) + (255-a)*PIXB(t)) >> 8);
+			}
+		}
+	}
+}
+
+TextRun & TextCache::Get(const char *text, int r, int g, int b, int a, bool noColor)
+{
+	std::string key(text);
+	key.push_back('\0');
+	key.push_back((char)r);
+	key.push_back((char)g);
+	key.push_back((char)b);
+	key.push_back((char)a);
+	key.push_back(noColor ? 1 : 0);
+
+	clock++;
+	auto found = runs.find(key);
+	if (found == runs.end())
+	{
+		if (runs.size() >= maxRuns)
+		{
+			// drop everything that wasn't drawn recently, and if that isn't enough, start over
+			for (auto iter = runs.begin(); iter != runs.end();)
+			{
+				if (clock - iter->second.lastUse > maxRuns)
+					iter = runs.erase(iter);
+				else
+					++iter;
+			}
+			if (runs.size() >= maxRuns)
+				runs.clear();
+		}
+		found = runs.emplace(std::move(key), TextRun()).first;
+	}
+	TextRun &run = found->second;
+	run.lastUse = clock;
+	if (run.uses < INT_MAX)
+		run.uses++;
+	return run;
+}
+
+TextCache & TextCache::ForThisThread()
+{
+	static thread_local TextCache cache;
+	return cache;
+}
@@ -0,0 +1,62 @@
+#ifndef TEXTCACHE_H
+#define TEXTCACHE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Pixel.h"
+
+namespace gfx
+{
+
+// One pixel of a glyph, as drawtext would have passed it to drawpixel
+struct TextDot
+{
+	int x, y;
+	pixel colour;
+	int alpha;
+};
+
+// A string drawtext has already laid out and rasterised: colour and alpha for every pixel of its bounding box,
+// relative to the position it is drawn at. Colour escapes are already applied, so drawing it again is one
+// blended copy of the box
+struct TextRun
+{
+	int left = 0, top = 0, width = 0, height = 0;
+	// what drawtext returns, minus the x it was given
+	int advance = 0;
+	bool rasterised = false;
+	// false for text that can't be drawn from the masks, highlights or glyphs that overlap each other
+	bool cacheable = true;
+	std::vector<pixel> colour;
+	// the alpha repeated in all four bytes, so it lines up with colour
+	std::vector<pixel> alpha;
+	int uses = 0;
+	unsigned int lastUse = 0;
+
+	void Rasterise(const std::vector<TextDot> &dots, int advance, bool cacheable);
+	// Blends the run into vid (vidWidth*vidHeight, no padding) at x, y, with the same rounding as drawpixel
+	void Blit(pixel *vid, int x, int y, int vidWidth, int vidHeight) const;
+};
+
+// drawtext's runs, keyed by string, colour, alpha and whether colour escapes are ignored. There is only one font.
+// Changed text is simply a new key, runs that stop being drawn get evicted. Each thread has its own cache,
+// since the render thread draws text too (streamline walls)
+class TextCache
+{
+	std::unordered_map<std::string, TextRun> runs;
+	unsigned int clock = 0;
+
+public:
+	static const size_t maxRuns = 1024;
+
+	TextRun & Get(const char *text, int r, int g, int b, int a, bool noColor);
+	void Clear() { runs.clear(); }
+	size_t Size() { return runs.size(); }
+
+	static TextCache & ForThisThread();
+};
+
+}
+
+#endif // TEXTCACHE_H
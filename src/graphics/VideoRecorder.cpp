@@ -0,0 +1,177 @@
+#include <cstring>
+#include <zlib.h>
+#include "VideoRecorder.h"
+
+static void WriteUint32(unsigned char *dst, unsigned int value)
+{
+	dst[0] = value & 0xFF;
+	dst[1] = (value >> 8) & 0xFF;
+	dst[2] = (value >> 16) & 0xFF;
+	dst[3] = (value >> 24) & 0xFF;
+}
+
+VideoRecorder::VideoRecorder(std::string filename, int width, int height, int bufferCount):
+	width(width),
+	height(height),
+	file(nullptr)
+{
+	file = fopen(filename.c_str(), "wb");
+	if (!file)
+		return;
+
+	unsigned char header[16];
+	memcpy(header, "TPTREC01", 8);
+	WriteUint32(header + 8, width);
+	WriteUint32(header + 12, height);
+	if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+	{
+		fclose(file);
+		file = nullptr;
+		return;
+	}
+
+	unused.resize(bufferCount);
+	for (auto &frame : unused)
+		frame.pixels.resize(width * height);
+	thread = std::thread([this]() { Encoder(); });
+}
+
+VideoRecorder::~VideoRecorder()
+{
+	Stop();
+}
+
+bool VideoRecorder::AddFrame(const pixel *src, int stride)
+{
+	std::unique_lock<std::mutex> lock(recorderMutex);
+	if (!file || stopping || failed)
+		return false;
+	unsigned int number = frameNumber++;
+	if (unused.empty())
+	{
+		framesDropped++;
+		return false;
+	}
+	Frame frame = std::move(unused.back());
+	unused.pop_back();
+	lock.unlock();
+
+	frame.number = number;
+	for (int y = 0; y < height; y++)
+		std::copy(src + y * stride, src + y * stride + width, frame.pixels.begin() + y * width);
+
+	lock.lock();
+	queued.push_back(std::move(frame));
+	lock.unlock();
+	queueCv.notify_one();
+	return true;
+}
+
+void VideoRecorder::Encoder()
+{
+	current.resize(width * height * 3);
+	previous.resize(width * height * 3);
+	delta.resize(width * height * 3);
+	compressed.resize(compressBound(width * height * 3));
+
+	while (true)
+	{
+		Frame frame;
+		{
+			std::unique_lock<std::mutex> lock(recorderMutex);
+			queueCv.wait(lock, [this]() { return stopping || !queued.empty(); });
+			// keep going after Stop() until the queue is empty, so no recorded frame is lost
+			if (queued.empty())
+			{
+				// the end marker carries the total frame count, so frames dropped at the very end are accounted for too
+				unsigned char marker[9];
+				WriteUint32(marker, frameNumber);
+				marker[4] = frameEnd;
+				WriteUint32(marker + 5, 0);
+				if (!failed)
+					fwrite(marker, 1, sizeof(marker), file);
+				return;
+			}
+			frame = std::move(queued.front());
+			queued.pop_front();
+		}
+
+		bool success = !failed && Encode(frame);
+
+		std::lock_guard<std::mutex> g(recorderMutex);
+		if (success)
+			framesWritten++;
+		else
+		{
+			failed = true;
+			framesDropped++;
+		}
+		unused.push_back(std::move(frame));
+	}
+}
+
+bool VideoRecorder::Encode(const Frame &frame)
+{
+	unsigned char *rgb = &current[0];
+	for (int i = 0; i < width * height; i++)
+	{
+		pixel p = frame.pixels[i];
+		*rgb++ = PIXR(p);
+		*rgb++ = PIXG(p);
+		*rgb++ = PIXB(p);
+	}
+
+	unsigned char type = frameKey;
+	const unsigned char *source = &current[0];
+	if (framesWritten && sinceKeyframe < keyframeInterval)
+	{
+		type = frameDelta;
+		for (size_t i = 0; i < current.size(); i++)
+			delta[i] = current[i] ^ previous[i];
+		source = &delta[0];
+		sinceKeyframe++;
+	}
+	else
+		sinceKeyframe = 1;
+
+	// level 1, compression has to keep up with the frame rate and the XORed frames are mostly zeros anyway
+	uLongf compressedSize = compressed.size();
+	if (compress2(&compressed[0], &compressedSize, source, current.size(), Z_BEST_SPEED) != Z_OK)
+		return false;
+
+	unsigned char header[9];
+	WriteUint32(header, frame.number);
+	header[4] = type;
+	WriteUint32(header + 5, compressedSize);
+	if (fwrite(header, 1, sizeof(header), file) != sizeof(header) || fwrite(&compressed[0], 1, compressedSize, file) != compressedSize)
+		return false;
+
+	std::swap(current, previous);
+	return true;
+}
+
+void VideoRecorder::Stop()
+{
+	{
+		std::lock_guard<std::mutex> g(recorderMutex);
+		if (!file || stopping)
+			return;
+		stopping = true;
+	}
+	queueCv.notify_all();
+	thread.join();
+	fclose(file);
+	file = nullptr;
+}
+
+unsigned int VideoRecorder::GetFramesWritten()
+{
+	std::lock_guard<std::mutex> g(recorderMutex);
+	return framesWritten;
+}
+
+unsigned int VideoRecorder::GetFramesDropped()
+{
+	std::lock_guard<std::mutex> g(recorderMutex);
+	return framesDropped;
+}
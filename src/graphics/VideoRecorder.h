@@ -0,0 +1,76 @@
+#ifndef VIDEORECORDER_H
+#define VIDEORECORDER_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "graphics/Pixel.h"
+
+// Records frames into a single .tptrec stream, utility/extract-recording.cpp turns it back into PNGs
+//
+// Layout, all numbers little endian:
+//   header: "TPTREC01", uint32 width, uint32 height
+//   frame:  uint32 frame number, uint8 type, uint32 size, then size bytes of zlib data
+// The zlib data inflates to width*height RGB triples. Keyframes (type 0) are the image itself, delta frames
+// (type 1) are XORed with the previous frame, which leaves mostly zeros for zlib to squash. Frame numbers
+// skip over frames that were dropped, so the original timing can be rebuilt. The stream ends with a type 2
+// frame that has no data, its number is the total count of frames recorded
+//
+// The main thread only copies the frame into a free buffer, conversion, compression and disk writes all
+// happen on the encoder thread. When every buffer is still queued, the frame is dropped instead of waiting
+class VideoRecorder
+{
+public:
+	static const unsigned char frameKey = 0;
+	static const unsigned char frameDelta = 1;
+	static const unsigned char frameEnd = 2;
+	static const int keyframeInterval = 300;
+
+private:
+	struct Frame
+	{
+		unsigned int number;
+		std::vector<pixel> pixels;
+	};
+
+	int width, height;
+	FILE *file;
+	std::thread thread;
+	std::mutex recorderMutex;
+	std::condition_variable queueCv;
+	std::deque<Frame> queued;
+	std::vector<Frame> unused;
+	bool stopping = false;
+	bool failed = false;
+
+	unsigned int frameNumber = 0;
+	unsigned int framesWritten = 0;
+	unsigned int framesDropped = 0;
+
+	// encoder thread state
+	std::vector<unsigned char> current, previous, delta, compressed;
+	unsigned int sinceKeyframe = 0;
+
+	void Encoder();
+	bool Encode(const Frame &frame);
+
+public:
+	VideoRecorder(std::string filename, int width, int height, int bufferCount = 8);
+	~VideoRecorder();
+
+	bool IsOpen() { return file != nullptr; }
+	// Copies width*height pixels out of src, which has rows stride pixels apart
+	// Returns false if the frame had to be dropped
+	bool AddFrame(const pixel *src, int stride);
+	// Writes out everything still queued and closes the file
+	void Stop();
+
+	unsigned int GetFramesWritten();
+	unsigned int GetFramesDropped();
+};
+
+#endif // VIDEORECORDER_H
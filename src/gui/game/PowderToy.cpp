@@ -993,6 +993,46 @@ void PowderToy::LoadRenderPreset(int preset)
 	}
 }
 
+// Keeps drawing with the tool while the mouse is held down, unless a mouse move already drew this tick
+void PowderToy::ApplyHeldTool()
+{
+	if (skipDraw)
+	{
+		skipDraw = false;
+		return;
+	}
+	if (!isMouseDown)
+		return;
+
+	if (drawState == POINTS)
+	{
+		activeTools[toolIndex]->DrawLine(sim, currentBrush, lastDrawPoint, cursor, true, toolStrength);
+		lastDrawPoint = cursor;
+	}
+	else if (drawState == LINE)
+	{
+		if (((ToolTool*)activeTools[toolIndex])->GetID() == TOOL_WIND)
+		{
+			Point drawPoint2 = cursor;
+			if (altHeld)
+				drawPoint2 = LineSnapCoords(initialDrawPoint, cursor);
+			activeTools[toolIndex]->DrawLine(sim, currentBrush, initialDrawPoint, drawPoint2, false, toolStrength);
+		}
+	}
+	else if (drawState == FILL)
+	{
+		activeTools[toolIndex]->FloodFill(sim, currentBrush, cursor);
+	}
+}
+
+void PowderToy::OnSkippedTick()
+{
+	ApplyHeldTool();
+#ifdef LUACONSOLE
+	luacon_step(mouse.X, mouse.Y);
+#endif
+}
+
 // Engine events
 void PowderToy::OnTick(uint32_t ticks)
 {
@@ -1015,30 +1055,7 @@ void PowderToy::OnTick(uint32_t ticks)
 		loginCheckTicks = (loginCheckTicks+1)%51;
 	waitToDraw = false;
 
-	if (skipDraw)
-		skipDraw = false;
-	else if (isMouseDown)
-	{
-		if (drawState == POINTS)
-		{
-			activeTools[toolIndex]->DrawLine(sim, currentBrush, lastDrawPoint, cursor, true, toolStrength);
-			lastDrawPoint = cursor;
-		}
-		else if (drawState == LINE)
-		{
-			if (((ToolTool*)activeTools[toolIndex])->GetID() == TOOL_WIND)
-			{
-				Point drawPoint2 = cursor;
-				if (altHeld)
-					drawPoint2 = LineSnapCoords(initialDrawPoint, cursor);
-				activeTools[toolIndex]->DrawLine(sim, currentBrush, initialDrawPoint, drawPoint2, false, toolStrength);
-			}
-		}
-		else if (drawState == FILL)
-		{
-			activeTools[toolIndex]->FloodFill(sim, currentBrush, cursor);
-		}
-	}
+	ApplyHeldTool();
 
 	if (versionCheck && versionCheck->CheckDone())
 	{
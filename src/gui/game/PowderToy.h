@@ -124,6 +124,8 @@ private:
 	bool previousPause;
 	bool restorePreviousPause;
 
+	void ApplyHeldTool();
+
 public:
 	PowderToy();
 	~PowderToy();
@@ -184,6 +186,10 @@ public:
 	void TranslateSave(Point point);
 	void TransformSave(int a, int b, int c, int d);
 
+	// frame skipping calls this after each tick that won't be drawn, so a held tool and Lua tick handlers still
+	// run once per simulated tick like they do without it
+	void OnSkippedTick();
+
 	void OnTick(uint32_t ticks) override;
 	void OnDraw(gfx::VideoBuffer *buf) override;
 	void OnMouseMove(int x, int y, Point difference) override;
@@ -11,6 +11,7 @@
 
 #include "common/tpt-minmax.h"
 #include "game/Menus.h"
+#include "graphics/FrameSkip.h"
 #include "simulation/Simulation.h"
 #include "simulation/Tool.h"
 #include "simulation/WallNumbers.h"
@@ -327,6 +328,11 @@ void SetLeftHudText(Simulation * sim, float FPSB2)
 	{
 		sprintf(tempstring,"FPS:%0.*f ",currentHud[3],FPSB2);
 		strappend(uitext,tempstring);
+		if (FrameSkip::Ref().Enabled())
+		{
+			sprintf(tempstring,"TPS:%0.*f (x%d) ",currentHud[3],FrameSkip::Ref().GetTickRate(),FrameSkip::Ref().GetRatio());
+			strappend(uitext,tempstring);
+		}
 	}
 	if (currentHud[4])
 	{
@@ -68,6 +68,8 @@
 #include "game/Menus.h"
 #include "game/Save.h"
 #include "game/Sign.h"
+#include "game/StampIndex.h"
+#include "game/ThumbnailCache.h"
 #include "game/ToolTip.h"
 #include "interface/Engine.h"
 #include "json/json.h"
@@ -112,8 +114,7 @@ int	  search_scoredown[GRID_X*GRID_Y];
 int	  search_scoreup[GRID_X*GRID_Y];
 char *search_names[GRID_X*GRID_Y];
 char *search_owners[GRID_X*GRID_Y];
-void *search_thumbs[GRID_X*GRID_Y];
-int   search_thsizes[GRID_X*GRID_Y];
+std::string search_thumb_ids[GRID_X*GRID_Y];
 
 int search_own = 0;
 int search_fav = 0;
@@ -1897,6 +1898,7 @@ int stamp_ui(pixel *vid_buf, int *reorder)
 					x = (XRES*i)/GRID_X + XRES/(GRID_X*2);
 					y = (YRES*j)/GRID_Y + YRES/(GRID_Y*2);
 					gy -= 20;
+					int thumbStatus = stamp_gen_thumb(k);
 					w = stamps[k].thumb_w;
 					h = stamps[k].thumb_h;
 					x -= w/2;
@@ -1906,6 +1908,10 @@ int stamp_ui(pixel *vid_buf, int *reorder)
 						draw_image(vid_buf, stamps[k].thumb, gx+(((XRES/GRID_S)/2)-(w/2)), gy+(((YRES/GRID_S)/2)-(h/2)), w, h, 255);
 						xor_rect(vid_buf, gx+(((XRES/GRID_S)/2)-(w/2)), gy+(((YRES/GRID_S)/2)-(h/2)), w, h);
 					}
+					else if (thumbStatus == STAMP_THUMB_PENDING)
+					{
+						drawtext(vid_buf, gx+XRES/(GRID_S*2)-textwidth("Loading...")/2, gy+((YRES/GRID_S)/2)-4, "Loading...", 128, 128, 128, 255);
+					}
 					else
 					{
 						drawtext(vid_buf, gx+8, gy+((YRES/GRID_S)/2)-4, "Error loading stamp", 255, 255, 255, 255);
@@ -1919,7 +1925,7 @@ int stamp_ui(pixel *vid_buf, int *reorder)
 					}
 					else
 					{
-						if (mx>=gx && mx<gx+(XRES/GRID_S) && my>=gy && my<gy+(YRES/GRID_S) && stamps[k].thumb)
+						if (mx>=gx && mx<gx+(XRES/GRID_S) && my>=gy && my<gy+(YRES/GRID_S) && thumbStatus != STAMP_THUMB_FAILED)
 						{
 							r = k;
 							drawrect(vid_buf, gx-2, gy-2, XRES/GRID_S+3, YRES/GRID_S+3, 128, 128, 210, 255);
@@ -2007,6 +2013,7 @@ int stamp_ui(pixel *vid_buf, int *reorder)
 			if (stamp_page)
 			{
 				stamp_page --;
+				StampIndex::Ref().CancelPending();
 			}
 			sdl_wheel = 0;
 		}
@@ -2015,6 +2022,7 @@ int stamp_ui(pixel *vid_buf, int *reorder)
 			if (stamp_page<page_count-1)
 			{
 				stamp_page ++;
+				StampIndex::Ref().CancelPending();
 			}
 			sdl_wheel = 0;
 		}
@@ -2044,6 +2052,8 @@ int stamp_ui(pixel *vid_buf, int *reorder)
 
 	for (i=0; i<STAMP_MAX; i++)
 		stamps[i].dodelete = 0;
+	StampIndex::Ref().CancelPending();
+	StampIndex::Ref().Save();
 	return r;
 }
 
@@ -3255,13 +3265,11 @@ void QuickoptionsMenu(pixel *vid_buf, int b, int bq, int x, int y)
 struct thumbDownloadInfo
 {
 	Request *req;
-	char *imgId;
-	int pos;
+	std::string imgId;
 
-	thumbDownloadInfo(Request *req, char *imgId, int pos):
+	thumbDownloadInfo(Request *req, std::string imgId):
 		req(req),
-		imgId(imgId),
-		pos(pos)
+		imgId(imgId)
 	{}
 };
 
@@ -3275,13 +3283,11 @@ int search_ui(pixel *vid_buf)
 	bool dragging = false;
 #else
 	const int xOffset = 0;
-	int nmp = -1;
 #endif
 	int touchOffset = 0;
 	bool touchDragged = false; // when true, ignore clicks on saves
 	int thumb_drawn[GRID_X*GRID_Y];
 	pixel *v_buf = (pixel *)malloc(((YRES+MENUSIZE)*(XRES+BARSIZE))*PIXELSIZE);
-	pixel *bthumb_rsdata = NULL;
 	float ry;
 	ui_edit ed;
 	ui_richtext motd;
@@ -3306,8 +3312,8 @@ int search_ui(pixel *vid_buf)
 	memset(search_scoredown, 0, sizeof(search_scoredown));
 	memset(search_publish, 0, sizeof(search_publish));
 	memset(search_owners, 0, sizeof(search_owners));
-	memset(search_thumbs, 0, sizeof(search_thumbs));
-	memset(search_thsizes, 0, sizeof(search_thsizes));
+	for (pos = 0; pos < GRID_X*GRID_Y; pos++)
+		search_thumb_ids[pos].clear();
 
 	memset(thumb_drawn, 0, sizeof(thumb_drawn));
 
@@ -3558,19 +3564,15 @@ int search_ui(pixel *vid_buf)
 				}
 				else
 					drawtext(vid_buf, gx+XRES/(GRID_S*2)-j/2, gy+YRES/GRID_S+20, search_owners[pos], 128, 128, 128, 255);
-				if (search_thumbs[pos]&&thumb_drawn[pos]==0)
+				if (!search_thumb_ids[pos].empty() && thumb_drawn[pos]==0)
 				{
-					//render_thumb(search_thumbs[pos], search_thsizes[pos], 1, v_buf, gx, gy, GRID_S);
-					int finh, finw;
-					pixel *thumb_rsdata = NULL;
-					pixel *thumb_imgdata = ptif_unpack(search_thumbs[pos], search_thsizes[pos], &finw, &finh);
-					if(thumb_imgdata!=NULL){
-						thumb_rsdata = resample_img(thumb_imgdata, finw, finh, XRES/GRID_S, YRES/GRID_S);
-						draw_image(v_buf, thumb_rsdata, gx-touchOffset, gy, XRES/GRID_S, YRES/GRID_S, 255);
-						free(thumb_imgdata);
-						free(thumb_rsdata);
+					// Decoded in the background, just try again next frame if it isn't ready yet
+					ThumbnailCache::Image thumb = ThumbnailCache::Ref().GetDecoded(search_thumb_ids[pos], XRES/GRID_S, YRES/GRID_S);
+					if (thumb)
+					{
+						draw_image(v_buf, thumb->data(), gx-touchOffset, gy, XRES/GRID_S, YRES/GRID_S, 255);
+						thumb_drawn[pos] = 1;
 					}
-					thumb_drawn[pos] = 1;
 				}
 				own = (svf_login && (!strcmp(svf_user, search_owners[pos]) || svf_admin || svf_mod));
 				if (mx>=gx-2 && mx<=gx+XRES/GRID_S+3 && my>=gy && my<=gy+YRES/GRID_S+29)
@@ -3687,21 +3689,11 @@ int search_ui(pixel *vid_buf)
 			if (gy+h>=YRES+(MENUSIZE-2)) gy=YRES+(MENUSIZE-3)-h;
 			clearrect(vid_buf, gx-1, gy-2, w+3, h-1);
 			drawrect(vid_buf, gx-2, gy-3, w+4, h, 160, 160, 192, 255);
-			if (search_thumbs[mp]){
-				if(mp != nmp && bthumb_rsdata){
-					free(bthumb_rsdata);
-					bthumb_rsdata = NULL;
-				}
-				if(!bthumb_rsdata){
-					int finh, finw;
-					pixel *thumb_imgdata = ptif_unpack(search_thumbs[mp], search_thsizes[mp], &finw, &finh);
-					if(thumb_imgdata!=NULL){
-						bthumb_rsdata = resample_img(thumb_imgdata, finw, finh, XRES/GRID_Z, YRES/GRID_Z, false);
-						free(thumb_imgdata);
-					}
-				}
-				draw_image(vid_buf, bthumb_rsdata, gx+(w-(XRES/GRID_Z))/2, gy, XRES/GRID_Z, YRES/GRID_Z, 255);
-				nmp = mp;
+			if (!search_thumb_ids[mp].empty())
+			{
+				ThumbnailCache::Image thumb = ThumbnailCache::Ref().GetDecoded(search_thumb_ids[mp], XRES/GRID_Z, YRES/GRID_Z, true);
+				if (thumb)
+					draw_image(vid_buf, thumb->data(), gx+(w-(XRES/GRID_Z))/2, gy, XRES/GRID_Z, YRES/GRID_Z, 255);
 			}
 			drawtext(vid_buf, gx+(w-i)/2, gy+YRES/GRID_Z+4, search_names[mp], 192, 192, 192, 255);
 			drawtext(vid_buf, gx+(w-textwidth(search_owners[mp]))/2, gy+YRES/GRID_Z+16, search_owners[mp], 128, 128, 128, 255);
@@ -3914,7 +3906,12 @@ int search_ui(pixel *vid_buf)
 
 			if (saveListDownload)
 				saveListDownload->Cancel();
+			// the page changed, thumbnails still on the way for the old one are no use anymore
+			for (auto requestPair : thumbDownloads)
+				requestPair.req->Cancel();
+			thumbDownloads.clear();
 			saveListDownload = new Request(uri.str());
+			saveListDownload->SetPriority(PRIORITY_HIGH);
 			if (svf_login)
 				saveListDownload->AuthHeaders(svf_user_id, svf_session_id);
 			saveListDownload->Start();
@@ -3930,12 +3927,10 @@ int search_ui(pixel *vid_buf)
 			touchOffset = 0;
 			if (status == 200)
 			{
+				ThumbnailCache::Ref().CancelDecodes();
 				page_count = search_results((char*)results, true);
 				memset(thumb_drawn, 0, sizeof(thumb_drawn));
 				memset(v_buf, 0, ((YRES+MENUSIZE)*(XRES+BARSIZE))*PIXELSIZE);
-#ifndef TOUCHUI
-				nmp = -1;
-#endif
 				
 				if (is_p1)
 				{
@@ -3950,32 +3945,25 @@ int search_ui(pixel *vid_buf)
 			else
 				searchFailureCode = status;
 			for (auto requestPair : thumbDownloads)
-			{
-				free(requestPair.imgId);
 				requestPair.req->Cancel();
-			}
 			thumbDownloads.clear();
+			// Everything on the page is on screen, requests of the same priority go out in the order they were made,
+			// so thumbnails arrive in the order they are drawn in. The save list and opened saves go first
+			// History thumbnails never change, once the thumbnail cache has one it's final. The current version of a
+			// save is always asked for again, through the HTTP cache, so an updated save doesn't keep its old
+			// thumbnail. Whatever is in memory is shown until the answer comes back
 			for (pos=0; pos<GRID_X*GRID_Y; pos++)
 			{
-				std::stringstream uri;
-				char *imgID = nullptr;
-				if (search_dates[pos])
+				std::string imgID = search_thumb_ids[pos];
+				bool immutable = ThumbnailCache::Immutable(imgID);
+				if (!imgID.empty() && !(immutable && ThumbnailCache::Ref().Contains(imgID)))
 				{
-					std::stringstream tempID;
-					tempID << search_ids[pos] << "_" << search_dates[pos];
-					imgID = mystrdup(tempID.str().c_str());
-					uri << STATICSCHEME << STATICSERVER << "/" << search_ids[pos] << "_" << search_dates[pos] << "_small.pti";
-				}
-				else if (search_ids[pos])
-				{
-					imgID = mystrdup(search_ids[pos]);
-					uri << STATICSCHEME STATICSERVER "/" << search_ids[pos] << "_small.pti";
-				}
-				if (imgID && !thumb_cache_find(imgID, search_thumbs + pos, search_thsizes + pos))
-				{
-					Request *req = new Request(uri.str());
+					Request *req = new Request(STATICSCHEME STATICSERVER "/" + imgID + "_small.pti");
+					req->SetPriority(PRIORITY_NORMAL);
+					if (!immutable)
+						req->UseCache();
 					req->Start();
-					thumbDownloads.push_back(thumbDownloadInfo(req, imgID, pos));
+					thumbDownloads.push_back(thumbDownloadInfo(req, imgID));
 				}
 				saveListDownload = nullptr;
 			}
@@ -3987,17 +3975,8 @@ int search_ui(pixel *vid_buf)
 			{
 				int status;
 				std::string thumbStr = iter->req->Finish(&status);
-				char *thumb = (char*)malloc(thumbStr.size() + 1);// mystrdup(thumbStr.c_str());
-				memcpy(thumb, thumbStr.c_str(), thumbStr.size());
-				int len = thumbStr.size();
-				if (thumb && status == 200)
-				{
-					thumb_cache_add(iter->imgId, thumb, len);
-					int pos = iter->pos;
-					search_thumbs[pos] = thumb;
-					search_thsizes[pos] = len;
-				}
-				free(iter->imgId);
+				if (status == 200)
+					ThumbnailCache::Ref().Add(iter->imgId, thumbStr);
 				iter = thumbDownloads.erase(iter);
 			}
 			else
@@ -4012,15 +3991,8 @@ finish:
 	if (saveListDownload)
 		saveListDownload->Cancel();
 	for (auto requestPair : thumbDownloads)
-	{
-		free(requestPair.imgId);
 		requestPair.req->Cancel();
-	}
-			
-	if(bthumb_rsdata){
-		free(bthumb_rsdata);
-		bthumb_rsdata = NULL;
-	}
+	ThumbnailCache::Ref().CancelDecodes();
 
 	search_results((char*)"", 0);
 
@@ -4256,9 +4228,7 @@ int open_ui(pixel *vid_buf, char *save_id, char *save_date, int instant_open)
 	int info_ready = 0, data_ready = 0, thumb_data_ready = 0;
 	pixel *save_pic = NULL;
 	pixel *save_pic_thumb = NULL;
-	char *thumb_data = NULL;
 	char viewcountbuffer[11];
-	int thumb_data_size = 0;
 	ui_edit ed;
 	ui_copytext ctb;
 
@@ -4309,30 +4279,15 @@ int open_ui(pixel *vid_buf, char *save_id, char *save_date, int instant_open)
 	}
 	
 	//Try to load the thumbnail from the cache
-	bool thumbFound;
-	if(save_date)
-	{
-		char * id_d_temp = (char*)malloc(strlen(save_id)+strlen(save_date)+2);
-		strcpy(id_d_temp, save_id);
-		strappend(id_d_temp, "_");
-		strappend(id_d_temp, save_date);
-		
-		thumbFound = thumb_cache_find(id_d_temp, (void**)(&thumb_data), &thumb_data_size);
-		free(id_d_temp);
-	}
-	else
-	{
-		thumbFound = thumb_cache_find(save_id, (void**)(&thumb_data), &thumb_data_size);
-	}
-	if (!thumbFound)
-	{
-		thumb_data = NULL;	
-	}
-	else
+	std::string thumb_data;
+	std::string thumbID = save_id;
+	if (save_date)
+		thumbID = thumbID + "_" + save_date;
+	if (ThumbnailCache::Ref().Find(thumbID, thumb_data))
 	{
 		//We found a thumbnail in the cache, we'll draw this one while we wait for the full image to load.
 		int finw, finh;
-		pixel *thumb_imgdata = ptif_unpack(thumb_data, thumb_data_size, &finw, &finh);
+		pixel *thumb_imgdata = ptif_unpack(&thumb_data[0], thumb_data.size(), &finw, &finh);
 		if(thumb_imgdata!=NULL){
 			save_pic_thumb = resample_img(thumb_imgdata, finw, finh, XRES/2, YRES/2, false);
 			//draw_image(vid_buf, save_pic_thumb, 51, 51, XRES/2, YRES/2, 255);	
@@ -4385,6 +4340,11 @@ int open_ui(pixel *vid_buf, char *save_id, char *save_date, int instant_open)
 		saveDataDownload->AuthHeaders(svf_user_id, svf_session_id);
 		saveInfoDownload->AuthHeaders(svf_user_id, svf_session_id);
 	}
+	// The save itself matters most, the preview can be drawn from the small thumbnail until the large one arrives
+	saveDataDownload->SetPriority(PRIORITY_HIGH);
+	saveDataDownload->UseCache();
+	saveInfoDownload->SetPriority(PRIORITY_HIGH);
+	saveInfoDownload->UseCache();
 	saveDataDownload->Start();
 	saveInfoDownload->Start();
 	if (!instant_open)
@@ -4392,8 +4352,10 @@ int open_ui(pixel *vid_buf, char *save_id, char *save_date, int instant_open)
 		std::stringstream uri;
 		uri << SCHEME << SERVER << "/Browse/Comments.json?ID=" << save_id << "&Start=0&Count=20";
 		commentsDownload = new Request(uri.str());
+		commentsDownload->SetPriority(PRIORITY_LOW);
 		commentsDownload->Start();
 
+		thumbnailDownload->UseCache();
 		thumbnailDownload->Start();
 	}
 
@@ -5209,7 +5171,6 @@ int open_ui(pixel *vid_buf, char *save_id, char *save_date, int instant_open)
 	info_parse("", info);
 	free(info);
 	free(old_vid);
-	if (thumb_data) free(thumb_data);
 	if (save_pic) free(save_pic);
 	if (save_pic_thumb) free(save_pic_thumb);
 	return retval;
@@ -5371,12 +5332,7 @@ int search_results(char *str, int votes)
 			free(search_owners[i]);
 			search_owners[i] = NULL;
 		}
-		if (search_thumbs[i])
-		{
-			free(search_thumbs[i]);
-			search_thumbs[i] = NULL;
-			search_thsizes[i] = 0;
-		}
+		search_thumb_ids[i].clear();
 	}
 	for (j=0; j<TAG_MAX; j++)
 		if (tag_names[j])
@@ -5461,12 +5417,11 @@ int search_results(char *str, int votes)
 
 			if (s)
 				search_votes[i] = atoi(s);
-			thumb_cache_find(str+5, search_thumbs+i, search_thsizes+i);
+			search_thumb_ids[i] = str+5;
 			i++;
 		}
 		else if (!strncmp(str, "HISTORY ", 8))
 		{
-			char * id_d_temp = NULL;
 			if (i>=GRID_X*GRID_Y)
 				break;
 			if (votes)
@@ -5534,13 +5489,7 @@ int search_results(char *str, int votes)
 			if (s)
 				search_votes[i] = atoi(s);
 				
-			//Build thumb cache ID and find
-			id_d_temp = (char*)malloc(strlen(search_ids[i])+strlen(search_dates[i])+2);
-			strcpy(id_d_temp, search_ids[i]);
-			strappend(id_d_temp, "_");
-			strappend(id_d_temp, search_dates[i]);
-			thumb_cache_find(id_d_temp, search_thumbs+i, search_thsizes+i);
-			free(id_d_temp);
+			search_thumb_ids[i] = std::string(search_ids[i]) + "_" + search_dates[i];
 			
 			i++;
 		}
@@ -5624,7 +5573,7 @@ int search_results(char *str, int votes)
 
 			if (s)
 				search_votes[i] = atoi(s);
-			thumb_cache_find(str, search_thumbs+i, search_thsizes+i);
+			search_thumb_ids[i] = str;
 			i++;
 		}
 		str = p;
@@ -5716,7 +5665,7 @@ int execute_save(pixel *vid_buf, Save *save)
 		return 1;
 	}
 
-	thumb_cache_inval(svf_id);
+	ThumbnailCache::Ref().Invalidate(svf_id);
 
 	svf_own = 1;
 	return 0;
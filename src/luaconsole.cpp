@@ -36,6 +36,7 @@
 #include "luaconsole.h"
 #include "luascriptinterface.h"
 #include "powder.h"
+#include "powdergraphics.h"
 #include "save_legacy.h"
 
 #include "common/Format.h"
@@ -57,9 +58,11 @@
 
 Simulation * luaSim;
 pixel *lua_vid_buf;
-int *lua_el_mode;
+int lua_el_mode[PT_NUM]; // all 0 until luacon_open, headless runs tick without Lua
 LuaSmartRef *lua_el_func, *lua_gr_func;
 std::vector<LuaSmartRef> lua_el_func_v, lua_gr_func_v;
+std::vector<LuaSmartRef> lua_el_batch_func, lua_gr_batch_func;
+std::vector<gcache_item> lua_gr_batch_results;
 std::vector<LuaSmartRef> luaCtypeDrawHandlers, luaCreateHandlers, luaCreateAllowedHandlers, luaChangeTypeHandlers;
 std::deque<std::pair<std::string, int>> logHistory;
 int getPartIndex_curIdx;
@@ -296,8 +299,10 @@ tpt.partsdata = nil");
 	lua_gr_func = &lua_gr_func_v[0];
 	lua_el_func_v = std::vector<LuaSmartRef>(PT_NUM, l);
 	lua_el_func = &lua_el_func_v[0];
-	lua_el_mode = new int[PT_NUM];
 	std::fill(lua_el_mode, lua_el_mode + PT_NUM, 0);
+	lua_el_batch_func = std::vector<LuaSmartRef>(PT_NUM, l);
+	lua_gr_batch_func = std::vector<LuaSmartRef>(PT_NUM, l);
+	lua_gr_batch_results = std::vector<gcache_item>(NPART);
 	luaCtypeDrawHandlers = std::vector<LuaSmartRef>(PT_NUM, l);
 	luaCreateHandlers = std::vector<LuaSmartRef>(PT_NUM, l);
 	luaCreateAllowedHandlers = std::vector<LuaSmartRef>(PT_NUM, l);
@@ -886,6 +891,133 @@ int luacon_graphics_update(int t, int i, int *pixel_mode, int *cola, int *colr,
 	return cache;
 }
 
+// Collects the ids of all particles whose type has a function in handlers, bucketed by type
+// Returns false without scanning parts[] if no element has a handler
+static bool luacon_collect_batch(Simulation *sim, std::vector<LuaSmartRef> &handlers, std::vector<std::vector<int>> &ids)
+{
+	// sized by luacon_open, headless runs never open Lua
+	if (handlers.empty())
+		return false;
+	bool any = false;
+	ids.resize(PT_NUM);
+	for (int t = 0; t < PT_NUM; t++)
+	{
+		ids[t].clear();
+		if (handlers[t])
+			any = true;
+	}
+	if (!any)
+		return false;
+
+	for (int i = 0; i <= sim->parts_lastActiveIndex; i++)
+	{
+		int t = sim->parts[i].type;
+		if (t > 0 && t < PT_NUM && handlers[t])
+			ids[t].push_back(i);
+	}
+	return true;
+}
+
+// Lua graphics functions can only be called from the main thread, pipelined rendering checks this before starting
+bool luacon_has_graphics_funcs()
+{
+	for (int t = 0; t < PT_NUM; t++)
+		if ((lua_gr_func_v.size() && lua_gr_func[t]) || (lua_gr_batch_func.size() && lua_gr_batch_func[t]))
+			return true;
+	return false;
+}
+
+// Pushes a new array table containing the given particle ids
+static void luacon_push_batch(std::vector<int> &ids)
+{
+	lua_createtable(l, ids.size(), 0);
+	for (size_t n = 0; n < ids.size(); n++)
+	{
+		lua_pushinteger(l, ids[n]);
+		lua_rawseti(l, -2, n + 1);
+	}
+}
+
+// Calls each UpdateBatch function once with all particles of that type, instead of one pcall per particle
+void luacon_part_update_batch(Simulation *sim)
+{
+	static std::vector<std::vector<int>> ids;
+	if (!luacon_collect_batch(sim, lua_el_batch_func, ids))
+		return;
+
+	for (int t = 1; t < PT_NUM; t++)
+	{
+		if (ids[t].empty() || !lua_el_batch_func[t])
+			continue;
+		lua_rawgeti(l, LUA_REGISTRYINDEX, lua_el_batch_func[t]);
+		luacon_push_batch(ids[t]);
+		lua_pushinteger(l, ids[t].size());
+		loop_time = Platform::GetTime();
+		if (lua_pcall(l, 2, 0, 0))
+		{
+			luacon_log("In batched particle update: " + luacon_geterror());
+		}
+	}
+}
+
+// Calls each GraphicsBatch function once per frame. The function returns a flat array with 9 values per particle,
+// in the same order as the ids: pixel_mode, cola, colr, colg, colb, firea, firer, fireg, fireb (nil keeps the default)
+// Results are stored in lua_gr_batch_results, indexed by particle id, and read back by render_parts
+void luacon_graphics_update_batch(Simulation *sim)
+{
+	static std::vector<std::vector<int>> ids;
+	if (!luacon_collect_batch(sim, lua_gr_batch_func, ids))
+		return;
+
+	for (int t = 1; t < PT_NUM; t++)
+	{
+		if (ids[t].empty())
+			continue;
+		for (int i : ids[t])
+			lua_gr_batch_results[i].isready = 0;
+
+		lua_rawgeti(l, LUA_REGISTRYINDEX, lua_gr_batch_func[t]);
+		luacon_push_batch(ids[t]);
+		lua_pushinteger(l, ids[t].size());
+		loop_time = Platform::GetTime();
+		if (lua_pcall(l, 2, 1, 0))
+		{
+			luacon_log("In batched graphics function: " + luacon_geterror());
+			continue;
+		}
+		if (!lua_istable(l, -1))
+		{
+			lua_pop(l, 1);
+			continue;
+		}
+
+		ARGBColour defaultColour = sim->elements[t].Colour;
+		for (size_t n = 0; n < ids[t].size(); n++)
+		{
+			gcache_item &result = lua_gr_batch_results[ids[t][n]];
+			int values[9] = { PMODE_FLAT, (int)COLA(defaultColour), (int)COLR(defaultColour), (int)COLG(defaultColour), (int)COLB(defaultColour), 0, 0, 0, 0 };
+			for (int v = 0; v < 9; v++)
+			{
+				lua_rawgeti(l, -1, n*9 + v + 1);
+				if (lua_isnumber(l, -1))
+					values[v] = lua_tointeger(l, -1);
+				lua_pop(l, 1);
+			}
+			result.isready = 1;
+			result.pixel_mode = values[0];
+			result.cola = values[1];
+			result.colr = values[2];
+			result.colg = values[3];
+			result.colb = values[4];
+			result.firea = values[5];
+			result.firer = values[6];
+			result.fireg = values[7];
+			result.fireb = values[8];
+		}
+		lua_pop(l, 1);
+	}
+}
+
 bool luaCtypeDrawWrapper(CTYPEDRAW_FUNC_ARGS)
 {
 	bool ret = false;
@@ -982,9 +1114,12 @@ std::string luacon_geterror()
 void luacon_close()
 {
 	delete tptPart;
-	delete[] lua_el_mode;
+	std::fill(lua_el_mode, lua_el_mode + PT_NUM, 0);
 	lua_el_func_v.clear();
 	lua_gr_func_v.clear();
+	lua_el_batch_func.clear();
+	lua_gr_batch_func.clear();
+	lua_gr_batch_results.clear();
 	luaCtypeDrawHandlers.clear();
 	luaCreateHandlers.clear();
 	luaCreateAllowedHandlers.clear();
@@ -2174,13 +2309,18 @@ int luatpt_record(lua_State* l)
 		return luaL_typerror(l, 1, lua_typename(l, LUA_TBOOLEAN));
 	bool record = lua_toboolean(l, -1);
 	if (record)
-		record = confirm_ui(vid_buf, "Recording", "You're about to start recording all drawn frames. This will use a lot of disk space", "Confirm");
+		record = confirm_ui(vid_buf, "Recording", "You're about to start recording all drawn frames. This can use a lot of disk space", "Confirm");
 	if (!record)
 	{
-		Renderer::Ref().StopRecording();
-		return 0;
+		unsigned int framesWritten = 0, framesDropped = 0;
+		Renderer::Ref().StopRecording(&framesWritten, &framesDropped);
+		lua_pushinteger(l, framesWritten);
+		lua_pushinteger(l, framesDropped);
+		return 2;
 	}
 	int recordingFolder = Renderer::Ref().StartRecording();
+	if (!recordingFolder)
+		return luaL_error(l, "Could not create recording file");
 	lua_pushinteger(l, recordingFolder);
 	return 1;
 }
@@ -2283,6 +2423,7 @@ int luatpt_createwall(lua_State* l)
 		for (int xx = x; xx < x + w; ++xx)
 		{
 			bmap[yy][xx] = wallType;
+			luaSim->WallChanged(xx, yy);
 			if (setFv)
 			{
 				luaSim->air->fvx[yy][xx] = fvx;
@@ -2313,7 +2454,10 @@ int luatpt_set_elecmap(lua_State* l)
 
 	for (nx = x1; nx < x1+width; nx++)
 		for (ny = y1; ny < y1+height; ny++)
+		{
 			emap[ny][nx] = value;
+			luaSim->WallChanged(nx, ny);
+		}
 	return 0;
 }
 
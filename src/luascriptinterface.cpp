@@ -2,6 +2,7 @@
 
 #include <dirent.h>
 #include <string>
+#include <vector>
 #ifdef WIN
 #include <direct.h>
 #else
@@ -30,6 +31,8 @@
 #include "game/ToolTip.h"
 #include "gui/game/PowderToy.h"
 #include "graphics/ARGBColour.h"
+#include "graphics/FrameSkip.h"
+#include "graphics/RenderPipeline.h"
 #include "graphics/Renderer.h"
 #include "interface/Engine.h"
 #include "lua/LuaButton.h"
@@ -269,6 +272,11 @@ void initSimulationAPI(lua_State * l)
 		{"getSaveID", simulation_getSaveID},
 		{"adjustCoords", simulation_adjustCoords},
 		{"prettyPowders", simulation_prettyPowders},
+		{"deterministicHeat", simulation_deterministicHeat},
+		{"particleCompaction", simulation_particleCompaction},
+		{"compactedID", simulation_compactedID},
+		{"randomKey", simulation_randomKey},
+		{"particleRandom", simulation_particleRandom},
 		{"gravityGrid", simulation_gravityGrid},
 		{"edgeMode", simulation_edgeMode},
 		{"gravityMode", simulation_gravityMode},
@@ -1319,6 +1327,77 @@ int simulation_prettyPowders(lua_State * l)
 	return 0;
 }
 
+int simulation_deterministicHeat(lua_State * l)
+{
+	int acount = lua_gettop(l);
+	if (acount == 0)
+	{
+		lua_pushboolean(l, luaSim->deterministicHeat);
+		return 1;
+	}
+	luaL_checktype(l, 1, LUA_TBOOLEAN);
+	luaSim->deterministicHeat = lua_toboolean(l, 1);
+	return 0;
+}
+
+int simulation_particleCompaction(lua_State * l)
+{
+	int acount = lua_gettop(l);
+	if (acount == 0)
+	{
+		lua_pushinteger(l, luaSim->compactionInterval);
+		return 1;
+	}
+	luaSim->compactionInterval = std::max(luaL_checkint(l, 1), 0);
+	return 0;
+}
+
+// Scripts that keep particle ids between ticks can find them again after compaction
+int simulation_compactedID(lua_State * l)
+{
+	int id = luaSim->CompactedID(luaL_checkint(l, 1));
+	if (id < 0)
+		return 0;
+	lua_pushinteger(l, id);
+	return 1;
+}
+
+int simulation_randomKey(lua_State * l)
+{
+	int acount = lua_gettop(l);
+	if (acount == 0)
+	{
+		lua_pushnumber(l, luaSim->randomKey);
+		return 1;
+	}
+	luaSim->randomKey = static_cast<unsigned int>(luaL_checknumber(l, 1));
+	return 0;
+}
+
+// sim.particleRandom(index, site, [count], [first]), count random integers from 0 to 2^31-1 for this particle,
+// this tick. The same arguments on the same tick always give the same numbers
+int simulation_particleRandom(lua_State * l)
+{
+	int index = luaL_checkint(l, 1);
+	int site = luaL_checkint(l, 2);
+	int count = luaL_optint(l, 3, 1);
+	int first = luaL_optint(l, 4, 0);
+	if (index < 0 || index >= NPART)
+		return luaL_error(l, "Invalid particle index %d", index);
+	if (site < 0 || site > 0xFFFF)
+		return luaL_error(l, "Site must be between 0 and 65535");
+	if (count < 0 || count > 4096 || first < 0)
+		return luaL_error(l, "Invalid count");
+	if (!lua_checkstack(l, count))
+		return luaL_error(l, "Too many results");
+
+	std::vector<unsigned int> values(count);
+	luaSim->ParticleRNG(index, RANDOM_SITE_LUA + site).Fill(values.data(), count, first);
+	for (unsigned int value : values)
+		lua_pushinteger(l, value);
+	return count;
+}
+
 int simulation_gravityGrid(lua_State * l)
 {
 	int acount = lua_gettop(l);
@@ -1448,7 +1527,7 @@ int simulation_canMove(lua_State * l)
 	{
 		int setting = (unsigned char)luaL_checkint(l, 3) & 0x7F;
 		custom_can_move[movingElement][destinationElement] = setting | 0x80;
-		luaSim->can_move[movingElement][destinationElement] = setting;
+		luaSim->SetCanMove(movingElement, destinationElement, setting);
 		return 0;
 	}
 }
@@ -1888,7 +1967,7 @@ void custom_init_can_move()
 		{
 			if (custom_can_move[moving][into] & 0x80)
 			{
-				luaSim->can_move[moving][into] = custom_can_move[moving][into] & 0x7F;
+				luaSim->SetCanMove(moving, into, custom_can_move[moving][into] & 0x7F);
 			}
 		}
 	}
@@ -1916,6 +1995,8 @@ void initRendererAPI(lua_State * l)
 		{"zoomEnabled", renderer_zoomEnabled},
 		{"zoomWindow", renderer_zoomWindowInfo},
 		{"zoomScope", renderer_zoomScopeInfo},
+		{"simAhead", renderer_simAhead},
+		{"frameSkip", renderer_frameSkip},
 		{NULL, NULL}
 	};
 	luaL_register(l, "renderer", rendererAPIMethods);
@@ -2111,6 +2192,38 @@ int renderer_showBrush(lua_State * l)
 	return 0;
 }
 
+int renderer_simAhead(lua_State * l)
+{
+	int acount = lua_gettop(l);
+	if (acount == 0)
+	{
+		lua_pushinteger(l, RenderPipeline::Ref().GetSimAhead());
+		return 1;
+	}
+	int frames = luaL_checkint(l, 1);
+	if (frames < 0 || frames > RenderPipeline::maxSimAhead)
+		return luaL_error(l, "Invalid value %d, must be between 0 and %d", frames, RenderPipeline::maxSimAhead);
+	RenderPipeline::Ref().SetSimAhead(frames);
+	return 0;
+}
+
+int renderer_frameSkip(lua_State * l)
+{
+	int acount = lua_gettop(l);
+	if (acount == 0)
+	{
+		lua_pushinteger(l, FrameSkip::Ref().GetTargetFps());
+		lua_pushinteger(l, FrameSkip::Ref().GetRatio());
+		lua_pushnumber(l, FrameSkip::Ref().GetTickRate());
+		return 3;
+	}
+	int fps = luaL_checkint(l, 1);
+	if (fps < 0)
+		return luaL_error(l, "Invalid target frame rate %d", fps);
+	FrameSkip::Ref().SetTargetFps(fps);
+	return 0;
+}
+
 int renderer_depth3d(lua_State * l)
 {
 	return luaL_error(l, "This feature is no longer supported");
@@ -3130,6 +3243,20 @@ int elements_element(lua_State * l)
 		}
 		lua_pop(l, 1);
 
+		lua_getfield(l, -1, "UpdateBatch");
+		if (lua_type(l, -1) == LUA_TFUNCTION)
+			lua_el_batch_func[id].Assign(l, -1);
+		else if (lua_type(l, -1) == LUA_TBOOLEAN && !lua_toboolean(l, -1))
+			lua_el_batch_func[id].Clear();
+		lua_pop(l, 1);
+
+		lua_getfield(l, -1, "GraphicsBatch");
+		if (lua_type(l, -1) == LUA_TFUNCTION)
+			lua_gr_batch_func[id].Assign(l, -1);
+		else if (lua_type(l, -1) == LUA_TBOOLEAN && !lua_toboolean(l, -1))
+			lua_gr_batch_func[id].Clear();
+		lua_pop(l, 1);
+
 		lua_getfield(l, -1, "CtypeDraw");
 		if (lua_type(l, -1) == LUA_TFUNCTION)
 		{
@@ -3309,6 +3436,25 @@ int elements_property(lua_State * l)
 			}
 			graphicscache[id].isready = 0;
 		}
+		else if (propertyName == "UpdateBatch")
+		{
+			// Called once per tick with an array of all particle ids of this type, and the number of ids
+			if (lua_type(l, 3) == LUA_TFUNCTION)
+				lua_el_batch_func[id].Assign(l, 3);
+			else if (lua_type(l, 3) == LUA_TBOOLEAN && !lua_toboolean(l, 3))
+				lua_el_batch_func[id].Clear();
+			return 0;
+		}
+		else if (propertyName == "GraphicsBatch")
+		{
+			// Called once per frame with an array of particle ids, returns 9 graphics values per particle in a flat array
+			if (lua_type(l, 3) == LUA_TFUNCTION)
+				lua_gr_batch_func[id].Assign(l, 3);
+			else if (lua_type(l, 3) == LUA_TBOOLEAN && !lua_toboolean(l, 3))
+				lua_gr_batch_func[id].Clear();
+			graphicscache[id].isready = 0;
+			return 0;
+		}
 		else if (propertyName == "CtypeDraw")
 		{
 			if (lua_type(l, 3) == LUA_TFUNCTION)
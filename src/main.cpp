@@ -76,15 +76,18 @@
 #include "benchmark.h"
 
 #include "common/Platform.h"
+#include "common/StartupTimer.h"
 #include "common/tpt-minmax.h"
 #include "game/Authors.h"
 #include "game/Brush.h"
 #include "game/Menus.h"
 #include "game/Save.h"
 #include "game/Sign.h"
+#include "game/StampIndex.h"
 #include "game/ToolTip.h"
 #include "game/Request.h"
 #include "game/RequestManager.h"
+#include "game/ThumbnailCache.h"
 #include "simulation/Simulation.h"
 #include "simulation/SnapshotHistory.h"
 #include "simulation/Tool.h"
@@ -93,6 +96,8 @@
 #include "simulation/elements/STKM.h"
 
 // new interface stuff
+#include "graphics/FrameSkip.h"
+#include "graphics/RenderPipeline.h"
 #include "graphics/Renderer.h"
 #include "graphics/VideoBuffer.h"
 #include "interface/Engine.h"
@@ -200,7 +205,11 @@ void clear_sim()
 	parts[NPART-1].life = -1;
 	memset(pmap, 0, sizeof(pmap));
 	memset(photons, 0, sizeof(photons));
-	memset(pers_bg, 0, (XRES+BARSIZE)*YRES*PIXELSIZE);
+	// the render thread owns these while it's running
+	RenderPipeline::Ref().Stop();
+	// headless runs never allocate it
+	if (pers_bg)
+		memset(pers_bg, 0, (XRES+BARSIZE)*YRES*PIXELSIZE);
 	memset(fire_r, 0, sizeof(fire_r));
 	memset(fire_g, 0, sizeof(fire_g));
 	memset(fire_b, 0, sizeof(fire_b));
@@ -269,43 +278,19 @@ void stamp_update(void)
 			char name[30] = {0};
 			sprintf(name,"stamps%s%s.stm",PATH_SEP,stamps[i].name);
 			remove(name);
+			StampIndex::Ref().Remove(stamps[i].name);
 		}
 	}
 	fclose(f);
 }
 
-void stamp_gen_thumb(int i)
+// Fetch a stamp's thumbnail from the stamp index, it gets rendered in the background if it isn't there yet
+// Returns one of STAMP_THUMB_PENDING, STAMP_THUMB_READY or STAMP_THUMB_FAILED, call again later while pending
+int stamp_gen_thumb(int i)
 {
-	char fn[64];
-	void *data;
-	int size, factor_x, factor_y;
-	pixel *tmp;
-
 	if (stamps[i].thumb)
-	{
-		free(stamps[i].thumb);
-		stamps[i].thumb = NULL;
-	}
-
-	sprintf(fn, "stamps" PATH_SEP "%s.stm", stamps[i].name);
-	data = file_load(fn, &size);
-
-	if (data)
-	{
-		stamps[i].thumb = prerender_save(data, size, &(stamps[i].thumb_w), &(stamps[i].thumb_h));
-		if (stamps[i].thumb && (stamps[i].thumb_w>XRES/GRID_S || stamps[i].thumb_h>YRES/GRID_S))
-		{
-			factor_x = (int)ceil((float)stamps[i].thumb_w/(float)(XRES/GRID_S));
-			factor_y = (int)ceil((float)stamps[i].thumb_h/(float)(YRES/GRID_S));
-			if (factor_y > factor_x)
-				factor_x = factor_y;
-			tmp = rescale_img(stamps[i].thumb, stamps[i].thumb_w, stamps[i].thumb_h, &(stamps[i].thumb_w), &(stamps[i].thumb_h), factor_x);
-			free(stamps[i].thumb);
-			stamps[i].thumb = tmp;
-		}
-	}
-
-	free(data);
+		return STAMP_THUMB_READY;
+	return StampIndex::Ref().GetThumb(stamps[i].name, &stamps[i].thumb, &stamps[i].thumb_w, &stamps[i].thumb_h);
 }
 
 int clipboard_ready = 0;
@@ -441,7 +426,7 @@ Save *stamp_load(int i, int reorder)
 	char fn[64];
 	struct stamp tmp;
 
-	if (!stamps[i].thumb || !stamps[i].name[0])
+	if (!stamps[i].name[0] || stamp_gen_thumb(i) == STAMP_THUMB_FAILED)
 		return NULL;
 
 	sprintf(fn, "stamps" PATH_SEP "%s.stm", stamps[i].name);
@@ -510,6 +495,8 @@ void stamp_init()
 	FILE *f;
 
 	memset(stamps, 0, sizeof(stamps));
+	// thumbnails are loaded on demand by stamp_ui
+	StampIndex::Ref().Load();
 
 	f=fopen("stamps" PATH_SEP "stamps.def", "rb");
 	if (!f)
@@ -520,7 +507,6 @@ void stamp_init()
 		if (readsize != 10 || !stamps[i].name[0])
 			break;
 		stamp_count++;
-		stamp_gen_thumb(i);
 	}
 	fclose(f);
 }
@@ -573,75 +559,6 @@ void del_stamp(int d)
 	stamp_init();
 }
 
-void thumb_cache_inval(char *id);
-
-char *thumb_cache_id[THUMB_CACHE_SIZE];
-void *thumb_cache_data[THUMB_CACHE_SIZE];
-int thumb_cache_size[THUMB_CACHE_SIZE];
-int thumb_cache_lru[THUMB_CACHE_SIZE];
-
-void thumb_cache_inval(char *id)
-{
-	int i,j;
-	for (i=0; i<THUMB_CACHE_SIZE; i++)
-		if (thumb_cache_id[i] && !strcmp(id, thumb_cache_id[i]))
-			break;
-	if (i >= THUMB_CACHE_SIZE)
-		return;
-	free(thumb_cache_id[i]);
-	free(thumb_cache_data[i]);
-	thumb_cache_id[i] = NULL;
-	for (j=0; j<THUMB_CACHE_SIZE; j++)
-		if (thumb_cache_lru[j] > thumb_cache_lru[i])
-			thumb_cache_lru[j]--;
-}
-void thumb_cache_add(char *id, void *thumb, int size)
-{
-	int i,m=-1,j=-1;
-	thumb_cache_inval(id);
-	if (!thumb || size == 0)
-		return;
-	for (i=0; i<THUMB_CACHE_SIZE; i++)
-	{
-		if (!thumb_cache_id[i])
-			break;
-		if (thumb_cache_lru[i] > m)
-		{
-			m = thumb_cache_lru[i];
-			j = i;
-		}
-	}
-	if (i >= THUMB_CACHE_SIZE)
-	{
-		thumb_cache_inval(thumb_cache_id[j]);
-		i = j;
-	}
-	for (j=0; j<THUMB_CACHE_SIZE; j++)
-		thumb_cache_lru[j] ++;
-	thumb_cache_id[i] = mystrdup(id);
-	thumb_cache_data[i] = malloc(size);
-	memcpy(thumb_cache_data[i], thumb, size);
-	thumb_cache_size[i] = size;
-	thumb_cache_lru[i] = 0;
-}
-bool thumb_cache_find(char *id, void **thumb, int *size)
-{
-	int i,j;
-	for (i=0; i<THUMB_CACHE_SIZE; i++)
-		if (thumb_cache_id[i] && !strcmp(id, thumb_cache_id[i]))
-			break;
-	if (i >= THUMB_CACHE_SIZE)
-		return false;
-	for (j=0; j<THUMB_CACHE_SIZE; j++)
-		if (thumb_cache_lru[j] < thumb_cache_lru[i])
-			thumb_cache_lru[j]++;
-	thumb_cache_lru[i] = 0;
-	*thumb = malloc(thumb_cache_size[i]);
-	*size = thumb_cache_size[i];
-	memcpy(*thumb, thumb_cache_data[i], *size);
-	return true;
-}
-
 char http_proxy_string[256] = "";
 
 unsigned short last_major=0, last_minor=0, last_build=0, update_flag=0;
@@ -721,7 +638,6 @@ int main(int argc, char *argv[])
 	display_mode = Renderer::Ref().GetDisplayModesRaw();
 	Renderer::Ref().SetColorMode(COLOR_DEFAULT);
 	init_display_modes();
-	TRON_init_graphics();
 
 	sys_pause = 1;
 	parts = (particle*)calloc(sizeof(particle), NPART);
@@ -729,9 +645,6 @@ int main(int argc, char *argv[])
 	clear_sim();
 
 	prepare_alpha(CELL, 1.0f);
-	prepare_graphicscache();
-	flm_data = generate_gradient(flm_data_colours, flm_data_pos, flm_data_points, 200);
-	plasma_data = generate_gradient(plasma_data_colours, plasma_data_pos, plasma_data_points, 200);
 
 	sprintf(ppmfilename, "%s.ppm", argv[2]);
 	sprintf(ptifilename, "%s.pti", argv[2]);
@@ -761,27 +674,22 @@ int main(int argc, char *argv[])
 			info_box(vid_buf, "Save file invalid or from newer version");
 		}
 
-		//Save PTi images
-		char * datares = NULL, *scaled_buf;
-		int res = 0, sw, sh;
-		datares = (char*)ptif_pack(vid_buf, XRES, YRES, &res);
-		if (datares!=NULL)
-		{
-			f=fopen(ptifilename, "wb");
-			fwrite(datares, res, 1, f);
-			fclose(f);
-			free(datares);
-			datares = NULL;
-		}
-		scaled_buf = (char*)resample_img(vid_buf, XRES, YRES, XRES/GRID_Z, YRES/GRID_Z);
-		datares = (char*)ptif_pack((pixel*)scaled_buf, XRES/GRID_Z, YRES/GRID_Z, &res);
-		if (datares!=NULL)
+		//Save PTi images, both compressed at the same time
+		char *scaled_buf = (char*)resample_img(vid_buf, XRES, YRES, XRES/GRID_Z, YRES/GRID_Z);
+		std::vector<PtifImage> ptiImages;
+		ptiImages.push_back({ vid_buf, XRES, YRES, NULL, 0 });
+		ptiImages.push_back({ (pixel*)scaled_buf, XRES/GRID_Z, YRES/GRID_Z, NULL, 0 });
+		ptif_pack_batch(ptiImages);
+		const char *ptiFilenames[] = { ptifilename, ptismallfilename };
+		for (size_t i = 0; i < ptiImages.size(); i++)
 		{
-			f=fopen(ptismallfilename, "wb");
-			fwrite(datares, res, 1, f);
-			fclose(f);
-			free(datares);
-			datares = NULL;
+			if (ptiImages[i].data!=NULL)
+			{
+				f=fopen(ptiFilenames[i], "wb");
+				fwrite(ptiImages[i].data, ptiImages[i].size, 1, f);
+				fclose(f);
+				free(ptiImages[i].data);
+			}
 		}
 		free(scaled_buf);
 		//Save PPM image
@@ -843,11 +751,37 @@ bool openConsole = false;
 bool openSign = false;
 bool openProp = false;
 PowderToy *the_game;
-int main(int argc, char *argv[])
+
+// Only the simulation, and the menus that saves and brushes look tools up in. No SDL, window, video buffers, Lua,
+// presets or stamps
+static int headless_main(bool benchmark_enable, bool startupReport)
 {
-	SDLInit();
+	StartupTimer::Ref().Phase("simulation and elements");
+	globalSim = new Simulation();
+	InitMenusections();
+	FillMenus();
+	activeTools[0] = GetToolFromIdentifier("DEFAULT_PT_DUST");
+	activeTools[1] = GetToolFromIdentifier("DEFAULT_PT_NONE");
+	activeTools[2] = GetToolFromIdentifier("DEFAULT_PT_NONE");
+	clear_sim();
 
+	StartupTimer::Ref().Finish();
+	if (startupReport || benchmark_enable)
+		StartupTimer::Ref().Report(stdout);
+	if (benchmark_enable)
+	{
+		benchmark_headless = true;
+		benchmark_run();
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
 	bool benchmark_enable = false;
+	// no window, no rendering setup and no scripts, for benchmarks and batch runs
+	bool headless = false;
+	bool startupReport = false;
 
 #ifdef X86_SSE
 	_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
@@ -856,16 +790,9 @@ int main(int argc, char *argv[])
 	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
 #endif
 
-	// initialize hud with defaults before loading powder.pref
-	HudDefaults();
-	memcpy(currentHud,normalHud,sizeof(currentHud));
-
-	render_mode = Renderer::Ref().GetRenderModesRaw();
-	display_mode = Renderer::Ref().GetDisplayModesRaw();
-	Renderer::Ref().SetColorMode(COLOR_DEFAULT);
-
 	Platform::originalCwd = Platform::GetCwd();
 
+	// the arguments that decide what starts up, headless runs branch off before SDL is touched
 	bool usedDdir = false;
 	for (int i = 1; i < argc; i++)
 	{
@@ -894,7 +821,38 @@ int main(int argc, char *argv[])
 			free(openData);
 			i++;
 		}
+		else if (!strcmp(argv[i], "benchmark"))
+		{
+			benchmark_enable = true;
+			if (i+1<argc)
+			{
+				benchmark_file = argv[i+1];
+				i++;
+			}
+		}
+		else if (!strcmp(argv[i], "headless"))
+		{
+			headless = true;
+		}
+		else if (!strcmp(argv[i], "startup-report"))
+		{
+			startupReport = true;
+		}
 	}
+	if (headless)
+		return headless_main(benchmark_enable, startupReport);
+
+	StartupTimer::Ref().Phase("SDL init");
+	SDLInit();
+
+	// initialize hud with defaults before loading powder.pref
+	HudDefaults();
+	memcpy(currentHud,normalHud,sizeof(currentHud));
+
+	render_mode = Renderer::Ref().GetRenderModesRaw();
+	display_mode = Renderer::Ref().GetDisplayModesRaw();
+	Renderer::Ref().SetColorMode(COLOR_DEFAULT);
+
 #ifndef ANDROID
 	if (!usedDdir)
 	{
@@ -920,8 +878,11 @@ int main(int argc, char *argv[])
 #endif
 
 	// initialize this first so simulation gets inited
+	StartupTimer::Ref().Phase("simulation and elements");
 	the_game = new PowderToy(); // you just lost
 
+	StartupTimer::Ref().Phase("buffers and Lua");
+
 	vid_buf = (pixel*)calloc((XRES+BARSIZE)*(YRES+MENUSIZE), PIXELSIZE);
 	part_vbuf = (pixel*)calloc((XRES+BARSIZE)*(YRES+MENUSIZE), PIXELSIZE); //Extra video buffer
 	part_vbuf_store = part_vbuf;
@@ -936,7 +897,6 @@ int main(int argc, char *argv[])
 	luacon_open();
 #endif
 
-	TRON_init_graphics();
 	init_color_boxes();
 
 	timesplayed = timesplayed + 1;
@@ -1046,14 +1006,9 @@ int main(int argc, char *argv[])
 			}
 			break;
 		}
-		else if (!strcmp(argv[i], "benchmark"))
+		else if (!strcmp(argv[i], "benchmark") && i+1<argc)
 		{
-			benchmark_enable = true;
-			if (i+1<argc)
-			{
-				benchmark_file = argv[i+1];
-				i++;
-			}
+			i++;
 		}
 		else if (!strcmp(argv[i], "disable-bluescreen"))
 		{
@@ -1070,13 +1025,17 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	StartupTimer::Ref().Phase("stamps");
 	stamp_init();
 
 #ifndef NOHTTP
+	StartupTimer::Ref().Phase("network");
 	if (!disableNetwork)
 		RequestManager::Ref().Initialise(http_proxy_string);
+	ThumbnailCache::Ref().Init();
 #endif
 
+	StartupTimer::Ref().Phase("window");
 	if (!SDLOpen())
 	{
 		Engine::Ref().SetScale(1);
@@ -1098,11 +1057,9 @@ int main(int argc, char *argv[])
 	save_presets();
 
 	prepare_alpha(1.0f);
-	prepare_graphicscache();
-	flm_data = generate_gradient(flm_data_colours, flm_data_pos, flm_data_points, 200);
-	plasma_data = generate_gradient(plasma_data_colours, plasma_data_pos, plasma_data_points, 200);
 
 #ifdef LUACONSOLE
+	StartupTimer::Ref().Phase("Lua scripts");
 	lua_vid_buf = the_game->GetVid()->GetVid();
 	char *autorun_result = NULL;
 	luacon_openeventcompat();
@@ -1133,6 +1090,7 @@ int main(int argc, char *argv[])
 	if (autorun_result)
 		free(autorun_result);
 #endif
+	StartupTimer::Ref().Phase("tabs");
 	for (int i = 0; i < 10; i++)
 	{
 		sprintf(tabNames[i], "Untitled Simulation %i", i+1);
@@ -1151,6 +1109,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	StartupTimer::Ref().Finish();
+	if (startupReport || benchmark_enable)
+		StartupTimer::Ref().Report(stdout);
 	if (benchmark_enable)
 	{
 		benchmark_run();
@@ -1176,6 +1137,26 @@ int main(int argc, char *argv[])
 	return 0;
 }
 
+// A tick that nothing gets drawn for, frame skipping runs these before the drawn one
+static void simulation_only_tick(Point mousePos)
+{
+	globalSim->Tick();
+	the_game->OnSkippedTick();
+	// the persistent display still collects every tick, otherwise fast particles would leave dotted trails
+	if ((display_mode & DISPLAY_PERS) && !RenderPipeline::Ref().Active())
+		render_parts(pers_bg, globalSim, mousePos);
+
+	globalSim->air->UpdateAir();
+	globalSim->air->UpdateAirHeat(globalSim->gravityMode == 0);
+	if (globalSim->grav->gravWallChanged)
+	{
+		globalSim->grav->CalculateMask();
+		globalSim->grav->gravWallChanged = false;
+	}
+	globalSim->grav->UpdateAsync();
+	memset(globalSim->grav->gravmap, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
+}
+
 	//while (!sdl_poll()) //the main loop
 int main_loop_temp(int b, int bq, int sdl_key, int scan, int x, int y, bool shift, bool ctrl, bool alt)
 {
@@ -1198,9 +1179,41 @@ int main_loop_temp(int b, int bq, int sdl_key, int scan, int x, int y, bool shif
 			part_vbuf = vid_buf;
 		}
 
-		render_before(part_vbuf, globalSim);
-		globalSim->Tick(); //update everything
-		render_after(part_vbuf, vid_buf, globalSim, Point(mx, my));
+		FrameSkip &frameSkip = FrameSkip::Ref();
+		bool ticking = !sys_pause || framerender;
+		frameSkip.BeginFrame();
+		// frame skipping, the ticks that won't be shown don't get drawn at all
+		// Fire and the persistent display still fade once per drawn frame, so on screen they look the same
+		if (!sys_pause)
+			for (int i = 1; i < frameSkip.GetRatio(); i++)
+			{
+				frameSkip.BeginTick();
+				simulation_only_tick(Point(mx, my));
+				frameSkip.EndTick();
+			}
+
+		if (RenderPipeline::Ref().Active())
+		{
+			// the render thread draws the previous ticks while this one is simulated
+			if (ticking)
+				frameSkip.BeginTick();
+			globalSim->Tick(); //update everything
+			if (ticking)
+				frameSkip.EndTick();
+			RenderPipeline::Ref().Submit(globalSim, Point(mx, my));
+			RenderPipeline::Ref().Composite(part_vbuf);
+			render_overlays(part_vbuf, vid_buf, globalSim, Point(mx, my));
+		}
+		else
+		{
+			render_before(part_vbuf, globalSim);
+			if (ticking)
+				frameSkip.BeginTick();
+			globalSim->Tick(); //update everything
+			if (ticking)
+				frameSkip.EndTick();
+			render_after(part_vbuf, vid_buf, globalSim, Point(mx, my));
+		}
 
 		// draw preview of stamp
 		if (the_game->GetStampState() == PowderToy::LOAD && !the_game->PlacingZoomWindow())
@@ -1748,6 +1761,8 @@ int main_loop_temp(int b, int bq, int sdl_key, int scan, int x, int y, bool shif
 
 void main_end_hack()
 {
+	RenderPipeline::Ref().Stop();
+	Renderer::Ref().StopRecording();
 	SaveWindowPosition();
 	save_presets();
 #ifdef LUACONSOLE
@@ -1755,6 +1770,7 @@ void main_end_hack()
 #endif
 #ifndef NOHTTP
 	RequestManager::Ref().Shutdown();
+	ThumbnailCache::Ref().Shutdown();
 #endif
 	ClearMenusections();
 	ClearSigns();
@@ -1771,6 +1787,7 @@ void main_end_hack()
 		remove(name);
 	}
 	Platform::DeleteDirectory("tabs");
+	StampIndex::Ref().Shutdown();
 	stamps_free();
 }
 #endif
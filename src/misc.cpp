@@ -43,6 +43,8 @@
 #include "game/Brush.h"
 #include "game/Favorite.h"
 #include "game/Menus.h"
+#include "graphics/FrameSkip.h"
+#include "graphics/RenderPipeline.h"
 #include "graphics/Renderer.h"
 #include "interface/Engine.h"
 #include "simulation/Simulation.h"
@@ -296,6 +298,10 @@ void save_presets()
 		cJSON_AddTrueToObject(root, "MouseClickRequired");
 	if (perfectCircleBrush)
 		cJSON_AddTrueToObject(root, "PerfectCircleBrush");
+	if (RenderPipeline::Ref().GetSimAhead())
+		cJSON_AddNumberToObject(root, "SimAhead", RenderPipeline::Ref().GetSimAhead());
+	if (FrameSkip::Ref().GetTargetFps())
+		cJSON_AddNumberToObject(root, "FrameSkipTarget", FrameSkip::Ref().GetTargetFps());
 
 	//additional settings from my mod
 	cJSON_AddNumberToObject(root, "heatmode", heatmode);
@@ -644,6 +650,10 @@ void load_presets(void)
 			stickyCategories = tmpobj->valueint ? true : false;
 		if ((tmpobj = cJSON_GetObjectItem(root, "PerfectCircleBrush")))
 			perfectCircleBrush = tmpobj->valueint ? true : false;
+		if ((tmpobj = cJSON_GetObjectItem(root, "SimAhead")))
+			RenderPipeline::Ref().SetSimAhead(tmpobj->valueint);
+		if ((tmpobj = cJSON_GetObjectItem(root, "FrameSkipTarget")))
+			FrameSkip::Ref().SetTargetFps(tmpobj->valueint);
 
 		//Read some extra mod settings
 		if ((tmpobj = cJSON_GetObjectItem(root, "heatmode")))
@@ -148,7 +148,11 @@ void set_emap(int x, int y)
 
 	// fill span
 	for (x=x1; x<=x2; x++)
+	{
+		if (!emap[y][x])
+			globalSim->WallChanged(x, y);
 		emap[y][x] = 16;
+	}
 
 	// fill children
 
@@ -278,11 +282,15 @@ void draw_bframe()
 	{
 		bmap[0][i]=WL_WALL;
 		bmap[YRES/CELL-1][i]=WL_WALL;
+		globalSim->WallChanged(i, 0);
+		globalSim->WallChanged(i, YRES/CELL-1);
 	}
 	for(i=1; i<((YRES/CELL)-1); i++)
 	{
 		bmap[i][0]=WL_WALL;
 		bmap[i][XRES/CELL-1]=WL_WALL;
+		globalSim->WallChanged(0, i);
+		globalSim->WallChanged(XRES/CELL-1, i);
 	}
 }
 
@@ -293,10 +301,14 @@ void erase_bframe()
 	{
 		bmap[0][i]=0;
 		bmap[YRES/CELL-1][i]=0;
+		globalSim->WallChanged(i, 0);
+		globalSim->WallChanged(i, YRES/CELL-1);
 	}
 	for(i=1; i<((YRES/CELL)-1); i++)
 	{
 		bmap[i][0]=0;
 		bmap[i][XRES/CELL-1]=0;
+		globalSim->WallChanged(0, i);
+		globalSim->WallChanged(XRES/CELL-1, i);
 	}
 }
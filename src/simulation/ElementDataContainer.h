@@ -17,6 +17,7 @@
 #define ElementDataContainer_h
 
 #include <memory>
+#include <vector>
 #include "common/tpt-compat.h"
 
 /**
@@ -40,6 +41,11 @@ public:
 	virtual void Simulation_Cleared(Simulation *sim) {}
 	virtual void Simulation_BeforeUpdate(Simulation *sim) {}
 	virtual void Simulation_AfterUpdate(Simulation *sim) {}
+	/**
+	 * Called after Simulation::CompactParticles moved particles to new ids. newIDs[old id] is the new id, or -1 where
+	 * there wasn't a particle. Containers that store particle ids must remap them here
+	 */
+	virtual void Simulation_Compacted(Simulation *sim, const std::vector<int> &newIDs) {}
 	/**
 	 * Compare two element data containers and return a delta. ElementDataContainers may opt to override this if they store a lot of data.
 	 * The default implementation returns null, which lets the snapshot code know to just take a clone of the whole data container.
@@ -0,0 +1,30 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include "FloodFill.h"
+
+void FloodFill::Begin(int width, int height)
+{
+	// stamps left over from a different size are from older generations, so they never match
+	stride = width;
+	if (visited.size() < (size_t)(width * height))
+		visited.resize(width * height, 0);
+	if (!++generation)
+	{
+		std::fill(visited.begin(), visited.end(), 0);
+		generation = 1;
+	}
+}
@@ -0,0 +1,127 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FLOODFILL_H
+#define FLOODFILL_H
+
+#include <algorithm>
+#include <vector>
+
+// Scanline flood fill shared by the simulation's fill functions
+//
+// Every row is filled a whole span at a time, and the rows above and below only get one seed for each run of
+// fillable pixels instead of one per pixel. Filled pixels are remembered with a generation stamp each, so a new
+// fill just bumps the generation instead of allocating and clearing a screen sized bitmap. The buffers are kept
+// between fills and only grow
+class FloodFill
+{
+	struct Seed
+	{
+		unsigned short x, y;
+	};
+
+	std::vector<unsigned int> visited;
+	std::vector<Seed> seeds;
+	unsigned int generation = 0;
+	int stride = 0;
+	bool filling = false;
+
+	void Begin(int width, int height);
+	bool Visited(int x, int y) { return visited[y*stride+x] == generation; }
+	template<class Check>
+	void PushSeeds(int x1, int x2, int y, Check &check);
+
+public:
+	// Inclusive area the fill may reach
+	struct Bounds
+	{
+		int x1, y1, x2, y2;
+	};
+
+	// Fills everything connected to (x, y) inside bounds where check(x, y) is true. The start point itself is
+	// always filled, callers check it first. A start outside bounds widens them to include it, like the old
+	// loops that never checked the start. apply(x1, x2, y) is called once per span and can return false to
+	// stop the fill. check is only called on pixels that haven't been filled yet, and sees the changes made by
+	// the spans applied before it
+	// Returns false if apply stopped the fill
+	template<class Check, class Apply>
+	bool Fill(int x, int y, Bounds bounds, Check check, Apply apply);
+};
+
+template<class Check>
+void FloodFill::PushSeeds(int x1, int x2, int y, Check &check)
+{
+	bool inRun = false;
+	for (int x = x1; x <= x2; x++)
+	{
+		bool fillable = !Visited(x, y) && check(x, y);
+		if (fillable && !inRun)
+			seeds.push_back({ (unsigned short)x, (unsigned short)y });
+		inRun = fillable;
+	}
+}
+
+template<class Check, class Apply>
+bool FloodFill::Fill(int x, int y, Bounds bounds, Check check, Apply apply)
+{
+	// started from one of another fill's callbacks, that fill's buffers are still in use
+	if (filling)
+	{
+		FloodFill nested;
+		return nested.Fill(x, y, bounds, check, apply);
+	}
+
+	if (x < 0 || y < 0 || x > 0xFFFF || y > 0xFFFF)
+		return true;
+	bounds.x1 = std::min(bounds.x1, x);
+	bounds.y1 = std::min(bounds.y1, y);
+	bounds.x2 = std::max(bounds.x2, x);
+	bounds.y2 = std::max(bounds.y2, y);
+
+	filling = true;
+	Begin(bounds.x2 + 1, bounds.y2 + 1);
+	seeds.push_back({ (unsigned short)x, (unsigned short)y });
+	bool completed = true;
+	while (seeds.size())
+	{
+		Seed seed = seeds.back();
+		seeds.pop_back();
+		y = seed.y;
+		if (Visited(seed.x, y))
+			continue;
+
+		int x1 = seed.x, x2 = seed.x;
+		while (x1 > bounds.x1 && !Visited(x1-1, y) && check(x1-1, y))
+			x1--;
+		while (x2 < bounds.x2 && !Visited(x2+1, y) && check(x2+1, y))
+			x2++;
+		std::fill(&visited[y*stride+x1], &visited[y*stride+x2+1], generation);
+		if (!apply(x1, x2, y))
+		{
+			completed = false;
+			break;
+		}
+
+		if (y > bounds.y1)
+			PushSeeds(x1, x2, y-1, check);
+		if (y < bounds.y2)
+			PushSeeds(x1, x2, y+1, check);
+	}
+	seeds.clear();
+	filling = false;
+	return completed;
+}
+
+#endif
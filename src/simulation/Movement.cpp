@@ -297,6 +297,14 @@ void Simulation::InitCanMove()
 	//  2 = Both particles occupy the same space.
 	//  3 = Varies, go run some extra checks
 
+	std::vector<MoveTableInput> inputs(PT_NUM);
+	for (int t = 0; t < PT_NUM; t++)
+		inputs[t] = { elements[t].Weight, elements[t].Properties, elements[t].HeatConduct };
+	if (!moveTablesModified && inputs == moveTableInputs)
+		return;
+	moveTableInputs.swap(inputs);
+	moveTablesModified = false;
+
 	// particles that don't exist shouldn't move...
 	for (int destinationType = 0; destinationType < PT_NUM; destinationType++)
 		can_move[0][destinationType] = 0;
@@ -449,15 +457,81 @@ void Simulation::InitCanMove()
 	can_move[PT_RAZR][PT_GEL] = 1;
 	can_move[PT_MOVS][PT_MOVS] = 2;
 #endif
+
+	InitMoveClasses();
+	InitHeatTables();
+}
+
+// Which of TryMove's special cases can apply when movingType moves into destinationType
+// Anything that touches either particle, looks at their properties or uses the RNG is MOVE_SPECIAL
+unsigned char Simulation::ClassifyMove(int movingType, int destinationType)
+{
+#ifndef NOMOD
+	// EvalMove looks through PINV at whatever is inside
+	if (destinationType == PT_PINV)
+		return MOVE_SPECIAL;
+#endif
+	// SPNG pushes whatever it moves into
+	if (movingType == PT_SPNG)
+		return MOVE_SPECIAL;
+
+	switch (can_move[movingType][destinationType])
+	{
+	case 0:
+		// fast WOOD turns into SAWD, energy particles heat things, get cloned or enter portals
+		if (destinationType == PT_WOOD || (elements[movingType].Properties & TYPE_ENERGY))
+			return MOVE_SPECIAL;
+		return MOVE_BLOCKED;
+	case 1:
+		switch (destinationType)
+		{
+		case PT_VOID:
+		case PT_PVOD:
+		case PT_BHOL:
+		case PT_NBHL:
+		case PT_WHOL:
+		case PT_NWHL:
+		case PT_DEUT:
+		case PT_VIBR:
+		case PT_BVBR:
+			return MOVE_SPECIAL;
+		}
+		if (movingType == PT_NEUT || movingType == PT_CNCT || movingType == PT_GBMB)
+			return MOVE_SPECIAL;
+		return MOVE_SWAP;
+	case 2:
+		switch (movingType)
+		{
+		case PT_PHOT:
+		case PT_NEUT:
+		case PT_ELEC:
+		case PT_PROT:
+		case PT_BIZR:
+		case PT_BIZRG:
+			return MOVE_SPECIAL;
+		}
+		return MOVE_OCCUPY;
+	default:
+		return MOVE_SPECIAL;
+	}
+}
+
+void Simulation::InitMoveClasses()
+{
+	for (int movingType = 0; movingType < PT_NUM; movingType++)
+		for (int destinationType = 0; destinationType < PT_NUM; destinationType++)
+			move_class[movingType][destinationType] = ClassifyMove(movingType, destinationType);
 }
 
-/*
-   RETURN-value explanation
-1 = Swap
-0 = No move/Bounce
-2 = Both particles occupy the same space.
- */
-unsigned char Simulation::EvalMove(int pt, int nx, int ny, unsigned *rr)
+void Simulation::SetCanMove(int movingType, int destinationType, unsigned char value)
+{
+	can_move[movingType][destinationType] = value;
+	move_class[movingType][destinationType] = ClassifyMove(movingType, destinationType);
+	moveTablesModified = true;
+}
+
+// Everything EvalMove doesn't handle inline: walls, PINV and the can_move results that vary (3)
+unsigned char Simulation::EvalMoveSpecial(int pt, int nx, int ny, unsigned *rr)
 {
 	unsigned r;
 	int result;
@@ -576,15 +650,52 @@ unsigned char Simulation::EvalMove(int pt, int nx, int ny, unsigned *rr)
 	return result;
 }
 
-int Simulation::TryMove(int i, int x, int y, int nx, int ny)
+// the particle at e makes room for one moving from x,y to nx,ny by moving the other way
+void Simulation::DisplaceSwapped(int e, int x, int y, int nx, int ny)
 {
-	unsigned r, e;
+	if (!OutOfBounds((int)(parts[e].x+0.5f)+x-nx, (int)(parts[e].y+0.5f)+y-ny))
+	{
+		if (!OutOfBounds(nx, ny) && (int)ID(pmap[ny][nx]) == e)
+			pmap[ny][nx] = 0;
+		parts[e].x += x-nx;
+		parts[e].y += y-ny;
+		pmap[(int)(parts[e].y+0.5f)][(int)(parts[e].x+0.5f)] = PMAP(e, parts[e].type);
+	}
+}
 
+int Simulation::TryMove(int i, int x, int y, int nx, int ny)
+{
 	if (x==nx && y==ny)
 		return 1;
 	if (nx<0 || ny<0 || nx>=XRES || ny>=YRES)
 		return 1;
 
+	// plain moves into empty space, swaps and blocked moves, as long as there are no walls at either end
+	unsigned r = pmap[ny][nx];
+	if (r)
+		r = (r&~PMAPMASK) | parts[ID(r)].type;
+	int t = parts[i].type;
+	if (t < PT_NUM && TYP(r) < PT_NUM && !bmap[ny/CELL][nx/CELL] && !bmap[y/CELL][x/CELL])
+	{
+		switch (move_class[t][TYP(r)])
+		{
+		case MOVE_BLOCKED:
+			return 0;
+		case MOVE_OCCUPY:
+			return 1;
+		case MOVE_SWAP:
+			if (r)
+				DisplaceSwapped(ID(r), x, y, nx, ny);
+			return 1;
+		}
+	}
+	return TryMoveSpecial(i, x, y, nx, ny);
+}
+
+int Simulation::TryMoveSpecial(int i, int x, int y, int nx, int ny)
+{
+	unsigned r, e;
+
 	e = EvalMove(parts[i].type, nx, ny, &r);
 
 	/* half-silvered mirror */
@@ -881,14 +992,7 @@ int Simulation::TryMove(int i, int x, int y, int nx, int ny)
 			return 1;
 		}
 
-		if (!OutOfBounds((int)(parts[e].x+0.5f)+x-nx, (int)(parts[e].y+0.5f)+y-ny))
-		{
-			if (!OutOfBounds(nx, ny) && ID(pmap[ny][nx]) == e)
-				pmap[ny][nx] = 0;
-			parts[e].x += x-nx;
-			parts[e].y += y-ny;
-			pmap[(int)(parts[e].y+0.5f)][(int)(parts[e].x+0.5f)] = PMAP(e, parts[e].type);
-		}
+		DisplaceSwapped(e, x, y, nx, ny);
 	}
 	return 1;
 }
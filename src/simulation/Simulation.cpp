@@ -13,11 +13,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cmath>
 
 //Simulation stuff
 #include "Simulation.h"
-#include "CoordStack.h"
+#include "FloodFill.h"
 #include "interface.h" //for framenum, try to remove this later
 #include "luaconsole.h" //for lua_el_mode
 #include "misc.h"
@@ -69,6 +70,7 @@ Simulation::Simulation():
 	lightningRecreate(0)
 {
 	std::fill(&elementData[0], &elementData[PT_NUM], nullptr);
+	randomKey = RNG::Ref().gen();
 
 	// Initialize global parts variable. TODO: make everything use sim->parts
 	::parts = this->parts;
@@ -117,14 +119,22 @@ void Simulation::Clear()
 	saveEdgeMode = -1;
 	if (edgeMode == 1)
 		draw_bframe();
+	AllWallsChanged();
 }
 
-CoordStack& Simulation::getCoordStackSingleton()
+void Simulation::AllWallsChanged()
 {
-	// Future-proofing in case Simulation is later multithreaded
-	thread_local CoordStack cs;
-	cs.clear();
-	return cs;
+	std::fill(&wallListed[0][0], &wallListed[0][0] + (YRES/CELL)*(XRES/CELL), true);
+	changedWalls.resize((YRES/CELL)*(XRES/CELL));
+	for (int i = 0; i < (YRES/CELL)*(XRES/CELL); i++)
+		changedWalls[i] = i;
+}
+
+void Simulation::ClearChangedWalls()
+{
+	for (int cell : changedWalls)
+		wallListed[cell/(XRES/CELL)][cell%(XRES/CELL)] = false;
+	changedWalls.clear();
 }
 
 void Simulation::RecountElements()
@@ -219,7 +229,64 @@ bool Simulation::LoadSave(int loadX, int loadY, Save *save, int replace, bool in
 	unsigned int animDataPos = 0;
 #endif
 
-	int r;
+	// Everything LoadSave checks per particle only depends on the type, so look it up in tables built once per load
+	// canSpawn is indexed by the type as it is in the save, typeMap gives the type it is loaded as
+	bool canSpawn[PT_NUM];
+	int typeMap[PT_NUM];
+	bool fighCanAlloc = static_cast<FIGH_ElementDataContainer&>(*elementData[PT_FIGH]).CanAlloc();
+	for (int t = 0; t < PT_NUM; t++)
+	{
+		canSpawn[t] = elements[t].Enabled;
+		if ((t == PT_STKM || t == PT_STKM2 || t == PT_SPAWN || t == PT_SPAWN2) && elementCount[t] > 0)
+			canSpawn[t] = false;
+		if (t == PT_FIGH && !fighCanAlloc)
+			canSpawn[t] = false;
+		typeMap[t] = hasPalette ? partMap[t] : save->FixType(t);
+	}
+	canSpawn[PT_NONE] = false;
+
+	// Which types store another type in ctype / tmp2, so those get remapped too
+	bool typeInCtype[PT_NUM], typeInTmp2[PT_NUM];
+	for (int t = 0; t < PT_NUM; t++)
+	{
+		typeInCtype[t] = Save::TypeInCtype(t, PT_NONE);
+		typeInTmp2[t] = Save::TypeInTmp2(t, PT_NONE);
+	}
+
+	// Types handled by the switch after placing: stickmen / fighters, SOAP links, pressure and the mod's per-element data.
+	// Everything else is done once its fields are copied
+	bool needsFixup[PT_NUM];
+	for (int t = 0; t < PT_NUM; t++)
+	{
+		switch (t)
+		{
+		case PT_STKM:
+		case PT_STKM2:
+		case PT_SPAWN:
+		case PT_SPAWN2:
+		case PT_FIGH:
+		case PT_SOAP:
+#ifndef NOMOD
+		case PT_MOVS:
+		case PT_ANIM:
+#endif
+			needsFixup[t] = true;
+			break;
+		case PT_QRTZ:
+		case PT_GLAS:
+		case PT_TUNG:
+			needsFixup[t] = !includePressure;
+			break;
+		default:
+			needsFixup[t] = false;
+			break;
+		}
+	}
+
+	// Collect the particles that can be placed. Nothing is in pmap / photons after a clear, so those only get checked when pasting
+	std::vector<unsigned int> placeable;
+	placeable.reserve(std::min<unsigned int>(save->particlesCount, NPART));
+	bool checkOverlap = replace < 1;
 	bool doFullScan = false;
 	for (unsigned int n = 0; n < NPART && n < save->particlesCount; n++)
 	{
@@ -228,49 +295,33 @@ bool Simulation::LoadSave(int loadX, int loadY, Save *save, int replace, bool in
 		tempPart->y += (float)loadY;
 		int x = int(tempPart->x + 0.5f);
 		int y = int(tempPart->y + 0.5f);
-		
-		// Check various scenarios where we are unable to spawn the element, and set type to 0 to block spawning later
-		if (!InBounds(x, y))
-		{
-			tempPart->type = 0;
-			continue;
-		}
 
+		// Check various scenarios where we are unable to spawn the element, and set type to 0 to block spawning later
 		int type = tempPart->type;
-		if (type < 0 && type >= PT_NUM)
-		{
-			tempPart->type = 0;
-			continue;
-		}
-		// Ensure we can spawn this element
-		if ((type == PT_STKM || type == PT_STKM2 || type == PT_SPAWN || type == PT_SPAWN2) && elementCount[type] > 0)
-		{
-			tempPart->type = 0;
-			continue;
-		}
-		if (type == PT_FIGH && !static_cast<FIGH_ElementDataContainer&>(*elementData[PT_FIGH]).CanAlloc())
-		{
-			tempPart->type = 0;
-			continue;
-		}
-		if (!elements[type].Enabled)
+		if (!InBounds(x, y) || type < 0 || type >= PT_NUM || !canSpawn[type])
 		{
 			tempPart->type = 0;
 			continue;
 		}
 
-		if ((r = pmap[y][x]))
+		if (checkOverlap)
 		{
-			// Particle already exists in this location. Set pmap to 0, then kill it and all stacked particles in the loop below
-			pmap[y][x] = 0;
-			doFullScan = true;
-		}
-		else if ((r = photons[y][x]))
-		{
-			// Particle already exists in this location. Set photons to 0, then kill it and all stacked particles in the loop below
-			photons[y][x] = 0;
-			doFullScan = true;
+			if (pmap[y][x])
+			{
+				// Particle already exists in this location. Set pmap to 0, then kill it and all stacked particles in the loop below
+				pmap[y][x] = 0;
+				doFullScan = true;
+			}
+			else if (photons[y][x])
+			{
+				// Particle already exists in this location. Set photons to 0, then kill it and all stacked particles in the loop below
+				photons[y][x] = 0;
+				doFullScan = true;
+			}
 		}
+		// custom elements missing from this game still clear the space, but aren't placed
+		if (typeMap[type] > 0 && typeMap[type] < PT_NUM)
+			placeable.push_back(n);
 	}
 
 	if (doFullScan)
@@ -295,21 +346,25 @@ bool Simulation::LoadSave(int loadX, int loadY, Save *save, int replace, bool in
 		}
 	}
 
+	// Take slots for all of them off the free list at once (this is after the full scan, which can free more)
+	std::vector<int> slots;
+	slots.reserve(placeable.size());
+	while (slots.size() < placeable.size() && pfree != -1)
+	{
+		slots.push_back(pfree);
+		if (pfree > parts_lastActiveIndex)
+			parts_lastActiveIndex = pfree;
+		pfree = parts[pfree].life;
+	}
+
 	int i;
 	// Map of soap particles loaded into this save, old ID -> new ID
 	std::map<unsigned int, unsigned int> soapList;
-	for (unsigned int n = 0; n < NPART && n < save->particlesCount; n++)
+	for (size_t k = 0; k < slots.size(); k++)
 	{
+		unsigned int n = placeable[k];
 		particle tempPart = save->particles[n];
-		if (tempPart.type > 0 && tempPart.type < PT_NUM)
-		{
-			if (hasPalette)
-				tempPart.type = partMap[tempPart.type];
-			else
-				tempPart.type = save->FixType(tempPart.type);
-		}
-		else
-			continue;
+		tempPart.type = typeMap[tempPart.type];
 
 		// These store type in ctype, but are special because they store extra information in the bits after type
 		if (tempPart.type == PT_CRAY || tempPart.type == PT_DRAY || tempPart.type == PT_CONV)
@@ -320,13 +375,8 @@ bool Simulation::LoadSave(int loadX, int loadY, Save *save, int replace, bool in
 				ctype = partMap[ctype];
 			tempPart.ctype = PMAP(extra, ctype);
 		}
-		else if (tempPart.ctype > 0 && tempPart.ctype < PT_NUM && Save::TypeInCtype(tempPart.type, tempPart.ctype))
-		{
-			if (hasPalette)
-				tempPart.ctype = partMap[tempPart.ctype];
-			else
-				tempPart.ctype = save->FixType(tempPart.ctype);
-		}
+		else if (tempPart.ctype > 0 && tempPart.ctype < PT_NUM && typeInCtype[tempPart.type])
+			tempPart.ctype = typeMap[tempPart.ctype];
 		// also stores extra bits past type (only STOR right now)
 		if (Save::TypeInTmp(tempPart.type))
 		{
@@ -338,31 +388,20 @@ bool Simulation::LoadSave(int loadX, int loadY, Save *save, int replace, bool in
 				tmp = save->FixType(tmp);
 			tempPart.tmp = PMAP(extra, tmp);
 		}
-		if (Save::TypeInTmp2(tempPart.type, tempPart.tmp2))
-		{
-			if (tempPart.tmp2 > 0 && tempPart.tmp2 < PT_NUM)
-			{
-				if (hasPalette)
-					tempPart.tmp2 = partMap[tempPart.tmp2];
-				else
-					tempPart.tmp2 = save->FixType(tempPart.tmp2);
-			}
-		}
+		if (typeInTmp2[tempPart.type] && tempPart.tmp2 > 0 && tempPart.tmp2 < PT_NUM)
+			tempPart.tmp2 = typeMap[tempPart.tmp2];
 
 		if (save->legacyHeatSave)
 		{
 			tempPart.temp = elements[tempPart.type].DefaultProperties.temp;
 		}
 
-		// Allocate particle (this location is guaranteed to be empty due to "full scan" logic above)
-		if (pfree == -1)
-			break;
-		i = pfree;
-		pfree = parts[i].life;
-		if (i > parts_lastActiveIndex)
-			parts_lastActiveIndex = i;
+		// This location is guaranteed to be empty due to "full scan" logic above
+		i = slots[k];
 		parts[i] = tempPart;
 		elementCount[tempPart.type]++;
+		if (!needsFixup[tempPart.type])
+			continue;
 
 		switch (parts[i].type)
 		{
@@ -539,6 +578,7 @@ bool Simulation::LoadSave(int loadX, int loadY, Save *save, int replace, bool in
 			if (save->blockMap[saveBlockY][saveBlockX])
 			{
 				bmap[saveBlockY+blockY][saveBlockX+blockX] = save->blockMap[saveBlockY][saveBlockX];
+				WallChanged(saveBlockX+blockX, saveBlockY+blockY);
 				air->fvx[saveBlockY+blockY][saveBlockX+blockX] = save->fanVelX[saveBlockY][saveBlockX];
 				air->fvy[saveBlockY+blockY][saveBlockX+blockX] = save->fanVelY[saveBlockY][saveBlockX];
 			}
@@ -1186,6 +1226,7 @@ void Simulation::ClearArea(int x, int y, int w, int h)
 		for (int cx = 0; cx < w; cx++)
 		{
 			bmap[(cy+y)/CELL][(cx+x)/CELL] = 0;
+			WallChanged((cx+x)/CELL, (cy+y)/CELL);
 		}
 	}
 	DeleteSignsInArea(Point(x, y), Point(x+w, y+h));
@@ -1331,6 +1372,98 @@ void Simulation::RecalcFreeParticles(bool doLifeDec)
 	parts_lastActiveIndex = lastPartUsed;
 }
 
+// Spreads the low 16 bits of v out to the even bits, for interleaving two coordinates
+static unsigned int morton_spread(unsigned int v)
+{
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+/* Sorts the particles along a Z-order curve over their positions and moves them to the start of parts[].
+ * After a long session particle ids have nothing to do with where particles are, so the update loop and every
+ * neighbour lookup jump all over memory. Particles that are close on screen end up close in parts[] again.
+ * Every particle id the simulation stores is remapped: SOAP links, PINV's stored particle and the element data
+ * containers. Undo snapshots keep whole copies of parts[] and don't need it. Ids held by Lua scripts can be looked
+ * up with CompactedID until the next pass.
+ * Particles are updated in id order, so this changes the update order the same way deleting and redrawing
+ * everything would. That's why it's off by default (compactionInterval). Must not run during an update */
+void Simulation::CompactParticles()
+{
+	std::vector<unsigned long long> order;
+	for (int i = 0; i <= parts_lastActiveIndex; i++)
+		if (parts[i].type)
+		{
+			unsigned int x = std::max(0, std::min((int)(parts[i].x + 0.5f), XRES-1));
+			unsigned int y = std::max(0, std::min((int)(parts[i].y + 0.5f), YRES-1));
+			unsigned long long key = morton_spread(x) | (morton_spread(y) << 1);
+			order.push_back((key << 32) | (unsigned int)i);
+		}
+	std::sort(order.begin(), order.end());
+
+	compactedIDs.assign(NPART, -1);
+	std::vector<particle> sorted(order.size());
+	for (size_t n = 0; n < order.size(); n++)
+	{
+		int i = (int)(order[n] & 0xFFFFFFFF);
+		compactedIDs[i] = (int)n;
+		sorted[n] = parts[i];
+	}
+	int count = (int)sorted.size();
+	std::copy(sorted.begin(), sorted.end(), &parts[0]);
+	// RecalcFreeParticles links these into the free list, and expects the ones past it to already be linked
+	for (int i = count; i <= parts_lastActiveIndex; i++)
+	{
+		parts[i] = particle();
+		parts[i].life = i + 1;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		particle &part = parts[i];
+		if (part.type == PT_SOAP)
+		{
+			if ((part.ctype&2) && part.tmp >= 0 && part.tmp < NPART)
+			{
+				if (compactedIDs[part.tmp] >= 0)
+					part.tmp = compactedIDs[part.tmp];
+				else
+					part.ctype &= ~2;
+			}
+			if ((part.ctype&4) && part.tmp2 >= 0 && part.tmp2 < NPART)
+			{
+				if (compactedIDs[part.tmp2] >= 0)
+					part.tmp2 = compactedIDs[part.tmp2];
+				else
+					part.ctype &= ~4;
+			}
+		}
+#ifndef NOMOD
+		else if (part.type == PT_PINV && part.tmp2)
+		{
+			int inside = compactedIDs[ID(part.tmp2)];
+			part.tmp2 = inside >= 0 ? PMAP(inside, TYP(part.tmp2)) : 0;
+		}
+#endif
+	}
+
+	for (int t = 1; t < PT_NUM; t++)
+		if (elementData[t])
+			elementData[t]->Simulation_Compacted(this, compactedIDs);
+}
+
+int Simulation::CompactedID(int i)
+{
+	if (i < 0 || i >= NPART)
+		return -1;
+	if (compactedIDs.empty())
+		return parts[i].type ? i : -1;
+	return compactedIDs[i];
+}
+
 void Simulation::UpdateBefore()
 {
 	//update wallmaps
@@ -1338,8 +1471,8 @@ void Simulation::UpdateBefore()
 	{
 		for (int x = 0; x < XRES/CELL; x++)
 		{
-			if (emap[y][x])
-				emap[y][x]--;
+			if (emap[y][x] && !--emap[y][x])
+				WallChanged(x, y);
 			air->bmap_blockair[y][x] = (bmap[y][x]==WL_WALL || bmap[y][x]==WL_WALLELEC || bmap[y][x]==WL_BLOCKAIR || (bmap[y][x]==WL_EWALL && !emap[y][x]));
 			air->bmap_blockairh[y][x] = (bmap[y][x]==WL_WALL || bmap[y][x]==WL_WALLELEC || bmap[y][x]==WL_BLOCKAIR || bmap[y][x]==WL_GRAV || (bmap[y][x]==WL_EWALL && !emap[y][x])) ? 0x8:0;
 		}
@@ -1436,6 +1569,11 @@ void Simulation::UpdateParticles(int start, int end)
 
 void Simulation::UpdateAfter()
 {
+#ifdef LUACONSOLE
+	// Batched Lua update functions are called once per tick with every particle of their type
+	luacon_part_update_batch(this);
+#endif
+
 	// For elements with extra data, run special update functions
 	// Used only for moving solids
 	for (int t = 1; t < PT_NUM; t++)
@@ -1450,7 +1588,11 @@ void Simulation::UpdateAfter()
 void Simulation::Tick()
 {
 	if (debug_currentParticle == 0)
+	{
+		if (compactionInterval > 0 && (!sys_pause || framerender) && !(currentTick % compactionInterval))
+			CompactParticles();
 		RecalcFreeParticles(true);
+	}
 	if (!sys_pause || framerender)
 	{
 		UpdateBefore();
@@ -2430,76 +2572,40 @@ bool Simulation::UpdateParticle(int i)
 
 bool Simulation::flood_water(int x, int y, int i)
 {
-	int x1, x2, originalY = y;
+	int originalY = y;
 	int r = pmap[y][x];
 	if (!r)
 		return false;
 
-	// Bitmap for checking where we've already looked
-	auto bitmapPtr = std::unique_ptr<char[]>(new char[XRES * YRES]);
-	char *bitmap = bitmapPtr.get();
-	std::fill(&bitmap[0], &bitmap[XRES * YRES], 0);
-
-	try
-	{
-		CoordStack& cs = getCoordStackSingleton();
-		cs.push(x, y);
-		do
+	bool moved = !floodFill.Fill(x, y, { CELL-1, CELL, XRES-CELL, YRES-CELL-1 }, [&](int x, int y) {
+		return elements[TYP(pmap[y][x])].Falldown == 2;
+	}, [&](int x1, int x2, int y) {
+		// Check above, maybe around other sides too?
+		if (y - 1 <= originalY)
+			return true;
+		for (int x = x1; x <= x2; x++)
 		{
-			cs.pop(x, y);
-			x1 = x2 = x;
-			while (x1 >= CELL)
-			{
-				if (elements[TYP(pmap[y][x1 - 1])].Falldown != 2 || bitmap[(y * XRES) + x1 - 1])
-					break;
-				x1--;
-			}
-			while (x2 < XRES-CELL)
-			{
-				if (elements[TYP(pmap[y][x2 + 1])].Falldown != 2 || bitmap[(y * XRES) + x1 - 1])
-					break;
-				x2++;
-			}
-			for (int x = x1; x <= x2; x++)
-			{
-				// Check above, maybe around other sides too?
-				if (((y - 1) > originalY) && !pmap[y - 1][x])
-				{
-					// Try to move the water to a random position on this line, because there's probably a free location somewhere
-					int randPos = RNG::Ref().between(x, x2);
-					if (!pmap[y - 1][randPos] && EvalMove(parts[i].type, randPos, y - 1, nullptr))
-						x = randPos;
-					// Couldn't move to random position, so try the original position on the left
-					else if (!EvalMove(parts[i].type, x, y - 1, nullptr))
-						continue;
-
-					int oldx = (int)(parts[i].x + 0.5f);
-					int oldy = (int)(parts[i].y + 0.5f);
-					pmap[y - 1][x] = pmap[oldy][oldx];
-					pmap[oldy][oldx] = 0;
-					parts[i].x = x;
-					parts[i].y = y - 1;
-					return true;
-				}
+			if (pmap[y - 1][x])
+				continue;
+			// Try to move the water to a random position on this line, because there's probably a free location somewhere
+			int randPos = RNG::Ref().between(x, x2);
+			if (!pmap[y - 1][randPos] && EvalMove(parts[i].type, randPos, y - 1, nullptr))
+				x = randPos;
+			// Couldn't move to random position, so try the original position on the left
+			else if (!EvalMove(parts[i].type, x, y - 1, nullptr))
+				continue;
 
-				bitmap[(y * XRES) + x] = 1;
-			}
-			if (y >= CELL + 1)
-				for (int x = x1; x <= x2; x++)
-					if (elements[TYP(pmap[y - 1][x])].Falldown == 2 && !bitmap[((y - 1) * XRES) + x])
-						cs.push(x, y - 1);
-			if (y < YRES - CELL - 1)
-				for (int x = x1; x <= x2; x++)
-					if (elements[TYP(pmap[y + 1][x])].Falldown == 2 && !bitmap[((y + 1) * XRES) + x])
-						cs.push(x, y + 1);
-		} while (cs.getSize() > 0);
-	}
-	catch (CoordStackOverflowException& e)
-	{
-		std::cerr << e.what() << std::endl;
-		return false;
-	}
-	return false;
+			int oldx = (int)(parts[i].x + 0.5f);
+			int oldy = (int)(parts[i].y + 0.5f);
+			pmap[y - 1][x] = pmap[oldy][oldx];
+			pmap[oldy][oldx] = 0;
+			parts[i].x = x;
+			parts[i].y = y - 1;
+			return false;
+		}
+		return true;
+	});
+	return moved;
 }
 
 /* spark_conductive turns a particle into SPRK and sets ctype, life, and temperature.
@@ -2609,11 +2715,17 @@ int Simulation::CreateParts(int x, int y, int c, int flags, bool fill, Brush* br
 			if (CreatePartFlags(x, j, c, flags))
 				f = 1;
 	}
+	else if (fill)
+	{
+		for (const BrushSpan &span : brush->GetSpans())
+			for (int i = x + span.x1; i <= x + span.x2; i++)
+				if (CreatePartFlags(i, y + span.y, c, flags))
+					f = 1;
+	}
 	else
 	{
-		int tempy = y - 1, i, j, jmax, oldy;
+		int tempy = y - 1, i, j, oldy;
 		// tempy is the closest y value that is just outside (above) the brush
-		// jmax is the closest y value that is just outside (below) the brush
 
 		// For triangle brush, start at the very bottom
 		if (shape == TRI_BRUSH)
@@ -2621,41 +2733,20 @@ int Simulation::CreateParts(int x, int y, int c, int flags, bool fill, Brush* br
 		for (i = x - rx; i <= x; i++)
 		{
 			oldy = tempy;
-			while (brush && tempy >= y - ry && brush->IsInside(i - x, tempy - y))
-				tempy = tempy - 1;
-			if (fill)
+			tempy = y + brush->GetColumnTop(i - x);
+			for (j = oldy + 1; j > tempy; j--)
 			{
-				// If triangle brush, create parts down to the bottom always; if not go down to the bottom border
+				int i2 = 2*x-i, j2 = 2*y-j;
 				if (shape == TRI_BRUSH)
-					jmax = y + ry;
-				else
-					jmax = 2 * y - tempy;
-
-				for (j = jmax - 1; j > tempy; j--)
-				{
-					if (CreatePartFlags(i, j, c, flags))
-						f = 1;
-					// Don't create twice in the vertical center line
-					if (i!=x && CreatePartFlags(2*x-i, j, c, flags))
-						f = 1;
-				}
-			}
-			else
-			{
-				for (j = oldy + 1; j > tempy; j--)
-				{
-					int i2 = 2*x-i, j2 = 2*y-j;
-					if (shape == TRI_BRUSH)
-						j2 = y+ry;
-					if (CreatePartFlags(i, j, c, flags))
-						f = 1;
-					if (i2 != i && CreatePartFlags(i2, j, c, flags))
-						f = 1;
-					if (j2 != j && CreatePartFlags(i, j2, c, flags))
-						f = 1;
-					if (i2 != i && j2 != j && CreatePartFlags(i2, j2, c, flags))
-						f = 1;
-				}
+					j2 = y+ry;
+				if (CreatePartFlags(i, j, c, flags))
+					f = 1;
+				if (i2 != i && CreatePartFlags(i2, j, c, flags))
+					f = 1;
+				if (j2 != j && CreatePartFlags(i, j2, c, flags))
+					f = 1;
+				if (i2 != i && j2 != j && CreatePartFlags(i2, j2, c, flags))
+					f = 1;
 			}
 		}
 	}
@@ -2703,8 +2794,81 @@ int Simulation::CreatePartFlags(int x, int y, int c, int flags)
 	return 0;
 }
 
+// Elements that CreateParts draws with a different shape or only some of the time
+static bool brush_shape_overridden(int c)
+{
+#ifndef NOMOD
+	if (c == PT_MOVS)
+		return true;
+#endif
+	return c == PT_LIGH || c == PT_STKM || c == PT_STKM2 || c == PT_FIGH || c == PT_TESC;
+}
+
+// Draws every pixel any brush position along the line covers exactly once. Each row of the line is the union of the
+// rows of the brushes on it, which is one span as brush rows are, and neighbouring positions are at most a pixel apart
+void Simulation::CreateSweptLine(int x1, int y1, int x2, int y2, int c, int flags, Brush* brush)
+{
+	int rowStart[YRES], rowEnd[YRES];
+	std::fill(&rowStart[0], &rowStart[YRES], XRES);
+	std::fill(&rowEnd[0], &rowEnd[YRES], -1);
+	const std::vector<BrushSpan> &spans = brush->GetSpans();
+	auto addBrush = [&](int x, int y) {
+		for (const BrushSpan &span : spans)
+		{
+			int row = y + span.y;
+			if (row < 0 || row >= YRES)
+				continue;
+			rowStart[row] = std::min(rowStart[row], std::max(x + span.x1, 0));
+			rowEnd[row] = std::max(rowEnd[row], std::min(x + span.x2, XRES-1));
+		}
+	};
+
+	// same steps as CreateLine
+	int x, y, dx, dy, sy;
+	bool reverseXY = abs(y2-y1) > abs(x2-x1);
+	float e = 0.0f, de;
+	if (reverseXY)
+	{
+		std::swap(x1, y1);
+		std::swap(x2, y2);
+	}
+	if (x1 > x2)
+	{
+		std::swap(x1, x2);
+		std::swap(y1, y2);
+	}
+	dx = x2 - x1;
+	dy = abs(y2 - y1);
+	de = dx ? dy/(float)dx : 0.0f;
+	y = y1;
+	sy = (y1<y2) ? 1 : -1;
+	for (x=x1; x<=x2; x++)
+	{
+		if (reverseXY)
+			addBrush(y, x);
+		else
+			addBrush(x, y);
+		e += de;
+		if (e >= 0.5f)
+		{
+			y += sy;
+			e -= 1.0f;
+		}
+	}
+
+	for (int row = 0; row < YRES; row++)
+		for (int i = rowStart[row]; i <= rowEnd[row]; i++)
+			CreatePartFlags(i, row, c, flags);
+}
+
 void Simulation::CreateLine(int x1, int y1, int x2, int y2, int c, int flags, Brush* brush)
 {
+	if (brush && brush->GetRadius().X > 0 && !brush_shape_overridden(c))
+	{
+		CreateSweptLine(x1, y1, x2, y2, c, flags, brush);
+		return;
+	}
+
 	int x, y, dx, dy, sy;
 	bool reverseXY = abs(y2-y1) > abs(x2-x1), fill = true;
 	float e = 0.0f, de;
@@ -2790,7 +2954,6 @@ int Simulation::FloodFillPmapCheck(int x, int y, unsigned int type)
 int Simulation::FloodParts(int x, int y, int fullc, int replace, int flags)
 {
 	unsigned int c = TYP(fullc);
-	int x1, x2;
 	int created_something = 0;
 
 	if (replace == -1)
@@ -2820,77 +2983,33 @@ int Simulation::FloodParts(int x, int y, int fullc, int replace, int flags)
 	if (!FloodFillPmapCheck(x, y, replace) || ((flags&BRUSH_SPECIFIC_DELETE) && ((ElementTool*)activeTools[2])->GetID() != replace))
 		return 0;
 
-	try
-	{
-		CoordStack& cs = getCoordStackSingleton();
-		cs.push(x, y);
-
-		do
+	FloodFill::Bounds bounds = c ? FloodFill::Bounds{ CELL, CELL, XRES-CELL-1, YRES-CELL-1 } : FloodFill::Bounds{ 0, 0, XRES-1, YRES-1 };
+	floodFill.Fill(x, y, bounds, [&](int x, int y) {
+		return FloodFillPmapCheck(x, y, replace) && (c == 0 || !IsWallBlocking(x, y, c));
+	}, [&](int x1, int x2, int y) {
+		for (int x = x1; x <= x2; x++)
 		{
-			cs.pop(x, y);
-			x1 = x2 = x;
-			// go left as far as possible
-			while (c?x1>CELL:x1>0)
-			{
-				if (!FloodFillPmapCheck(x1-1, y, replace) || (c != 0 && IsWallBlocking(x1-1, y, c)))
-				{
-					break;
-				}
-				x1--;
-			}
-			// go right as far as possible
-			while (c?x2<XRES-CELL-1:x2<XRES-1)
-			{
-				if (!FloodFillPmapCheck(x2+1, y, replace) || (c != 0 && IsWallBlocking(x2+1, y, c)))
-				{
-					break;
-				}
-				x2++;
-			}
-			// fill span
-			for (x=x1; x<=x2; x++)
+			if (!fullc)
 			{
-				if (!fullc)
+				if (elements[replace].Properties&TYPE_ENERGY)
 				{
-					if (elements[replace].Properties&TYPE_ENERGY)
+					if (photons[y][x])
 					{
-						if (photons[y][x])
-						{
-							part_kill(ID(photons[y][x]));
-							created_something = 1;
-						}
-					}
-					else if (pmap[y][x])
-					{
-						part_kill(ID(pmap[y][x]));
+						part_kill(ID(photons[y][x]));
 						created_something = 1;
 					}
 				}
-				else if (CreateParts(x, y, fullc, flags, true))
+				else if (pmap[y][x])
+				{
+					part_kill(ID(pmap[y][x]));
 					created_something = 1;
+				}
 			}
-
-			if (c ? y>CELL : y>0)
-				for (x=x1; x<=x2; x++)
-					if (FloodFillPmapCheck(x, y-1, replace) && (c == 0 || !IsWallBlocking(x, y-1, c)))
-					{
-						cs.push(x, y-1);
-					}
-
-			if (c ? y<YRES-CELL-1 : y<YRES-1)
-				for (x=x1; x<=x2; x++)
-					if (FloodFillPmapCheck(x, y+1, replace) && (c == 0 || !IsWallBlocking(x, y+1, c)))
-					{
-						cs.push(x, y+1);
-					}
+			else if (CreateParts(x, y, fullc, flags, true))
+				created_something = 1;
 		}
-		while (cs.getSize() > 0);
-	}
-	catch (const CoordStackOverflowException& e)
-	{
-		(void)e; //ignore compiler warning
-		return -1;
-	}
+		return true;
+	});
 	return created_something;
 }
 
@@ -2928,6 +3047,7 @@ void Simulation::CreateWall(int x, int y, int wall)
 	if (wall == WL_GRAV || bmap[y][x] == WL_GRAV)
 		grav->gravWallChanged = true;
 	bmap[y][x] = (unsigned char)wall;
+	WallChanged(x, y);
 }
 
 void Simulation::CreateWallLine(int x1, int y1, int x2, int y2, int rx, int ry, int wall)
@@ -3004,7 +3124,6 @@ void Simulation::CreateWallBox(int x1, int y1, int x2, int y2, int wall)
 
 int Simulation::FloodWalls(int x, int y, int wall, int replace)
 {
-	int x1, x2;
 	if (replace == -1)
 	{
 		if (wall==WL_ERASE || wall==WL_ERASEALL)
@@ -3020,41 +3139,13 @@ int Simulation::FloodWalls(int x, int y, int wall, int replace)
 	if (bmap[y][x] != replace)
 		return 1;
 
-	// go left as far as possible
-	x1 = x2 = x;
-	while (x1 >= 1)
-	{
-		if (bmap[y][x1-1] != replace)
-		{
-			break;
-		}
-		x1--;
-	}
-	while (x2 < XRES/CELL-1)
-	{
-		if (bmap[y][x2+1] != replace)
-		{
-			break;
-		}
-		x2++;
-	}
-
-	// fill span
-	for (x=x1; x<=x2; x++)
-	{
-		CreateWall(x, y, wall);
-	}
-	// fill children
-	if (y >= 1)
-		for (x=x1; x<=x2; x++)
-			if (bmap[y-1][x] == replace)
-				if (!FloodWalls(x, y-1, wall, replace))
-					return 0;
-	if (y < YRES/CELL-1)
-		for (x=x1; x<=x2; x++)
-			if (bmap[y+1][x] == replace)
-				if (!FloodWalls(x, y+1, wall, replace))
-					return 0;
+	floodFill.Fill(x, y, { 0, 0, XRES/CELL-1, YRES/CELL-1 }, [&](int x, int y) {
+		return bmap[y][x] == replace;
+	}, [&](int x1, int x2, int y) {
+		for (int x = x1; x <= x2; x++)
+			CreateWall(x, y, wall);
+		return true;
+	});
 	return 1;
 }
 
@@ -3471,7 +3562,6 @@ void Simulation::CreatePropBox(int x1, int y1, int x2, int y2, StructProperty pr
 
 int Simulation::FloodProp(int x, int y, StructProperty prop, PropertyValue propValue)
 {
-	int x1, x2, dy = 1;
 	int did_something = 0;
 	int r = pmap[y][x];
 	if (!r)
@@ -3479,53 +3569,14 @@ int Simulation::FloodProp(int x, int y, StructProperty prop, PropertyValue propV
 	if (!r)
 		return 0;
 	int parttype = TYP(r);
-	char *bitmap = new char[XRES*YRES]; //Bitmap for checking
-	if (!bitmap)
-		return -1;
-	std::fill_n(&bitmap[0], XRES*YRES, 0);
-	try
-	{
-		CoordStack& cs = getCoordStackSingleton();
-		cs.push(x, y);
-		do
-		{
-			cs.pop(x, y);
-			x1 = x2 = x;
-			while (x1>=CELL)
-			{
-				if (!FloodFillPmapCheck(x1-1, y, parttype) || bitmap[(y*XRES)+x1-1])
-					break;
-				x1--;
-			}
-			while (x2<XRES-CELL)
-			{
-				if (!FloodFillPmapCheck(x2+1, y, parttype) || bitmap[(y*XRES)+x2+1])
-					break;
-				x2++;
-			}
-			for (x=x1; x<=x2; x++)
-			{
-				CreateProp(x, y, prop, propValue);
-				bitmap[(y*XRES)+x] = 1;
-				did_something = 1;
-			}
-			if (y>=CELL+dy)
-				for (x=x1; x<=x2; x++)
-					if (FloodFillPmapCheck(x, y-dy, parttype) && !bitmap[((y-dy)*XRES)+x])
-						cs.push(x, y-dy);
-			if (y<YRES-CELL-dy)
-				for (x=x1; x<=x2; x++)
-					if (FloodFillPmapCheck(x, y+dy, parttype) && !bitmap[((y+dy)*XRES)+x])
-						cs.push(x, y+dy);
-		} while (cs.getSize()>0);
-	}
-	catch (CoordStackOverflowException& e)
-	{
-		std::cerr << e.what() << std::endl;
-		delete[] bitmap;
-		return -1;
-	}
-	delete[] bitmap;
+	floodFill.Fill(x, y, { CELL-1, CELL, XRES-CELL, YRES-CELL-1 }, [&](int x, int y) {
+		return FloodFillPmapCheck(x, y, parttype);
+	}, [&](int x1, int x2, int y) {
+		for (int x = x1; x <= x2; x++)
+			CreateProp(x, y, prop, propValue);
+		did_something = 1;
+		return true;
+	});
 	return did_something;
 }
 
@@ -3831,60 +3882,16 @@ bool Simulation::ColorCompare(pixel *vid, int x, int y, ARGBColour replace)
 
 void Simulation::FloodDeco(pixel *vid, int x, int y, ARGBColour color, ARGBColour replace)
 {
-	int x1, x2;
-	char *bitmap = new char[XRES*YRES]; //Bitmap for checking
-	if (!bitmap)
-		return;
-	std::fill_n(&bitmap[0], XRES*YRES, 0);
-
 	if (!ColorCompare(vid, x, y, replace))
-	{
-		delete[] bitmap;
 		return;
-	}
 
-	try
-	{
-		CoordStack& cs = getCoordStackSingleton();
-		cs.push(x, y);
-		do
-		{
-			cs.pop(x, y);
-			x1 = x2 = x;
-			while (x1 >= 1)
-			{
-				if (bitmap[(y*XRES)+x1-1] || !ColorCompare(vid, x1-1, y, replace))
-					break;
-				x1--;
-			}
-			while (x2 < XRES-1)
-			{
-				if (bitmap[(y*XRES)+x2+1] || !ColorCompare(vid, x2+1, y, replace))
-					break;
-				x2++;
-			}
-			for (x = x1; x <= x2; x++)
-			{
-				CreateDeco(x, y, DECO_DRAW, color);
-				bitmap[(y*XRES)+x] = 1;
-			}
-			if (y >= 1)
-				for (x=x1; x<=x2; x++)
-					if (!bitmap[x+(y-1)*XRES] && ColorCompare(vid, x, y-1, replace))
-						cs.push(x, y-1);
-			if (y < YRES-1)
-				for (x=x1; x<=x2; x++)
-					if (!bitmap[x+(y+1)*XRES] && ColorCompare(vid, x, y+1, replace))
-						cs.push(x, y+1);
-		} while (cs.getSize()>0);
-	}
-	catch (CoordStackOverflowException& e)
-	{
-		std::cerr << e.what() << std::endl;
-		delete[] bitmap;
-		return;
-	}
-	delete[] bitmap;
+	floodFill.Fill(x, y, { 0, 0, XRES-1, YRES-1 }, [&](int x, int y) {
+		return ColorCompare(vid, x, y, replace);
+	}, [&](int x1, int x2, int y) {
+		for (int x = x1; x <= x2; x++)
+			CreateDeco(x, y, DECO_DRAW, color);
+		return true;
+	});
 }
 
 /*
@@ -16,21 +16,30 @@
 #ifndef Simulation_h
 #define Simulation_h
 
+#include <bitset>
 #include <string>
+#include <vector>
+#include "common/tpt-rand.h"
 #include "graphics/ARGBColour.h"
 #include "graphics/Pixel.h"
 #include "simulation/Air.h"
 #include "simulation/Element.h"
+#include "simulation/FloodFill.h"
 #include "simulation/Gravity.h"
 #include "simulation/SimulationData.h"
 #include "simulation/StructProperty.h"
 #include "powder.h"
 
 class Brush;
-class CoordStack;
 class ElementDataContainer;
 class Save;
 
+// Call sites for Simulation::ParticleRNG, so two users of the same particle on the same tick don't get the same numbers
+enum RandomSite
+{
+	RANDOM_SITE_LUA = 0x10000, // plus the script's own site, 0 to 0xFFFF
+};
+
 class Simulation
 {
 public:
@@ -56,6 +65,9 @@ public:
 	bool instantActivation; //electronics are instantly activated
 	bool includePressure = true;
 	int decoSpace = 0;
+	bool deterministicHeat = false; // conduction spread evenly over ticks instead of random
+	int compactionInterval = 0; // ticks between sorting parts[] by position, 0 is off. Changes the update order
+	unsigned int randomKey; // seed for ParticleRNG, random at startup
 
 	// misc Simulation variables
 	unsigned int lightningRecreate; //timer for when LIGH can be created again
@@ -74,7 +86,13 @@ public:
 	void ClearArea(int x, int y, int w, int h);
 	void GetGravityField(int x, int y, float particleGrav, float newtonGrav, float & pGravX, float & pGravY);
 
+	// Random numbers for particle i this tick, independent of update order and of which thread asks
+	CounterRNG ParticleRNG(int i, unsigned int site) { return CounterRNG(randomKey, site, currentTick, i); }
+
 	void RecalcFreeParticles(bool doLifeDec);
+	void CompactParticles();
+	// After CompactParticles, the new id of the particle that had this id before, or -1 if there was none
+	int CompactedID(int i);
 	void UpdateBefore();
 	void UpdateParticles(int start, int end);
 	void UpdateAfter();
@@ -103,6 +121,19 @@ public:
 	void CreateWallLine(int x1, int y1, int x2, int y2, int rx, int ry, int wall);
 	void CreateWallBox(int x1, int y1, int x2, int y2, int wall);
 	int FloodWalls(int x, int y, int wall, int replace);
+	// Cells where bmap or emap may look different since the walls were last drawn, y*(XRES/CELL)+x, each listed
+	// once. Everything that writes either map reports the cell here, the renderer only redraws these
+	std::vector<int> changedWalls;
+	void WallChanged(int x, int y)
+	{
+		if (!wallListed[y][x])
+		{
+			wallListed[y][x] = true;
+			changedWalls.push_back(y*(XRES/CELL)+x);
+		}
+	}
+	void AllWallsChanged();
+	void ClearChangedWalls();
 
 	int CreateTool(int x, int y, int brushX, int brushY, int tool, float strength);
 	void CreateToolBrush(int x, int y, int tool, float strength, Brush* brush);
@@ -124,11 +155,26 @@ public:
 
 	// movement, functions implemented in Movement.cpp
 	unsigned char can_move[PT_NUM][PT_NUM];
+	// can_move together with everything TryMove does for a pair of types, so the common moves skip all the special cases
+	// MOVE_SPECIAL means go through TryMoveSpecial, the others are what TryMove does when there are no walls around
+	enum MoveClass : unsigned char { MOVE_BLOCKED, MOVE_SWAP, MOVE_OCCUPY, MOVE_SPECIAL };
+	unsigned char move_class[PT_NUM][PT_NUM];
 	bool OutOfBounds(int x, int y);
 	bool IsWallBlocking(int x, int y, int type);
 	bool GetNormalInterp(int pt, float x0, float y0, float dx, float dy, float *nx, float *ny);
 	void InitCanMove();
-	unsigned char EvalMove(int pt, int nx, int ny, unsigned *rr = NULL);
+	void InitMoveClasses();
+	// use this instead of writing to can_move directly, so move_class stays in sync
+	void SetCanMove(int movingType, int destinationType, unsigned char value);
+	unsigned char EvalMoveSpecial(int pt, int nx, int ny, unsigned *rr = NULL);
+
+	// heat conduction, implemented in Transitions.cpp
+	// heat_pair_allowed is whether type [t] takes heat from type [rt] next to it, heat_pair_checked marks the
+	// pairs where that also depends on the particles (HSWC). heat_capacity is 96.645/HeatConduct*|Weight|
+	float heat_capacity[PT_NUM];
+	std::bitset<PT_NUM> heat_pair_allowed[PT_NUM];
+	std::bitset<PT_NUM> heat_pair_checked[PT_NUM];
+	void InitHeatTables();
 	int DoMove(int i, int x, int y, float nxf, float nyf);
 	int Move(int i, int x, int y, float nxf, float nyf);
 
@@ -146,6 +192,36 @@ public:
 	{
 		return (x>=0 && y>=0 && x<XRES && y<YRES);
 	}
+	/*
+	   RETURN-value explanation
+	1 = Swap
+	0 = No move/Bounce
+	2 = Both particles occupy the same space.
+	 */
+	unsigned char EvalMove(int pt, int nx, int ny, unsigned *rr = NULL)
+	{
+		if (nx<0 || ny<0 || nx>=XRES || ny>=YRES)
+			return 0;
+		unsigned r = pmap[ny][nx];
+		if (r)
+			r = (r&~PMAPMASK) | parts[ID(r)].type;
+		// walls, PINV and the "varies" results are left to EvalMoveSpecial
+		if (pt < PT_NUM && TYP(r) < PT_NUM && !bmap[ny/CELL][nx/CELL]
+#ifndef NOMOD
+		    && TYP(r) != PT_PINV
+#endif
+		    )
+		{
+			unsigned char result = can_move[pt][TYP(r)];
+			if (result != 3)
+			{
+				if (rr)
+					*rr = r;
+				return result;
+			}
+		}
+		return EvalMoveSpecial(pt, nx, ny, rr);
+	}
 	std::string ElementResolve(int type, int ctype);
 
 	// Most of the time, part_alloc and part_free should not be used directly unless you really know what you're doing. 
@@ -203,13 +279,38 @@ private:
 	bool FindNextBoundary(int pt, int *x, int *y, int dm, int *em);
 	bool GetNormal(int pt, int x, int y, float dx, float dy, float *nx, float *ny);
 
+	void CreateSweptLine(int x1, int y1, int x2, int y2, int c, int flags, Brush* brush);
+
+	unsigned char ClassifyMove(int movingType, int destinationType);
+	// The element properties InitCanMove built the movement and heat tables from. Scripts call it after every
+	// element property change, it only rebuilds when one of these changed or SetCanMove touched the tables
+	struct MoveTableInput
+	{
+		int weight;
+		unsigned int properties;
+		unsigned char heatConduct;
+
+		bool operator==(const MoveTableInput &other) const
+		{
+			return weight == other.weight && properties == other.properties && heatConduct == other.heatConduct;
+		}
+	};
+	std::vector<MoveTableInput> moveTableInputs;
+	bool moveTablesModified = true;
+	void DisplaceSwapped(int e, int x, int y, int nx, int ny);
 	int TryMove(int i, int x, int y, int nx, int ny);
+	int TryMoveSpecial(int i, int x, int y, int nx, int ny);
 	
+	std::vector<int> compactedIDs;
+	bool wallListed[YRES/CELL][XRES/CELL] = {};
+
 	// Functions in Transitions.cpp
+	bool HeatPairConducts(int i, int t, int ri, int rt);
+	bool ConductsThisTick(int i, int conductivity);
 	bool TransferHeat(int i, int t, int surround[8]);
 	bool CheckPressureTransitions(int i, int t);
 
-	CoordStack& getCoordStackSingleton();
+	FloodFill floodFill;
 };
 
 extern Simulation *globalSim; // TODO: remove this
@@ -49,6 +49,7 @@ void Snapshot::Restore(Simulation * sim, const Snapshot &snap)
 	std::copy(snap.AmbientHeat .begin(), snap.AmbientHeat .end(), &sim->air->hv [0][0]);
 	std::copy(snap.BlockMap    .begin(), snap.BlockMap    .end(), &bmap         [0][0]);
 	std::copy(snap.ElecMap     .begin(), snap.ElecMap     .end(), &emap         [0][0]);
+	sim->AllWallsChanged();
 	std::copy(snap.FanVelocityX.begin(), snap.FanVelocityX.end(), &sim->air->fvx[0][0]);
 	std::copy(snap.FanVelocityY.begin(), snap.FanVelocityY.end(), &sim->air->fvy[0][0]);
 	std::copy(snap.Particles   .begin(), snap.Particles   .end(), &parts        [0]);
@@ -246,6 +246,7 @@ void WallTool::DrawLine(Simulation *sim, Brush *brush, Point startPos, Point end
 					sim->air->fvx[j][i] = nfvx;
 					sim->air->fvy[j][i] = nfvy;
 					bmap[j][i] = WL_FAN;
+					sim->WallChanged(i, j);
 				}
 	}
 	else
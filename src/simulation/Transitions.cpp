@@ -6,6 +6,46 @@
 
 static float (*tptabs)(float) = & std::abs;
 
+// Tables for TransferHeat, they depend on element properties so InitCanMove rebuilds them too
+void Simulation::InitHeatTables()
+{
+	for (int t = 0; t < PT_NUM; t++)
+	{
+		heat_capacity[t] = elements[t].HeatConduct ? 96.645f/elements[t].HeatConduct*tptabs(elements[t].Weight) : 0.0f;
+		heat_pair_allowed[t].reset();
+		heat_pair_checked[t].reset();
+	}
+	for (int t = 0; t < PT_NUM; t++)
+		for (int rt = 1; rt < PT_NUM; rt++)
+		{
+			if (elements[rt].HeatConduct
+			       && (t !=PT_FILT || (rt!=PT_BRAY && rt!=PT_BIZR && rt!=PT_BIZRG))
+			       && (rt!=PT_FILT || (t !=PT_BRAY && t !=PT_BIZR && t!=PT_BIZRG && t!=PT_PHOT))
+			       && (t !=PT_ELEC || rt!=PT_DEUT)
+			       && (t !=PT_DEUT || rt!=PT_ELEC))
+				heat_pair_allowed[t][rt] = true;
+			if (rt == PT_HSWC || (t == PT_HSWC && rt == PT_FILT) || (t == PT_FILT && rt == PT_HSWC))
+				heat_pair_checked[t][rt] = true;
+		}
+}
+
+// the part of the neighbour check that depends on the particles, not just the types
+bool Simulation::HeatPairConducts(int i, int t, int ri, int rt)
+{
+	return (rt!=PT_HSWC || parts[ri].life == 10)
+	       && (t !=PT_HSWC || rt!=PT_FILT || parts[i].tmp != 1)
+	       && (t !=PT_FILT || rt!=PT_HSWC || parts[ri].tmp != 1);
+}
+
+// A particle with conductivity n conducts on n ticks out of 250. Normally it's random, deterministic heat spreads
+// those ticks out evenly instead, each particle with its own offset so neighbours don't all conduct at once
+bool Simulation::ConductsThisTick(int i, int conductivity)
+{
+	if (!deterministicHeat)
+		return RNG::Ref().chance(conductivity, 250);
+	return (int)((currentTick * (unsigned int)conductivity + (unsigned int)i * 89) % 250) < conductivity;
+}
+
 bool Simulation::TransferHeat(int i, int t, int surround[8])
 {
 	int x = (int)(parts[i].x+0.5f), y = (int)(parts[i].y+0.5f);
@@ -31,15 +71,17 @@ bool Simulation::TransferHeat(int i, int t, int surround[8])
 	}
 
 	//heat transfer code
-	if ((t!=PT_HSWC || parts[i].life==10) && elements[t].HeatConduct*gel_scale != 0 && (realistic || RNG::Ref().chance(elements[t].HeatConduct*gel_scale, 250)))
+	int conductivity = (int)(elements[t].HeatConduct*gel_scale);
+	if ((t!=PT_HSWC || parts[i].life==10) && elements[t].HeatConduct*gel_scale != 0 && (realistic || ConductsThisTick(i, conductivity)))
 	{
 		float c_Cm = 0.0f;
 		if (aheat_enable && !(elements[t].Properties&PROP_NOAMBHEAT))
 		{
 			if (realistic)
 			{
-				c_heat = parts[i].temp*96.645f/elements[t].HeatConduct*gel_scale*tptabs(elements[t].Weight) + air->hv[y/CELL][x/CELL]*100*(air->pv[y/CELL][x/CELL]+273.15f)/256;
-				c_Cm = 96.645f/elements[t].HeatConduct*gel_scale*tptabs(elements[t].Weight) + 100*(air->pv[y/CELL][x/CELL]+273.15f)/256;
+				float capacity = heat_capacity[t]*gel_scale;
+				c_heat = parts[i].temp*capacity + air->hv[y/CELL][x/CELL]*100*(air->pv[y/CELL][x/CELL]+273.15f)/256;
+				c_Cm = capacity + 100*(air->pv[y/CELL][x/CELL]+273.15f)/256;
 				pt = c_heat/c_Cm;
 				pt = restrict_flt(pt, -MAX_TEMP+MIN_TEMP, MAX_TEMP-MIN_TEMP);
 				parts[i].temp = pt;
@@ -60,51 +102,51 @@ bool Simulation::TransferHeat(int i, int t, int surround[8])
 				c_heat= 0.0f;
 			}
 		}
+
+		// which neighbours conduct, only HSWC and FILT next to HSWC depend on more than the two types
+		const std::bitset<PT_NUM> &allowed = heat_pair_allowed[t], &checked = heat_pair_checked[t];
+		bool conducts[8];
 		for (j=0; j<8; j++)
 		{
-			surround_hconduct[j] = i;
 			r = surround[j];
-			if (!r)
-				continue;
 			rt = TYP(r);
-
-			if (rt && elements[rt].HeatConduct && (rt!=PT_HSWC || parts[ID(r)].life == 10)
-			       && (t !=PT_FILT || (rt!=PT_BRAY && rt!=PT_BIZR && rt!=PT_BIZRG))
-			       && (rt!=PT_FILT || (t !=PT_BRAY && t !=PT_BIZR && t!=PT_BIZRG && t!=PT_PHOT))
-			       && (t !=PT_ELEC || rt!=PT_DEUT)
-			       && (t !=PT_DEUT || rt!=PT_ELEC)
-			       && (t !=PT_HSWC || rt!=PT_FILT || parts[i].tmp != 1)
-			       && (t !=PT_FILT || rt!=PT_HSWC || parts[ID(r)].tmp != 1))
+			conducts[j] = allowed[rt];
+			if (checked[rt])
+				conducts[j] = conducts[j] && HeatPairConducts(i, t, ID(r), rt);
+			surround_hconduct[j] = conducts[j] ? ID(r) : i;
+		}
+		// adding 0 for the ones that don't conduct keeps the sums exactly the same as skipping them
+		if (realistic)
+		{
+			for (j=0; j<8; j++)
 			{
-				surround_hconduct[j] = ID(r);
-				if (realistic)
-				{
-					if (rt==PT_GEL)
-						gel_scale = parts[ID(r)].tmp*2.55f;
-					else gel_scale = 1.0f;
-
-					c_heat += parts[ID(r)].temp*96.645f/elements[rt].HeatConduct*tptabs(elements[rt].Weight);
-					c_Cm += 96.645f/elements[rt].HeatConduct*tptabs(elements[rt].Weight);
-				}
-				else
-				{
-					c_heat += parts[ID(r)].temp;
-				}
-				h_count++;
+				float capacity = conducts[j] ? heat_capacity[TYP(surround[j])] : 0.0f;
+				c_heat += parts[surround_hconduct[j]].temp*capacity;
+				c_Cm += capacity;
 			}
 		}
+		else
+		{
+			for (j=0; j<8; j++)
+				c_heat += conducts[j] ? parts[surround_hconduct[j]].temp : 0.0f;
+		}
+		for (j=0; j<8; j++)
+			h_count += conducts[j];
+
 		if (realistic)
 		{
+			// this has always looked at the last neighbour, not the particle itself
 			if (t==PT_GEL)
-				gel_scale = parts[ID(r)].tmp*2.55f;
+				gel_scale = parts[ID(surround[7])].tmp*2.55f;
 			else gel_scale = 1.0f;
 
+			float capacity = heat_capacity[t]*gel_scale;
 			if (t == PT_PHOT)
 				pt = (c_heat+parts[i].temp*96.645f)/(c_Cm+96.645f);
 			else
-				pt = (c_heat+parts[i].temp*96.645f/elements[t].HeatConduct*gel_scale*tptabs(elements[t].Weight))/(c_Cm+96.645f/elements[t].HeatConduct*gel_scale*tptabs(elements[t].Weight));
-			c_heat += parts[i].temp*96.645f/elements[t].HeatConduct*gel_scale*tptabs(elements[t].Weight);
-			c_Cm += 96.645f/elements[t].HeatConduct*gel_scale*tptabs(elements[t].Weight);
+				pt = (c_heat+parts[i].temp*capacity)/(c_Cm+capacity);
+			c_heat += parts[i].temp*capacity;
+			c_Cm += capacity;
 			parts[i].temp = restrict_flt(pt, MIN_TEMP, MAX_TEMP);
 		}
 		else
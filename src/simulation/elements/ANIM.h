@@ -55,6 +55,21 @@ public:
 			}
 	}
 
+	void Simulation_Compacted(Simulation *sim, const std::vector<int> &newIDs) override
+	{
+		std::vector<ARGBColour*> moved(NPART, nullptr);
+		for (int i = 0; i < NPART; i++)
+		{
+			if (!animations[i])
+				continue;
+			if (newIDs[i] >= 0)
+				moved[newIDs[i]] = animations[i];
+			else
+				delete[] animations[i];
+		}
+		std::copy(moved.begin(), moved.end(), &animations[0]);
+	}
+
 	unsigned int GetMaxFrames()
 	{
 		return maxFrames;
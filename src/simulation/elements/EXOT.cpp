@@ -153,7 +153,7 @@ int EXOT_graphics(GRAPHICS_FUNC_ARGS)
 	int c = cpart->tmp2;	
 	if (cpart->life < 1001)
 	{
-		if (RNG::Ref().chance(cpart->tmp2 - 1, 1000))
+		if (RNG::Graphics().chance(cpart->tmp2 - 1, 1000))
 		{	
 			float frequency = 0.04045f;
 			*colr = (int)(sinf(frequency*c + 4) * 127 + 150);
@@ -318,6 +318,7 @@ int FIRE_update(UPDATE_FUNC_ARGS)
 int FIRE_graphics(GRAPHICS_FUNC_ARGS)
 {
 	int caddress = (int)restrict_flt(restrict_flt((float)cpart->life, 0.0f, 200.0f)*3, 0.0f, (200.0f*3)-3);
+	const char *flm_data = flm_gradient();
 	*colr = (unsigned char)flm_data[caddress];
 	*colg = (unsigned char)flm_data[caddress+1];
 	*colb = (unsigned char)flm_data[caddress+2];
@@ -51,7 +51,7 @@ int GLOW_graphics(GRAPHICS_FUNC_ARGS)
 	*colg = int(restrict_flt(64.0f+cpart->ctype, 0, 255));
 	*colb = int(restrict_flt(64.0f+cpart->tmp, 0, 255));
 
-	int rng = RNG::Ref().between(1, 32); //
+	int rng = RNG::Graphics().between(1, 32); //
 	if(((*colr) + (*colg) + (*colb)) > (256 + rng)) {
 		*colr -= 54;
 		*colg -= 54;
@@ -216,7 +216,7 @@ int LITH_graphics(GRAPHICS_FUNC_ARGS)
 	// Charged lith
 	else if (cpart->ctype > 0)
 	{
-		int mult = RNG::Ref().between(cpart->ctype / 3, cpart->ctype) / 15;
+		int mult = RNG::Graphics().between(cpart->ctype / 3, cpart->ctype) / 15;
 		mult = std::min(6, mult);
 		*colr -= 30 * mult;
 		*colb += 20 * mult;
@@ -119,6 +119,14 @@ public:
 		}
 	}
 
+	void Simulation_Compacted(Simulation *sim, const std::vector<int> &newIDs) override
+	{
+		// index is the centre particle's id + 1, 0 for none
+		for (int bn = 0; bn < numBalls; bn++)
+			if (movingSolids[bn].index > 0 && movingSolids[bn].index <= NPART)
+				movingSolids[bn].index = newIDs[movingSolids[bn].index-1] + 1;
+	}
+
 	bool IsCreatingSolid()
 	{
 		return creatingSolid != 0;
@@ -21,6 +21,7 @@ int FIRE_update(UPDATE_FUNC_ARGS);
 int PLSM_graphics(GRAPHICS_FUNC_ARGS)
 {
 	int caddress = (int)restrict_flt(restrict_flt((float)cpart->life, 0.0f, 200.0f)*3, 0.0f, (200.0f*3)-3);
+	const char *plasma_data = plasma_gradient();
 	*colr = (unsigned char)plasma_data[caddress];
 	*colg = (unsigned char)plasma_data[caddress+1];
 	*colb = (unsigned char)plasma_data[caddress+2];
@@ -58,6 +58,14 @@ public:
 
 	void Simulation_AfterUpdate(Simulation *sim) override;
 
+	void Simulation_Compacted(Simulation *sim, const std::vector<int> &newIDs) override
+	{
+		if (player.spawnID >= 0 && player.spawnID < NPART)
+			player.spawnID = newIDs[player.spawnID];
+		if (player2.spawnID >= 0 && player2.spawnID < NPART)
+			player2.spawnID = newIDs[player2.spawnID];
+	}
+
 	Stickman * GetStickman1()
 	{
 		return &player;
@@ -40,7 +40,22 @@
 #define TRON_NORANDOM 65536
 int tron_rx[4] = {-1, 0, 1, 0};
 int tron_ry[4] = { 0,-1, 0, 1};
-unsigned int tron_colours[32];
+
+// colours by hue, built the first time a TRON is drawn
+struct TronColours
+{
+	unsigned int colours[32];
+
+	TronColours()
+	{
+		int r, g, b;
+		for (int i = 0; i < 32; i++)
+		{
+			HSV_to_RGB(i<<4, 255, 255, &r, &g, &b);
+			colours[i] = r<<16 | g<<8 | b;
+		}
+	}
+};
 
 int new_tronhead(Simulation *sim, int x, int y, int i, int direction)
 {
@@ -192,7 +207,8 @@ int TRON_update(UPDATE_FUNC_ARGS)
 
 int TRON_graphics(GRAPHICS_FUNC_ARGS)
 {
-	unsigned int col = tron_colours[(cpart->tmp&0xF800)>>11];
+	static const TronColours tron_colours;
+	unsigned int col = tron_colours.colours[(cpart->tmp&0xF800)>>11];
 	if(cpart->tmp & TRON_HEAD)
 		*pixel_mode |= PMODE_GLOW;
 	*colr = (col & 0xFF0000)>>16;
@@ -215,17 +231,6 @@ int TRON_graphics(GRAPHICS_FUNC_ARGS)
 	return 0;
 }
 
-void TRON_init_graphics()
-{
-	int i;
-	int r, g, b;
-	for (i=0; i<32; i++)
-	{
-		HSV_to_RGB(i<<4,255,255,&r,&g,&b);
-		tron_colours[i] = r<<16 | g<<8 | b;
-	}
-}
-
 void TRON_create(ELEMENT_CREATE_FUNC_ARGS)
 {
 	int randhue = RNG::Ref().between(0, 359);
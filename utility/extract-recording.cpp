@@ -0,0 +1,251 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef EXTRACTRECORDING //prevent this file from automatically being compiled when people add every file they can find to Visual Studio
+
+/* Turns a .tptrec recording (see src/graphics/VideoRecorder.h) back into
+ * numbered PNG files, frame_000000.png, frame_000001.png, ...
+ *
+ * Usage: extract-recording <recording.tptrec> <output directory> [fill]
+ *
+ * The output directory is created if it doesn't exist. With "fill", frames
+ * that were dropped while recording (including at the very end) are written
+ * out as copies of the frame before them, so there is one PNG per recorded
+ * frame and the original timing is kept.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#ifdef WIN
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+static unsigned int ReadUint32(const unsigned char *src)
+{
+	return src[0] | (src[1] << 8) | (src[2] << 16) | ((unsigned int)src[3] << 24);
+}
+
+static void WriteChunk(FILE *f, const char *name, const unsigned char *data, unsigned int size)
+{
+	unsigned char header[8] = { (unsigned char)(size >> 24), (unsigned char)(size >> 16), (unsigned char)(size >> 8), (unsigned char)size };
+	memcpy(header + 4, name, 4);
+	fwrite(header, 1, 8, f);
+	if (size)
+		fwrite(data, 1, size, f);
+	uLong crc = crc32(0, header + 4, 4);
+	if (size)
+		crc = crc32(crc, data, size);
+	unsigned char crcBytes[4] = { (unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8), (unsigned char)crc };
+	fwrite(crcBytes, 1, 4, f);
+}
+
+static bool WritePNG(const std::string &filename, const std::vector<unsigned char> &rgb, unsigned int width, unsigned int height)
+{
+	// every row starts with filter type 0 (none)
+	std::vector<unsigned char> raw((width * 3 + 1) * height);
+	for (unsigned int y = 0; y < height; y++)
+	{
+		raw[y * (width * 3 + 1)] = 0;
+		memcpy(&raw[y * (width * 3 + 1) + 1], &rgb[y * width * 3], width * 3);
+	}
+	uLongf compressedSize = compressBound(raw.size());
+	std::vector<unsigned char> compressed(compressedSize);
+	if (compress2(&compressed[0], &compressedSize, &raw[0], raw.size(), Z_DEFAULT_COMPRESSION) != Z_OK)
+		return false;
+
+	FILE *f = fopen(filename.c_str(), "wb");
+	if (!f)
+		return false;
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	fwrite(signature, 1, 8, f);
+	unsigned char ihdr[13] = {
+		(unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+		(unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+		8, 2, 0, 0, 0 // 8 bit RGB, no interlacing
+	};
+	WriteChunk(f, "IHDR", ihdr, sizeof(ihdr));
+	WriteChunk(f, "IDAT", &compressed[0], compressedSize);
+	WriteChunk(f, "IEND", NULL, 0);
+	bool success = !ferror(f);
+	fclose(f);
+	return success;
+}
+
+// creates the directory and any missing parents
+static bool MakeDirectories(const std::string &path)
+{
+	for (size_t end = path.find_first_of("/\\", 1); ; end = path.find_first_of("/\\", end + 1))
+	{
+		std::string part = path.substr(0, end);
+#ifdef WIN
+		int result = _mkdir(part.c_str());
+#else
+		int result = mkdir(part.c_str(), 0755);
+#endif
+		if (result && errno != EEXIST)
+			return false;
+		if (end == path.npos)
+			return true;
+	}
+}
+
+static std::string FrameName(const std::string &outputDir, unsigned int index)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "frame_%06u.png", index);
+	return outputDir + "/" + name;
+}
+
+// the previous image is what was on screen during missing frames, write copies of it for them
+static void FillDropped(const std::string &outputDir, unsigned int &outputIndex, unsigned int count)
+{
+	if (!outputIndex)
+		return;
+	FILE *previous = fopen(FrameName(outputDir, outputIndex - 1).c_str(), "rb");
+	std::vector<unsigned char> previousData;
+	if (previous)
+	{
+		unsigned char buffer[4096];
+		size_t read;
+		while ((read = fread(buffer, 1, sizeof(buffer), previous)))
+			previousData.insert(previousData.end(), buffer, buffer + read);
+		fclose(previous);
+	}
+	for (unsigned int n = 0; n < count; n++)
+	{
+		FILE *copy = fopen(FrameName(outputDir, outputIndex++).c_str(), "wb");
+		if (copy)
+		{
+			if (previousData.size())
+				fwrite(&previousData[0], 1, previousData.size(), copy);
+			fclose(copy);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " <recording.tptrec> <output directory> [fill]" << std::endl;
+		return 1;
+	}
+	std::string outputDir = argv[2];
+	bool fill = argc > 3 && !strcmp(argv[3], "fill");
+	if (!MakeDirectories(outputDir))
+	{
+		std::cerr << "Could not create " << outputDir << std::endl;
+		return 1;
+	}
+
+	FILE *f = fopen(argv[1], "rb");
+	if (!f)
+	{
+		std::cerr << "Could not open " << argv[1] << std::endl;
+		return 1;
+	}
+	unsigned char header[16];
+	if (fread(header, 1, 16, f) != 16 || memcmp(header, "TPTREC01", 8))
+	{
+		std::cerr << "Not a recording" << std::endl;
+		fclose(f);
+		return 1;
+	}
+	unsigned int width = ReadUint32(header + 8), height = ReadUint32(header + 12);
+	if (!width || !height || width > 16384 || height > 16384)
+	{
+		std::cerr << "Bad recording size " << width << "x" << height << std::endl;
+		fclose(f);
+		return 1;
+	}
+
+	std::vector<unsigned char> image(width * height * 3), frameData(width * height * 3), compressed;
+	unsigned int framesRead = 0, framesDropped = 0, outputIndex = 0, expectedNumber = 0;
+	bool haveKeyframe = false;
+	unsigned char frameHeader[9];
+	while (fread(frameHeader, 1, 9, f) == 9)
+	{
+		unsigned int number = ReadUint32(frameHeader);
+		unsigned char type = frameHeader[4];
+		unsigned int size = ReadUint32(frameHeader + 5);
+		if (type == 2)
+		{
+			// end marker, number is how many frames there should have been. Frames dropped right at the end
+			// only show up here
+			if (number > expectedNumber)
+			{
+				framesDropped += number - expectedNumber;
+				if (fill)
+					FillDropped(outputDir, outputIndex, number - expectedNumber);
+			}
+			break;
+		}
+		compressed.resize(size);
+		if (type > 1 || (size && fread(&compressed[0], 1, size, f) != size))
+		{
+			std::cerr << "Recording is truncated or corrupt after " << framesRead << " frames" << std::endl;
+			break;
+		}
+		uLongf dataSize = frameData.size();
+		if (uncompress(&frameData[0], &dataSize, &compressed[0], size) != Z_OK || dataSize != frameData.size())
+		{
+			std::cerr << "Could not decompress frame " << number << std::endl;
+			break;
+		}
+
+		if (type == 0)
+		{
+			image.swap(frameData);
+			haveKeyframe = true;
+		}
+		else if (!haveKeyframe)
+			continue;
+		else
+		{
+			for (size_t i = 0; i < image.size(); i++)
+				image[i] ^= frameData[i];
+		}
+
+		if (number > expectedNumber)
+		{
+			framesDropped += number - expectedNumber;
+			if (fill)
+				FillDropped(outputDir, outputIndex, number - expectedNumber);
+		}
+		expectedNumber = number + 1;
+
+		std::string name = FrameName(outputDir, outputIndex++);
+		if (!WritePNG(name, image, width, height))
+		{
+			std::cerr << "Could not write " << name << std::endl;
+			fclose(f);
+			return 1;
+		}
+		framesRead++;
+	}
+	fclose(f);
+
+	std::cout << framesRead << " frames extracted, " << framesDropped << " dropped while recording" << std::endl;
+	return 0;
+}
+
+#endif
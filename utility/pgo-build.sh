@@ -0,0 +1,65 @@
+#!/bin/sh
+# Two stage profile guided build, with link time optimization
+#
+# An instrumented binary runs the headless benchmark (the built in scenes, then every save given on the
+# command line, or the ones in utility/pgo-saves if none are), and the release build is then optimized using
+# the profile it recorded. Afterwards a plain --release build and the optimized one run the same benchmarks,
+# and the times of both are appended to utility/pgo-results.txt with the speedup of each line, so a
+# regression in either build shows up next time
+#
+# usage: utility/pgo-build.sh [save.cps ...]
+# run from the top of the source tree. Extra scons flags go in SCONSFLAGS, e.g. SCONSFLAGS="--64bit --native"
+# with clang, llvm-profdata has to be in PATH
+
+set -e
+
+PROFILE_DIR=pgo-profile
+RESULTS=utility/pgo-results.txt
+SAVES="$*"
+if [ -z "$SAVES" ]; then
+	SAVES=$(ls utility/pgo-saves/*.cps)
+fi
+
+run_benchmarks()
+{
+	"$1" headless benchmark
+	for save in $SAVES; do
+		"$1" headless benchmark "$save"
+	done
+}
+
+# same builddir for both stages, gcc finds each object's profile by its path
+rm -rf "$PROFILE_DIR"
+scons --release --lto --pgo-generate --pgo-dir="$PROFILE_DIR" --builddir=build-pgo --output=powder-pgo $SCONSFLAGS
+run_benchmarks build-pgo/powder-pgo > /dev/null
+if ls "$PROFILE_DIR"/*.profraw > /dev/null 2>&1; then
+	llvm-profdata merge -output="$PROFILE_DIR"/default.profdata "$PROFILE_DIR"/*.profraw
+fi
+scons --release --lto --pgo-use --pgo-dir="$PROFILE_DIR" --builddir=build-pgo --output=powder-pgo $SCONSFLAGS
+scons --release --builddir=build-release --output=powder-release $SCONSFLAGS
+
+run_benchmarks build-release/powder-release > build-release/benchmark.txt
+run_benchmarks build-pgo/powder-pgo > build-pgo/benchmark.txt
+
+# both runs print the same lines in the same order, compare the "mean time per iteration" of each
+{
+	echo "== $(date -u '+%Y-%m-%d %H:%M') $(git rev-parse --short HEAD 2>/dev/null) SCONSFLAGS=\"$SCONSFLAGS\" saves: ${SAVES:-none}"
+	paste -d '\t' build-release/benchmark.txt build-pgo/benchmark.txt | awk -F '\t' '
+	{
+		split($1, release, "mean time per iteration ")
+		split($2, pgo, "mean time per iteration ")
+		if (release[2] == "" || pgo[2] == "")
+			next
+		releaseMs = release[2] + 0
+		pgoMs = pgo[2] + 0
+		if (releaseMs <= 0 || pgoMs <= 0)
+			next
+		printf("%-70s release %10.4f ms  pgo+lto %10.4f ms  %5.2fx\n", release[1], releaseMs, pgoMs, releaseMs / pgoMs)
+		logSum += log(releaseMs / pgoMs)
+		count++
+	}
+	END {
+		if (count)
+			printf("geometric mean speedup over %d benchmarks: %.3fx\n\n", count, exp(logSum / count))
+	}'
+} | tee -a "$RESULTS"